@@ -0,0 +1,389 @@
+﻿#ifndef ASYNCTREE_H
+#define ASYNCTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "BinaryTrees.h"
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CLASS ASYNCTREE ------------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Дерево с асинхронной записью: потоки-производители не берут блокировку дерева, а добавляют операции
+//insert, erase, setValue в очередь без блокировок. Единственный поток-применитель забирает очередь
+//пачкой, сортирует ее по ключу и применяет под одной блокировкой, вставляя с подсказкой (Tree::insertHint).
+//Пачка применяется, когда в очереди накопилось _maxBatch операций или прошло _flushLatency с первой
+//операции пачки. Пока очередь пуста, применитель спит и не берет блокировку дерева.
+//Результат операции (true - успешно) приходит через std::future или через callback, который вызывается
+//в потоке-применителе. Чтение (find, forEach) видит состояние после последней примененной пачки.
+template<KEY KeyType, typename ValueType, typename TreeType = RBTree<KeyType, ValueType>>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+class AsyncTree
+{
+//Public types:
+public:
+	using Duration = std::chrono::steady_clock::duration;
+	using Callback = std::function<void(bool)>;
+
+//Private structs:
+private:
+	enum class OPERATIONS : std::uint8_t
+	{
+		INSERT,
+		ERASE,
+		SET_VALUE,
+		FLUSH
+	};
+
+	struct Operation
+	{
+		Operation* next;
+		OPERATIONS operation;
+		KeyType key;
+		ValueType value;
+
+		std::optional<std::promise<bool>> promise;
+		Callback callback;
+
+		void complete(bool _result)
+		{
+			if (promise)
+				promise->set_value(_result);
+			else if (callback)
+				callback(_result);
+		};
+	};
+
+	//SplayTree и LRUTree перестраиваются при поиске, поэтому поиск в них требует исключительной блокировки
+	static constexpr bool MUTATING_FIND = std::derived_from<TreeType, SplayTree<KeyType, ValueType>> ||
+		std::derived_from<TreeType, LRUTree<KeyType, ValueType>>;
+
+//Private members:
+private:
+	TreeType tree;
+	mutable std::shared_mutex tree_mutex;
+
+	//Очередь - стек Трайбера: производители добавляют операции CAS в голову, применитель забирает
+	//весь стек одним exchange и разворачивает его в порядок поступления
+	std::atomic<Operation*> head;
+	std::atomic<int> pending;
+
+	Duration flush_latency;
+	int max_batch;
+
+	std::mutex wake_mutex;
+	std::condition_variable wake_condition;
+	bool stopping;
+	bool flush_requested;
+
+	std::thread applier;
+
+	void push(Operation* _operation, bool _wake);
+	void wake(bool _flush);
+	void run();
+	void apply(std::vector<Operation*>& _batch, std::vector<Operation*>& _flushes);
+
+	std::future<bool> submit(OPERATIONS _operation, const KeyType& _key, const ValueType& _value);
+	void submit(OPERATIONS _operation, const KeyType& _key, const ValueType& _value, Callback&& _callback);
+
+//Public members:
+public:
+	AsyncTree(Duration _flushLatency = std::chrono::milliseconds(1), int _maxBatch = 1024);
+	~AsyncTree();
+
+	AsyncTree(const AsyncTree&) = delete;
+	AsyncTree& operator=(const AsyncTree&) = delete;
+
+	std::future<bool> insert(const KeyType& _key, const ValueType& _value)
+	{
+		return submit(OPERATIONS::INSERT, _key, _value);
+	};
+	std::future<bool> erase(const KeyType& _key) { return submit(OPERATIONS::ERASE, _key, ValueType()); };
+	std::future<bool> setValue(const KeyType& _key, const ValueType& _value)
+	{
+		return submit(OPERATIONS::SET_VALUE, _key, _value);
+	};
+
+	//Пустой _callback (nullptr) - результат не нужен
+	void insert(const KeyType& _key, const ValueType& _value, Callback _callback)
+	{
+		submit(OPERATIONS::INSERT, _key, _value, std::move(_callback));
+	};
+	void erase(const KeyType& _key, Callback _callback)
+	{
+		submit(OPERATIONS::ERASE, _key, ValueType(), std::move(_callback));
+	};
+	void setValue(const KeyType& _key, const ValueType& _value, Callback _callback)
+	{
+		submit(OPERATIONS::SET_VALUE, _key, _value, std::move(_callback));
+	};
+
+	void flush();
+
+	bool find(const KeyType& _key, ValueType& _value);
+	bool contains(const KeyType& _key);
+	int size() const;
+	bool empty() const { return size() == 0; };
+
+	template<typename Function>
+	void forEach(Function&& _function);
+};
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+AsyncTree<KeyType, ValueType, TreeType>::AsyncTree(Duration _flushLatency, int _maxBatch) :
+	head(nullptr), pending(0), flush_latency(_flushLatency), max_batch(std::max(_maxBatch, 1)),
+	stopping(false), flush_requested(false)
+{
+	applier = std::thread([this]() { run(); });
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+AsyncTree<KeyType, ValueType, TreeType>::~AsyncTree()
+{
+	//Операции, добавленные до разрушения, применяются
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		stopping = true;
+	}
+	wake_condition.notify_one();
+	applier.join();
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void AsyncTree<KeyType, ValueType, TreeType>::wake(bool _flush)
+{
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		if (_flush)
+			flush_requested = true;
+	}
+	wake_condition.notify_one();
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void AsyncTree<KeyType, ValueType, TreeType>::push(Operation* _operation, bool _wake)
+{
+	//После публикации операцию может забрать и удалить применитель, поэтому прежняя голова хранится в локальной
+	Operation* previous = head.load(std::memory_order_relaxed);
+	do
+		_operation->next = previous;
+	while (!head.compare_exchange_weak(previous, _operation, std::memory_order_release, std::memory_order_relaxed));
+
+	//Применитель будится первой операцией в пустой очереди (запускает отсчет flush_latency) и при заполнении
+	//пачки, поэтому производители берут мьютекс один-два раза на пачку
+	bool first = previous == nullptr;
+	if (pending.fetch_add(1, std::memory_order_relaxed) + 1 == max_batch || first || _wake)
+		wake(_wake);
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+std::future<bool> AsyncTree<KeyType, ValueType, TreeType>::submit(OPERATIONS _operation, const KeyType& _key,
+	const ValueType& _value)
+{
+	Operation* operation = new Operation{ nullptr, _operation, _key, _value, std::promise<bool>(), nullptr };
+	std::future<bool> result = operation->promise->get_future();
+	push(operation, false);
+	return result;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void AsyncTree<KeyType, ValueType, TreeType>::submit(OPERATIONS _operation, const KeyType& _key,
+	const ValueType& _value, Callback&& _callback)
+{
+	push(new Operation{ nullptr, _operation, _key, _value, std::nullopt, std::move(_callback) }, false);
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void AsyncTree<KeyType, ValueType, TreeType>::flush()
+{
+	//Метка FLUSH завершается после пачки, в которую попали все операции, добавленные раньше нее
+	Operation* marker = new Operation{ nullptr, OPERATIONS::FLUSH, KeyType(), ValueType(), std::promise<bool>(), nullptr };
+	std::future<bool> done = marker->promise->get_future();
+	push(marker, true);
+	done.wait();
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void AsyncTree<KeyType, ValueType, TreeType>::run()
+{
+	std::vector<Operation*> batch;
+	std::vector<Operation*> flushes;
+	while (true)
+	{
+		bool stop;
+		{
+			//Пока очередь пуста, применитель спит без таймаута: раньше он просыпался каждые flush_latency
+			//и брал исключительную блокировку дерева ради пустой пачки. Производитель кладет операцию
+			//до того, как взять wake_mutex, поэтому пробуждение не теряется
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			wake_condition.wait(lock, [this]()
+			{
+				return stopping || flush_requested || head.load(std::memory_order_acquire) != nullptr;
+			});
+			wake_condition.wait_for(lock, flush_latency, [this]()
+			{
+				return stopping || flush_requested || pending.load(std::memory_order_relaxed) >= max_batch;
+			});
+			flush_requested = false;
+			stop = stopping;
+		}
+
+		Operation* list = head.exchange(nullptr, std::memory_order_acquire);
+		if (!list)
+		{
+			if (stop)
+				return;
+			continue;
+		}
+
+		for (Operation* operation = list; operation; operation = operation->next)
+		{
+			if (operation->operation == OPERATIONS::FLUSH)
+				flushes.push_back(operation);
+			else
+				batch.push_back(operation);
+		}
+		pending.fetch_sub(static_cast<int>(batch.size() + flushes.size()), std::memory_order_relaxed);
+
+		//Стек отдает операции от новых к старым
+		std::reverse(batch.begin(), batch.end());
+		apply(batch, flushes);
+
+		if (stop && !head.load(std::memory_order_acquire))
+			return;
+	}
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void AsyncTree<KeyType, ValueType, TreeType>::apply(std::vector<Operation*>& _batch, std::vector<Operation*>& _flushes)
+{
+	//Устойчивая сортировка сохраняет порядок операций с одним ключом. Вставки отсортированной пачки
+	//идут с подсказкой - предыдущим вставленным узлом. Удаление может освободить узел подсказки
+	//(Tree::swapNodes), поэтому после него подсказка сбрасывается
+	std::stable_sort(_batch.begin(), _batch.end(),
+		[](const Operation* _operation1, const Operation* _operation2) { return _operation1->key < _operation2->key; });
+
+	std::vector<char> results(_batch.size());
+	{
+		std::unique_lock<std::shared_mutex> lock(tree_mutex);
+		auto hint = tree.afterEnd();
+		for (std::size_t i = 0; i < _batch.size(); ++i)
+		{
+			Operation* operation = _batch[i];
+			switch (operation->operation)
+			{
+			case OPERATIONS::INSERT:
+				results[i] = tree.insertHint(hint, operation->key, operation->value);
+				break;
+			case OPERATIONS::ERASE:
+				results[i] = tree.erase(operation->key);
+				hint = tree.afterEnd();
+				break;
+			case OPERATIONS::SET_VALUE:
+				results[i] = tree.setValue(operation->key, operation->value);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	//Результаты сообщаются после снятия блокировки: callback может читать дерево
+	for (std::size_t i = 0; i < _batch.size(); ++i)
+	{
+		_batch[i]->complete(results[i]);
+		delete _batch[i];
+	}
+
+	for (Operation* marker : _flushes)
+	{
+		marker->complete(true);
+		delete marker;
+	}
+
+	_batch.clear();
+	_flushes.clear();
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool AsyncTree<KeyType, ValueType, TreeType>::find(const KeyType& _key, ValueType& _value)
+{
+	auto read = [&]()
+	{
+		auto it = tree.find(_key);
+		if (it == tree.afterEnd())
+			return false;
+
+		_value = (*it).second;
+		return true;
+	};
+
+	if constexpr (MUTATING_FIND)
+	{
+		std::unique_lock<std::shared_mutex> lock(tree_mutex);
+		return read();
+	}
+	else
+	{
+		std::shared_lock<std::shared_mutex> lock(tree_mutex);
+		return read();
+	}
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool AsyncTree<KeyType, ValueType, TreeType>::contains(const KeyType& _key)
+{
+	ValueType value;
+	return find(_key, value);
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+int AsyncTree<KeyType, ValueType, TreeType>::size() const
+{
+	std::shared_lock<std::shared_mutex> lock(tree_mutex);
+	return tree.size();
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+template<typename Function>
+void AsyncTree<KeyType, ValueType, TreeType>::forEach(Function&& _function)
+{
+	//Вызывает _function(const KeyType&, const ValueType&) в порядке возрастания ключей
+	//под разделяемой блокировкой: применитель ждет окончания обхода
+	std::shared_lock<std::shared_mutex> lock(tree_mutex);
+	for (auto it = tree.begin(); !(it == tree.afterEnd()); ++it)
+	{
+		auto pair = *it;
+		_function(static_cast<const KeyType&>(pair.first), static_cast<const ValueType&>(pair.second));
+	}
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CLASS ASYNCTREE ------------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
@@ -0,0 +1,1500 @@
+﻿//Набор тестов производительности для Tree, AVLTree, RBTree, SplayTree и ScapegoatTree
+//со std::map в качестве эталона.
+//
+//Сборка:
+//	g++ -std=c++20 -O2 -pthread Benchmarks.cpp -o Benchmarks
+//	cl /std:c++20 /O2 /EHsc Benchmarks.cpp
+//
+//Параметры:
+//	--sizes=1000,100000    размеры деревьев (по умолчанию 1000,10000,100000,1000000)
+//	--filter=RBTree        запускать только тесты, в имени которых есть подстрока
+//	--format=json          вывод в формате JSON, совместимом с google benchmark
+//	--min_time=0.2         минимальное суммарное время измерения одного теста в секундах
+//	--threads=1,2,4        количество потоков многопоточных тестов (по умолчанию степени двойки до числа ядер)
+//	--external=100000000   количество пар теста ExternalBuild (по умолчанию 0 - тест не запускается)
+//
+//Если собрать с -DTREES_ENABLE_STATS, тесты Insert и Erase деревьев дополнительно выводят
+//счетчики TreeStats в пересчете на одну операцию (сравнения, повороты, перекрашивания и т.д.)
+//
+//Если собрать с -DTREES_ENABLE_LATENCY, тест Latency замеряет каждую операцию AVLTree и RBTree на случайных
+//ключах (вставка всех ключей, поиск, удаление) и выводит p50, p99 и p999 в наносекундах. Вместе
+//с -DTREES_ENABLE_STATS после него выводятся самые медленные операции с глубиной и поворотами.
+//
+//Перед тестами каждого дерева Validate проверяет validate() после вставки всех ключей и после удаления половины:
+//ошибка балансировки не видна по результатам, но делает операции линейными. Если проверка не прошла,
+//программа сообщает об этом и завершается с кодом 1.
+//
+//Тест Memory - оценка памяти (memoryUsage) заполненных Tree, AVLTree, RBTree и std::map: счетчики bytes_per_entry
+//(узел с заголовком malloc, служебные структуры и строки ключей), node_size и node_allocation - sizeof узла
+//и блок malloc под него. Узел std::map оценивается по libstdc++: цвет, три указателя и пара.
+//
+//Тест Copy - конструктор копирования, CopyByInsert - копия, собранная вставками элементов getVector.
+//
+//Тест SmallKey - вставка, поиск (попадания и промахи) и очистка AVLTree<uint64_t, uint64_t>, где работают
+//специализации для тривиально копируемых ключей, против того же дерева с ключом opaque_uint64: обертка над
+//uint64_t с собственным конструктором копирования, поэтому дерево идет по общему пути.
+//
+//Тест Static - таблица из 1024 пар, известных при компиляции: StaticTree строится компилятором, поэтому
+//StaticBuild измеряет только RBTree (вставка тех же пар при запуске), а StaticFind сравнивает поиск в обоих.
+//
+//Тест Churn сравнивает LRUTree с таблицей сессий из RBTree и двух std::list (давность и истечение):
+//поток zipf-запросов, промах добавляет запись, емкость - четверть ключей, раз в 64 запроса evictExpired.
+//
+//Тест Scaling сравнивает ShardedTree (RANGE и HASH) и ConcurrentAVLTree с одним RBTree под std::shared_mutex:
+//потоки делят ключи поровну и каждый вставляет, ищет и удаляет свою часть. Имена получают суффикс /threads:N.
+//Тест Writes так же делит ключи, но только вставляет и удаляет их: AsyncTree (очередь и поток-применитель,
+//время включает flush) против RBTree под std::shared_mutex.
+//Тест Mixed - заполненная таблица, потоки ищут ключи из запросов, каждый десятый запрос удаляет и снова
+//вставляет свой ключ: ConcurrentAVLTree против AVLTree и RBTree под std::shared_mutex.
+//Тесты ParallelReduce, ParallelGetVector и ParallelClear - параллельные обходы RBTree пулом ThreadPool
+//из N - 1 потоков (вызывающий поток тоже работает); однопоточные эталоны - Iterate, GetVector и Clear.
+//
+//Тест Frozen - запуск с готовым файлом FrozenTree из int64 ключей: FrozenOpen - open (mmap) и первый поиск,
+//FrozenLoad - загрузка того же файла в RBTree (чтение записей и buildFromSorted), FrozenFind - поиск попаданий
+//и промахов прямо в отображенном файле. Счетчик rss_mb у FrozenOpen и FrozenFind - прирост резидентной памяти
+//процесса (/proc/self/statm, только Linux): ОС подгружает только страницы, которых коснулся поиск.
+//У FrozenLoad счетчик memory_mb - память дерева по memoryUsage, поскольку освобожденная куча остается в RSS.
+//
+//Тест Durable - вставка int64 ключей в DurableTree с fsync журнала раз в 1, 8, 64 и 512 записей
+//(групповая фиксация), время включает итоговый sync. Ключей не больше 10000, имена получают суффикс /batch:N.
+//
+//Тест ExternalBuild - построение RBTree<int64, long long> из --external случайных пар через ExternalTreeBuilder
+//с бюджетом памяти 256 МБ: сортировка серий, слияние и линейное построение. Генерация ключей не замеряется.
+//Счетчики runs и merge_passes - число временных файлов и промежуточных проходов слияния. Для 100 млн пар
+//тесту нужно около 3.2 ГБ во временном каталоге и память под дерево.
+//
+//Имена тестов: <операция>/<контейнер>/<тип ключа>/<распределение>/<размер>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "AsyncTree.h"
+#include "BinaryTrees.h"
+#include "ConcurrentAVLTree.h"
+#include "DurableTree.h"
+#include "ExternalBuilder.h"
+#include "FrozenTree.h"
+#include "ShardedTree.h"
+#include "StaticTree.h"
+#include "ThreadPool.h"
+
+using Value = long long;
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------------ OPTIONS ---------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+struct Options
+{
+	std::vector<int> sizes = { 1000, 10000, 100000, 1000000 };
+	std::string filter;
+	bool json = false;
+	double minTime = 0.2;
+	std::vector<int> threads;
+	int externalPairs = 0;
+};
+
+struct Result
+{
+	std::string name;
+	long long iterations;
+	double nsPerIteration;
+	double itemsPerSecond;
+	std::vector<std::pair<std::string, double>> counters;
+};
+
+static Options options;
+static std::vector<Result> results;
+static Value blackHole = 0;
+static bool invalidTrees = false;
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------------ TIMING ----------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Аналог benchmark::State: тело теста само приостанавливает таймер на время подготовки данных
+class State
+{
+	using Clock = std::chrono::steady_clock;
+
+	Clock::time_point startTime;
+	Clock::duration elapsed = Clock::duration::zero();
+	bool running = false;
+
+public:
+	//Дополнительные счетчики, которые тело теста может сообщить (аналог State::counters)
+	std::vector<std::pair<std::string, double>> counters;
+
+	void resume() { startTime = Clock::now(); running = true; };
+	void pause() { elapsed += Clock::now() - startTime; running = false; };
+
+	double seconds() const { return std::chrono::duration<double>(elapsed).count(); };
+};
+
+template<typename Body>
+void runBenchmark(const std::string& _name, int _items, Body&& _body)
+{
+	if (!options.filter.empty() && _name.find(options.filter) == std::string::npos)
+		return;
+
+	State state;
+	long long iterations = 0;
+	while (iterations == 0 || (state.seconds() < options.minTime && iterations < 1000000))
+	{
+		_body(state);
+		++iterations;
+	}
+
+	Result result;
+	result.name = _name;
+	result.iterations = iterations;
+	result.nsPerIteration = state.seconds() * 1e9 / iterations;
+	result.itemsPerSecond = (state.seconds() > 0) ? _items * iterations / state.seconds() : 0;
+	result.counters = state.counters;
+	results.push_back(result);
+
+	if (!options.json)
+	{
+		std::printf("%-56s %14.0f ns %10lld %14.3fM items/s", _name.c_str(), result.nsPerIteration,
+			iterations, result.itemsPerSecond / 1e6);
+		for (const auto& counter : result.counters)
+			std::printf(" %s=%.3g", counter.first.c_str(), counter.second);
+		std::printf("\n");
+		std::fflush(stdout);
+	}
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------------ DATASETS --------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Генератор Zipf распределения (Gray et al., "Quickly generating billion-record synthetic databases"),
+//ранг 0 - самый популярный
+class ZipfGenerator
+{
+	std::uint64_t n;
+	double theta, alpha, zetan, eta;
+	std::uniform_real_distribution<double> uniform;
+
+	static double zeta(std::uint64_t _n, double _theta)
+	{
+		double sum = 0;
+		for (std::uint64_t i = 1; i <= _n; ++i)
+			sum += 1.0 / std::pow(static_cast<double>(i), _theta);
+		return sum;
+	}
+
+public:
+	ZipfGenerator(std::uint64_t _n, double _theta = 0.99) : n(_n), theta(_theta), uniform(0.0, 1.0)
+	{
+		zetan = zeta(n, theta);
+		alpha = 1.0 / (1.0 - theta);
+		eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetan);
+	}
+
+	template<typename Engine>
+	std::uint64_t operator()(Engine& _engine)
+	{
+		double u = uniform(_engine);
+		double uz = u * zetan;
+		if (uz < 1.0)
+			return 0;
+		if (uz < 1.0 + std::pow(0.5, theta))
+			return 1;
+		std::uint64_t rank = static_cast<std::uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha));
+		return std::min(rank, n - 1);
+	}
+};
+
+enum class DISTRIBUTIONS
+{
+	RANDOM,
+	SORTED,
+	ZIPFIAN
+};
+
+static const char* distributionName(DISTRIBUTIONS _distribution)
+{
+	switch (_distribution)
+	{
+	case DISTRIBUTIONS::RANDOM: return "random";
+	case DISTRIBUTIONS::SORTED: return "sorted";
+	default: return "zipfian";
+	}
+}
+
+template<typename Key>
+Key makeKey(std::uint64_t _number)
+{
+	if constexpr (std::is_same_v<Key, std::string>)
+	{
+		//Фиксированная ширина: лексикографический порядок совпадает с числовым
+		char buffer[24];
+		std::snprintf(buffer, sizeof(buffer), "key%016llu", static_cast<unsigned long long>(_number));
+		return buffer;
+	}
+	else
+		return static_cast<Key>(_number);
+}
+
+template<typename Key>
+struct Dataset
+{
+	std::vector<Key> insertOrder;	//порядок вставки и удаления
+	std::vector<Key> hits;			//запросы к существующим ключам
+	std::vector<Key> misses;		//запросы к отсутствующим ключам
+	std::vector<std::pair<Key, Value>> pairs;
+
+	Dataset(int _size, DISTRIBUTIONS _distribution)
+	{
+		std::mt19937_64 engine(42);
+
+		//Существующие ключи четные, отсутствующие - нечетные
+		std::vector<std::uint64_t> numbers(_size);
+		for (int i = 0; i < _size; ++i)
+			numbers[i] = 2 * static_cast<std::uint64_t>(i);
+		std::shuffle(numbers.begin(), numbers.end(), engine);
+
+		std::vector<std::uint64_t> order = numbers;
+		std::vector<std::uint64_t> queries(_size);
+		switch (_distribution)
+		{
+		case DISTRIBUTIONS::RANDOM:
+			for (int i = 0; i < _size; ++i)
+				queries[i] = numbers[engine() % _size];
+			break;
+		case DISTRIBUTIONS::SORTED:
+			std::sort(order.begin(), order.end());
+			queries = order;
+			break;
+		case DISTRIBUTIONS::ZIPFIAN:
+		{
+			//Популярность ключа не связана с его величиной: ранг i соответствует numbers[i]
+			ZipfGenerator zipf(_size);
+			for (int i = 0; i < _size; ++i)
+				order[i] = numbers[zipf(engine)];
+			for (int i = 0; i < _size; ++i)
+				queries[i] = numbers[zipf(engine)];
+			break;
+		}
+		}
+
+		for (std::uint64_t number : order)
+			insertOrder.push_back(makeKey<Key>(number));
+		for (std::uint64_t number : queries)
+		{
+			hits.push_back(makeKey<Key>(number));
+			misses.push_back(makeKey<Key>(number + 1));
+		}
+		for (std::uint64_t number : order)
+			pairs.push_back({ makeKey<Key>(number), static_cast<Value>(number) });
+	}
+};
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------------ ADAPTERS --------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+template<typename Key>
+bool findValue(std::map<Key, Value>& _map, const Key& _key)
+{
+	auto it = _map.find(_key);
+	if (it == _map.end())
+		return false;
+
+	blackHole += it->second;
+	return true;
+}
+
+template<typename TreeType, typename Key>
+bool findValue(TreeType& _tree, const Key& _key)
+{
+	auto it = _tree.find(_key);
+	if (it == _tree.afterEnd())
+		return false;
+
+	blackHole += (*it).second;
+	return true;
+}
+
+template<typename Key>
+void iterate(std::map<Key, Value>& _map)
+{
+	for (auto& pair : _map)
+		blackHole += pair.second;
+}
+
+template<typename TreeType>
+void iterate(TreeType& _tree)
+{
+	if (_tree.empty())
+		return;
+
+	auto last = _tree.afterEnd();
+	for (auto it = _tree.begin(); !(it == last); ++it)
+		blackHole += (*it).second;
+}
+
+template<typename Key>
+void getVector(std::map<Key, Value>& _map)
+{
+	std::vector<std::pair<Key, Value>> vector(_map.begin(), _map.end());
+	blackHole += vector.size();
+}
+
+template<typename TreeType>
+void getVector(TreeType& _tree)
+{
+	if (_tree.empty())
+		return;
+
+	blackHole += _tree.getVector().size();
+}
+
+template<typename Key>
+void insertValue(std::map<Key, Value>& _map, const Key& _key, Value _value)
+{
+	_map.emplace(_key, _value);
+}
+
+template<typename TreeType, typename Key>
+void insertValue(TreeType& _tree, const Key& _key, Value _value)
+{
+	_tree.insert(_key, _value);
+}
+
+template<typename Key>
+void resetStats(std::map<Key, Value>&) {}
+
+template<typename TreeType>
+void resetStats(TreeType& _tree)
+{
+	_tree.resetStats();
+}
+
+template<typename Key>
+void reportStats(State&, std::map<Key, Value>&, int) {}
+
+//Переводит счетчики дерева в значения на одну операцию
+template<typename TreeType>
+void reportStats(State& _state, TreeType& _tree, int _operations)
+{
+#ifdef TREES_ENABLE_STATS
+	TreeStats stats = _tree.stats();
+	double operations = (_operations > 0) ? _operations : 1;
+
+	_state.counters = {
+		{ "comparisons", stats.comparisons / operations },
+		{ "visits", stats.nodeVisits / operations },
+		{ "rotations", (stats.leftRotations + stats.rightRotations) / operations },
+		{ "recolorings", stats.recolorings / operations },
+		{ "balance_updates", stats.balanceUpdates / operations },
+		{ "rebuilt_nodes", stats.rebuiltNodes / operations },
+		{ "cache_hit_rate", stats.cacheHitRate() },
+		{ "avg_depth", stats.averageDepth() },
+		{ "max_depth", static_cast<double>(stats.maxDepth) }
+	};
+#else
+	(void)_state;
+	(void)_tree;
+	(void)_operations;
+#endif
+}
+
+//SplayTree с заданным режимом расширения: тесты создают контейнеры конструктором по умолчанию
+//и конструктором из вектора, поэтому режим задается параметрами шаблона
+template<typename Key, SPLAY_MODES Mode, int Period>
+class ConfiguredSplayTree : public SplayTree<Key, Value>
+{
+public:
+	ConfiguredSplayTree() { this->setSplayMode(Mode, Period); };
+	ConfiguredSplayTree(const std::vector<std::pair<Key, Value>>& _pairs) : SplayTree<Key, Value>(_pairs)
+	{
+		this->setSplayMode(Mode, Period);
+	};
+};
+
+//RBTree с включенным кэшем горячих ключей на Slots слотов
+template<typename Key, int Slots>
+class CachedRBTree : public RBTree<Key, Value>
+{
+public:
+	CachedRBTree() { this->enableCache(Slots); };
+	CachedRBTree(const std::vector<std::pair<Key, Value>>& _pairs) : RBTree<Key, Value>(_pairs)
+	{
+		this->enableCache(Slots);
+	};
+};
+
+//Таблица сессий в два прохода: RBTree, значение которого хранит позиции записи в отдельных
+//списках давности и истечения. Три выделения памяти на запись против одного у LRUTree
+template<typename Key>
+class SessionTable
+{
+	using TimePoint = std::chrono::steady_clock::time_point;
+
+	struct Slot
+	{
+		Value value;
+		typename std::list<Key>::iterator recent;
+		typename std::list<std::pair<TimePoint, Key>>::iterator expiring;
+	};
+
+	RBTree<Key, Slot> tree;
+	std::list<Key> recent;
+	std::list<std::pair<TimePoint, Key>> expiring;
+	int capacity;
+
+public:
+	SessionTable(int _capacity) : capacity(_capacity) {};
+
+	bool touch(const Key& _key)
+	{
+		auto it = tree.find(_key);
+		if (it == tree.afterEnd())
+			return false;
+
+		Slot& slot = (*it).second;
+		recent.splice(recent.begin(), recent, slot.recent);
+		blackHole += slot.value;
+		return true;
+	}
+
+	void insert(const Key& _key, Value _value, TimePoint _expiry)
+	{
+		recent.push_front(_key);
+		expiring.push_back({ _expiry, _key });
+		tree.insert(_key, { _value, recent.begin(), std::prev(expiring.end()) });
+
+		if (tree.size() > capacity)
+			erase(recent.back());
+	}
+
+	void erase(const Key& _key)
+	{
+		auto it = tree.find(_key);
+		recent.erase((*it).second.recent);
+		expiring.erase((*it).second.expiring);
+		tree.erase(it);
+	}
+
+	void evictExpired(TimePoint _now)
+	{
+		while (!expiring.empty() && !(_now < expiring.front().first))
+			erase(expiring.front().second);
+	}
+};
+
+template<typename Key>
+bool touchValue(SessionTable<Key>& _table, const Key& _key)
+{
+	return _table.touch(_key);
+}
+
+template<typename Key>
+bool touchValue(LRUTree<Key, Value>& _tree, const Key& _key)
+{
+	return findValue(_tree, _key);
+}
+
+//Эталон для тестов Scaling, Writes и Mixed: одно дерево под общей блокировкой, интерфейс как у ShardedTree
+template<typename Key, typename TreeType = RBTree<Key, Value>>
+class LockedTree
+{
+	TreeType tree;
+	std::shared_mutex mutex;
+
+public:
+	bool insert(const Key& _key, Value _value)
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		return tree.insert(_key, _value);
+	}
+
+	bool erase(const Key& _key)
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		return tree.erase(_key);
+	}
+
+	bool find(const Key& _key, Value& _value)
+	{
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		auto it = tree.find(_key);
+		if (it == tree.afterEnd())
+			return false;
+
+		_value = (*it).second;
+		return true;
+	}
+};
+
+//ShardedTree с заданным способом деления: тест создает контейнер конструктором по умолчанию
+template<typename Key, SHARDING_MODES Mode>
+class ConfiguredShardedTree : public ShardedTree<Key, Value>
+{
+public:
+	ConfiguredShardedTree() : ShardedTree<Key, Value>(static_cast<int>(std::thread::hardware_concurrency()), Mode) {};
+};
+
+//Запись без ожидания результата: AsyncTree только ставит операцию в очередь
+template<typename Key, typename TreeType>
+void writeInsert(LockedTree<Key, TreeType>& _table, const Key& _key, Value _value)
+{
+	_table.insert(_key, _value);
+}
+
+template<typename Key>
+void writeInsert(AsyncTree<Key, Value>& _table, const Key& _key, Value _value)
+{
+	_table.insert(_key, _value, nullptr);
+}
+
+template<typename Key, typename TreeType>
+void writeErase(LockedTree<Key, TreeType>& _table, const Key& _key)
+{
+	_table.erase(_key);
+}
+
+template<typename Key>
+void writeErase(AsyncTree<Key, Value>& _table, const Key& _key)
+{
+	_table.erase(_key, nullptr);
+}
+
+template<typename Key, typename TreeType>
+void waitWrites(LockedTree<Key, TreeType>&) {}
+
+template<typename Key>
+void waitWrites(AsyncTree<Key, Value>& _table)
+{
+	_table.flush();
+}
+
+template<typename Key>
+std::map<Key, Value> construct(std::map<Key, Value>*, const std::vector<std::pair<Key, Value>>& _pairs)
+{
+	return std::map<Key, Value>(_pairs.begin(), _pairs.end());
+}
+
+template<typename TreeType, typename Key>
+TreeType* construct(TreeType*, const std::vector<std::pair<Key, Value>>& _pairs)
+{
+	return new TreeType(_pairs);
+}
+
+template<typename Key>
+bool isValid(std::map<Key, Value>&)
+{
+	return true;
+}
+
+template<typename TreeType>
+bool isValid(TreeType& _tree)
+{
+	return _tree.validate();
+}
+
+template<typename Key>
+TreeMemoryUsage memoryOf(std::map<Key, Value>& _map)
+{
+	TreeMemoryUsage usage;
+	usage.nodes = static_cast<long long>(_map.size());
+	usage.nodeSize = static_cast<long long>(4 * sizeof(void*) + sizeof(std::pair<const Key, Value>));
+	usage.nodeAllocation = static_cast<long long>(mallocBlockSize(static_cast<std::size_t>(usage.nodeSize)));
+	for (const auto& pair : _map)
+		usage.ownedBytes += static_cast<long long>(ownedHeapBytes(pair.first));
+	return usage;
+}
+
+template<typename TreeType>
+TreeMemoryUsage memoryOf(TreeType& _tree)
+{
+	return _tree.memoryUsage();
+}
+
+template<typename Key>
+void copyByInsert(std::map<Key, Value>& _copy, std::map<Key, Value>& _source)
+{
+	for (const auto& pair : _source)
+		_copy.insert(pair);
+}
+
+template<typename TreeType>
+void copyByInsert(TreeType& _copy, TreeType& _source)
+{
+	for (const auto& pair : _source.getVector())
+		_copy.insert(pair.first, pair.second);
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------------- BENCHMARKS -------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+template<typename Container, typename Key>
+void fill(Container& _container, const Dataset<Key>& _dataset)
+{
+	for (const auto& pair : _dataset.pairs)
+		insertValue(_container, pair.first, pair.second);
+}
+
+//Проверка инвариантов и границы высоты, не входит в результаты
+template<typename Container, typename Key>
+void validateContainer(const std::string& _name, const Dataset<Key>& _dataset)
+{
+	if (!options.filter.empty() && _name.find(options.filter) == std::string::npos)
+		return;
+
+	Container container;
+	fill(container, _dataset);
+	bool valid = isValid(container);
+
+	for (std::size_t i = 0; i < _dataset.insertOrder.size(); i += 2)
+		container.erase(_dataset.insertOrder[i]);
+	valid = valid && isValid(container);
+
+	if (!valid)
+	{
+		std::fprintf(stderr, "%s: validate() failed\n", _name.c_str());
+		invalidTrees = true;
+	}
+}
+
+template<typename Container, typename Key>
+void benchmarkContainer(const std::string& _containerName, const std::string& _keyName, int _size,
+	DISTRIBUTIONS _distribution, const Dataset<Key>& _dataset)
+{
+	std::string suffix = "/" + _containerName + "/" + _keyName + "/" + distributionName(_distribution) +
+		"/" + std::to_string(_size);
+
+	validateContainer<Container>("Validate" + suffix, _dataset);
+
+	runBenchmark("Insert" + suffix, _size, [&](State& _state)
+	{
+		Container container;
+		resetStats(container);
+		_state.resume();
+		fill(container, _dataset);
+		_state.pause();
+		reportStats(_state, container, _size);
+	});
+
+	runBenchmark("Erase" + suffix, _size, [&](State& _state)
+	{
+		Container container;
+		fill(container, _dataset);
+		resetStats(container);
+		_state.resume();
+		for (const Key& key : _dataset.insertOrder)
+			container.erase(key);
+		_state.pause();
+		reportStats(_state, container, _size);
+	});
+
+	Container container;
+	fill(container, _dataset);
+
+	runBenchmark("FindHit" + suffix, _size, [&](State& _state)
+	{
+		resetStats(container);
+		_state.resume();
+		for (const Key& key : _dataset.hits)
+			findValue(container, key);
+		_state.pause();
+		reportStats(_state, container, _size);
+	});
+
+	runBenchmark("FindMiss" + suffix, _size, [&](State& _state)
+	{
+		_state.resume();
+		for (const Key& key : _dataset.misses)
+			findValue(container, key);
+		_state.pause();
+	});
+
+	runBenchmark("Iterate" + suffix, _size, [&](State& _state)
+	{
+		_state.resume();
+		iterate(container);
+		_state.pause();
+	});
+
+	runBenchmark("GetVector" + suffix, _size, [&](State& _state)
+	{
+		_state.resume();
+		getVector(container);
+		_state.pause();
+	});
+
+	runBenchmark("Copy" + suffix, _size, [&](State& _state)
+	{
+		_state.resume();
+		Container copy(container);
+		_state.pause();
+	});
+
+	runBenchmark("CopyByInsert" + suffix, _size, [&](State& _state)
+	{
+		Container copy;
+		_state.resume();
+		copyByInsert(copy, container);
+		_state.pause();
+	});
+
+	runBenchmark("Clear" + suffix, _size, [&](State& _state)
+	{
+		Container filled;
+		fill(filled, _dataset);
+		_state.resume();
+		filled.clear();
+		_state.pause();
+	});
+
+	runBenchmark("FromVector" + suffix, _size, [&](State& _state)
+	{
+		_state.resume();
+		auto constructed = construct(static_cast<Container*>(nullptr), _dataset.pairs);
+		_state.pause();
+
+		if constexpr (std::is_pointer_v<decltype(constructed)>)
+			delete constructed;
+	});
+}
+
+//Запрос находит запись (и делает ее самой свежей) или добавляет ее. Время логическое:
+//i-й запрос происходит в момент i, запись живет _timeToLive запросов
+template<typename Table, typename Key>
+void churn(Table& _table, const std::vector<Key>& _requests, int _timeToLive)
+{
+	using Duration = std::chrono::steady_clock::duration;
+	using TimePoint = std::chrono::steady_clock::time_point;
+
+	for (std::size_t i = 0; i < _requests.size(); ++i)
+	{
+		TimePoint now(Duration(static_cast<Duration::rep>(i)));
+		if (!touchValue(_table, _requests[i]))
+			_table.insert(_requests[i], static_cast<Value>(i), now + Duration(_timeToLive));
+
+		if ((i & 63) == 0)
+			_table.evictExpired(now);
+	}
+}
+
+template<typename Key>
+void benchmarkChurn(const std::string& _keyName, int _size, const Dataset<Key>& _dataset)
+{
+	std::string suffix = "/" + _keyName + "/zipfian/" + std::to_string(_size);
+	int capacity = std::max(_size / 4, 1);
+	int timeToLive = std::max(_size / 2, 1);
+
+	runBenchmark("Churn/LRUTree" + suffix, _size, [&](State& _state)
+	{
+		LRUTree<Key, Value> tree(capacity);
+		_state.resume();
+		churn(tree, _dataset.hits, timeToLive);
+		_state.pause();
+	});
+
+	runBenchmark("Churn/RBTree+list" + suffix, _size, [&](State& _state)
+	{
+		SessionTable<Key> table(capacity);
+		_state.resume();
+		churn(table, _dataset.hits, timeToLive);
+		_state.pause();
+	});
+}
+
+//Поток _thread из _threads вставляет, ищет и удаляет каждый _threads-й ключ набора
+template<typename Table, typename Key>
+void scalingWorker(Table& _table, const Dataset<Key>& _dataset, int _thread, int _threads)
+{
+	Value sum = 0;
+	std::size_t count = _dataset.pairs.size();
+	for (std::size_t i = _thread; i < count; i += _threads)
+		_table.insert(_dataset.pairs[i].first, _dataset.pairs[i].second);
+
+	for (std::size_t i = _thread; i < count; i += _threads)
+	{
+		Value value;
+		if (_table.find(_dataset.pairs[i].first, value))
+			sum += value;
+	}
+
+	for (std::size_t i = _thread; i < count; i += _threads)
+		_table.erase(_dataset.pairs[i].first);
+
+	static std::mutex sumMutex;
+	std::lock_guard<std::mutex> lock(sumMutex);
+	blackHole += sum;
+}
+
+template<typename Table, typename Key>
+void benchmarkScaling(const std::string& _containerName, const std::string& _keyName, int _size,
+	const Dataset<Key>& _dataset)
+{
+	for (int threads : options.threads)
+	{
+		std::string name = "Scaling/" + _containerName + "/" + _keyName + "/random/" + std::to_string(_size) +
+			"/threads:" + std::to_string(threads);
+
+		runBenchmark(name, 3 * _size, [&](State& _state)
+		{
+			Table table;
+			std::vector<std::thread> workers;
+			_state.resume();
+			for (int i = 0; i < threads; ++i)
+				workers.emplace_back([&, i]() { scalingWorker(table, _dataset, i, threads); });
+			for (std::thread& worker : workers)
+				worker.join();
+			_state.pause();
+		});
+	}
+}
+
+template<typename Table, typename Key>
+void benchmarkWrites(const std::string& _containerName, const std::string& _keyName, int _size,
+	const Dataset<Key>& _dataset)
+{
+	for (int threads : options.threads)
+	{
+		std::string name = "Writes/" + _containerName + "/" + _keyName + "/random/" + std::to_string(_size) +
+			"/threads:" + std::to_string(threads);
+
+		runBenchmark(name, 2 * _size, [&](State& _state)
+		{
+			Table table;
+			std::vector<std::thread> workers;
+			std::size_t count = _dataset.pairs.size();
+			_state.resume();
+			for (int i = 0; i < threads; ++i)
+			{
+				workers.emplace_back([&, i]()
+				{
+					for (std::size_t j = i; j < count; j += threads)
+						writeInsert(table, _dataset.pairs[j].first, _dataset.pairs[j].second);
+					for (std::size_t j = i; j < count; j += threads)
+						writeErase(table, _dataset.pairs[j].first);
+				});
+			}
+			for (std::thread& worker : workers)
+				worker.join();
+			waitWrites(table);
+			_state.pause();
+		});
+	}
+}
+
+//Поток _thread из _threads проходит каждый _threads-й запрос: каждый десятый удаляет и снова вставляет ключ,
+//остальные ищут его
+template<typename Table, typename Key>
+void mixedWorker(Table& _table, const Dataset<Key>& _dataset, int _thread, int _threads)
+{
+	Value sum = 0;
+	std::size_t count = _dataset.hits.size();
+	for (std::size_t i = _thread; i < count; i += _threads)
+	{
+		const Key& key = _dataset.hits[i];
+		if (i % 10 == 0)
+		{
+			_table.erase(key);
+			_table.insert(key, static_cast<Value>(i));
+			continue;
+		}
+
+		Value value;
+		if (_table.find(key, value))
+			sum += value;
+	}
+
+	static std::mutex sumMutex;
+	std::lock_guard<std::mutex> lock(sumMutex);
+	blackHole += sum;
+}
+
+template<typename Table, typename Key>
+void benchmarkMixed(const std::string& _containerName, const std::string& _keyName, int _size,
+	const Dataset<Key>& _dataset)
+{
+	for (int threads : options.threads)
+	{
+		std::string name = "Mixed/" + _containerName + "/" + _keyName + "/random/" + std::to_string(_size) +
+			"/threads:" + std::to_string(threads);
+
+		runBenchmark(name, _size, [&](State& _state)
+		{
+			Table table;
+			for (const auto& pair : _dataset.pairs)
+				table.insert(pair.first, pair.second);
+
+			std::vector<std::thread> workers;
+			_state.resume();
+			for (int i = 0; i < threads; ++i)
+				workers.emplace_back([&, i]() { mixedWorker(table, _dataset, i, threads); });
+			for (std::thread& worker : workers)
+				worker.join();
+			_state.pause();
+		});
+	}
+}
+
+template<typename Container, typename Key>
+void benchmarkMemory(const std::string& _containerName, const std::string& _keyName, int _size,
+	const Dataset<Key>& _dataset)
+{
+	Container container;
+	fill(container, _dataset);
+
+	runBenchmark("Memory/" + _containerName + "/" + _keyName + "/random/" + std::to_string(_size), _size,
+		[&](State& _state)
+	{
+		_state.resume();
+		TreeMemoryUsage usage = memoryOf(container);
+		_state.pause();
+
+		_state.counters = {
+			{ "bytes_per_entry", usage.bytesPerEntry() },
+			{ "node_size", static_cast<double>(usage.nodeSize) },
+			{ "node_allocation", static_cast<double>(usage.nodeAllocation) }
+		};
+	});
+}
+
+#ifdef TREES_ENABLE_LATENCY
+template<typename TreeType, typename Key>
+void benchmarkLatency(const std::string& _containerName, const std::string& _keyName, int _size,
+	const Dataset<Key>& _dataset)
+{
+	std::string name = "Latency/" + _containerName + "/" + _keyName + "/random/" + std::to_string(_size);
+	const std::pair<TREE_OPERATIONS, std::string> operations[] = {
+		{ TREE_OPERATIONS::INSERT, "insert" },
+		{ TREE_OPERATIONS::FIND, "find" },
+		{ TREE_OPERATIONS::ERASE, "erase" }
+	};
+
+	LatencyRecorder recorder(1);
+	runBenchmark(name, 3 * _size, [&](State& _state)
+	{
+		TreeType tree;
+		tree.setLatencyRecorder(&recorder);
+		_state.resume();
+		fill(tree, _dataset);
+		for (const Key& key : _dataset.hits)
+			findValue(tree, key);
+		for (const Key& key : _dataset.insertOrder)
+			tree.erase(key);
+		_state.pause();
+
+		_state.counters.clear();
+		for (const auto& operation : operations)
+		{
+			for (double percent : { 50.0, 99.0, 99.9 })
+			{
+				std::string label = operation.second + "_p" + ((percent == 99.9) ? "999" : std::to_string(static_cast<int>(percent)));
+				_state.counters.push_back({ label, static_cast<double>(recorder.percentile(operation.first, percent)) });
+			}
+		}
+	});
+
+	if (options.json || (!options.filter.empty() && name.find(options.filter) == std::string::npos))
+		return;
+
+	for (const auto& operation : operations)
+	{
+		std::vector<LatencySample> slowest = recorder.slowest(operation.first);
+		for (std::size_t i = 0; i < slowest.size() && i < 3; ++i)
+			std::printf("    slowest %-6s %10lld ns depth=%lld rotations=%lld recolorings=%lld balance_updates=%lld\n",
+				operation.second.c_str(), slowest[i].nanoseconds, slowest[i].depth, slowest[i].rotations,
+				slowest[i].recolorings, slowest[i].balanceUpdates);
+	}
+}
+#endif
+
+//Тот же uint64_t, но не тривиально копируемый: дерево с таким ключом не использует быстрые пути
+struct OpaqueKey
+{
+	std::uint64_t value = 0;
+
+	OpaqueKey() = default;
+	OpaqueKey(std::uint64_t _value) : value(_value) {};
+	OpaqueKey(const OpaqueKey& _other) : value(_other.value) {};
+	OpaqueKey& operator=(const OpaqueKey& _other) { value = _other.value; return *this; };
+
+	bool operator==(const OpaqueKey& _other) const { return value == _other.value; };
+	bool operator<(const OpaqueKey& _other) const { return value < _other.value; };
+	bool operator>(const OpaqueKey& _other) const { return value > _other.value; };
+};
+
+template<typename SmallKey>
+void benchmarkSmallKey(const std::string& _keyName, int _size, const Dataset<std::int64_t>& _dataset)
+{
+	using SmallTree = AVLTree<SmallKey, std::uint64_t>;
+	std::string suffix = "/AVLTree/" + _keyName + "/random/" + std::to_string(_size);
+
+	auto fillSmall = [&](SmallTree& _tree)
+	{
+		for (std::int64_t key : _dataset.insertOrder)
+			_tree.insert(static_cast<std::uint64_t>(key), static_cast<std::uint64_t>(key));
+	};
+
+	runBenchmark("SmallKeyInsert" + suffix, _size, [&](State& _state)
+	{
+		SmallTree tree;
+		_state.resume();
+		fillSmall(tree);
+		_state.pause();
+	});
+
+	SmallTree tree;
+	fillSmall(tree);
+	runBenchmark("SmallKeyFind" + suffix, 2 * _size, [&](State& _state)
+	{
+		_state.resume();
+		for (std::int64_t key : _dataset.hits)
+			findValue(tree, SmallKey(static_cast<std::uint64_t>(key)));
+		for (std::int64_t key : _dataset.misses)
+			findValue(tree, SmallKey(static_cast<std::uint64_t>(key)));
+		_state.pause();
+	});
+
+	runBenchmark("SmallKeyClear" + suffix, _size, [&](State& _state)
+	{
+		SmallTree filled;
+		fillSmall(filled);
+		_state.resume();
+		filled.clear();
+		_state.pause();
+	});
+}
+
+constexpr int STATIC_TABLE_SIZE = 1024;
+
+//Ключи - четные числа в перемешанном порядке (7919 взаимно просто с размером), сортирует их конструктор StaticTree
+constexpr std::array<std::pair<std::int64_t, Value>, STATIC_TABLE_SIZE> staticTablePairs()
+{
+	std::array<std::pair<std::int64_t, Value>, STATIC_TABLE_SIZE> pairs{};
+	for (int i = 0; i < STATIC_TABLE_SIZE; ++i)
+	{
+		std::int64_t number = (static_cast<std::int64_t>(i) * 7919) % STATIC_TABLE_SIZE;
+		pairs[i] = { 2 * number, static_cast<Value>(i) };
+	}
+	return pairs;
+}
+
+static constexpr StaticTree<std::int64_t, Value, STATIC_TABLE_SIZE> staticTable(staticTablePairs());
+
+void benchmarkStatic()
+{
+	std::string suffix = "/int64/" + std::to_string(STATIC_TABLE_SIZE);
+	const auto pairs = staticTablePairs();
+
+	runBenchmark("StaticBuild/RBTree" + suffix, STATIC_TABLE_SIZE, [&](State& _state)
+	{
+		RBTree<std::int64_t, Value> tree;
+		_state.resume();
+		for (const auto& pair : pairs)
+			tree.insert(pair);
+		_state.pause();
+	});
+
+	//Запросы - попадания и промахи вперемешку
+	std::vector<std::int64_t> queries(2 * STATIC_TABLE_SIZE);
+	for (int i = 0; i < 2 * STATIC_TABLE_SIZE; ++i)
+		queries[i] = (static_cast<std::int64_t>(i) * 4099) % (2 * STATIC_TABLE_SIZE);
+
+	runBenchmark("StaticFind/StaticTree" + suffix, 2 * STATIC_TABLE_SIZE, [&](State& _state)
+	{
+		_state.resume();
+		for (std::int64_t key : queries)
+		{
+			auto it = staticTable.find(key);
+			if (it != staticTable.afterEnd())
+				blackHole += (*it).second;
+		}
+		_state.pause();
+	});
+
+	RBTree<std::int64_t, Value> tree;
+	for (const auto& pair : pairs)
+		tree.insert(pair);
+	runBenchmark("StaticFind/RBTree" + suffix, 2 * STATIC_TABLE_SIZE, [&](State& _state)
+	{
+		_state.resume();
+		for (std::int64_t key : queries)
+			findValue(tree, key);
+		_state.pause();
+	});
+}
+
+//Резидентная память процесса в байтах, 0 там, где она не читается
+static long long residentBytes()
+{
+#ifdef __linux__
+	std::FILE* file = std::fopen("/proc/self/statm", "r");
+	if (!file)
+		return 0;
+
+	long long pages = 0, resident = 0;
+	int read = std::fscanf(file, "%lld %lld", &pages, &resident);
+	std::fclose(file);
+	return (read == 2) ? resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+	return 0;
+#endif
+}
+
+void benchmarkFrozen(int _size, const Dataset<std::int64_t>& _dataset)
+{
+	using Frozen = FrozenTree<std::int64_t, Value>;
+	std::string suffix = "/int64/random/" + std::to_string(_size);
+	std::string path = (std::filesystem::temp_directory_path() / "trees_benchmark.frz").string();
+	{
+		RBTree<std::int64_t, Value> tree;
+		fill(tree, _dataset);
+		if (!Frozen::write(tree, path))
+			return;
+	}
+
+	runBenchmark("FrozenOpen/FrozenTree" + suffix, 1, [&](State& _state)
+	{
+		long long before = residentBytes();
+		_state.resume();
+		Frozen frozen;
+		frozen.open(path);
+		auto it = frozen.find(_dataset.hits.front());
+		_state.pause();
+		blackHole += (it != frozen.afterEnd()) ? (*it).second : 0;
+		_state.counters = { { "rss_mb", (residentBytes() - before) / 1048576.0 } };
+	});
+
+	runBenchmark("FrozenLoad/RBTree" + suffix, _size, [&](State& _state)
+	{
+		RBTree<std::int64_t, Value> tree;
+		_state.resume();
+		//Загрузка без отображения: записи читаются из файла по порядку и сразу строят дерево
+		std::FILE* file = std::fopen(path.c_str(), "rb");
+		typename Frozen::Header header;
+		if (file && std::fread(&header, sizeof(header), 1, file) == 1)
+		{
+			std::pair<std::int64_t, Value> pair;
+			tree.buildFromSorted(static_cast<int>(header.count), [&]() -> const std::pair<std::int64_t, Value>&
+			{
+				typename Frozen::Entry entry{};
+				std::fread(&entry, sizeof(entry), 1, file);
+				pair = { entry.key, entry.value };
+				return pair;
+			});
+		}
+		if (file)
+			std::fclose(file);
+		_state.pause();
+		blackHole += tree.size();
+		_state.counters = { { "memory_mb", memoryOf(tree).totalBytes() / 1048576.0 } };
+	});
+
+	runBenchmark("FrozenFind/FrozenTree" + suffix, 2 * _size, [&](State& _state)
+	{
+		long long before = residentBytes();
+		Frozen frozen(path);
+		_state.resume();
+		for (std::int64_t key : _dataset.hits)
+		{
+			auto it = frozen.find(key);
+			if (it != frozen.afterEnd())
+				blackHole += (*it).second;
+		}
+		for (std::int64_t key : _dataset.misses)
+			blackHole += (frozen.find(key) != frozen.afterEnd());
+		_state.pause();
+		_state.counters = { { "rss_mb", (residentBytes() - before) / 1048576.0 } };
+	});
+
+	std::error_code error;
+	std::filesystem::remove(path, error);
+}
+
+constexpr int DURABLE_OPERATIONS = 10000;
+
+void benchmarkDurable(int _size, const Dataset<std::int64_t>& _dataset)
+{
+	int count = std::min(_size, DURABLE_OPERATIONS);
+	std::filesystem::path directory = std::filesystem::temp_directory_path() / "trees_benchmark_wal";
+
+	for (int batch : { 1, 8, 64, 512 })
+	{
+		runBenchmark("Durable/RBTree/int64/random/" + std::to_string(count) + "/batch:" + std::to_string(batch), count,
+			[&](State& _state)
+		{
+			std::error_code error;
+			std::filesystem::remove_all(directory, error);
+			DurableTree<std::int64_t, Value> tree;
+			if (!tree.open(directory.string(), batch))
+				return;
+
+			_state.resume();
+			for (int i = 0; i < count; ++i)
+				tree.insert(_dataset.insertOrder[i], i);
+			tree.sync();
+			_state.pause();
+			blackHole += tree.size();
+		});
+	}
+
+	std::error_code error;
+	std::filesystem::remove_all(directory, error);
+}
+
+constexpr std::size_t EXTERNAL_MEMORY_BUDGET = 256 << 20;
+
+void benchmarkExternal()
+{
+	if (options.externalPairs <= 0)
+		return;
+
+	int count = options.externalPairs;
+	runBenchmark("ExternalBuild/RBTree/int64/random/" + std::to_string(count), count, [&](State& _state)
+	{
+		ExternalTreeBuilder<std::int64_t, Value> builder(EXTERNAL_MEMORY_BUDGET);
+		std::mt19937_64 generator(1);
+		std::vector<std::int64_t> keys(1 << 20);
+		for (int added = 0; added < count; added += static_cast<int>(keys.size()))
+		{
+			keys.resize(std::min<std::size_t>(keys.size(), static_cast<std::size_t>(count - added)));
+			for (std::int64_t& key : keys)
+				key = static_cast<std::int64_t>(generator());
+
+			_state.resume();
+			for (std::int64_t key : keys)
+				builder.add(key, key);
+			_state.pause();
+		}
+
+		RBTree<std::int64_t, Value> tree;
+		_state.resume();
+		bool built = builder.build(tree);
+		_state.pause();
+
+		if (!built)
+		{
+			std::printf("ExternalBuild failed: not enough space in the temporary directory?\n");
+			invalidTrees = true;
+		}
+		//Последний неполный буфер становится серией уже внутри build
+		double runs = std::ceil(static_cast<double>(count) * sizeof(FrozenTree<std::int64_t, Value>::Entry) /
+			EXTERNAL_MEMORY_BUDGET);
+		_state.counters = { { "runs", runs }, { "merge_passes", static_cast<double>(builder.mergePassCount()) } };
+		blackHole += tree.size();
+	});
+}
+
+template<typename Key>
+void benchmarkParallel(const std::string& _keyName, int _size, const Dataset<Key>& _dataset)
+{
+	RBTree<Key, Value> tree;
+	fill(tree, _dataset);
+
+	for (int threads : options.threads)
+	{
+		std::string suffix = "/RBTree/" + _keyName + "/random/" + std::to_string(_size) + "/threads:" +
+			std::to_string(threads);
+		ThreadPool pool(threads - 1);
+
+		runBenchmark("ParallelReduce" + suffix, _size, [&](State& _state)
+		{
+			_state.resume();
+			Value sum = tree.parallelReduce(Value(0), [](const Key&, Value& _value) { return _value; },
+				[](Value _left, Value _right) { return _left + _right; }, pool);
+			_state.pause();
+			blackHole += sum;
+		});
+
+		runBenchmark("ParallelGetVector" + suffix, _size, [&](State& _state)
+		{
+			_state.resume();
+			auto vector = tree.parallelGetVector(pool);
+			_state.pause();
+			blackHole += static_cast<Value>(vector.size());
+		});
+
+		runBenchmark("ParallelClear" + suffix, _size, [&](State& _state)
+		{
+			RBTree<Key, Value> filled;
+			fill(filled, _dataset);
+			filled.setParallelPool(&pool);
+			_state.resume();
+			filled.clear();
+			_state.pause();
+		});
+	}
+}
+
+template<typename Key>
+void benchmarkKeyType(const std::string& _keyName)
+{
+	for (int size : options.sizes)
+	{
+		for (DISTRIBUTIONS distribution : { DISTRIBUTIONS::RANDOM, DISTRIBUTIONS::SORTED, DISTRIBUTIONS::ZIPFIAN })
+		{
+			Dataset<Key> dataset(size, distribution);
+
+			benchmarkContainer<std::map<Key, Value>>("std::map", _keyName, size, distribution, dataset);
+			benchmarkContainer<AVLTree<Key, Value>>("AVLTree", _keyName, size, distribution, dataset);
+			benchmarkContainer<RBTree<Key, Value>>("RBTree", _keyName, size, distribution, dataset);
+			benchmarkContainer<CachedRBTree<Key, 1024>>("RBTreeCached", _keyName, size, distribution, dataset);
+			benchmarkContainer<SplayTree<Key, Value>>("SplayTree", _keyName, size, distribution, dataset);
+			benchmarkContainer<ScapegoatTree<Key, Value>>("ScapegoatTree", _keyName, size, distribution, dataset);
+			benchmarkContainer<ConfiguredSplayTree<Key, SPLAY_MODES::SEMI, 1>>("SemiSplayTree", _keyName, size,
+				distribution, dataset);
+			benchmarkContainer<ConfiguredSplayTree<Key, SPLAY_MODES::FULL, 16>>("SplayTree16", _keyName, size,
+				distribution, dataset);
+
+			//Tree не балансируется: на отсортированных данных он вырождается в список
+			//и операции становятся линейными, поэтому большие размеры пропускаются
+			if (distribution != DISTRIBUTIONS::SORTED || size <= 10000)
+				benchmarkContainer<Tree<Key, Value>>("Tree", _keyName, size, distribution, dataset);
+
+			if (distribution == DISTRIBUTIONS::ZIPFIAN)
+				benchmarkChurn<Key>(_keyName, size, dataset);
+
+			if (distribution == DISTRIBUTIONS::RANDOM)
+			{
+				benchmarkMemory<std::map<Key, Value>>("std::map", _keyName, size, dataset);
+				benchmarkMemory<Tree<Key, Value>>("Tree", _keyName, size, dataset);
+				benchmarkMemory<AVLTree<Key, Value>>("AVLTree", _keyName, size, dataset);
+				benchmarkMemory<RBTree<Key, Value>>("RBTree", _keyName, size, dataset);
+#ifdef TREES_ENABLE_LATENCY
+				benchmarkLatency<AVLTree<Key, Value>>("AVLTree", _keyName, size, dataset);
+				benchmarkLatency<RBTree<Key, Value>>("RBTree", _keyName, size, dataset);
+#endif
+				if constexpr (std::is_same_v<Key, std::int64_t>)
+				{
+					benchmarkSmallKey<std::uint64_t>("uint64", size, dataset);
+					benchmarkSmallKey<OpaqueKey>("opaque_uint64", size, dataset);
+					benchmarkFrozen(size, dataset);
+					benchmarkDurable(size, dataset);
+				}
+				benchmarkParallel<Key>(_keyName, size, dataset);
+				benchmarkScaling<LockedTree<Key>>("RBTree+mutex", _keyName, size, dataset);
+				benchmarkScaling<ConfiguredShardedTree<Key, SHARDING_MODES::RANGE>>("ShardedTreeRange", _keyName,
+					size, dataset);
+				benchmarkScaling<ConfiguredShardedTree<Key, SHARDING_MODES::HASH>>("ShardedTreeHash", _keyName,
+					size, dataset);
+				benchmarkScaling<ConcurrentAVLTree<Key, Value>>("ConcurrentAVLTree", _keyName, size, dataset);
+				benchmarkWrites<LockedTree<Key>>("RBTree+mutex", _keyName, size, dataset);
+				benchmarkWrites<AsyncTree<Key, Value>>("AsyncTree", _keyName, size, dataset);
+				benchmarkMixed<LockedTree<Key, AVLTree<Key, Value>>>("AVLTree+mutex", _keyName, size, dataset);
+				benchmarkMixed<LockedTree<Key>>("RBTree+mutex", _keyName, size, dataset);
+				benchmarkMixed<ConcurrentAVLTree<Key, Value>>("ConcurrentAVLTree", _keyName, size, dataset);
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------------- MAIN ----------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+static void parseArguments(int _argc, char** _argv)
+{
+	for (int i = 1; i < _argc; ++i)
+	{
+		std::string argument = _argv[i];
+		auto valueOf = [&](const std::string& _prefix) { return argument.substr(_prefix.size()); };
+
+		auto listOf = [&](const std::string& _prefix)
+		{
+			std::vector<int> values;
+			std::string list = valueOf(_prefix);
+			std::size_t position = 0;
+			while (position < list.size())
+			{
+				std::size_t comma = list.find(',', position);
+				if (comma == std::string::npos)
+					comma = list.size();
+				values.push_back(std::stoi(list.substr(position, comma - position)));
+				position = comma + 1;
+			}
+			return values;
+		};
+
+		if (argument.rfind("--sizes=", 0) == 0)
+			options.sizes = listOf("--sizes=");
+		else if (argument.rfind("--threads=", 0) == 0)
+			options.threads = listOf("--threads=");
+		else if (argument.rfind("--filter=", 0) == 0)
+			options.filter = valueOf("--filter=");
+		else if (argument == "--format=json")
+			options.json = true;
+		else if (argument.rfind("--min_time=", 0) == 0)
+			options.minTime = std::stod(valueOf("--min_time="));
+		else if (argument.rfind("--external=", 0) == 0)
+			options.externalPairs = std::stoi(valueOf("--external="));
+	}
+}
+
+static void printJson()
+{
+	char date[64];
+	std::time_t now = std::time(nullptr);
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+	std::printf("{\n  \"context\": {\n    \"date\": \"%s\",\n    \"library_build_type\": \"%s\"\n  },\n",
+		date,
+#ifdef NDEBUG
+		"release"
+#else
+		"debug"
+#endif
+	);
+
+	std::printf("  \"benchmarks\": [\n");
+	for (std::size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& result = results[i];
+		std::printf("    {\n      \"name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+			"      \"iterations\": %lld,\n      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n"
+			"      \"time_unit\": \"ns\",\n      \"items_per_second\": %.3f",
+			result.name.c_str(), result.iterations, result.nsPerIteration, result.nsPerIteration,
+			result.itemsPerSecond);
+		for (const auto& counter : result.counters)
+			std::printf(",\n      \"%s\": %.6g", counter.first.c_str(), counter.second);
+		std::printf("\n    }%s\n", (i + 1 < results.size()) ? "," : "");
+	}
+	std::printf("  ]\n}\n");
+}
+
+int main(int argc, char** argv)
+{
+	parseArguments(argc, argv);
+
+	if (options.threads.empty())
+	{
+		int cores = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+		for (int threads = 1; threads <= cores; threads *= 2)
+			options.threads.push_back(threads);
+	}
+
+	benchmarkStatic();
+	benchmarkExternal();
+	benchmarkKeyType<std::int64_t>("int64");
+	benchmarkKeyType<std::string>("string");
+
+	if (options.json)
+		printJson();
+
+	return (invalidTrees || blackHole == 42) ? 1 : 0;
+}
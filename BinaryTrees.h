@@ -1,9 +1,30 @@
 ﻿#ifndef BINARYTREES_H
 #define BINARYTREES_H
 
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <stack>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+//Пул потоков и регистратор времени нужны только тем, кто их использует: методы с пулом - шаблоны
+//и инстанцируются там, где подключен ThreadPool.h, а LatencyRecorder.h подключается вместе с замерами
+#ifdef TREES_ENABLE_LATENCY
+#include "LatencyRecorder.h"
+#endif
+
+class ThreadPool;
+class LatencyRecorder;
+
 template<typename T>
 concept KEY = requires(const T & t1, const T & t2)
 {
@@ -12,58 +33,222 @@ concept KEY = requires(const T & t1, const T & t2)
 	t1 < t2;
 };
 
+//Атрибут [[no_unique_address]]: пустое поле (например, NoValue у множеств) не занимает памяти.
+//MSVC игнорирует стандартное написание и понимает только свое
+#if defined(_MSC_VER)
+#define TREES_NO_UNIQUE_ADDRESS [[msvc::no_unique_address]]
+#else
+#define TREES_NO_UNIQUE_ADDRESS [[no_unique_address]]
+#endif
+
+//Счетчики операций дерева. Собираются, только если перед подключением файла определен
+//макрос TREES_ENABLE_STATS, иначе вызовы TREE_STATS(...) удаляются препроцессором
+//и не стоят ничего
+#ifdef TREES_ENABLE_STATS
+#define TREE_STATS(expression) expression
+#else
+#define TREE_STATS(expression)
+#endif
+
+//Замер времени операций (см. Tree::setLatencyRecorder) так же включается макросом TREES_ENABLE_LATENCY.
+//Со включенным макросом дерево без регистратора платит за операцию одну проверку указателя
+#ifdef TREES_ENABLE_LATENCY
+#define TREE_LATENCY(expression) expression
+#else
+#define TREE_LATENCY(expression)
+#endif
+
+struct TreeStats
+{
+	long long comparisons = 0;		//Сравнения ключей
+	long long nodeVisits = 0;		//Узлы, пройденные при спуске от корня
+	long long leftRotations = 0;
+	long long rightRotations = 0;
+	long long doubleRotations = 0;	//Большие повороты AVL дерева (каждый также учтен как два простых)
+	long long recolorings = 0;		//Перекрашивания узлов RB дерева
+	long long balanceUpdates = 0;	//Узлы AVL дерева, пройденные при восстановлении баланса
+	long long rebuiltNodes = 0;		//Узлы, перестроенные деревом-козлом отпущения
+	long long cacheHits = 0;		//Поиски, обслуженные кэшем горячих ключей без спуска от корня
+	long long cacheMisses = 0;
+	long long allocations = 0;
+	long long deallocations = 0;
+
+	long long searches = 0;			//Количество спусков от корня
+	long long totalDepth = 0;		//Суммарная глубина спусков
+	int maxDepth = 0;
+
+	double averageDepth() const { return searches ? static_cast<double>(totalDepth) / searches : 0.0; };
+	double cacheHitRate() const
+	{
+		return (cacheHits + cacheMisses) ? static_cast<double>(cacheHits) / (cacheHits + cacheMisses) : 0.0;
+	};
+};
+
+#ifdef TREES_ENABLE_LATENCY
+//Замер одной операции дерева от создания до разрушения. Без регистратора не читает часы.
+//Глубину и повороты операции дают разности счетчиков TreeStats до и после нее
+class LatencyScope
+{
+	LatencyRecorder* recorder;
+	const TreeStats* stats;
+	LatencySample sample;
+	TreeStats before;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	LatencyScope(LatencyRecorder* _recorder, TREE_OPERATIONS _operation, const TreeStats* _stats) :
+		recorder(_recorder), stats(_stats)
+	{
+		if (!recorder)
+			return;
+
+		sample.operation = _operation;
+		if (stats)
+			before = *stats;
+		start = std::chrono::steady_clock::now();
+	};
+
+	LatencyScope(const LatencyScope&) = delete;
+	LatencyScope& operator=(const LatencyScope&) = delete;
+
+	~LatencyScope()
+	{
+		if (!recorder)
+			return;
+
+		sample.nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+		if (stats)
+		{
+			sample.depth = stats->totalDepth - before.totalDepth;
+			sample.rotations = stats->leftRotations + stats->rightRotations - before.leftRotations - before.rightRotations;
+			sample.recolorings = stats->recolorings - before.recolorings;
+			sample.balanceUpdates = stats->balanceUpdates - before.balanceUpdates;
+		}
+		recorder->record(sample);
+	};
+};
+#endif
+
+//Оценка памяти дерева (Tree::memoryUsage). Размер блока malloc оценивается по схеме glibc:
+//к запрошенному размеру добавляется заголовок в size_t, блок выравнивается на 2 * size_t и не меньше 4 * size_t
+struct TreeMemoryUsage
+{
+	long long nodes = 0;
+	long long nodeSize = 0;			//sizeof узла
+	long long nodeAllocation = 0;	//Блок malloc под узел: sizeof вместе с заголовком и выравниванием
+	long long auxiliaryBytes = 0;	//Кэш горячих ключей, буфер перестройки ScapegoatTree
+	long long ownedBytes = 0;		//Память в куче, которой владеют ключи и значения (длинные строки и т.п.)
+
+	long long totalBytes() const { return nodes * nodeAllocation + auxiliaryBytes + ownedBytes; };
+	double bytesPerEntry() const { return nodes ? static_cast<double>(totalBytes()) / nodes : 0.0; };
+};
+
+constexpr std::size_t mallocBlockSize(std::size_t _size)
+{
+	if (!_size)
+		return 0;
+
+	constexpr std::size_t word = sizeof(std::size_t);
+	std::size_t block = (_size + word + 2 * word - 1) & ~(2 * word - 1);
+	return std::max(block, 4 * word);
+}
+
+//Память в куче, которой владеет объект, для memoryUsage по умолчанию. Тривиально копируемые типы
+//памяти не владеют, строка владеет блоком, если текст не поместился во внутренний буфер (SSO)
+template<typename T>
+std::size_t ownedHeapBytes(const T&)
+{
+	return 0;
+}
+
+template<typename CharType, typename Traits, typename Allocator>
+std::size_t ownedHeapBytes(const std::basic_string<CharType, Traits, Allocator>& _string)
+{
+	auto data = reinterpret_cast<std::uintptr_t>(_string.data());
+	auto object = reinterpret_cast<std::uintptr_t>(&_string);
+	if (data >= object && data < object + sizeof(_string))
+		return 0;
+
+	return mallocBlockSize((_string.capacity() + 1) * sizeof(CharType));
+}
+
 enum class TREE_TYPES
 {
 	RANDOMIZED,
 	AVL,
-	RB
+	RB,
+	SPLAY,
+	SCAPEGOAT,
+	LRU
+};
+
+enum class NODE_COLORS : char
+{
+	RED,
+	BLACK
 };
 
+//Тип значения для множеств (Set, AVLSet, RBSet и Multi-варианты): узлы хранят только ключ
+struct NoValue {};
+
+//Узлы не имеют виртуальных функций и указателя на таблицу виртуальных функций:
+//фактический тип узла определяется видом дерева (Tree::type), см. Tree::createNode и Tree::destroyNode
 template<KEY KeyType, typename ValueType>
 struct BasicNode
 {
-	KeyType key;
-	ValueType value;
-
+	//Указатели идут первыми, а ключ и значение - в конце: тогда поля AVLNode и RBNode
+	//помещаются в выравнивающий хвост BasicNode и не увеличивают размер узла
 	BasicNode* parent;
 	BasicNode* left;
 	BasicNode* right;
 
-	BasicNode(const KeyType& _key, const ValueType& _value, BasicNode* _parent = nullptr)
-		: key(_key), value(_value), parent(_parent), left(nullptr), right(nullptr) {};
+	KeyType key;
+	TREES_NO_UNIQUE_ADDRESS ValueType value;
 
-	virtual ~BasicNode() {};
+	BasicNode(const KeyType& _key, const ValueType& _value, BasicNode* _parent = nullptr)
+		: parent(_parent), left(nullptr), right(nullptr), key(_key), value(_value) {};
 
-	virtual short getHeight() { return -1; }
-	virtual char getColor() { return 0; }
-	virtual void setHeight(short _height) { return; }
-	virtual void setColor(char _color) { return; }
+	//Доступ к ребенку по направлению: false - левый, true - правый.
+	//Позволяет записывать симметричные случаи балансировки одной веткой
+	BasicNode*& child(bool _right) { return _right ? right : left; }
 };
 
 template<KEY KeyType, typename ValueType>
 struct AVLNode : public BasicNode<KeyType, ValueType>
 {	
-	short height;
+	//Показатель баланса: высота правого поддерева минус высота левого, всегда -1, 0 или 1
+	signed char balance;
 	
 	AVLNode(const KeyType& _key, const ValueType& _value, BasicNode<KeyType, ValueType>* _parent = nullptr) :
-		BasicNode<KeyType, ValueType>(_key, _value, _parent), height(0) {};
-	virtual ~AVLNode() {};
-
-	virtual short getHeight() override { return height; };
-	virtual void setHeight(short _height) override { height = _height; };
+		BasicNode<KeyType, ValueType>(_key, _value, _parent), balance(0) {};
 };
 
 template<KEY KeyType, typename ValueType>
 struct RBNode : public BasicNode<KeyType, ValueType>
 {
-	char color;
+	NODE_COLORS color;
 
 	RBNode(const KeyType& _key, const ValueType& _value, BasicNode<KeyType, ValueType>* _parent = nullptr) :
-		BasicNode<KeyType, ValueType>(_key, _value, _parent), color('R') {};
-	virtual ~RBNode() {};
+		BasicNode<KeyType, ValueType>(_key, _value, _parent), color(NODE_COLORS::RED) {};
+};
+
+//Узел LRUTree: кроме полей RBNode входит в два двусвязных списка - по давности обращения
+//и по времени истечения - и хранит время истечения записи
+template<KEY KeyType, typename ValueType>
+struct LRUNode : public RBNode<KeyType, ValueType>
+{
+	LRUNode* newer;
+	LRUNode* older;
+	LRUNode* previousExpiring;
+	LRUNode* nextExpiring;
+
+	//TimePoint::max() - запись не истекает, TimePoint::min() - время еще не назначено деревом
+	std::chrono::steady_clock::time_point expiry;
 
-	virtual char getColor() override { return color; }
-	virtual void setColor(char _color) override { color = _color; }
+	LRUNode(const KeyType& _key, const ValueType& _value, BasicNode<KeyType, ValueType>* _parent = nullptr) :
+		RBNode<KeyType, ValueType>(_key, _value, _parent), newer(nullptr), older(nullptr),
+		previousExpiring(nullptr), nextExpiring(nullptr), expiry(std::chrono::steady_clock::time_point::min()) {};
 };
 
 
@@ -102,38 +287,21 @@ public:
 			if (*this == pointerToOwner->afterEnd())
 				return;
 
-			if (*this == pointerToOwner->end())
-			{
-				*this = pointerToOwner->afterEnd();
-				return;
-			}
-
 			if (*this == pointerToOwner->beforeBegin())
 			{
 				*this = pointerToOwner->begin();
 				return;
 			}
 
-			Node* searchPtr;
-
-			//Если узел имеет правое поддерево, то следующий ключ будет у самого левого узла 
-			//этого поддерева
-			if (pointerToNode->right)
+			//Переход по связям, а не по ключам, поэтому работает и с одинаковыми ключами
+			Node* next = Tree<KeyType, ValueType>::nextNode(pointerToNode);
+			if (!next)
 			{
-				searchPtr = pointerToNode->right;
-				while (searchPtr->left)
-					searchPtr = searchPtr->left;
-
-				pointerToNode = searchPtr;
+				*this = pointerToOwner->afterEnd();
 				return;
 			}
-			//Если правого поддерева нет, идем вверх по родителям, пока их ключи
-			//меньше ключа текущего узла
-			searchPtr = pointerToNode->parent;
-			while (searchPtr->key < pointerToNode->key)
-				searchPtr = searchPtr->parent;
 
-			pointerToNode = searchPtr;
+			pointerToNode = next;
 		}
 
 		void operator--()
@@ -141,39 +309,65 @@ public:
 			if (*this == pointerToOwner->beforeBegin())
 				return;
 
-			if (*this == pointerToOwner->begin())
+			if (*this == pointerToOwner->afterEnd())
 			{
-				*this = pointerToOwner->beforeBegin();
+				*this = pointerToOwner->end();
 				return;
 			}
 
-			if (*this == pointerToOwner->afterEnd())
+			Node* previous = Tree<KeyType, ValueType>::previousNode(pointerToNode);
+			if (!previous)
 			{
-				*this = pointerToOwner->end();
+				*this = pointerToOwner->beforeBegin();
 				return;
 			}
 
-			Node* searchPtr;
-			//Если есть левое поддерево, следующий ключ будет у самого правого узла
-			//данного поддерева
-			if (pointerToNode->left)
-			{
-				searchPtr = pointerToNode->left;
-				while (searchPtr->right)
-					searchPtr = searchPtr->right;
+			pointerToNode = previous;
+		}
 
-				pointerToNode = searchPtr;
-				return;
+		friend class Tree<KeyType, ValueType>;
+	};
+
+	//Владеющий указатель на узел, извлеченный из дерева методом extract. Узел можно вставить
+	//в другое дерево того же вида (или с тем же видом узлов) без выделения памяти.
+	//Если handle так и не был вставлен, узел удаляется вместе с ним
+	struct NodeHandle
+	{
+	private:
+		Node* pointerToNode;
+		TREE_TYPES nodeType;
+
+		NodeHandle(Node* _ptr, TREE_TYPES _type) : pointerToNode(_ptr), nodeType(_type) {};
+	public:
+		NodeHandle() : pointerToNode(nullptr), nodeType(TREE_TYPES::RANDOMIZED) {};
+		NodeHandle(NodeHandle&& _other) noexcept : pointerToNode(_other.pointerToNode), nodeType(_other.nodeType)
+		{
+			_other.pointerToNode = nullptr;
+		};
+		NodeHandle& operator=(NodeHandle&& _other) noexcept
+		{
+			if (this != &_other)
+			{
+				Tree<KeyType, ValueType>::destroyNode(pointerToNode, nodeType);
+				pointerToNode = _other.pointerToNode;
+				nodeType = _other.nodeType;
+				_other.pointerToNode = nullptr;
 			}
+			return *this;
+		};
+		NodeHandle(const NodeHandle&) = delete;
+		NodeHandle& operator=(const NodeHandle&) = delete;
 
-			//Если левого поддерева нет, идем вверх по родителям, пока их ключи
-			//больше ключа текущего узла
-			searchPtr = pointerToNode->parent;
-			while (searchPtr->key > pointerToNode->parent)
-				searchPtr = searchPtr->parent;
+		~NodeHandle() { Tree<KeyType, ValueType>::destroyNode(pointerToNode, nodeType); };
 
-			pointerToNode = searchPtr;
-		}
+		bool empty() const { return !pointerToNode; };
+		explicit operator bool() const { return pointerToNode != nullptr; };
+
+		//Пока узел не в дереве, его ключ можно менять
+		KeyType& key() const { return pointerToNode->key; };
+		ValueType& value() const { return pointerToNode->value; };
+
+		friend class Tree<KeyType, ValueType>;
 	};
 
 //Protected members: 
@@ -181,13 +375,144 @@ protected:
 	Node* root;
 	Node* last_added_node;
 	Node* parent_of_last_erased_node;
+	bool last_erased_was_left;
+
+	//Разрешены ли одинаковые ключи (Multi-деревья). Одинаковые ключи хранятся
+	//отдельными узлами в порядке добавления
+	bool allow_duplicates;
 
 	TREE_TYPES type;
 	int m_size;
 
+	//Кэш горячих ключей перед innerFind: слот с номером, вычисленным по хэшу ключа, хранит
+	//последний найденный узел с таким хэшем. Пустой вектор - кэш выключен (см. enableCache)
+	std::vector<Node*> front_cache;
+	int front_cache_shift;
+
+	//Пул, которым clear() и деструктор удаляют большие деревья (см. setParallelPool). nullptr - последовательно.
+	//parallel_clear - clearParallel, инстанцированный в setParallelPool, где тип пула известен
+	ThreadPool* parallel_pool;
+	void (Tree::*parallel_clear)(ThreadPool&);
+
+#ifdef TREES_ENABLE_LATENCY
+	LatencyRecorder* latency_recorder;
+#endif
+
+	static constexpr bool HASHABLE_KEY = requires(const KeyType& _key) { std::hash<KeyType>{}(_key); };
+	//Небольшой тривиально копируемый ключ (числа, указатели, короткие структуры) при поиске копируется в регистр,
+	//а спуск выбирает потомка без ветвления (см. innerFind)
+	static constexpr bool SMALL_KEY = std::is_trivially_copyable_v<KeyType> && sizeof(KeyType) <= 2 * sizeof(void*);
+	//Узлы с тривиально разрушаемыми ключом и значением освобождаются без деструктора (см. destroyNode)
+	static constexpr bool TRIVIAL_NODES = std::is_trivially_destructible_v<KeyType> && std::is_trivially_destructible_v<ValueType>;
+
+#ifdef TREES_ENABLE_STATS
+	mutable TreeStats m_stats;
+
+	void recordDepth(int _depth) const
+	{
+		++m_stats.searches;
+		m_stats.totalDepth += _depth;
+		if (_depth > m_stats.maxDepth)
+			m_stats.maxDepth = _depth;
+	}
+
+	TreeStats* statsSink() const { return &m_stats; };
+#else
+	TreeStats* statsSink() const { return nullptr; };
+#endif
+
 	void swapNodes(Node* _node1, Node* _node2);
 	Node* innerFind(const KeyType& _key);
 
+	Node*& cacheSlot(const KeyType& _key);
+	void forgetNode(Node* _node);
+	Node* boundNode(const KeyType& _key, bool _upper);
+
+	static Node* nextNode(Node* _node);
+	static Node* previousNode(Node* _node);
+
+	Node* createNode(const KeyType& _key, const ValueType& _value, Node* _parent = nullptr);
+	void deleteNode(Node* _node);
+	void resetNode(Node* _node);
+
+	//Деревья RANDOMIZED, SPLAY и SCAPEGOAT хранят одинаковые узлы BasicNode
+	static TREE_TYPES nodeKind(TREE_TYPES _type)
+	{
+		return (_type == TREE_TYPES::AVL || _type == TREE_TYPES::RB || _type == TREE_TYPES::LRU) ?
+			_type : TREE_TYPES::RANDOMIZED;
+	};
+	static void destroyNode(Node* _node, TREE_TYPES _type);
+	static Node* selectChild(const Node* _node, bool _right);
+
+	//Копия узла того же вида вместе со служебными полями (баланс AVL, цвет RB, время истечения LRU).
+	//Связи списков LRUNode не копируются, их восстанавливает LRUTree
+	static Node* cloneNode(const Node* _node, Node* _parent, TREE_TYPES _type);
+	static Node* cloneSubtree(const Node* _root, TREE_TYPES _type);
+
+	//Форму дерева можно скопировать или забрать, только если у деревьев одинаковые вид и правила для ключей
+	bool sameKind(const Tree& _other) const { return type == _other.type && allow_duplicates == _other.allow_duplicates; };
+	void copyFrom(const Tree& _other);
+	void moveFrom(Tree& _other);
+
+	bool findInsertPosition(const KeyType& _key, Node*& _parent, bool& _right);
+	void attachNode(Node* _node, Node* _parent, bool _right);
+	virtual void insertFixup(Node* /*_node*/) { return; };
+	virtual void accessFixup(Node* /*_node*/) { return; };
+	//Вызываются после того, как clear, buildFromSorted или присваивание заменили все узлы дерева: наследники
+	//приводят в соответствие свои структуры вне формы дерева (списки LRUTree, max_size ScapegoatTree).
+	//Методы не виртуальные, поэтому через ссылку на Tree состояние наследника обновляют только эти функции
+	virtual void clearFixup() { return; };
+	virtual void buildFixup() { return; };
+	virtual void copyFixup(const Tree& /*_other*/) { return; };
+	virtual void moveFixup(Tree& /*_other*/) { return; };
+
+	virtual Node* unlinkNode(Node* _node);
+	Node* linkBalanced(std::vector<Node*>& _nodes, int _first, int _last, Node* _parent, int _depth, int _redDepth);
+
+	//Параллельные обходы делят дерево по границам поддеревьев: верхние уровни до глубины, дающей около
+	//4 частей на поток, становятся отдельными узлами, а поддеревья под ними - задачами пула.
+	//Деревья меньше PARALLEL_MIN_SIZE обходятся одной задачей
+	static constexpr int PARALLEL_MIN_SIZE = 1 << 14;
+
+	struct Part
+	{
+		Node* node;
+		bool subtree;	//true - все поддерево node, false - только узел node
+	};
+
+	std::vector<Part> splitParts(int _threads) const;
+	static void splitParts(Node* _node, int _depth, std::vector<Part>& _parts);
+	template<typename Function>
+	static void forEachInSubtree(Node* _root, Function&& _function);
+	static void destroySubtree(Node* _root, TREE_TYPES _type);
+	template<typename Pool>
+	void clearParallel(Pool& _pool);
+
+	//Сводка по поддереву для validate: крайние узлы в порядке обхода, количество узлов, высота
+	//(пустое поддерево - 0) и черная высота, которую заполняет RB дерево
+	struct Subtree
+	{
+		Node* first;
+		Node* last;
+		int size;
+		int height;
+		int blackHeight;
+	};
+
+	//Проверка служебных полей узла по уже проверенным поддеревьям детей
+	virtual bool validateNode(Node* /*_node*/, const Subtree& /*_left*/, const Subtree& /*_right*/, Subtree& /*_result*/) const
+	{
+		return true;
+	};
+	//Наибольшая допустимая высота дерева из m_size узлов, у несбалансированных деревьев не ограничена
+	virtual int heightBound() const { return std::numeric_limits<int>::max(); };
+
+	static std::size_t nodeSize(TREE_TYPES _type);
+	//Память служебных структур дерева вне узлов
+	virtual std::size_t auxiliaryBytes() const { return mallocBlockSize(front_cache.capacity() * sizeof(Node*)); };
+	//memoryUsage без памяти, которой владеют ключи и значения
+	TreeMemoryUsage structureUsage() const;
+
 //Public members:
 public:
 	Tree() 
@@ -197,6 +522,12 @@ public:
 		m_size = 0;
 		last_added_node = nullptr;
 		parent_of_last_erased_node = nullptr;
+		last_erased_was_left = false;
+		allow_duplicates = false;
+		front_cache_shift = 0;
+		parallel_pool = nullptr;
+		parallel_clear = nullptr;
+		TREE_LATENCY(latency_recorder = nullptr);
 	};
 	Tree(const KeyType& _key, const ValueType& _value) 
 	{
@@ -205,29 +536,64 @@ public:
 		m_size = 1;
 		last_added_node = root;
 		parent_of_last_erased_node = nullptr;
+		last_erased_was_left = false;
+		allow_duplicates = false;
+		front_cache_shift = 0;
+		parallel_pool = nullptr;
+		parallel_clear = nullptr;
+		TREE_LATENCY(latency_recorder = nullptr);
 	};
 	Tree(const std::pair<KeyType, ValueType>& _pair) : Tree(_pair.first, _pair.second) {};
 	Tree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : Tree()
 	{		
+		if (buildFromSorted(_vector))
+			return;
+
 		for (const auto& pair : _vector)
 			insert(pair);
 		parent_of_last_erased_node = nullptr;
 	};
 	
+	//Копирование повторяет форму исходного дерева узел в узел за O(n) без сравнений ключей и балансировки.
+	//Перемещение забирает узлы за O(1), исходное дерево остается пустым.
+	//Наследники не объявляют деструкторов, поэтому их копирование и перемещение создает компилятор
+	Tree(const Tree& _other);
+	Tree(Tree&& _other) noexcept;
+	Tree& operator=(const Tree& _other);
+	Tree& operator=(Tree&& _other);
+
 	virtual ~Tree() { clear();};
 
 	bool empty() const { return (!root) ? true : false; };
 	int size() const { return m_size; };
+	bool allowsDuplicates() const { return allow_duplicates; };
 
 	virtual bool insert(const KeyType& _key, const ValueType& _value);
 	bool insert(const std::pair<KeyType, ValueType>& _pair);
+	virtual bool insert(NodeHandle&& _handle);
+	virtual bool insertHint(Iterator& _hint, const KeyType& _key, const ValueType& _value);
 
 	virtual bool erase(const KeyType& _key);
 	bool erase(Iterator& _iterator);
 
+	int eraseAll(const KeyType& _key);
+
+	NodeHandle extract(const KeyType& _key);
+	NodeHandle extract(Iterator& _iterator);
+	virtual void merge(Tree& _other);
+
 	bool setValue(const KeyType& _key, const ValueType& _value);
 
+	bool buildFromSorted(const std::vector<std::pair<KeyType, ValueType>>& _vector);
+	template<typename Generator>
+	bool buildFromSorted(int _count, Generator&& _next);
+
 	Iterator find(const KeyType& _key);
+	Iterator lower_bound(const KeyType& _key);
+	Iterator upper_bound(const KeyType& _key);
+	std::pair<Iterator, Iterator> equal_range(const KeyType& _key);
+	int count(const KeyType& _key);
+
 	std::vector< std::pair<KeyType, ValueType&> > getVector() const;
 
 	Iterator begin();
@@ -236,17 +602,83 @@ public:
 	Iterator afterEnd();
 
 	void clear();
+
+	//Параллельные версии обхода, getVector и clear для больших деревьев (см. ThreadPool.h).
+	//Function вызывается из нескольких потоков для разных узлов одновременно, дерево в это время менять нельзя.
+	//Pool - ThreadPool; методы шаблонные, чтобы BinaryTrees.h не подключал ThreadPool.h
+	template<typename Function, typename Pool>
+	void parallelForEach(Function&& _function, Pool& _pool);
+	template<typename Result, typename Map, typename Reduce, typename Pool>
+	Result parallelReduce(Result _identity, Map&& _map, Reduce&& _reduce, Pool& _pool);
+	template<typename Pool>
+	std::vector<std::pair<KeyType, ValueType>> parallelGetVector(Pool& _pool) const
+		requires std::default_initializable<KeyType> && std::default_initializable<ValueType>;
+	template<typename Pool>
+	void setParallelPool(Pool* _pool)
+	{
+		parallel_pool = _pool;
+		parallel_clear = &Tree::template clearParallel<Pool>;
+	};
+	void setParallelPool(std::nullptr_t) { parallel_pool = nullptr; };
+
+	//Регистратор времени insert, erase, find и getVector (см. LatencyRecorder.h), nullptr - не замерять.
+	//Замеры есть, только если перед подключением BinaryTrees.h определен макрос TREES_ENABLE_LATENCY.
+	//Регистратор можно разделять между деревьями и потоками, он должен жить дольше дерева
+	void setLatencyRecorder(LatencyRecorder* _recorder)
+	{
+		TREE_LATENCY(latency_recorder = _recorder);
+		(void)_recorder;
+	};
+
+	//Проверяет порядок ключей, связи с родителями, m_size, инварианты вида дерева (баланс AVL, цвета
+	//и черную высоту RB) и что высота не превышает теоретическую границу. Для отладки и тестов: O(n)
+	bool validate() const;
+
+	//Оценка занимаемой деревом памяти, см. TreeMemoryUsage. _ownedBytes(const KeyType&, const ValueType&)
+	//возвращает байты в куче, которыми владеют ключ и значение. Без нее используется ownedHeapBytes
+	//(учитывает std::string). Узлы обходятся, только если ключ или значение не тривиально копируемые
+	template<typename Function>
+	TreeMemoryUsage memoryUsage(Function&& _ownedBytes) const;
+	TreeMemoryUsage memoryUsage() const;
+
+	bool enableCache(int _slots);
+	int cacheSize() const { return static_cast<int>(front_cache.size()); };
+
+	//Снимок счетчиков операций, при выключенном TREES_ENABLE_STATS все счетчики нулевые
+	TreeStats stats() const
+	{
+#ifdef TREES_ENABLE_STATS
+		return m_stats;
+#else
+		return TreeStats();
+#endif
+	};
+	void resetStats() { TREE_STATS(m_stats = TreeStats()); };
 };
 
 template<KEY KeyType, typename ValueType>
 void Tree<KeyType, ValueType>::swapNodes(Node* _node1, Node* _node2)
 {
-	Node temp = *_node1;
-	_node1->key = _node2->key;
-	_node1->value = _node2->value;
+	//После обмена узлы хранят чужие ключи, поэтому слоты кэша, указывающие на них, устаревают
+	forgetNode(_node1);
+	forgetNode(_node2);
+
+	//Меняются только ключи и значения: для тривиально копируемых типов std::swap сводится к копированию байтов,
+	//а строки и контейнеры обмениваются перемещением без выделения памяти
+	using std::swap;
+	swap(_node1->key, _node2->key);
+	swap(_node1->value, _node2->value);
+}
 
-	_node2->key = temp.key;
-	_node2->value = temp.value;
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::selectChild(const Node* _node, bool _right)
+{
+	//Выбор потомка маской вместо _right ? right : left: компиляторы превращают тернарный оператор обратно
+	//в условный переход, а направление спуска по случайным ключам предсказывается в половине случаев
+	std::uintptr_t left = reinterpret_cast<std::uintptr_t>(_node->left);
+	std::uintptr_t right = reinterpret_cast<std::uintptr_t>(_node->right);
+	std::uintptr_t mask = std::uintptr_t(0) - static_cast<std::uintptr_t>(_right);
+	return reinterpret_cast<Node*>(left ^ ((left ^ right) & mask));
 }
 
 template<KEY KeyType, typename ValueType>
@@ -255,78 +687,71 @@ Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::innerFind(const KeyTyp
 	if (!root)
 		return nullptr;
 
-	Node* searchPtr = root;
-	while(true)
+	//Среди одинаковых ключей возвращаем первый по порядку
+	if (allow_duplicates)
 	{
-		if (_key == searchPtr->key)
-			return searchPtr;
-
-		if (_key > searchPtr->key)
-		{
-			if (!searchPtr->right)
-				return nullptr;
+		Node* result = boundNode(_key, false);
+		return (result && result->key == _key) ? result : nullptr;
+	}
 
-			searchPtr = searchPtr->right;
-		}
-		else
+	Node** slot = nullptr;
+	if (!front_cache.empty())
+	{
+		slot = &cacheSlot(_key);
+		TREE_STATS(++m_stats.comparisons);
+		if (*slot && (*slot)->key == _key)
 		{
-			if (!searchPtr->left)
-				return nullptr;
-
-			searchPtr = searchPtr->left;
+			TREE_STATS(++m_stats.cacheHits);
+			return *slot;
 		}
+		TREE_STATS(++m_stats.cacheMisses);
 	}
-}
 
-template<KEY KeyType, typename ValueType>
-bool Tree<KeyType, ValueType>::insert(const KeyType& _key, const ValueType& _value)
-{
-	if (!root)
+	if constexpr (SMALL_KEY)
 	{
-		switch (type)
+		//Ключ держится в регистре, а потомок выбирается без перехода (см. selectChild)
+		const KeyType key = _key;
+		Node* searchPtr = root;
+		TREE_STATS(int depth = 0);
+		while (searchPtr)
 		{
-		case TREE_TYPES::RANDOMIZED:
-			root = new BasicNode<KeyType, ValueType>(_key, _value);
-			break;
-		case TREE_TYPES::AVL:
-			root = new AVLNode<KeyType, ValueType>(_key, _value);
-			break;
-		case TREE_TYPES::RB:
-			root = new RBNode<KeyType, ValueType>(_key, _value);
-			break;
+			TREE_STATS(++m_stats.nodeVisits; ++m_stats.comparisons);
+			if (key == searchPtr->key)
+			{
+				TREE_STATS(recordDepth(depth));
+				if (slot)
+					*slot = searchPtr;
+				return searchPtr;
+			}
+
+			TREE_STATS(++m_stats.comparisons; ++depth);
+			searchPtr = selectChild(searchPtr, searchPtr->key < key);
 		}
 
-		last_added_node = root;
-		++m_size;
-		return true;
+		TREE_STATS(recordDepth(depth));
+		return nullptr;
 	}
 
 	Node* searchPtr = root;
-	while (true)
+	TREE_STATS(int depth = 0);
+	while(true)
 	{
+		TREE_STATS(++m_stats.nodeVisits; ++m_stats.comparisons);
 		if (_key == searchPtr->key)
-			return false;
+		{
+			TREE_STATS(recordDepth(depth));
+			if (slot)
+				*slot = searchPtr;
+			return searchPtr;
+		}
 
+		TREE_STATS(++m_stats.comparisons; ++depth);
 		if (_key > searchPtr->key)
 		{
 			if (!searchPtr->right)
 			{
-				switch (type)
-				{
-				case TREE_TYPES::RANDOMIZED:
-					searchPtr->right = new BasicNode<KeyType, ValueType>(_key, _value, searchPtr);
-					break;
-				case TREE_TYPES::AVL:
-					searchPtr->right = new AVLNode<KeyType, ValueType>(_key, _value, searchPtr);
-					break;
-				case TREE_TYPES::RB:
-					searchPtr->right = new RBNode<KeyType, ValueType>(_key, _value, searchPtr);
-					break;
-				}
-
-				last_added_node = searchPtr->right;
-				++m_size;				
-				return true;
+				TREE_STATS(recordDepth(depth));
+				return nullptr;
 			}
 
 			searchPtr = searchPtr->right;
@@ -335,22 +760,8 @@ bool Tree<KeyType, ValueType>::insert(const KeyType& _key, const ValueType& _val
 		{
 			if (!searchPtr->left)
 			{
-				switch (type)
-				{
-				case TREE_TYPES::RANDOMIZED:
-					searchPtr->left = new BasicNode<KeyType, ValueType>(_key, _value, searchPtr);
-					break;
-				case TREE_TYPES::AVL:
-					searchPtr->left = new AVLNode<KeyType, ValueType>(_key, _value, searchPtr);
-					break;
-				case TREE_TYPES::RB:
-					searchPtr->left = new RBNode<KeyType, ValueType>(_key, _value, searchPtr);
-					break;
-				}
-
-				last_added_node = searchPtr->left;
-				++m_size;
-				return true;
+				TREE_STATS(recordDepth(depth));
+				return nullptr;
 			}
 
 			searchPtr = searchPtr->left;
@@ -359,531 +770,1753 @@ bool Tree<KeyType, ValueType>::insert(const KeyType& _key, const ValueType& _val
 }
 
 template<KEY KeyType, typename ValueType>
-bool Tree<KeyType, ValueType>::insert(const std::pair<KeyType, ValueType>& _pair)
+Tree<KeyType, ValueType>::Node*& Tree<KeyType, ValueType>::cacheSlot(const KeyType& _key)
 {
-	return insert(_pair.first, _pair.second);
+	//Фибоначчиево хэширование: старшие биты произведения перемешаны лучше младших,
+	//поэтому даже тождественный std::hash<int> не собирает соседние ключи в один слот
+	if constexpr (HASHABLE_KEY)
+	{
+		std::uint64_t hash = static_cast<std::uint64_t>(std::hash<KeyType>{}(_key)) * 0x9E3779B97F4A7C15ull;
+		return front_cache[static_cast<std::size_t>(hash >> front_cache_shift)];
+	}
+	else
+		return front_cache.front();	//Не вызывается: enableCache не включает кэш для таких ключей
 }
 
-template <KEY KeyType, typename ValueType>
-bool Tree<KeyType, ValueType>::erase(const KeyType& _key)
+template<KEY KeyType, typename ValueType>
+void Tree<KeyType, ValueType>::forgetNode(Node* _node)
 {
-	Node* nodeToErase = innerFind(_key);
-	
-	if (!nodeToErase)
-		return false;
-
-	//Если у удаляемого узла 2 потомка, ищем самый правый узел левого поддерева
-	//он будет фактически удален
-	if (nodeToErase->left && nodeToErase->right)
-	{
-		Node* newNode = nodeToErase->left;
-		while (newNode->right)
-			newNode = newNode->right;
-
-		//Свапаем ключ и значение узлов
-		swapNodes(nodeToErase, newNode);
-		parent_of_last_erased_node = newNode->parent;
-
-		//Если у удаляемого узла есть левый потомок, переписываем указатели у него и родителя
-		if (newNode->left)
-		{
-			Node* leftChild = newNode->left;
-			leftChild->parent = parent_of_last_erased_node;
-
-			if (parent_of_last_erased_node->right == newNode)
-				parent_of_last_erased_node->right = leftChild;
-			else
-				parent_of_last_erased_node->left = leftChild;
-
-			//Фактически удаляем узел
-			delete newNode;
-			--m_size;
-			return true;
-		}
+	if (front_cache.empty())
+		return;
 
-		//Если левого потомка нет, просто удаляем узел
-		if (parent_of_last_erased_node->right == newNode)
-			parent_of_last_erased_node->right = nullptr;
-		else
-			parent_of_last_erased_node->left = nullptr;
+	Node*& slot = cacheSlot(_node->key);
+	if (slot == _node)
+		slot = nullptr;
+}
 
-		delete newNode;
-		--m_size;
+template<KEY KeyType, typename ValueType>
+bool Tree<KeyType, ValueType>::enableCache(int _slots)
+{
+	//_slots округляется вверх до степени двойки (не меньше 2), 0 выключает кэш. Кэшу нужен std::hash ключа,
+	//а в Multi-деревьях innerFind ищет первый из одинаковых ключей, поэтому там кэш не включается
+	if (_slots <= 0)
+	{
+		front_cache.clear();
+		front_cache.shrink_to_fit();
 		return true;
 	}
 
-	//Если у удаляемого узла есть только один потомок - левый
-	if (nodeToErase->left)
+	if constexpr (!HASHABLE_KEY)
+		return false;
+	else
 	{
-		if (nodeToErase == root)
-		{
-			root = root->left;
-			root->parent = nullptr;
-			parent_of_last_erased_node = root;
-
-			delete nodeToErase;
-			--m_size;
-			return true;
-		}
-		
-		parent_of_last_erased_node = nodeToErase->parent;
-		Node* leftChild = nodeToErase->left;
-		leftChild->parent = parent_of_last_erased_node;
-		
-		if (parent_of_last_erased_node->right == nodeToErase)
-			parent_of_last_erased_node->right = leftChild;
-		else
-			parent_of_last_erased_node->left = leftChild;
+		if (allow_duplicates)
+			return false;
 
-		delete nodeToErase;
-		--m_size;
+		unsigned slots = std::bit_ceil(static_cast<unsigned>(std::max(_slots, 2)));
+		front_cache.assign(slots, nullptr);
+		front_cache_shift = 64 - std::countr_zero(slots);
 		return true;
 	}
+}
 
-	//Если у удаляемого узла есть только один потомок - правый
-	if (nodeToErase->right)
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::boundNode(const KeyType& _key, bool _upper)
+{
+	//Возвращает первый узел с ключом не меньше (_upper = false) или больше (_upper = true) _key.
+	//После поворотов одинаковые ключи могут оказаться по обе стороны от узла,
+	//поэтому спуск не останавливается на равном ключе
+	Node* result = nullptr;
+	Node* searchPtr = root;
+	TREE_STATS(int depth = 0);
+	while (searchPtr)
 	{
-		if (nodeToErase == root)
+		TREE_STATS(++m_stats.nodeVisits; ++m_stats.comparisons; ++depth);
+		bool toLeft = _upper ? (_key < searchPtr->key) : !(searchPtr->key < _key);
+		if (toLeft)
 		{
-			root = root->right;
-			root->parent = nullptr;
-			parent_of_last_erased_node = root;
-
-			delete nodeToErase;
-			--m_size;
-			return true;
+			result = searchPtr;
+			searchPtr = searchPtr->left;
 		}
-
-		parent_of_last_erased_node = nodeToErase->parent;
-		Node* rightChild = nodeToErase->right;
-		rightChild->parent = parent_of_last_erased_node;
-
-		if (parent_of_last_erased_node->right == nodeToErase)
-			parent_of_last_erased_node->right = rightChild;
 		else
-			parent_of_last_erased_node->left = rightChild;
-
-		delete nodeToErase;
-		--m_size;
-		return true;
+			searchPtr = searchPtr->right;
 	}
 
-	//Если потомков не было вообще
-	parent_of_last_erased_node = nodeToErase->parent;
-	
-	if (parent_of_last_erased_node)
+	TREE_STATS(recordDepth(depth));
+	return result;
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::nextNode(Node* _node)
+{
+	//Если узел имеет правое поддерево, то следующий узел - самый левый узел этого поддерева
+	if (_node->right)
 	{
+		Node* searchPtr = _node->right;
+		while (searchPtr->left)
+			searchPtr = searchPtr->left;
 
-		if (parent_of_last_erased_node->right == nodeToErase)
-			parent_of_last_erased_node->right = nullptr;
-		else
-			parent_of_last_erased_node->left = nullptr;
+		return searchPtr;
 	}
-	else
-		root = nullptr;
 
-	delete nodeToErase;
-	--m_size;
-	return true;
+	//Иначе поднимаемся, пока узел является правым ребенком своего родителя
+	Node* searchPtr = _node;
+	while (searchPtr->parent && searchPtr->parent->right == searchPtr)
+		searchPtr = searchPtr->parent;
+
+	return searchPtr->parent;
 }
 
 template<KEY KeyType, typename ValueType>
-bool Tree<KeyType, ValueType>::erase(Iterator& _iterator)
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::previousNode(Node* _node)
 {
-	KeyType _key = (*_iterator).first;
-	_iterator = { nullptr, nullptr };
+	if (_node->left)
+	{
+		Node* searchPtr = _node->left;
+		while (searchPtr->right)
+			searchPtr = searchPtr->right;
 
-	return erase(_key);
-}
+		return searchPtr;
+	}
+
+	Node* searchPtr = _node;
+	while (searchPtr->parent && searchPtr->parent->left == searchPtr)
+		searchPtr = searchPtr->parent;
+
+	return searchPtr->parent;
+}
 
 template<KEY KeyType, typename ValueType>
-bool Tree<KeyType, ValueType>::setValue(const KeyType& _key, const ValueType& _value)
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::createNode(const KeyType& _key, const ValueType& _value,
+	Node* _parent)
 {
-	Node* result = innerFind(_key);
-	if (!result)
-		return false;
+	TREE_STATS(++m_stats.allocations);
 
-	result->value = _value;
-	return true;
+	//Выделяем память в соответствии с типом дерева
+	switch (type)
+	{
+	case TREE_TYPES::AVL:
+		return new AVLNode<KeyType, ValueType>(_key, _value, _parent);
+	case TREE_TYPES::RB:
+		return new RBNode<KeyType, ValueType>(_key, _value, _parent);
+	case TREE_TYPES::LRU:
+		return new LRUNode<KeyType, ValueType>(_key, _value, _parent);
+	default:
+		return new BasicNode<KeyType, ValueType>(_key, _value, _parent);
+	}
 }
 
 template<KEY KeyType, typename ValueType>
-Tree<KeyType, ValueType>::Iterator Tree<KeyType, ValueType>::find(const KeyType& _key)
+void Tree<KeyType, ValueType>::destroyNode(Node* _node, TREE_TYPES _type)
 {
-	Node* result = innerFind(_key);
-	if (!result)
-		return afterEnd();
+	//Деструкторы таких узлов ничего не делают, поэтому память возвращается без разбора вида узла
+	if constexpr (TRIVIAL_NODES)
+	{
+		::operator delete(static_cast<void*>(_node));
+		return;
+	}
 
-	return { result, this };
+	//Деструктор не виртуальный, поэтому удаляем узел через его настоящий тип
+	switch (nodeKind(_type))
+	{
+	case TREE_TYPES::AVL:
+		delete static_cast<AVLNode<KeyType, ValueType>*>(_node);
+		break;
+	case TREE_TYPES::RB:
+		delete static_cast<RBNode<KeyType, ValueType>*>(_node);
+		break;
+	case TREE_TYPES::LRU:
+		delete static_cast<LRUNode<KeyType, ValueType>*>(_node);
+		break;
+	default:
+		delete _node;
+		break;
+	}
 }
 
 template<KEY KeyType, typename ValueType>
-std::vector< std::pair<KeyType, ValueType&> > Tree<KeyType, ValueType>::getVector() const
+void Tree<KeyType, ValueType>::deleteNode(Node* _node)
 {
-	std::vector< std::pair<KeyType, ValueType&> > vector;
-	vector.reserve(m_size);
-	std::stack<Node*> stack;
-	stack.push(root);
+	TREE_STATS(++m_stats.deallocations);
+	destroyNode(_node, type);
+}
 
-	Node* searchPtr = root->left;
-	while (!stack.empty() || searchPtr)
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::cloneNode(const Node* _node, Node* _parent, TREE_TYPES _type)
+{
+	switch (_type)
 	{
-		while (searchPtr)
-		{
-			stack.push(searchPtr);
-			searchPtr = searchPtr->left;
-		}
+	case TREE_TYPES::AVL:
+	{
+		auto* copy = new AVLNode<KeyType, ValueType>(_node->key, _node->value, _parent);
+		copy->balance = static_cast<const AVLNode<KeyType, ValueType>*>(_node)->balance;
+		return copy;
+	}
+	case TREE_TYPES::RB:
+	{
+		auto* copy = new RBNode<KeyType, ValueType>(_node->key, _node->value, _parent);
+		copy->color = static_cast<const RBNode<KeyType, ValueType>*>(_node)->color;
+		return copy;
+	}
+	case TREE_TYPES::LRU:
+	{
+		auto* source = static_cast<const LRUNode<KeyType, ValueType>*>(_node);
+		auto* copy = new LRUNode<KeyType, ValueType>(_node->key, _node->value, _parent);
+		copy->color = source->color;
+		copy->expiry = source->expiry;
+		return copy;
+	}
+	default:
+		return new BasicNode<KeyType, ValueType>(_node->key, _node->value, _parent);
+	}
+}
 
-		searchPtr = stack.top();
-		stack.pop();
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::cloneSubtree(const Node* _root, TREE_TYPES _type)
+{
+	//Прямой обход без стека сразу по двум деревьям: спускаемся к еще не скопированному ребенку,
+	//а когда скопированы оба, поднимаемся к родителю
+	Node* copyRoot = cloneNode(_root, nullptr, _type);
 
-		vector.push_back({ searchPtr->key, searchPtr->value });
-		searchPtr = searchPtr->right;
+	const Node* source = _root;
+	Node* copy = copyRoot;
+	while (true)
+	{
+		if (source->left && !copy->left)
+		{
+			copy->left = cloneNode(source->left, copy, _type);
+			source = source->left;
+			copy = copy->left;
+		}
+		else if (source->right && !copy->right)
+		{
+			copy->right = cloneNode(source->right, copy, _type);
+			source = source->right;
+			copy = copy->right;
+		}
+		else if (source == _root)
+			return copyRoot;
+		else
+		{
+			source = source->parent;
+			copy = copy->parent;
+		}
 	}
-
-	return vector;
 }
 
 template<KEY KeyType, typename ValueType>
-Tree<KeyType, ValueType>::Iterator  Tree<KeyType, ValueType>::begin()
+void Tree<KeyType, ValueType>::copyFrom(const Tree& _other)
 {
-	if (!root)
-		return { nullptr, nullptr };
-
-	Node* searchPtr = root;
-	while (searchPtr->left)
-		searchPtr = searchPtr->left;
+	//Дерево пустое и того же вида, что _other: скопированные баланс и цвета остаются верными
+	if (_other.root)
+		root = cloneSubtree(_other.root, type);
+
+	m_size = _other.m_size;
+	last_added_node = nullptr;
+	parent_of_last_erased_node = nullptr;
+	TREE_STATS(m_stats.allocations += m_size);
+}
 
-	return { searchPtr, this };
+template<KEY KeyType, typename ValueType>
+void Tree<KeyType, ValueType>::moveFrom(Tree& _other)
+{
+	//Кэш указывает на узлы _other и переходит вместе с ними, _other получает пустой кэш этого дерева
+	root = _other.root;
+	m_size = _other.m_size;
+	last_added_node = _other.last_added_node;
+	parent_of_last_erased_node = nullptr;
+	std::swap(front_cache, _other.front_cache);
+	std::swap(front_cache_shift, _other.front_cache_shift);
+
+	_other.root = nullptr;
+	_other.m_size = 0;
+	_other.last_added_node = nullptr;
+	_other.parent_of_last_erased_node = nullptr;
 }
 
 template<KEY KeyType, typename ValueType>
-Tree<KeyType, ValueType>::Iterator  Tree<KeyType, ValueType>::beforeBegin()
+Tree<KeyType, ValueType>::Tree(const Tree& _other) : Tree()
 {
-	if (!root)
-		return { nullptr, nullptr };
+	type = _other.type;
+	allow_duplicates = _other.allow_duplicates;
+	parallel_pool = _other.parallel_pool;
+	parallel_clear = _other.parallel_clear;
+	TREE_LATENCY(latency_recorder = _other.latency_recorder);
+	front_cache.assign(_other.front_cache.size(), nullptr);
+	front_cache_shift = _other.front_cache_shift;
+
+	copyFrom(_other);
+}
 
-	Node* searchPtr = root;
-	while (searchPtr->left)
-		searchPtr = searchPtr->left;
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Tree(Tree&& _other) noexcept : Tree()
+{
+	type = _other.type;
+	allow_duplicates = _other.allow_duplicates;
+	parallel_pool = _other.parallel_pool;
+	parallel_clear = _other.parallel_clear;
+	TREE_LATENCY(latency_recorder = _other.latency_recorder);
 
-	return { searchPtr - 1, this };
+	moveFrom(_other);
 }
 
 template<KEY KeyType, typename ValueType>
-Tree<KeyType, ValueType>::Iterator  Tree<KeyType, ValueType>::end() 
+Tree<KeyType, ValueType>& Tree<KeyType, ValueType>::operator=(const Tree& _other)
 {
-	if (!root)
-		return { nullptr, nullptr };
+	if (this == &_other)
+		return *this;
 
-	Node* searchPtr = root;
-	while (searchPtr->right)
-		searchPtr = searchPtr->right;
+	clear();
+	if (sameKind(_other))
+	{
+		copyFrom(_other);
+		copyFixup(_other);
+		return *this;
+	}
 
-	return { searchPtr, this };
+	//Присваивание дерева другого вида через ссылку на Tree: чужая форма может нарушать правила
+	//этого дерева, поэтому элементы добавляются по одному
+	if (_other.root)
+	{
+		for (const auto& pair : _other.getVector())
+			insert(pair.first, pair.second);
+	}
+	return *this;
 }
 
 template<KEY KeyType, typename ValueType>
-Tree<KeyType, ValueType>::Iterator  Tree<KeyType, ValueType>::afterEnd() 
+Tree<KeyType, ValueType>& Tree<KeyType, ValueType>::operator=(Tree&& _other)
 {
-	if (!root)
-		return { nullptr, nullptr };
+	if (this == &_other)
+		return *this;
 
-	Node* searchPtr = root;
-	while (searchPtr->right)
-		searchPtr = searchPtr->right;
+	//Узлы другого вида забрать нельзя, такое дерево копируется и не изменяется
+	if (!sameKind(_other))
+		return *this = static_cast<const Tree&>(_other);
 
-	return { searchPtr + 1, this };
+	clear();
+	moveFrom(_other);
+	moveFixup(_other);
+	return *this;
 }
 
 template<KEY KeyType, typename ValueType>
-void Tree<KeyType, ValueType>::clear()
+bool Tree<KeyType, ValueType>::validate() const
 {
 	if (!root)
-		return;
-
-	std::stack<Node*> stack;
-	stack.push(root);
+		return m_size == 0;
+	if (root->parent)
+		return false;
 
-	Node* searchPtr = root->left;
-	Node* deletePtr;
+	//Обратный обход с явным стеком: выродившееся дерево может иметь глубину порядка n.
+	//Сводки детей лежат на вершине summaries: сначала левого, затем правого
+	std::vector<std::pair<Node*, bool>> stack;
+	std::vector<Subtree> summaries;
+	stack.push_back({ root, false });
+	const Subtree empty = { nullptr, nullptr, 0, 0, 1 };
 
-	while (!stack.empty() || searchPtr)
+	while (!stack.empty())
 	{
-		while (searchPtr)
+		auto [node, expanded] = stack.back();
+		stack.pop_back();
+
+		if (!expanded)
 		{
-			stack.push(searchPtr);
-			searchPtr = searchPtr->left;
+			stack.push_back({ node, true });
+			for (Node* child : { node->right, node->left })
+			{
+				if (!child)
+					continue;
+				if (child->parent != node)
+					return false;
+				stack.push_back({ child, false });
+			}
+			continue;
 		}
 
-		searchPtr = deletePtr = stack.top();
-		stack.pop();
-		searchPtr = searchPtr->right;
-
-		delete deletePtr;
-		--m_size;
-	}
-
-	root = nullptr;
-}
+		Subtree right = empty;
+		Subtree left = empty;
+		if (node->right)
+		{
+			right = summaries.back();
+			summaries.pop_back();
+		}
+		if (node->left)
+		{
+			left = summaries.back();
+			summaries.pop_back();
+		}
 
-//------------------------------------------------------------------------------------------------------
-//--------------------------------------------- CLASS TREE ---------------------------------------------
-//------------------------------------------------- END ------------------------------------------------
+		//Одинаковые ключи допустимы только в Multi-деревьях
+		if (left.last && (node->key < left.last->key || (!allow_duplicates && node->key == left.last->key)))
+			return false;
+		if (right.first && (right.first->key < node->key || (!allow_duplicates && node->key == right.first->key)))
+			return false;
 
+		Subtree result;
+		result.first = left.first ? left.first : node;
+		result.last = right.last ? right.last : node;
+		result.size = left.size + right.size + 1;
+		result.height = std::max(left.height, right.height) + 1;
+		result.blackHeight = 1;
+		if (!validateNode(node, left, right, result))
+			return false;
 
+		summaries.push_back(result);
+	}
 
-//------------------------------------------------------------------------------------------------------
-//-------------------------------------------- CLASS AVLTREE -------------------------------------------
-//------------------------------------------------ BEGIN -----------------------------------------------
+	return summaries.back().size == m_size && summaries.back().height <= heightBound();
+}
 
 template<KEY KeyType, typename ValueType>
-class AVLTree : public Tree<KeyType, ValueType>
+std::size_t Tree<KeyType, ValueType>::nodeSize(TREE_TYPES _type)
 {
-	using Node = BasicNode<KeyType, ValueType>;
-	using Tree<KeyType, ValueType>::type;
-	using Tree<KeyType, ValueType>::root;
-	using Tree<KeyType, ValueType>::m_size;
-	using Tree<KeyType, ValueType>::last_added_node;		
-	using Tree<KeyType, ValueType>::parent_of_last_erased_node;
-
-//Protected members:
-protected:
-	void calculateHeight(Node* _node);
-	void updateHeight(Node* _node);
-	void getSubTreesHeight(Node* _node, short& lheight, short& rheight);
-
-	void leftRotate(Node* _node);
-	void rightRotate(Node* _node);
-	void balance(Node* _node);
-
-//Public members:
-public:
-	AVLTree()
-	{
-		type = TREE_TYPES::AVL;
-		m_size = 0;
-		root = nullptr;
-		last_added_node = nullptr;
-		parent_of_last_erased_node = nullptr;
-	};
-	AVLTree(const KeyType& _key, const ValueType& _value)
-	{
-		type = TREE_TYPES::AVL;
-		root = new AVLNode<KeyType, ValueType>(_key, _value);
-		m_size = 1;
-		last_added_node = root;
-		parent_of_last_erased_node = nullptr;
-	}
-	AVLTree(const std::pair<KeyType, ValueType>& _pair) : AVLTree(_pair.first, _pair.second) {};
-	AVLTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : AVLTree()
+	switch (nodeKind(_type))
 	{
-		for (const auto& pair : _vector)
-			this->insert(pair);
-		parent_of_last_erased_node = nullptr;
+	case TREE_TYPES::AVL:
+		return sizeof(AVLNode<KeyType, ValueType>);
+	case TREE_TYPES::RB:
+		return sizeof(RBNode<KeyType, ValueType>);
+	case TREE_TYPES::LRU:
+		return sizeof(LRUNode<KeyType, ValueType>);
+	default:
+		return sizeof(BasicNode<KeyType, ValueType>);
 	}
-	
-	virtual ~AVLTree() {};
-
-	virtual bool insert(const KeyType& _key, const ValueType& _value) override;
-	virtual bool erase(const KeyType& _key) override;
-
-};
+}
 
 template<KEY KeyType, typename ValueType>
-void AVLTree<KeyType, ValueType>::calculateHeight(Node* _node)
+TreeMemoryUsage Tree<KeyType, ValueType>::structureUsage() const
 {
-	short lheight = -1, rheight = -1;
-	getSubTreesHeight(_node, lheight, rheight);
-
-	_node->setHeight(std::max(lheight, rheight) + 1);
+	TreeMemoryUsage usage;
+	usage.nodes = m_size;
+	usage.nodeSize = static_cast<long long>(nodeSize(type));
+	usage.nodeAllocation = static_cast<long long>(mallocBlockSize(nodeSize(type)));
+	usage.auxiliaryBytes = static_cast<long long>(auxiliaryBytes());
+	return usage;
 }
 
 template<KEY KeyType, typename ValueType>
-void AVLTree<KeyType, ValueType>::updateHeight(Node* _node)
+template<typename Function>
+TreeMemoryUsage Tree<KeyType, ValueType>::memoryUsage(Function&& _ownedBytes) const
 {
-	while (_node)
+	TreeMemoryUsage usage = structureUsage();
+	if (root)
 	{
-		calculateHeight(_node);
-		_node = _node->parent;
+		forEachInSubtree(root, [&](Node* _node)
+		{
+			usage.ownedBytes += static_cast<long long>(_ownedBytes(static_cast<const KeyType&>(_node->key),
+				static_cast<const ValueType&>(_node->value)));
+		});
 	}
+	return usage;
 }
 
 template<KEY KeyType, typename ValueType>
-void AVLTree<KeyType, ValueType>::getSubTreesHeight(Node* _node, short& lheight, short& rheight)
+TreeMemoryUsage Tree<KeyType, ValueType>::memoryUsage() const
 {
-	if (!_node)
-		return;
-
-	if (_node->left)
-		lheight = _node->left->getHeight();
-	if (_node->right)
-		rheight = _node->right->getHeight();
+	if constexpr (std::is_trivially_copyable_v<KeyType> && std::is_trivially_copyable_v<ValueType>)
+		return structureUsage();
+	else
+		return memoryUsage([](const KeyType& _key, const ValueType& _value)
+		{
+			return ownedHeapBytes(_key) + ownedHeapBytes(_value);
+		});
 }
 
 template<KEY KeyType, typename ValueType>
-void AVLTree<KeyType, ValueType>::leftRotate(Node* _node)
+void Tree<KeyType, ValueType>::resetNode(Node* _node)
 {
-	Node* parentOfNode = _node->parent;
-	Node* rightChild = _node->right;
+	//Узел становится листом: сбрасываем связи и служебные поля, оставшиеся от прежнего дерева
+	_node->left = _node->right = nullptr;
 
-	short lheight = -1, rheight = -1;
-	getSubTreesHeight(rightChild, lheight, rheight);
-
-	//Если высота левого поддерева правого ребенка больше высоты его правого поддерева
-	//делаем большой левый поворот
-	if (lheight > rheight)
+	switch (type)
 	{
-		rightRotate(rightChild);
-		leftRotate(_node);
-		return;
+	case TREE_TYPES::AVL:
+		static_cast<AVLNode<KeyType, ValueType>*>(_node)->balance = 0;
+		break;
+	//Связи списков LRUNode сбрасывает LRUTree::unlinkNode, время истечения переходит вместе с узлом
+	case TREE_TYPES::RB:
+	case TREE_TYPES::LRU:
+		static_cast<RBNode<KeyType, ValueType>*>(_node)->color = NODE_COLORS::RED;
+		break;
+	default:
+		break;
 	}
+}
 
-	//В противном случае совершаем простой левый поворот
-	_node->right = rightChild->left;
-	if (_node->right)
-		_node->right->parent = _node;
-	calculateHeight(_node);
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::linkBalanced(std::vector<Node*>& _nodes, int _first, int _last,
+	Node* _parent, int _depth, int _redDepth)
+{
+	if (_first > _last)
+		return nullptr;
 
-	rightChild->left = _node;
-	_node->parent = rightChild;
-	calculateHeight(rightChild);
+	//Корнем поддерева становится средний узел диапазона, поэтому глубины листьев
+	//отличаются не больше чем на 1
+	int middle = _first + (_last - _first) / 2;
+	Node* node = _nodes[middle];
 
-	if (!parentOfNode)
+	node->parent = _parent;
+	node->left = linkBalanced(_nodes, _first, middle - 1, node, _depth + 1, _redDepth);
+	node->right = linkBalanced(_nodes, middle + 1, _last, node, _depth + 1, _redDepth);
+
+	switch (type)
 	{
-		root = rightChild;
-		root->parent = nullptr;
-		return;
+	//Высота такого поддерева однозначно определяется его размером,
+	//поэтому показатель баланса - разность высот правой и левой половин
+	case TREE_TYPES::AVL:
+		static_cast<AVLNode<KeyType, ValueType>*>(node)->balance =
+			static_cast<signed char>(std::bit_width(static_cast<unsigned>(_last - middle)) -
+				std::bit_width(static_cast<unsigned>(middle - _first)));
+		break;
+	//Все полные уровни черные, а узлы неполного нижнего уровня красные:
+	//тогда на любом пути от корня одинаковое количество черных узлов
+	case TREE_TYPES::RB:
+	case TREE_TYPES::LRU:
+		static_cast<RBNode<KeyType, ValueType>*>(node)->color =
+			(_depth == _redDepth) ? NODE_COLORS::RED : NODE_COLORS::BLACK;
+		break;
+	default:
+		break;
 	}
 
-	if (parentOfNode->right == _node)
-		parentOfNode->right = rightChild;
-	else
-		parentOfNode->left = rightChild;
-
-	rightChild->parent = parentOfNode;
-	updateHeight(parentOfNode);
+	return node;
 }
 
 template<KEY KeyType, typename ValueType>
-void AVLTree<KeyType, ValueType>::rightRotate(Node* _node)
+bool Tree<KeyType, ValueType>::findInsertPosition(const KeyType& _key, Node*& _parent, bool& _right)
 {
-	Node* parentOfNode = _node->parent;
-	Node* leftChild = _node->left;
+	//Возвращает false, если ключ уже есть в дереве. Иначе в _parent записывает будущего родителя
+	//нового узла (nullptr для пустого дерева), а в _right - с какой стороны от него встать
+	_parent = nullptr;
+	_right = false;
 
-	short lheight = -1, rheight = -1;
-	getSubTreesHeight(leftChild, lheight, rheight);
-
-	//Если высота левого поддерева правого ребенка больше высоты его правого поддерева
-	//делаем большой левый поворот
-	if (rheight > lheight)
+	Node* searchPtr = root;
+	TREE_STATS(int depth = 0);
+	while (searchPtr)
 	{
-		leftRotate(leftChild);
-		rightRotate(_node);
-		return;
-	}
-	
-	//В противном случаем делаем простой правый поворот
-	_node->left = leftChild->right;
-	if (_node->left)
-		_node->left->parent = _node;
-	calculateHeight(_node);
-
-	leftChild->right = _node;
-	_node->parent = leftChild;
-	calculateHeight(leftChild);
+		TREE_STATS(++m_stats.nodeVisits; ++m_stats.comparisons);
+		if (!allow_duplicates && _key == searchPtr->key)
+		{
+			TREE_STATS(recordDepth(depth));
+			return false;
+		}
 
-	if (!parentOfNode)
-	{
-		root = leftChild;
-		root->parent = nullptr;
-		return;
+		//Равный ключ (возможен только в Multi-деревьях) уходит вправо,
+		//поэтому одинаковые ключи сохраняют порядок добавления
+		TREE_STATS(++m_stats.comparisons; ++depth);
+		_parent = searchPtr;
+		_right = !(_key < searchPtr->key);
+		searchPtr = selectChild(searchPtr, _right);
 	}
 
-	if (parentOfNode->right == _node)
-		parentOfNode->right = leftChild;
+	TREE_STATS(if (_parent) recordDepth(depth));
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+void Tree<KeyType, ValueType>::attachNode(Node* _node, Node* _parent, bool _right)
+{
+	_node->parent = _parent;
+	if (!_parent)
+		root = _node;
 	else
-		parentOfNode->left = leftChild;
+		_parent->child(_right) = _node;
 
-	leftChild->parent = parentOfNode;
-	updateHeight(parentOfNode);
+	last_added_node = _node;
+	++m_size;
+
+	//AVLTree и RBTree восстанавливают баланс от нового узла
+	insertFixup(_node);
 }
-	
+
 template<KEY KeyType, typename ValueType>
-void AVLTree<KeyType, ValueType>::balance(Node* _node)
+bool Tree<KeyType, ValueType>::insert(const KeyType& _key, const ValueType& _value)
 {
-	while (_node)
-	{
-		short lheight = -1;
-		short rheight = -1;
-		getSubTreesHeight(_node, lheight, rheight);
+	TREE_LATENCY(LatencyScope latency(latency_recorder, TREE_OPERATIONS::INSERT, statsSink()));
 
-		// Если поддерево перегружено влево
-		if ((rheight)-(lheight) <= -2)
-		{
-			rightRotate(_node);
-			return;
-		}
-		
-		// Если поддерево перегружено вправо
-		if ((rheight)-(lheight) >= 2)
-		{
-			leftRotate(_node);
-			return;
-		}
+	Node* parent;
+	bool right;
+	if (!findInsertPosition(_key, parent, right))
+		return false;
 
-		_node = _node->parent;
-	}
+	attachNode(createNode(_key, _value, parent), parent, right);
+	return true;
 }
 
 template<KEY KeyType, typename ValueType>
-bool AVLTree<KeyType, ValueType>::insert(const KeyType& _key, const ValueType& _value)
+bool Tree<KeyType, ValueType>::insert(NodeHandle&& _handle)
 {
-	auto result = Tree<KeyType, ValueType>::insert(_key, _value);
-	if (!result)
+	if (!_handle.pointerToNode)
 		return false;
 
-	//Если у добавленного узла нет родителя, значит он был корнем
-	if (!last_added_node->parent)
-		return true;
+	//Узел другого вида (например, AVLNode в RB дереве) вставить нельзя - копируем ключ и значение
+	if (nodeKind(_handle.nodeType) != nodeKind(type))
+	{
+		if (!insert(_handle.pointerToNode->key, _handle.pointerToNode->value))
+			return false;
 
-	//Если у родительского узла стало 2 ребенка, 
-	//значит высота не изменилась и балансировка не нужна
-	if (last_added_node->parent->left && last_added_node->parent->right) 
+		_handle = NodeHandle();
 		return true;
+	}
 
-	updateHeight(last_added_node);
-	balance(last_added_node->parent);
+	//При неудаче узел остается в handle
+	Node* node = _handle.pointerToNode;
+	Node* parent;
+	bool right;
+	if (!findInsertPosition(node->key, parent, right))
+		return false;
 
+	resetNode(node);
+	_handle.pointerToNode = nullptr;
+	attachNode(node, parent, right);
 	return true;
 }
 
 template<KEY KeyType, typename ValueType>
-bool AVLTree<KeyType, ValueType>::erase(const KeyType& _key)
+bool Tree<KeyType, ValueType>::insertHint(Iterator& _hint, const KeyType& _key, const ValueType& _value)
 {
-	bool result = Tree<KeyType, ValueType>::erase(_key);
-	if (!result)
-		return false;
+	//Подсказка - узел, за которым должен встать ключ, например предыдущий ключ отсортированной серии.
+	//Если ключ лежит строго между подсказкой и следующим за ней узлом, новый узел подвешивается без спуска
+	//от корня: правым ребенком подсказки, а если это место занято - левым ребенком следующего узла
+	//(он самый левый в правом поддереве подсказки). Иначе выполняется обычная вставка.
+	//В случае успеха _hint переводится на новый узел
+	Node* hint = _hint.pointerToNode;
+	Node* parent = nullptr;
+	bool right = false;
+	bool hinted = false;
+
+	if (hint && _hint.pointerToOwner == this && !(_hint == beforeBegin()))
+	{
+		TREE_STATS(++m_stats.comparisons);
+		if (hint->key < _key)
+		{
+			Node* next = nextNode(hint);
+			TREE_STATS(if (next) ++m_stats.comparisons);
+			if (!next || _key < next->key)
+			{
+				right = !hint->right;
+				parent = right ? hint : next;
+				hinted = true;
+			}
+		}
+	}
 
-	if (!parent_of_last_erased_node)
-		return true;
+	if (!hinted && !findInsertPosition(_key, parent, right))
+		return false;
 
-	updateHeight(parent_of_last_erased_node);
-	balance(parent_of_last_erased_node);
+	Node* node = createNode(_key, _value, parent);
+	attachNode(node, parent, right);
+	_hint = Iterator(node, this);
 	return true;
 }
 
-//------------------------------------------------------------------------------------------------------
-//-------------------------------------------- CLASS AVLTREE -------------------------------------------
-//------------------------------------------------- END ------------------------------------------------
+template<KEY KeyType, typename ValueType>
+bool Tree<KeyType, ValueType>::insert(const std::pair<KeyType, ValueType>& _pair)
+{
+	return insert(_pair.first, _pair.second);
+}
+
+template <KEY KeyType, typename ValueType>
+bool Tree<KeyType, ValueType>::erase(const KeyType& _key)
+{
+	TREE_LATENCY(LatencyScope latency(latency_recorder, TREE_OPERATIONS::ERASE, statsSink()));
+
+	Node* nodeToErase = innerFind(_key);
+	
+	if (!nodeToErase)
+		return false;
+
+	deleteNode(unlinkNode(nodeToErase));
+	return true;
+}
+
+template <KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Node* Tree<KeyType, ValueType>::unlinkNode(Node* _node)
+{
+	Node* nodeToErase = _node;
+
+	//Если у удаляемого узла 2 потомка, ищем самый правый узел левого поддерева
+	//он будет фактически удален
+	if (nodeToErase->left && nodeToErase->right)
+	{
+		Node* newNode = nodeToErase->left;
+		while (newNode->right)
+			newNode = newNode->right;
+
+		//Свапаем ключ и значение узлов
+		swapNodes(nodeToErase, newNode);
+		nodeToErase = newNode;
+	}
+
+	//Узел покидает дерево (удаляется или извлекается в NodeHandle), слот кэша на него не должен указывать
+	forgetNode(nodeToErase);
+
+	//Теперь у удаляемого узла не больше одного потомка, он занимает место удаляемого узла
+	Node* child = (nodeToErase->left) ? nodeToErase->left : nodeToErase->right;
+	parent_of_last_erased_node = nodeToErase->parent;
+
+	if (child)
+		child->parent = parent_of_last_erased_node;
+
+	if (!parent_of_last_erased_node)
+		root = child;
+	else if (parent_of_last_erased_node->left == nodeToErase)
+	{
+		parent_of_last_erased_node->left = child;
+		last_erased_was_left = true;
+	}
+	else
+	{
+		parent_of_last_erased_node->right = child;
+		last_erased_was_left = false;
+	}
+
+	nodeToErase->parent = nodeToErase->left = nodeToErase->right = nullptr;
+	--m_size;
+	return nodeToErase;
+}
+
+template<KEY KeyType, typename ValueType>
+bool Tree<KeyType, ValueType>::erase(Iterator& _iterator)
+{
+	if (!_iterator.pointerToNode || _iterator.pointerToOwner != this ||
+		_iterator == beforeBegin() || _iterator == afterEnd())
+		return false;
+
+	//Удаляем именно тот узел, на который указывает итератор - среди одинаковых ключей это важно
+	Node* nodeToErase = _iterator.pointerToNode;
+	_iterator = { nullptr, nullptr };
+
+	deleteNode(unlinkNode(nodeToErase));
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+int Tree<KeyType, ValueType>::eraseAll(const KeyType& _key)
+{
+	int erased = 0;
+	while (Node* nodeToErase = innerFind(_key))
+	{
+		deleteNode(unlinkNode(nodeToErase));
+		++erased;
+	}
+
+	return erased;
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::NodeHandle Tree<KeyType, ValueType>::extract(const KeyType& _key)
+{
+	Node* node = innerFind(_key);
+	if (!node)
+		return NodeHandle();
+
+	//unlinkNode может отцепить другой узел, переложив в него ключ и значение, поэтому
+	//handle получает именно возвращенный узел
+	return NodeHandle(unlinkNode(node), type);
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::NodeHandle Tree<KeyType, ValueType>::extract(Iterator& _iterator)
+{
+	if (!_iterator.pointerToNode || _iterator.pointerToOwner != this ||
+		_iterator == beforeBegin() || _iterator == afterEnd())
+		return NodeHandle();
+
+	Node* node = _iterator.pointerToNode;
+	_iterator = { nullptr, nullptr };
+
+	return NodeHandle(unlinkNode(node), type);
+}
+
+template<KEY KeyType, typename ValueType>
+void Tree<KeyType, ValueType>::merge(Tree& _other)
+{
+	if (&_other == this || !_other.root)
+		return;
+
+	//Переносим узлы _other по порядку. Узлы, ключи которых уже есть в дереве, остаются в _other.
+	//unlinkNode может переложить в текущий узел ключ предшественника, который уже пройден
+	//и остался в _other, поэтому следующий узел запоминаем до извлечения
+	Node* node = _other.root;
+	while (node->left)
+		node = node->left;
+
+	while (node)
+	{
+		Node* next = nextNode(node);
+
+		Node* parent;
+		bool right;
+		if (findInsertPosition(node->key, parent, right))
+		{
+			Node* extracted = _other.unlinkNode(node);
+
+			if (nodeKind(_other.type) == nodeKind(type))
+			{
+				resetNode(extracted);
+				attachNode(extracted, parent, right);
+			}
+			else
+			{
+				attachNode(createNode(extracted->key, extracted->value, parent), parent, right);
+				_other.deleteNode(extracted);
+			}
+		}
+
+		node = next;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+bool Tree<KeyType, ValueType>::setValue(const KeyType& _key, const ValueType& _value)
+{
+	Node* result = innerFind(_key);
+	if (!result)
+		return false;
+
+	result->value = _value;
+	accessFixup(result);
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+bool Tree<KeyType, ValueType>::buildFromSorted(const std::vector<std::pair<KeyType, ValueType>>& _vector)
+{
+	int index = 0;
+	return buildFromSorted(static_cast<int>(_vector.size()),
+		[&]() -> const std::pair<KeyType, ValueType>& { return _vector[index++]; });
+}
+
+template<KEY KeyType, typename ValueType>
+template<typename Generator>
+bool Tree<KeyType, ValueType>::buildFromSorted(int _count, Generator&& _next)
+{
+	std::vector<Node*> nodes;
+	nodes.reserve(_count);
+
+	for (int i = 0; i < _count; ++i)
+	{
+		const auto& pair = _next();
+
+		//Ключи должны строго возрастать (в Multi-деревьях - не убывать), иначе прерываем построение
+		if (i && (pair.first < nodes.back()->key || (!allow_duplicates && pair.first == nodes.back()->key)))
+		{
+			for (Node* node : nodes)
+				deleteNode(node);
+			return false;
+		}
+
+		nodes.push_back(createNode(pair.first, pair.second));
+	}
+
+	clear();
+
+	//Узлы глубины _redDepth образуют неполный нижний уровень
+	int redDepth = std::bit_width(static_cast<unsigned>(_count) + 1) - 1;
+	root = linkBalanced(nodes, 0, _count - 1, nullptr, 0, redDepth);
+
+	m_size = _count;
+	last_added_node = nullptr;
+	parent_of_last_erased_node = nullptr;
+	buildFixup();
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Iterator Tree<KeyType, ValueType>::find(const KeyType& _key)
+{
+	TREE_LATENCY(LatencyScope latency(latency_recorder, TREE_OPERATIONS::FIND, statsSink()));
+
+	Node* result = innerFind(_key);
+	if (!result)
+		return afterEnd();
+
+	accessFixup(result);
+	return { result, this };
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Iterator Tree<KeyType, ValueType>::lower_bound(const KeyType& _key)
+{
+	Node* result = boundNode(_key, false);
+	if (!result)
+		return afterEnd();
+
+	return { result, this };
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Iterator Tree<KeyType, ValueType>::upper_bound(const KeyType& _key)
+{
+	Node* result = boundNode(_key, true);
+	if (!result)
+		return afterEnd();
+
+	return { result, this };
+}
+
+template<KEY KeyType, typename ValueType>
+std::pair<typename Tree<KeyType, ValueType>::Iterator, typename Tree<KeyType, ValueType>::Iterator>
+	Tree<KeyType, ValueType>::equal_range(const KeyType& _key)
+{
+	return { lower_bound(_key), upper_bound(_key) };
+}
+
+template<KEY KeyType, typename ValueType>
+int Tree<KeyType, ValueType>::count(const KeyType& _key)
+{
+	if (!allow_duplicates)
+		return innerFind(_key) ? 1 : 0;
+
+	int result = 0;
+	for (Node* node = boundNode(_key, false); node && node->key == _key; node = nextNode(node))
+		++result;
+
+	return result;
+}
+
+template<KEY KeyType, typename ValueType>
+std::vector< std::pair<KeyType, ValueType&> > Tree<KeyType, ValueType>::getVector() const
+{
+	TREE_LATENCY(LatencyScope latency(latency_recorder, TREE_OPERATIONS::ITERATION, statsSink()));
+
+	std::vector< std::pair<KeyType, ValueType&> > vector;
+	vector.reserve(m_size);
+	std::stack<Node*> stack;
+	stack.push(root);
+
+	Node* searchPtr = root->left;
+	while (!stack.empty() || searchPtr)
+	{
+		while (searchPtr)
+		{
+			stack.push(searchPtr);
+			searchPtr = searchPtr->left;
+		}
+
+		searchPtr = stack.top();
+		stack.pop();
+
+		vector.push_back({ searchPtr->key, searchPtr->value });
+		searchPtr = searchPtr->right;
+	}
+
+	return vector;
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Iterator  Tree<KeyType, ValueType>::begin()
+{
+	if (!root)
+		return { nullptr, this };
+
+	Node* searchPtr = root;
+	while (searchPtr->left)
+		searchPtr = searchPtr->left;
+
+	return { searchPtr, this };
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Iterator  Tree<KeyType, ValueType>::beforeBegin()
+{
+	if (!root)
+		return { nullptr, this };
+
+	//Метка, которая не совпадает ни с одним узлом. Она никогда не разыменовывается,
+	//а ее получение не требует спуска по дереву
+	return { reinterpret_cast<Node*>(&root), this };
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Iterator  Tree<KeyType, ValueType>::end() 
+{
+	if (!root)
+		return { nullptr, this };
+
+	Node* searchPtr = root;
+	while (searchPtr->right)
+		searchPtr = searchPtr->right;
+
+	return { searchPtr, this };
+}
+
+template<KEY KeyType, typename ValueType>
+Tree<KeyType, ValueType>::Iterator  Tree<KeyType, ValueType>::afterEnd() 
+{
+	return { nullptr, this };
+}
+
+template<KEY KeyType, typename ValueType>
+void Tree<KeyType, ValueType>::clear()
+{
+	if (root)
+	{
+		//Обход без стека; для тривиально разрушаемых ключей и значений destroyNode только возвращает память
+		if (parallel_pool && m_size >= PARALLEL_MIN_SIZE)
+			(this->*parallel_clear)(*parallel_pool);
+		else
+			destroySubtree(root, type);
+
+		TREE_STATS(m_stats.deallocations += m_size);
+		m_size = 0;
+		root = nullptr;
+		std::fill(front_cache.begin(), front_cache.end(), nullptr);
+	}
+
+	//В деструкторе Tree вызывается версия базового класса: наследник к этому моменту уже разрушен
+	clearFixup();
+}
+
+template<KEY KeyType, typename ValueType>
+std::vector<typename Tree<KeyType, ValueType>::Part> Tree<KeyType, ValueType>::splitParts(int _threads) const
+{
+	//Части идут в порядке обхода: поддеревья и узлы над ними чередуются так же, как ключи
+	std::vector<Part> parts;
+	if (!root)
+		return parts;
+
+	int depth = (m_size < PARALLEL_MIN_SIZE) ? 0 : std::bit_width(static_cast<unsigned>(4 * (_threads + 1)));
+	splitParts(root, depth, parts);
+	return parts;
+}
+
+template<KEY KeyType, typename ValueType>
+void Tree<KeyType, ValueType>::splitParts(Node* _node, int _depth, std::vector<Part>& _parts)
+{
+	if (!_node)
+		return;
+
+	if (_depth == 0)
+	{
+		_parts.push_back({ _node, true });
+		return;
+	}
+
+	splitParts(_node->left, _depth - 1, _parts);
+	_parts.push_back({ _node, false });
+	splitParts(_node->right, _depth - 1, _parts);
+}
+
+template<KEY KeyType, typename ValueType>
+template<typename Function>
+void Tree<KeyType, ValueType>::forEachInSubtree(Node* _root, Function&& _function)
+{
+	//Обход со стеком, как в getVector: он не поднимается по ссылкам на родителей и заметно быстрее nextNode
+	std::vector<Node*> stack;
+	Node* searchPtr = _root;
+	while (!stack.empty() || searchPtr)
+	{
+		while (searchPtr)
+		{
+			stack.push_back(searchPtr);
+			searchPtr = searchPtr->left;
+		}
+
+		searchPtr = stack.back();
+		stack.pop_back();
+
+		_function(searchPtr);
+		searchPtr = searchPtr->right;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+void Tree<KeyType, ValueType>::destroySubtree(Node* _root, TREE_TYPES _type)
+{
+	//Обратный обход без стека: лист удаляется, а ссылка на него у родителя обнуляется.
+	//Узлы выше _root не изменяются, поэтому соседние поддеревья можно удалять параллельно
+	Node* node = _root;
+	while (true)
+	{
+		if (node->left)
+		{
+			node = node->left;
+			continue;
+		}
+		if (node->right)
+		{
+			node = node->right;
+			continue;
+		}
+
+		if (node == _root)
+		{
+			destroyNode(node, _type);
+			return;
+		}
+
+		Node* parent = node->parent;
+		parent->child(parent->right == node) = nullptr;
+		destroyNode(node, _type);
+		node = parent;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+template<typename Pool>
+void Tree<KeyType, ValueType>::clearParallel(Pool& _pool)
+{
+	std::vector<Part> parts = splitParts(_pool.threadCount());
+	_pool.parallelFor(static_cast<int>(parts.size()), [&](int _index)
+	{
+		if (parts[_index].subtree)
+			destroySubtree(parts[_index].node, type);
+	});
+
+	for (const Part& part : parts)
+	{
+		if (!part.subtree)
+			destroyNode(part.node, type);
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+template<typename Function, typename Pool>
+void Tree<KeyType, ValueType>::parallelForEach(Function&& _function, Pool& _pool)
+{
+	//Вызывает _function(const KeyType&, ValueType&) для каждого узла, порядок вызовов не определен
+	std::vector<Part> parts = splitParts(_pool.threadCount());
+	_pool.parallelFor(static_cast<int>(parts.size()), [&](int _index)
+	{
+		auto visit = [&](Node* _node) { _function(static_cast<const KeyType&>(_node->key), _node->value); };
+		if (parts[_index].subtree)
+			forEachInSubtree(parts[_index].node, visit);
+		else
+			visit(parts[_index].node);
+	});
+}
+
+template<KEY KeyType, typename ValueType>
+template<typename Result, typename Map, typename Reduce, typename Pool>
+Result Tree<KeyType, ValueType>::parallelReduce(Result _identity, Map&& _map, Reduce&& _reduce, Pool& _pool)
+{
+	//Свертка _reduce(Result, Result) значений _map(const KeyType&, ValueType&). Частичные результаты
+	//сворачиваются в порядке ключей, поэтому _reduce должна быть ассоциативной, но может быть не коммутативной
+	std::vector<Part> parts = splitParts(_pool.threadCount());
+	std::vector<Result> results(parts.size(), _identity);
+	_pool.parallelFor(static_cast<int>(parts.size()), [&](int _index)
+	{
+		Result& result = results[_index];
+		auto visit = [&](Node* _node)
+		{
+			result = _reduce(std::move(result), _map(static_cast<const KeyType&>(_node->key), _node->value));
+		};
+
+		if (parts[_index].subtree)
+			forEachInSubtree(parts[_index].node, visit);
+		else
+			visit(parts[_index].node);
+	});
+
+	Result total = std::move(_identity);
+	for (Result& result : results)
+		total = _reduce(std::move(total), std::move(result));
+
+	return total;
+}
+
+template<KEY KeyType, typename ValueType>
+template<typename Pool>
+std::vector<std::pair<KeyType, ValueType>> Tree<KeyType, ValueType>::parallelGetVector(Pool& _pool) const
+	requires std::default_initializable<KeyType> && std::default_initializable<ValueType>
+{
+	//В отличие от getVector возвращает копии значений: пары со ссылками нельзя создать заранее.
+	//Каждая часть собирается в свой вектор, размеры частей (размеры поддеревьев) задают их диапазоны
+	//в заранее созданном результате, и части переносятся туда параллельно. Второй обход дерева ради
+	//подсчета размеров обходится дороже этого переноса
+	std::vector<Part> parts = splitParts(_pool.threadCount());
+	std::vector<std::vector<std::pair<KeyType, ValueType>>> pieces(parts.size());
+	_pool.parallelFor(static_cast<int>(parts.size()), [&](int _index)
+	{
+		auto visit = [&](Node* _node) { pieces[_index].emplace_back(_node->key, _node->value); };
+		if (parts[_index].subtree)
+			forEachInSubtree(parts[_index].node, visit);
+		else
+			visit(parts[_index].node);
+	});
+
+	std::vector<int> offsets(parts.size() + 1, 0);
+	for (std::size_t i = 0; i < parts.size(); ++i)
+		offsets[i + 1] = offsets[i] + static_cast<int>(pieces[i].size());
+
+	std::vector<std::pair<KeyType, ValueType>> vector(m_size);
+	_pool.parallelFor(static_cast<int>(parts.size()), [&](int _index)
+	{
+		std::move(pieces[_index].begin(), pieces[_index].end(), vector.begin() + offsets[_index]);
+		std::vector<std::pair<KeyType, ValueType>>().swap(pieces[_index]);
+	});
+
+	return vector;
+}
+
+//------------------------------------------------------------------------------------------------------
+//--------------------------------------------- CLASS TREE ---------------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+
+
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------- CLASSES AVLBALANCER, RBBALANCER ----------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Балансировка AVL и RB деревьев не зависит ни от ключа, ни от того, кто владеет узлами: она работает
+//с любыми узлами со связями parent, left, right и методом child(bool). Ею пользуются AVLTree и RBTree
+//(узлы AVLNode и RBNode) и интрузивные деревья из IntrusiveTree.h (крючки внутри объектов пользователя).
+//NodeTraits дает доступ к служебному полю узла: static signed char& balance(Node*) для AVL,
+//static NODE_COLORS& color(Node*) для RB. Балансировщик хранит ссылку на корень дерева
+//и указатель на его счетчики (nullptr - счетчики не собираются), создается на время операции.
+
+template<typename Node, typename NodeTraits>
+class AVLBalancer
+{
+//Private members:
+private:
+	Node*& root;
+	TreeStats* stats;
+
+	void replaceChild(Node* _parent, Node* _oldChild, Node* _newChild);
+
+//Public members:
+public:
+	AVLBalancer(Node*& _root, TreeStats* _stats) : root(_root), stats(_stats) {};
+
+	Node* leftRotate(Node* _node);
+	Node* rightRotate(Node* _node);
+	Node* balance(Node* _node);
+
+	void insertRetrace(Node* _node);
+	void eraseRetrace(Node* _parent, bool _fromLeft);
+};
+
+template<typename Node, typename NodeTraits>
+void AVLBalancer<Node, NodeTraits>::replaceChild(Node* _parent, Node* _oldChild, Node* _newChild)
+{
+	_newChild->parent = _parent;
+
+	if (!_parent)
+		root = _newChild;
+	else if (_parent->left == _oldChild)
+		_parent->left = _newChild;
+	else
+		_parent->right = _newChild;
+}
+
+template<typename Node, typename NodeTraits>
+Node* AVLBalancer<Node, NodeTraits>::leftRotate(Node* _node)
+{
+	TREE_STATS(if (stats) ++stats->leftRotations);
+
+	Node* rightChild = _node->right;
+
+	_node->right = rightChild->left;
+	if (_node->right)
+		_node->right->parent = _node;
+
+	replaceChild(_node->parent, _node, rightChild);
+	rightChild->left = _node;
+	_node->parent = rightChild;
+
+	//Пересчитываем показатели баланса по старым значениям, не обращаясь к поддеревьям
+	signed char& nodeBalance = NodeTraits::balance(_node);
+	signed char& childBalance = NodeTraits::balance(rightChild);
+	nodeBalance = nodeBalance - 1 - std::max<signed char>(childBalance, 0);
+	childBalance = childBalance - 1 + std::min<signed char>(nodeBalance, 0);
+
+	return rightChild;
+}
+
+template<typename Node, typename NodeTraits>
+Node* AVLBalancer<Node, NodeTraits>::rightRotate(Node* _node)
+{
+	TREE_STATS(if (stats) ++stats->rightRotations);
+
+	Node* leftChild = _node->left;
+
+	_node->left = leftChild->right;
+	if (_node->left)
+		_node->left->parent = _node;
+
+	replaceChild(_node->parent, _node, leftChild);
+	leftChild->right = _node;
+	_node->parent = leftChild;
+
+	signed char& nodeBalance = NodeTraits::balance(_node);
+	signed char& childBalance = NodeTraits::balance(leftChild);
+	nodeBalance = nodeBalance + 1 - std::min<signed char>(childBalance, 0);
+	childBalance = childBalance + 1 + std::max<signed char>(nodeBalance, 0);
+
+	return leftChild;
+}
+	
+template<typename Node, typename NodeTraits>
+Node* AVLBalancer<Node, NodeTraits>::balance(Node* _node)
+{
+	// Если поддерево перегружено вправо
+	if (NodeTraits::balance(_node) > 0)
+	{
+		//Если правый ребенок перегружен влево, делаем большой левый поворот
+		if (NodeTraits::balance(_node->right) < 0)
+		{
+			TREE_STATS(if (stats) ++stats->doubleRotations);
+			rightRotate(_node->right);
+		}
+
+		return leftRotate(_node);
+	}
+
+	// Если поддерево перегружено влево
+	if (NodeTraits::balance(_node->left) > 0)
+	{
+		TREE_STATS(if (stats) ++stats->doubleRotations);
+		leftRotate(_node->left);
+	}
+
+	return rightRotate(_node);
+}
+
+template<typename Node, typename NodeTraits>
+void AVLBalancer<Node, NodeTraits>::insertRetrace(Node* _node)
+{
+	//Поднимаемся от добавленного узла, пока высота очередного поддерева растет
+	Node* child = _node;
+	Node* parent = _node->parent;
+	while (parent)
+	{
+		TREE_STATS(if (stats) ++stats->balanceUpdates);
+
+		signed char& parentBalance = NodeTraits::balance(parent);
+		parentBalance += (child == parent->left) ? -1 : 1;
+
+		//Поддерево выровнялось - его высота не изменилась
+		if (parentBalance == 0)
+			return;
+
+		//После поворота высота поддерева становится прежней
+		if (parentBalance == 2 || parentBalance == -2)
+		{
+			balance(parent);
+			return;
+		}
+
+		child = parent;
+		parent = parent->parent;
+	}
+}
+
+template<typename Node, typename NodeTraits>
+void AVLBalancer<Node, NodeTraits>::eraseRetrace(Node* _parent, bool _fromLeft)
+{
+	//Поднимаемся от родителя удаленного узла, пока высота очередного поддерева уменьшается
+	Node* parent = _parent;
+	while (parent)
+	{
+		TREE_STATS(if (stats) ++stats->balanceUpdates);
+
+		signed char& parentBalance = NodeTraits::balance(parent);
+		parentBalance += _fromLeft ? 1 : -1;
+
+		//Поддерево было выровнено - его высота не изменилась
+		if (parentBalance == 1 || parentBalance == -1)
+			return;
+
+		Node* subtree = parent;
+		if (parentBalance == 2 || parentBalance == -2)
+		{
+			//Если брат был выровнен, после поворота высота поддерева прежняя
+			Node* brother = (parentBalance > 0) ? parent->right : parent->left;
+			bool brotherBalanced = NodeTraits::balance(brother) == 0;
+
+			subtree = balance(parent);
+			if (brotherBalanced)
+				return;
+		}
+
+		parent = subtree->parent;
+		if (parent)
+			_fromLeft = (parent->left == subtree);
+	}
+}
+
+template<typename Node, typename NodeTraits>
+class RBBalancer
+{
+//Private members:
+private:
+	Node*& root;
+	TreeStats* stats;
+
+//Public members:
+public:
+	RBBalancer(Node*& _root, TreeStats* _stats) : root(_root), stats(_stats) {};
+
+	//Отсутствующий ребенок считается черным
+	static NODE_COLORS colorOf(Node* _node) { return _node ? NodeTraits::color(_node) : NODE_COLORS::BLACK; };
+
+	void paint(Node* _node, NODE_COLORS _color)
+	{
+		TREE_STATS(if (stats) ++stats->recolorings);
+		NodeTraits::color(_node) = _color;
+	};
+
+	Node* rotate(Node* _node, bool _right);
+
+	void insertBalance(Node* _node);
+	void eraseBalance(Node* _parent, bool _right);
+};
+
+template<typename Node, typename NodeTraits>
+Node* RBBalancer<Node, NodeTraits>::rotate(Node* _node, bool _right)
+{
+	//При правом повороте поднимается левый ребенок, при левом - правый
+	TREE_STATS(if (stats) _right ? ++stats->rightRotations : ++stats->leftRotations);
+	Node* parentOfNode = _node->parent;
+	Node* pivot = _node->child(!_right);
+
+	_node->child(!_right) = pivot->child(_right);
+	if (pivot->child(_right))
+		pivot->child(_right)->parent = _node;
+
+	pivot->child(_right) = _node;
+	_node->parent = pivot;
+	pivot->parent = parentOfNode;
+
+	if (!parentOfNode)
+		root = pivot;
+	else
+		parentOfNode->child(parentOfNode->right == _node) = pivot;
+
+	return pivot;
+}
+
+template<typename Node, typename NodeTraits>
+void RBBalancer<Node, NodeTraits>::insertBalance(Node* _node)
+{
+	Node* node = _node;
+	Node* father = node->parent;
+
+	//Нарушение возможно только пока отец красный. Красный отец не может быть корнем,
+	//поэтому дед всегда существует
+	while (father && colorOf(father) == NODE_COLORS::RED)
+	{
+		Node* grandFather = father->parent;
+		bool fatherSide = (grandFather->right == father);
+		Node* uncle = grandFather->child(!fatherSide);
+
+		//Если дядя красный, перекрашиваем отца и дядю в черный, деда в красный
+		//и продолжаем балансировку для деда
+		if (colorOf(uncle) == NODE_COLORS::RED)
+		{
+			paint(father, NODE_COLORS::BLACK);
+			paint(uncle, NODE_COLORS::BLACK);
+			paint(grandFather, NODE_COLORS::RED);
+
+			node = grandFather;
+			father = node->parent;
+			continue;
+		}
+
+		//Если узел и его отец лежат на разных сторонах отностиельно своих родителей,
+		//поворачиваем вокруг отца, после чего они меняются ролями
+		if (node == father->child(!fatherSide))
+		{
+			rotate(father, fatherSide);
+			node = father;
+			father = node->parent;
+		}
+
+		//Узел и отец на одной стороне: перекрашиваем и поворачиваем вокруг деда, балансировка завершена
+		paint(father, NODE_COLORS::BLACK);
+		paint(grandFather, NODE_COLORS::RED);
+		rotate(grandFather, !fatherSide);
+		return;
+	}
+
+	//Если перекрашивание дошло до корня, он должен остаться черным
+	if (colorOf(root) == NODE_COLORS::RED)
+		paint(root, NODE_COLORS::BLACK);
+}
+
+template<typename Node, typename NodeTraits>
+void RBBalancer<Node, NodeTraits>::eraseBalance(Node* _parent, bool _right)
+{
+	//На стороне _right узла father не хватает одного черного узла. Брат существует всегда,
+	//т.к. до удаления черная высота с его стороны была не меньше 1
+	Node* father = _parent;
+	bool side = _right;
+
+	while (true)
+	{
+		Node* brother = father->child(!side);
+
+		//Если брат красный, красим брата в черный, а отца в красный и поворачиваем вокруг отца
+		//в сторону недостающего узла. Новым братом становится черный племянник
+		if (colorOf(brother) == NODE_COLORS::RED)
+		{
+			paint(brother, NODE_COLORS::BLACK);
+			paint(father, NODE_COLORS::RED);
+			rotate(father, side);
+			brother = father->child(!side);
+		}
+
+		Node* farNephew = brother->child(!side);
+		Node* nearNephew = brother->child(side);
+
+		//Если оба племянника черные, красим брата в красный. Красный отец достаточно перекрасить
+		//в черный, иначе недостаток черного поднимается к деду
+		if (colorOf(farNephew) == NODE_COLORS::BLACK && colorOf(nearNephew) == NODE_COLORS::BLACK)
+		{
+			paint(brother, NODE_COLORS::RED);
+
+			if (colorOf(father) == NODE_COLORS::RED)
+			{
+				paint(father, NODE_COLORS::BLACK);
+				return;
+			}
+
+			Node* grandFather = father->parent;
+			if (!grandFather)
+				return;
+
+			side = (grandFather->right == father);
+			father = grandFather;
+			continue;
+		}
+
+		//Если дальний племянник черный, а ближний красный, поворачиваем вокруг брата,
+		//чтобы красным стал дальний племянник
+		if (colorOf(farNephew) == NODE_COLORS::BLACK)
+		{
+			paint(nearNephew, NODE_COLORS::BLACK);
+			paint(brother, NODE_COLORS::RED);
+			rotate(brother, !side);
+
+			farNephew = brother;
+			brother = nearNephew;
+		}
+
+		//Дальний племянник красный: брат получает цвет отца, отец и племянник становятся черными,
+		//после поворота вокруг отца черная высота восстановлена
+		paint(brother, colorOf(father));
+		paint(father, NODE_COLORS::BLACK);
+		paint(farNephew, NODE_COLORS::BLACK);
+		rotate(father, side);
+		return;
+	}
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------- CLASSES AVLBALANCER, RBBALANCER ----------------------------------
+//------------------------------------------------- END ------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------- CLASS AVLTREE -------------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+template<KEY KeyType, typename ValueType>
+class AVLTree : public Tree<KeyType, ValueType>
+{
+	using Node = BasicNode<KeyType, ValueType>;
+	using Tree<KeyType, ValueType>::type;
+	using Tree<KeyType, ValueType>::root;
+	using Tree<KeyType, ValueType>::m_size;
+	using Tree<KeyType, ValueType>::last_added_node;		
+	using Tree<KeyType, ValueType>::parent_of_last_erased_node;
+	using Tree<KeyType, ValueType>::last_erased_was_left;
+
+//Protected members:
+protected:
+	//Все узлы AVL дерева имеют тип AVLNode
+	struct NodeTraits
+	{
+		static signed char& balance(Node* _node) { return static_cast<AVLNode<KeyType, ValueType>*>(_node)->balance; };
+	};
+
+	AVLBalancer<Node, NodeTraits> balancer() { return AVLBalancer<Node, NodeTraits>(root, this->statsSink()); };
+
+	virtual void insertFixup(Node* _node) override { balancer().insertRetrace(_node); };
+	virtual Node* unlinkNode(Node* _node) override;
+
+	using Subtree = typename Tree<KeyType, ValueType>::Subtree;
+	virtual bool validateNode(Node* _node, const Subtree& _left, const Subtree& _right, Subtree& /*_result*/) const override
+	{
+		int balance = _right.height - _left.height;
+		return balance >= -1 && balance <= 1 && NodeTraits::balance(_node) == balance;
+	};
+	//Высота AVL дерева из n узлов меньше 1.4405 * log2(n + 2) - 0.3277
+	virtual int heightBound() const override
+	{
+		return static_cast<int>(1.4405 * std::log2(m_size + 2.0) - 0.3277);
+	};
+
+//Public members:
+public:
+	AVLTree()
+	{
+		type = TREE_TYPES::AVL;
+		m_size = 0;
+		root = nullptr;
+		last_added_node = nullptr;
+		parent_of_last_erased_node = nullptr;
+	};
+	AVLTree(const KeyType& _key, const ValueType& _value)
+	{
+		type = TREE_TYPES::AVL;
+		root = new AVLNode<KeyType, ValueType>(_key, _value);
+		m_size = 1;
+		last_added_node = root;
+		parent_of_last_erased_node = nullptr;
+	}
+	AVLTree(const std::pair<KeyType, ValueType>& _pair) : AVLTree(_pair.first, _pair.second) {};
+	AVLTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : AVLTree()
+	{
+		if (this->buildFromSorted(_vector))
+			return;
+
+		for (const auto& pair : _vector)
+			this->insert(pair);
+		parent_of_last_erased_node = nullptr;
+	}
+};
+
+template<KEY KeyType, typename ValueType>
+AVLTree<KeyType, ValueType>::Node* AVLTree<KeyType, ValueType>::unlinkNode(Node* _node)
+{
+	Node* erasedNode = Tree<KeyType, ValueType>::unlinkNode(_node);
+
+	if (parent_of_last_erased_node)
+		balancer().eraseRetrace(parent_of_last_erased_node, last_erased_was_left);
+
+	return erasedNode;
+}
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------- CLASS AVLTREE -------------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+
+
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------- CLASS RBTREE --------------------------------------------
+//----------------------------------------------- BEGIN ------------------------------------------------
+template<KEY KeyType, typename ValueType>
+class RBTree : public Tree<KeyType, ValueType>
+{
+	using Node = BasicNode<KeyType, ValueType>;
+
+//Protected members:
+protected:
+	//Открыты наследникам (LRUTree)
+	using Tree<KeyType, ValueType>::type;
+	using Tree<KeyType, ValueType>::root;
+	using Tree<KeyType, ValueType>::m_size;
+	using Tree<KeyType, ValueType>::last_added_node;
+	using Tree<KeyType, ValueType>::parent_of_last_erased_node;
+	using Tree<KeyType, ValueType>::last_erased_was_left;
+
+	//Все узлы RB дерева имеют тип RBNode
+	struct NodeTraits
+	{
+		static NODE_COLORS& color(Node* _node) { return static_cast<RBNode<KeyType, ValueType>*>(_node)->color; };
+	};
+
+	using Balancer = RBBalancer<Node, NodeTraits>;
+	Balancer balancer() { return Balancer(root, this->statsSink()); };
+
+	virtual void insertFixup(Node* _node) override { balancer().insertBalance(_node); };
+	virtual Node* unlinkNode(Node* _node) override;
+
+	//Корень черный, у красного узла черные дети, черная высота поддеревьев одинакова
+	using Subtree = typename Tree<KeyType, ValueType>::Subtree;
+	virtual bool validateNode(Node* _node, const Subtree& _left, const Subtree& _right, Subtree& _result) const override
+	{
+		NODE_COLORS color = Balancer::colorOf(_node);
+		if (_left.blackHeight != _right.blackHeight)
+			return false;
+		if (color == NODE_COLORS::RED && (!_node->parent || Balancer::colorOf(_node->left) == NODE_COLORS::RED ||
+			Balancer::colorOf(_node->right) == NODE_COLORS::RED))
+			return false;
+
+		_result.blackHeight = _left.blackHeight + (color == NODE_COLORS::BLACK);
+		return true;
+	};
+	//Высота RB дерева из n узлов не больше 2 * log2(n + 1)
+	virtual int heightBound() const override { return static_cast<int>(2.0 * std::log2(m_size + 1.0)); };
+
+//Public members:
+public:
+	RBTree() { 
+		type = TREE_TYPES::RB;
+		m_size = 0;
+		root = nullptr;
+		last_added_node = nullptr;
+		parent_of_last_erased_node = nullptr;
+	};
+	RBTree(const KeyType& _key, const ValueType& _value)
+	{
+		type = TREE_TYPES::RB;
+		root = new RBNode<KeyType, ValueType>(_key, _value);
+		static_cast<RBNode<KeyType, ValueType>*>(root)->color = NODE_COLORS::BLACK;
+		m_size = 1;
+		last_added_node = root;
+		parent_of_last_erased_node = nullptr;
+	}
+	RBTree(const std::pair<KeyType, ValueType>& _pair) : RBTree(_pair.first, _pair.second) {};
+	RBTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : RBTree()
+	{
+		if (this->buildFromSorted(_vector))
+			return;
+
+		for (const auto& pair : _vector)
+			this->insert(pair);
+		parent_of_last_erased_node = nullptr;
+	}
+};
+
+template<KEY KeyType, typename ValueType>
+RBTree<KeyType, ValueType>::Node* RBTree<KeyType, ValueType>::unlinkNode(Node* _node)
+{
+	//swapNodes меняет только ключ и значение, поэтому цвет у фактически удаляемого узла свой
+	Node* erasedNode = Tree<KeyType, ValueType>::unlinkNode(_node);
+
+	//Удаление красного узла не меняет черную высоту
+	if (Balancer::colorOf(erasedNode) == NODE_COLORS::RED)
+		return erasedNode;
+
+	bool side = !last_erased_was_left;
+	Node* child = parent_of_last_erased_node ? parent_of_last_erased_node->child(side) : root;
+
+	//Занявшего место узла красного ребенка достаточно перекрасить в черный
+	if (Balancer::colorOf(child) == NODE_COLORS::RED)
+		balancer().paint(child, NODE_COLORS::BLACK);
+	else if (parent_of_last_erased_node)
+		balancer().eraseBalance(parent_of_last_erased_node, side);
 
+	return erasedNode;
+}
 
 
 //------------------------------------------------------------------------------------------------------
 //-------------------------------------------- CLASS RBTREE --------------------------------------------
+//------------------------------------------------ END -------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CLASS SPLAYTREE ------------------------------------------
 //----------------------------------------------- BEGIN ------------------------------------------------
+
+enum class SPLAY_MODES
+{
+	FULL,	//Узел поднимается до корня
+	SEMI	//Полурасширение: в случае zig-zig поворачивается только отец, путь сокращается вдвое
+};
+
+//Самонастраивающееся дерево: найденный или добавленный узел поднимается к корню,
+//поэтому часто запрашиваемые ключи оказываются близко к корню.
+//Узлы не хранят служебных полей и имеют тип BasicNode
 template<KEY KeyType, typename ValueType>
-class RBTree : public Tree<KeyType, ValueType>
+class SplayTree : public Tree<KeyType, ValueType>
 {
 	using Node = BasicNode<KeyType, ValueType>;
 	using Tree<KeyType, ValueType>::type;
@@ -894,525 +2527,1023 @@ class RBTree : public Tree<KeyType, ValueType>
 
 //Protected members:
 protected:
+	SPLAY_MODES splay_mode;
+	int splay_period;
+	int access_count;
 
-	struct structForInsertBalance
-	{
-		Node* father; Node* grand_father; Node* uncle;
-		char f_color; char gf_color; char u_color;
-		char node_side; char father_side;
-
-		structForInsertBalance(Node* _node)
-		{
-			setNode(_node);
-		}
-
-		void setNode(Node* _node)
-		{
-			father = _node->parent;
-			f_color = father->getColor();
+	void rotateUp(Node* _node);
+	void splay(Node* _node);
 
-			if (_node == father->right)
-				node_side = 'R';
-			else node_side = 'L';
+	virtual void insertFixup(Node* _node) override { splay(_node); };
+	virtual void accessFixup(Node* _node) override;
+	virtual Node* unlinkNode(Node* _node) override;
 
-			grand_father = father->parent;
-			gf_color = grand_father->getColor();
+//Public members:
+public:
+	SplayTree()
+	{
+		type = TREE_TYPES::SPLAY;
+		m_size = 0;
+		root = nullptr;
+		last_added_node = nullptr;
+		parent_of_last_erased_node = nullptr;
+		splay_mode = SPLAY_MODES::FULL;
+		splay_period = 1;
+		access_count = 0;
+	};
+	SplayTree(const KeyType& _key, const ValueType& _value) : SplayTree()
+	{
+		this->insert(_key, _value);
+	};
+	SplayTree(const std::pair<KeyType, ValueType>& _pair) : SplayTree(_pair.first, _pair.second) {};
+	SplayTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : SplayTree()
+	{
+		if (this->buildFromSorted(_vector))
+			return;
 
-			if (father == grand_father->right)
-			{
-				father_side = 'R';
-				uncle = grand_father->left;
-			}
-			else
-			{
-				father_side = 'L';
-				uncle = grand_father->right;
-			}
+		for (const auto& pair : _vector)
+			this->insert(pair);
+		parent_of_last_erased_node = nullptr;
+	};
 
-			if (uncle)
-				u_color = uncle->getColor();
-			else
-				u_color = 'B';
-		}
+	//Режим расширения при поиске. _period > 1 - узел поднимается только при каждом _period-м
+	//успешном поиске (find, setValue), что уменьшает количество записей в узлы для чтения.
+	//Добавленные узлы поднимаются всегда
+	void setSplayMode(SPLAY_MODES _mode, int _period = 1)
+	{
+		splay_mode = _mode;
+		splay_period = (_period > 0) ? _period : 1;
+		access_count = 0;
 	};
+};
+
+template<KEY KeyType, typename ValueType>
+void SplayTree<KeyType, ValueType>::rotateUp(Node* _node)
+{
+	//Поворот, поднимающий _node на место его отца
+	Node* father = _node->parent;
+	Node* grandFather = father->parent;
+	bool side = (father->right == _node);
+	TREE_STATS(side ? ++this->m_stats.leftRotations : ++this->m_stats.rightRotations);
+
+	father->child(side) = _node->child(!side);
+	if (father->child(side))
+		father->child(side)->parent = father;
+
+	_node->child(!side) = father;
+	father->parent = _node;
+	_node->parent = grandFather;
+
+	if (!grandFather)
+		root = _node;
+	else
+		grandFather->child(grandFather->right == father) = _node;
+}
 
-	struct structForEraseBalance
+template<KEY KeyType, typename ValueType>
+void SplayTree<KeyType, ValueType>::splay(Node* _node)
+{
+	Node* node = _node;
+	while (node->parent)
 	{
-		Node* father; Node* brother; Node* new_node;
-		char node_color; char b_color; char node_side; char child_count;
-		char left_nephew_color; char right_nephew_color;
+		Node* father = node->parent;
+		Node* grandFather = father->parent;
 
-		structForEraseBalance() {};
-		structForEraseBalance(Node* _node)
+		//Отец - корень: простой поворот (zig). При полурасширении не выполняется
+		if (!grandFather)
 		{
-			setNode(_node);
+			if (splay_mode == SPLAY_MODES::FULL)
+				rotateUp(node);
+			return;
 		}
 
-		void setNode(Node* _node)
+		//Узел и отец на одной стороне (zig-zig): сначала поворачиваем отца
+		if ((grandFather->right == father) == (father->right == node))
 		{
-			father = _node->parent;
-			node_color = _node->getColor();
-			if (_node == father->right)
-			{
-				node_side = 'R';
-				brother = father->left;
-			}
-			else
-			{
-				node_side = 'L';
-				brother = father->right;
-			}
+			rotateUp(father);
 
-			if (brother)
-			{
-				b_color = brother->getColor();
-				if (brother->right)
-					right_nephew_color = brother->right->getColor();
-				else
-					right_nephew_color = 'B';
-
-				if (brother->left)
-					left_nephew_color = brother->left->getColor();
-				else
-					left_nephew_color = 'B';
-			}
-			else
-				b_color = left_nephew_color = right_nephew_color = 'B';
-			
-			if (_node->right)
-			{
-				child_count = 1;
-				new_node = _node->right;
-			}
-			else if (_node->left)
-			{
-				child_count = 1;
-				new_node = _node->left;
-			}
-			else
+			//При полурасширении узел остается под отцом, продолжаем с отца
+			if (splay_mode == SPLAY_MODES::SEMI)
 			{
-				child_count = 0;
-				new_node = nullptr;
+				node = father;
+				continue;
 			}
+
+			rotateUp(node);
+			continue;
 		}
-	};
 
-	void leftRotate(Node* _node);
-	void rightRotate(Node* _node);
+		//Узел и отец на разных сторонах (zig-zag): дважды поднимаем узел
+		rotateUp(node);
+		rotateUp(node);
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+void SplayTree<KeyType, ValueType>::accessFixup(Node* _node)
+{
+	if (++access_count < splay_period)
+		return;
+
+	access_count = 0;
+	splay(_node);
+}
+
+template<KEY KeyType, typename ValueType>
+SplayTree<KeyType, ValueType>::Node* SplayTree<KeyType, ValueType>::unlinkNode(Node* _node)
+{
+	//После удаления к корню поднимается отец удаленного узла
+	Node* erasedNode = Tree<KeyType, ValueType>::unlinkNode(_node);
+
+	if (parent_of_last_erased_node)
+		splay(parent_of_last_erased_node);
+
+	return erasedNode;
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CLASS SPLAYTREE ------------------------------------------
+//------------------------------------------------ END -------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------- CLASS SCAPEGOATTREE ----------------------------------------
+//----------------------------------------------- BEGIN ------------------------------------------------
+
+//Дерево-козел отпущения (scapegoat tree): узлы не хранят ни высоты, ни цвета и имеют тип BasicNode.
+//Если после вставки глубина нового узла больше log(max_size) по основанию 1/alpha, среди его предков
+//находится узел, одно из поддеревьев которого содержит больше alpha его узлов, и это поддерево
+//перестраивается в идеально сбалансированное за линейное время (тем же linkBalanced, что и buildFromSorted).
+//Если после удалений узлов становится меньше alpha * max_size, перестраивается все дерево.
+//Вставка и удаление выполняются за амортизированное O(log n), поиск - за O(log n) в худшем случае
+template<KEY KeyType, typename ValueType>
+class ScapegoatTree : public Tree<KeyType, ValueType>
+{
+	using Node = BasicNode<KeyType, ValueType>;
+	using Tree<KeyType, ValueType>::type;
+	using Tree<KeyType, ValueType>::root;
+	using Tree<KeyType, ValueType>::m_size;
+	using Tree<KeyType, ValueType>::last_added_node;
+	using Tree<KeyType, ValueType>::parent_of_last_erased_node;
+
+//Protected members:
+protected:
+	int max_size;					//Наибольший размер дерева с последней полной перестройки
+	double alpha;
+	double log_inverse_alpha;		//ln(1 / alpha), чтобы не вычислять при каждой вставке
+	std::vector<Node*> rebuild_buffer;
+
+	static int subtreeSize(Node* _node);
+	void rebuild(Node* _node);
+
+	virtual void insertFixup(Node* _node) override;
+	virtual Node* unlinkNode(Node* _node) override;
+	virtual void clearFixup() override { max_size = 0; };
+	virtual void buildFixup() override { max_size = m_size; };
+	virtual void copyFixup(const Tree<KeyType, ValueType>& _other) override;
+	virtual void moveFixup(Tree<KeyType, ValueType>& _other) override;
+
+	virtual std::size_t auxiliaryBytes() const override
+	{
+		return Tree<KeyType, ValueType>::auxiliaryBytes() + mallocBlockSize(rebuild_buffer.capacity() * sizeof(Node*));
+	};
 
-	void insertBalance();
-	void eraseBalance(structForEraseBalance& sfeb);
+	//Глубина узлов не больше log(max_size) по основанию 1/alpha: более глубокая вставка перестраивает поддерево.
+	//Между перестройками alpha * max_size <= m_size <= max_size. Если это не так (например, max_size остался
+	//от дерева до clear), граница глубины считается от неверного размера, и допустимой высоты нет
+	virtual int heightBound() const override
+	{
+		if (m_size > max_size || m_size < alpha * max_size)
+			return -1;
+		return static_cast<int>(std::log(static_cast<double>(max_size)) / log_inverse_alpha) + 1;
+	};
 
 //Public members:
 public:
-	RBTree() { 
-		type = TREE_TYPES::RB;
+	ScapegoatTree()
+	{
+		type = TREE_TYPES::SCAPEGOAT;
 		m_size = 0;
 		root = nullptr;
 		last_added_node = nullptr;
 		parent_of_last_erased_node = nullptr;
+		max_size = 0;
+		setAlpha(0.7);
 	};
-	RBTree(const KeyType& _key, const ValueType& _value)
+	ScapegoatTree(const KeyType& _key, const ValueType& _value) : ScapegoatTree()
 	{
-		type = TREE_TYPES::RB;
-		root = new RBNode<KeyType, ValueType>(_key, _value);
-		m_size = 1;
-		last_added_node = root;
-		parent_of_last_erased_node = nullptr;
-	}
-	RBTree(const std::pair<KeyType, ValueType>& _pair) : RBTree(_pair.first, _pair.second) {};
-	RBTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : RBTree()
+		this->insert(_key, _value);
+	};
+	ScapegoatTree(const std::pair<KeyType, ValueType>& _pair) : ScapegoatTree(_pair.first, _pair.second) {};
+	//Перемещение обнуляет max_size исходного дерева: оно остается пустым, и старая граница глубины ему не подходит
+	ScapegoatTree(const ScapegoatTree&) = default;
+	ScapegoatTree(ScapegoatTree&& _other) noexcept : Tree<KeyType, ValueType>(std::move(_other)) { moveFixup(_other); };
+	ScapegoatTree& operator=(const ScapegoatTree&) = default;
+	ScapegoatTree& operator=(ScapegoatTree&& _other)
+	{
+		Tree<KeyType, ValueType>::operator=(std::move(_other));
+		return *this;
+	};
+	ScapegoatTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : ScapegoatTree()
 	{
+		if (this->buildFromSorted(_vector))
+			return;
+
 		for (const auto& pair : _vector)
 			this->insert(pair);
 		parent_of_last_erased_node = nullptr;
+	};
+
+	//Параметр баланса из интервала (0.5, 1): чем он меньше, тем ниже дерево и тем чаще перестройки.
+	//Уменьшение alpha перестраивает дерево, чтобы сразу выполнялась новая граница глубины, увеличение -
+	//если после удалений узлов стало меньше новой доли alpha * max_size
+	bool setAlpha(double _alpha)
+	{
+		if (!(_alpha > 0.5 && _alpha < 1.0))
+			return false;
+
+		if (root && (_alpha < alpha || m_size < _alpha * max_size))
+		{
+			rebuild(root);
+			max_size = m_size;
+		}
+
+		alpha = _alpha;
+		log_inverse_alpha = std::log(1.0 / _alpha);
+		return true;
+	};
+};
+
+template<KEY KeyType, typename ValueType>
+int ScapegoatTree<KeyType, ValueType>::subtreeSize(Node* _node)
+{
+	if (!_node)
+		return 0;
+
+	int size = 0;
+	std::stack<Node*> stack;
+	stack.push(_node);
+	while (!stack.empty())
+	{
+		Node* node = stack.top();
+		stack.pop();
+		++size;
+
+		if (node->left)
+			stack.push(node->left);
+		if (node->right)
+			stack.push(node->right);
 	}
-	
-	virtual ~RBTree() {};
-	
+
+	return size;
+}
+
+template<KEY KeyType, typename ValueType>
+void ScapegoatTree<KeyType, ValueType>::rebuild(Node* _node)
+{
+	Node* parent = _node->parent;
+	bool side = parent && (parent->right == _node);
+
+	//Выкладываем узлы поддерева в порядке возрастания ключей
+	rebuild_buffer.clear();
+	std::stack<Node*> stack;
+	Node* searchPtr = _node;
+	while (!stack.empty() || searchPtr)
+	{
+		while (searchPtr)
+		{
+			stack.push(searchPtr);
+			searchPtr = searchPtr->left;
+		}
+
+		searchPtr = stack.top();
+		stack.pop();
+
+		rebuild_buffer.push_back(searchPtr);
+		searchPtr = searchPtr->right;
+	}
+
+	TREE_STATS(this->m_stats.rebuiltNodes += rebuild_buffer.size());
+
+	//Глубины для раскраски не нужны - у узлов BasicNode нет служебных полей
+	Node* subtreeRoot = this->linkBalanced(rebuild_buffer, 0, static_cast<int>(rebuild_buffer.size()) - 1,
+		parent, 0, 0);
+
+	if (!parent)
+		root = subtreeRoot;
+	else
+		parent->child(side) = subtreeRoot;
+}
+
+template<KEY KeyType, typename ValueType>
+void ScapegoatTree<KeyType, ValueType>::insertFixup(Node* _node)
+{
+	if (m_size > max_size)
+		max_size = m_size;
+
+	int depth = 0;
+	for (Node* node = _node->parent; node; node = node->parent)
+		++depth;
+
+	if (depth <= static_cast<int>(std::log(static_cast<double>(max_size)) / log_inverse_alpha))
+		return;
+
+	//Поднимаемся от нового узла, считая размеры поддеревьев, пока не найдем козла отпущения:
+	//предка, у которого поддерево со стороны нового узла слишком тяжелое
+	Node* child = _node;
+	int childSize = 1;
+	while (child->parent)
+	{
+		Node* parent = child->parent;
+		int parentSize = childSize + 1 + subtreeSize(parent->child(parent->left == child));
+
+		if (childSize > alpha * parentSize)
+		{
+			rebuild(parent);
+			return;
+		}
+
+		child = parent;
+		childSize = parentSize;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+void ScapegoatTree<KeyType, ValueType>::copyFixup(const Tree<KeyType, ValueType>& _other)
+{
+	//Форма копируется только у дерева того же вида. Она удовлетворяет границе глубины _other,
+	//поэтому параметры баланса копируются вместе с ней
+	const ScapegoatTree& other = static_cast<const ScapegoatTree&>(_other);
+	max_size = other.max_size;
+	alpha = other.alpha;
+	log_inverse_alpha = other.log_inverse_alpha;
+}
+
+template<KEY KeyType, typename ValueType>
+void ScapegoatTree<KeyType, ValueType>::moveFixup(Tree<KeyType, ValueType>& _other)
+{
+	copyFixup(_other);
+	static_cast<ScapegoatTree&>(_other).max_size = 0;
+}
+
+template<KEY KeyType, typename ValueType>
+ScapegoatTree<KeyType, ValueType>::Node* ScapegoatTree<KeyType, ValueType>::unlinkNode(Node* _node)
+{
+	Node* erasedNode = Tree<KeyType, ValueType>::unlinkNode(_node);
+
+	if (m_size < alpha * max_size)
+	{
+		if (root)
+			rebuild(root);
+		max_size = m_size;
+	}
+
+	return erasedNode;
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------- CLASS SCAPEGOATTREE ----------------------------------------
+//------------------------------------------------ END -------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CLASS LRUTREE --------------------------------------------
+//----------------------------------------------- BEGIN ------------------------------------------------
+
+//Упорядоченный словарь с вытеснением по давности обращения (LRU) и по времени жизни (TTL) на основе RBTree.
+//Узел LRUNode одновременно входит в дерево и в два списка, поэтому запись стоит одного выделения памяти:
+//	список давности - от самой свежей записи (newest_node) к самой старой (oldest_node): вставка, find,
+//		setValue и contains переносят запись в начало, при переполнении удаляется oldest_node;
+//	список истечения - по возрастанию времени истечения, поэтому evictExpired удаляет записи с начала
+//		списка за O(количества истекших) и не просматривает живые. Неистекающие записи в него не входят.
+//Истекшие записи остаются в дереве и находятся поиском до вызова evictExpired.
+template<KEY KeyType, typename ValueType>
+class LRUTree : public RBTree<KeyType, ValueType>
+{
+//Public structs:
+public:
+	using Clock = std::chrono::steady_clock;
+	using TimePoint = Clock::time_point;
+	using Duration = Clock::duration;
+
+private:
+	using Node = BasicNode<KeyType, ValueType>;
+	using Entry = LRUNode<KeyType, ValueType>;
+	using Tree<KeyType, ValueType>::type;
+	using Tree<KeyType, ValueType>::root;
+	using Tree<KeyType, ValueType>::m_size;
+
+//Protected members:
+protected:
+	Entry* newest_node;
+	Entry* oldest_node;
+	Entry* first_expiring;
+	Entry* last_expiring;
+
+	int capacity;				//0 - размер не ограничен
+	Duration time_to_live;		//0 - записи, добавленные без явного времени истечения, не истекают
+
+	static Entry* entry(Node* _node) { return static_cast<Entry*>(_node); };
+	TimePoint defaultExpiry() const
+	{
+		return (time_to_live == Duration::zero()) ? TimePoint::max() : Clock::now() + time_to_live;
+	};
+
+	void linkRecent(Entry* _entry);
+	void unlinkRecent(Entry* _entry);
+	void linkExpiry(Entry* _entry);
+	void unlinkExpiry(Entry* _entry);
+	void replaceEntry(Entry* _old, Entry* _new);
+	void linkAll();
+	void copyLists(const LRUTree& _other);
+	void takeLists(LRUTree& _other);
+	void evictOverCapacity();
+
+	virtual void insertFixup(Node* _node) override;
+	virtual void accessFixup(Node* _node) override;
+	virtual Node* unlinkNode(Node* _node) override;
+	virtual void clearFixup() override;
+	virtual void buildFixup() override { linkAll(); };
+	virtual void copyFixup(const Tree<KeyType, ValueType>& _other) override;
+	virtual void moveFixup(Tree<KeyType, ValueType>& _other) override;
+
+//Public members:
+public:
+	LRUTree(int _capacity = 0, Duration _timeToLive = Duration::zero())
+	{
+		type = TREE_TYPES::LRU;
+		newest_node = oldest_node = nullptr;
+		first_expiring = last_expiring = nullptr;
+		capacity = (_capacity > 0) ? _capacity : 0;
+		time_to_live = _timeToLive;
+	};
+	LRUTree(const LRUTree& _other);
+	LRUTree(LRUTree&& _other) noexcept;
+	LRUTree& operator=(const LRUTree& _other);
+	LRUTree& operator=(LRUTree&& _other);
+
 	virtual bool insert(const KeyType& _key, const ValueType& _value) override;
-	virtual bool erase(const KeyType& _key) override;
+	bool insert(const KeyType& _key, const ValueType& _value, TimePoint _expiry);
+	bool insert(const std::pair<KeyType, ValueType>& _pair) { return insert(_pair.first, _pair.second); };
+	virtual bool insert(typename Tree<KeyType, ValueType>::NodeHandle&& _handle) override;
+	virtual bool insertHint(typename Tree<KeyType, ValueType>::Iterator& _hint, const KeyType& _key,
+		const ValueType& _value) override;
+	virtual void merge(Tree<KeyType, ValueType>& _other) override;
+
+	//Кроме инвариантов RB дерева проверяет списки давности и истечения
+	bool validate() const;
+
+	bool setExpiry(const KeyType& _key, TimePoint _expiry);
+	int evictExpired(TimePoint _now = Clock::now());
+	std::vector<KeyType> getKeysByRecency() const;
+
+	void setCapacity(int _capacity);
+	int getCapacity() const { return capacity; };
+	void setTimeToLive(Duration _timeToLive) { time_to_live = _timeToLive; };
 };
 
 template<KEY KeyType, typename ValueType>
-void RBTree<KeyType, ValueType>::leftRotate(Node* _node)
+void LRUTree<KeyType, ValueType>::linkRecent(Entry* _entry)
+{
+	_entry->newer = nullptr;
+	_entry->older = newest_node;
+	if (newest_node)
+		newest_node->newer = _entry;
+	else
+		oldest_node = _entry;
+
+	newest_node = _entry;
+}
+
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::unlinkRecent(Entry* _entry)
+{
+	(_entry->newer ? _entry->newer->older : newest_node) = _entry->older;
+	(_entry->older ? _entry->older->newer : oldest_node) = _entry->newer;
+	_entry->newer = _entry->older = nullptr;
+}
+
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::linkExpiry(Entry* _entry)
 {
-	Node* parentOfNode = _node->parent;
-	Node* rightChild = _node->right;
+	_entry->previousExpiring = _entry->nextExpiring = nullptr;
+	if (_entry->expiry == TimePoint::max())
+		return;
 
-	_node->right = rightChild->left;
-	if (_node->right)
-		_node->right->parent = _node;
+	//При одинаковом времени жизни записи истекают в порядке добавления,
+	//поэтому место новой записи почти всегда в конце списка
+	Entry* previous = last_expiring;
+	while (previous && _entry->expiry < previous->expiry)
+		previous = previous->previousExpiring;
 
-	rightChild->left = _node;
-	_node->parent = rightChild;
+	_entry->previousExpiring = previous;
+	_entry->nextExpiring = previous ? previous->nextExpiring : first_expiring;
+	(previous ? previous->nextExpiring : first_expiring) = _entry;
+	(_entry->nextExpiring ? _entry->nextExpiring->previousExpiring : last_expiring) = _entry;
+}
 
-	if (!parentOfNode)
-	{
-		root = rightChild;
-		root->parent = nullptr;
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::unlinkExpiry(Entry* _entry)
+{
+	if (!_entry->previousExpiring && first_expiring != _entry)
 		return;
-	}
-
-	if (parentOfNode->right == _node)
-		parentOfNode->right = rightChild;
-	else
-		parentOfNode->left = rightChild;
 
-	rightChild->parent = parentOfNode;
+	(_entry->previousExpiring ? _entry->previousExpiring->nextExpiring : first_expiring) = _entry->nextExpiring;
+	(_entry->nextExpiring ? _entry->nextExpiring->previousExpiring : last_expiring) = _entry->previousExpiring;
+	_entry->previousExpiring = _entry->nextExpiring = nullptr;
 }
 
 template<KEY KeyType, typename ValueType>
-void RBTree<KeyType, ValueType>::rightRotate(Node* _node)
+void LRUTree<KeyType, ValueType>::replaceEntry(Entry* _old, Entry* _new)
 {
-	Node* parentOfNode = _node->parent;
-	Node* leftChild = _node->left;
-
-	_node->left = leftChild->right;
-	if (_node->left)
-		_node->left->parent = _node;
+	//_new занимает места _old в обоих списках и получает его время истечения
+	_new->expiry = _old->expiry;
 
-	leftChild->right = _node;
-	_node->parent = leftChild;
+	_new->newer = _old->newer;
+	_new->older = _old->older;
+	(_new->newer ? _new->newer->older : newest_node) = _new;
+	(_new->older ? _new->older->newer : oldest_node) = _new;
 
-	if (!parentOfNode)
+	_new->previousExpiring = _new->nextExpiring = nullptr;
+	if (_old->previousExpiring || first_expiring == _old)
 	{
-		root = leftChild;
-		root->parent = nullptr;
-		return;
+		_new->previousExpiring = _old->previousExpiring;
+		_new->nextExpiring = _old->nextExpiring;
+		(_new->previousExpiring ? _new->previousExpiring->nextExpiring : first_expiring) = _new;
+		(_new->nextExpiring ? _new->nextExpiring->previousExpiring : last_expiring) = _new;
 	}
 
-	if (parentOfNode->right == _node)
-		parentOfNode->right = leftChild;
-	else
-		parentOfNode->left = leftChild;
+	_old->newer = _old->older = _old->previousExpiring = _old->nextExpiring = nullptr;
+}
+
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::insertFixup(Node* _node)
+{
+	RBTree<KeyType, ValueType>::insertFixup(_node);
+
+	//Узел, пришедший из LRUTree через NodeHandle или merge, сохраняет свое время истечения
+	Entry* added = entry(_node);
+	if (added->expiry == TimePoint::min())
+		added->expiry = defaultExpiry();
 
-	leftChild->parent = parentOfNode;
+	linkRecent(added);
+	linkExpiry(added);
 }
 
 template<KEY KeyType, typename ValueType>
-void RBTree<KeyType, ValueType>::insertBalance()
+void LRUTree<KeyType, ValueType>::accessFixup(Node* _node)
 {
-	//Создаем структуру для информации необходимой для балансировки
-	structForInsertBalance sfib(last_added_node);
+	Entry* accessed = entry(_node);
+	if (accessed == newest_node)
+		return;
 
-	while(true)
+	unlinkRecent(accessed);
+	linkRecent(accessed);
+}
+
+template<KEY KeyType, typename ValueType>
+LRUTree<KeyType, ValueType>::Node* LRUTree<KeyType, ValueType>::unlinkNode(Node* _node)
+{
+	Entry* removed = entry(_node);
+	TimePoint expiry = removed->expiry;
+	unlinkRecent(removed);
+	unlinkExpiry(removed);
+
+	//Если у узла два ребенка, фактически отцепляется узел предшественника, а его ключ и значение
+	//перекладываются в _node: тогда _node занимает места предшественника в списках
+	Entry* erasedNode = entry(RBTree<KeyType, ValueType>::unlinkNode(_node));
+	if (erasedNode != removed)
 	{
-		//Если дядя красный
-		if (sfib.u_color == 'R')
-		{
-			//Если попадаем в этот кейс, значит у узла существует черный дед, т.к отец и дядя красные
-			//Перекрашиваем отца и дядю в черный
-			sfib.father->setColor('B'); 
-			sfib.uncle->setColor('B');
+		replaceEntry(erasedNode, removed);
+		erasedNode->expiry = expiry;
+	}
 
-			//Если дед корень, дальнейшая балансировка не требуется
-			if (sfib.grand_father == root)
-				return;
+	return erasedNode;
+}
+
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::copyLists(const LRUTree& _other)
+{
+	//Копия имеет ту же форму, что _other, поэтому одновременный обход двух деревьев сопоставляет
+	//узлы друг другу, и связи списков переносятся через это соответствие
+	newest_node = oldest_node = nullptr;
+	first_expiring = last_expiring = nullptr;
+	if (!root)
+		return;
 
-			//В противном случае, перекрашиваем деда в красный
-			sfib.grand_father->setColor('R');
+	std::unordered_map<const Entry*, Entry*> copies;
+	copies.reserve(static_cast<std::size_t>(m_size) + 1);
+	copies[nullptr] = nullptr;
 
-			//Если отец деда черный, балансировка завершена
-			if (sfib.grand_father->parent->getColor() == 'B')
-				return;
+	Node* source = _other.root;
+	Node* copy = root;
+	while (source->left)
+	{
+		source = source->left;
+		copy = copy->left;
+	}
 
-			//В противном случае, запускаем балансировку для деда
-			sfib.setNode(sfib.grand_father);
+	for (; source; source = Tree<KeyType, ValueType>::nextNode(source), copy = Tree<KeyType, ValueType>::nextNode(copy))
+		copies[entry(source)] = entry(copy);
+
+	for (const auto& [original, clone] : copies)
+	{
+		if (!original)
 			continue;
-		}
 
-		//Попадаем сюда, если дядя черный
+		clone->newer = copies[original->newer];
+		clone->older = copies[original->older];
+		clone->previousExpiring = copies[original->previousExpiring];
+		clone->nextExpiring = copies[original->nextExpiring];
+	}
 
-		//Если добавленный узел и его отец, лежат на разных сторонах отностиельно своих родителей
-		//делаем соответсвующий поворот вокруг отца
-		if (sfib.node_side != sfib.father_side)
-		{
-			if (sfib.node_side == 'R')
-				leftRotate(sfib.father);
-			else
-				rightRotate(sfib.father);
+	newest_node = copies[_other.newest_node];
+	oldest_node = copies[_other.oldest_node];
+	first_expiring = copies[_other.first_expiring];
+	last_expiring = copies[_other.last_expiring];
+}
 
-			//Поскольку узел и его отец поменялись местами
-			sfib.setNode(sfib.father);			
-		}
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::takeLists(LRUTree& _other)
+{
+	newest_node = _other.newest_node;
+	oldest_node = _other.oldest_node;
+	first_expiring = _other.first_expiring;
+	last_expiring = _other.last_expiring;
 
-		//Если попадаем сюда, значит узел и его отец лежат на одной стороне относительно своих родителей
-		//Перекрашиваем деда в красный, а отца в черный и делаем поворот вокруг деда со стороны отца
-		sfib.grand_father->setColor('R');
-		sfib.father->setColor('B');
+	_other.newest_node = _other.oldest_node = nullptr;
+	_other.first_expiring = _other.last_expiring = nullptr;
+}
 
-		if (sfib.father_side == 'R')
-			leftRotate(sfib.grand_father);
-		else
-			rightRotate(sfib.grand_father);
+template<KEY KeyType, typename ValueType>
+LRUTree<KeyType, ValueType>::LRUTree(const LRUTree& _other) : RBTree<KeyType, ValueType>(_other)
+{
+	capacity = _other.capacity;
+	time_to_live = _other.time_to_live;
+	copyLists(_other);
+}
 
-		return;
-	} 
+template<KEY KeyType, typename ValueType>
+LRUTree<KeyType, ValueType>::LRUTree(LRUTree&& _other) noexcept : RBTree<KeyType, ValueType>(std::move(_other))
+{
+	capacity = _other.capacity;
+	time_to_live = _other.time_to_live;
+	takeLists(_other);
+}
+
+template<KEY KeyType, typename ValueType>
+LRUTree<KeyType, ValueType>& LRUTree<KeyType, ValueType>::operator=(const LRUTree& _other)
+{
+	if (this == &_other)
+		return *this;
+
+	//Списки копирует copyFixup, емкость нужна ему уже новая
+	capacity = _other.capacity;
+	time_to_live = _other.time_to_live;
+	RBTree<KeyType, ValueType>::operator=(_other);
+	return *this;
+}
+
+template<KEY KeyType, typename ValueType>
+LRUTree<KeyType, ValueType>& LRUTree<KeyType, ValueType>::operator=(LRUTree&& _other)
+{
+	if (this == &_other)
+		return *this;
+
+	capacity = _other.capacity;
+	time_to_live = _other.time_to_live;
+	RBTree<KeyType, ValueType>::operator=(std::move(_other));
+	return *this;
+}
+
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::evictOverCapacity()
+{
+	while (capacity && m_size > capacity)
+		this->deleteNode(unlinkNode(oldest_node));
 }
 
 template<KEY KeyType, typename ValueType>
-void RBTree<KeyType, ValueType>::eraseBalance(structForEraseBalance& sfeb)
+void LRUTree<KeyType, ValueType>::linkAll()
 {
-	//Если удаленный узел был красным балансировка не требуется
-	if (sfeb.node_color == 'R')
+	newest_node = oldest_node = nullptr;
+	first_expiring = last_expiring = nullptr;
+	if (!root)
 		return;
 
-	//Если удаленный элемент имел одного ребенка красного цвета, перекрашиваем его(ребенка) в черный
-	if (sfeb.child_count == 1 && sfeb.new_node->getColor() == 'R')
+	TimePoint expiry = defaultExpiry();
+
+	Node* node = root;
+	while (node->left)
+		node = node->left;
+
+	for (; node; node = Tree<KeyType, ValueType>::nextNode(node))
 	{
-		sfeb.new_node->setColor('B');
-		return;
+		entry(node)->expiry = expiry;
+		linkRecent(entry(node));
+		linkExpiry(entry(node));
 	}
 
-	while (true)
-	{
-		//Если брат удаленного элемента красный
-		if (sfeb.b_color == 'R')
-		{
-			//Если оба ребенка красного брата черные, красим племянника лежащего на той же стороне, что и
-			//удаленный узел в красный, а красного брата в черный
-			if (sfeb.left_nephew_color == 'B' && sfeb.right_nephew_color == 'B')
-			{
-				if (sfeb.node_side == 'R')
-					sfeb.brother->right->setColor('R');
-				else
-					sfeb.brother->left->setColor('R');
+	evictOverCapacity();
+}
 
-				sfeb.brother->setColor('B');
-			}
-			else //В противном случае, красим брата в черный, а отца в красный
-			{
-				sfeb.brother->setColor('B');
-				sfeb.father->setColor('R');
-			}
+template<KEY KeyType, typename ValueType>
+bool LRUTree<KeyType, ValueType>::insert(const KeyType& _key, const ValueType& _value)
+{
+	return insert(_key, _value, defaultExpiry());
+}
 
-			//Затем делаем поворот вокруг отца со стороны брата
-			if (sfeb.father->right == sfeb.brother)
-				leftRotate(sfeb.father);
-			else
-				rightRotate(sfeb.father);
+template<KEY KeyType, typename ValueType>
+bool LRUTree<KeyType, ValueType>::insert(const KeyType& _key, const ValueType& _value, TimePoint _expiry)
+{
+	TREE_LATENCY(LatencyScope latency(this->latency_recorder, TREE_OPERATIONS::INSERT, this->statsSink()));
 
-			return;
-		}
+	Node* parent;
+	bool right;
+	if (!this->findInsertPosition(_key, parent, right))
+		return false;
 
-		//Если брат черный и оба племянника тоже черные
-		if (sfeb.left_nephew_color == 'B' && sfeb.right_nephew_color == 'B')
-		{
-			//Если черный родитель, красим брата в красный и повторяем алгоритм для отца,
-			//пока не дойдем до корня
-			if (sfeb.father->getColor() == 'B')
-			{
-				sfeb.brother->setColor('R');
-				
-				if (sfeb.father == root)									
-					return;
-				
-				sfeb.setNode(sfeb.father);
-				continue;
-			}
+	Node* node = this->createNode(_key, _value, parent);
+	entry(node)->expiry = _expiry;
+	this->attachNode(node, parent, right);
 
-			//Если отец красный, перекрашиваем его в черный, а брата в красный
-			sfeb.father->setColor('B');
-			sfeb.brother->setColor('R');
-			return;
-		}
+	evictOverCapacity();
+	return true;
+}
 
-		//Если противоположный удаленному узлу племянник красный, перекрашиваем его(племянника) в черный, затем
-		//перекрашиваем брата в цвет отца, а отца в черный и делаем поворот вокруг отца со строны братского узла
-		if ((sfeb.node_side == 'R' && sfeb.left_nephew_color == 'R') ||
-			(sfeb.node_side == 'L' && sfeb.right_nephew_color == 'R'))
-		{
-			if (sfeb.node_side == 'R')
-				sfeb.brother->left->setColor('B');
-			else
-				sfeb.brother->right->setColor('B');
+template<KEY KeyType, typename ValueType>
+bool LRUTree<KeyType, ValueType>::insert(typename Tree<KeyType, ValueType>::NodeHandle&& _handle)
+{
+	if (!Tree<KeyType, ValueType>::insert(std::move(_handle)))
+		return false;
 
-			sfeb.brother->setColor(sfeb.father->getColor());
-			sfeb.father->setColor('B');
+	evictOverCapacity();
+	return true;
+}
 
-			if (sfeb.father->right == sfeb.brother)
-				leftRotate(sfeb.father);
-			else
-				rightRotate(sfeb.father);
+template<KEY KeyType, typename ValueType>
+bool LRUTree<KeyType, ValueType>::insertHint(typename Tree<KeyType, ValueType>::Iterator& _hint, const KeyType& _key,
+	const ValueType& _value)
+{
+	if (!Tree<KeyType, ValueType>::insertHint(_hint, _key, _value))
+		return false;
 
-			return;
-		}
+	//Удаление давней записи может освободить узел, на который указывает подсказка
+	//(см. unlinkNode: отцепляется узел предшественника), поэтому после вытеснения подсказка сбрасывается
+	int sizeBefore = m_size;
+	evictOverCapacity();
+	if (m_size != sizeBefore)
+		_hint = this->afterEnd();
 
-		//Если противоположный удаленному узлу племянник черный, а другой племянник красный, перекрашиваем
-		//красного племянника в цвет отца, а отца в черный, затем делаем поворот вокруг брата со стороны
-		//красного племянника, а после делаем поворот вокруг отца с другой стороны
-		if ((sfeb.node_side == 'R' && sfeb.left_nephew_color == 'B' && sfeb.right_nephew_color == 'R') ||
-			(sfeb.node_side == 'L' && sfeb.right_nephew_color == 'B' && sfeb.left_nephew_color == 'R'))
-		{
-			if (sfeb.node_side == 'R')
-			{
-				sfeb.brother->right->setColor(sfeb.father->getColor());
-				sfeb.father->setColor('B');
-				leftRotate(sfeb.brother);
-				rightRotate(sfeb.father);
-				return;
-			}
-			else
-			{
-				sfeb.brother->left->setColor(sfeb.father->getColor());
-				sfeb.father->setColor('B');
-				rightRotate(sfeb.brother);
-				leftRotate(sfeb.father);
-				return;
-			}
-		}
+	return true;
+}
 
-	}
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::merge(Tree<KeyType, ValueType>& _other)
+{
+	Tree<KeyType, ValueType>::merge(_other);
+	evictOverCapacity();
 }
 
 template<KEY KeyType, typename ValueType>
-bool RBTree<KeyType, ValueType>::insert(const KeyType& _key, const ValueType& _value)
+void LRUTree<KeyType, ValueType>::clearFixup()
 {
-	auto result = Tree<KeyType, ValueType>::insert(_key, _value);
+	newest_node = oldest_node = nullptr;
+	first_expiring = last_expiring = nullptr;
+}
 
-	if (!result)
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::copyFixup(const Tree<KeyType, ValueType>& _other)
+{
+	//Присваивание копирует форму только дерева того же вида, то есть другого LRUTree
+	copyLists(static_cast<const LRUTree&>(_other));
+	evictOverCapacity();
+}
+
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::moveFixup(Tree<KeyType, ValueType>& _other)
+{
+	takeLists(static_cast<LRUTree&>(_other));
+	evictOverCapacity();
+}
+
+template<KEY KeyType, typename ValueType>
+bool LRUTree<KeyType, ValueType>::validate() const
+{
+	if (!Tree<KeyType, ValueType>::validate())
 		return false;
 
-	//Если добавленный элемент стал корнем, его нужно перекрасить в черный 
-	if (!last_added_node->parent)
+	//Список давности содержит все записи
+	int count = 0;
+	Entry* previous = nullptr;
+	for (Entry* node = newest_node; node; node = node->older)
 	{
-		root->setColor('B');
-		return true;
+		if (node->newer != previous || ++count > m_size)
+			return false;
+		previous = node;
 	}
+	if (count != m_size || previous != oldest_node)
+		return false;
 
-	//Если родитель был черный, значит балансировка не нужна
-	if (last_added_node->parent->getColor() == 'B')
-		return true;
-
-	insertBalance();
-	return true;
+	//Список истечения упорядочен по времени и не содержит неистекающих записей
+	count = 0;
+	previous = nullptr;
+	for (Entry* node = first_expiring; node; node = node->nextExpiring)
+	{
+		if (node->previousExpiring != previous || node->expiry == TimePoint::max() || ++count > m_size)
+			return false;
+		if (previous && node->expiry < previous->expiry)
+			return false;
+		previous = node;
+	}
+	return previous == last_expiring;
 }
 
 template<KEY KeyType, typename ValueType>
-bool RBTree<KeyType, ValueType>::erase(const KeyType& _key)
+bool LRUTree<KeyType, ValueType>::setExpiry(const KeyType& _key, TimePoint _expiry)
 {
-	Node* nodeToErase = this->innerFind(_key);
-	if (!nodeToErase)
+	Node* node = this->innerFind(_key);
+	if (!node)
 		return false;
-	
-	// Создаем структуру для хранения информации для балансировки после удаления элемента
-	structForEraseBalance sfeb; 
 
-	// Далее вызваем sfeb.setNode() для узла который будет фактически удален
-	// и выполняем обычный алгоритм удаления
-	if (nodeToErase->left && nodeToErase->right)
+	unlinkExpiry(entry(node));
+	entry(node)->expiry = _expiry;
+	linkExpiry(entry(node));
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+int LRUTree<KeyType, ValueType>::evictExpired(TimePoint _now)
+{
+	int evicted = 0;
+	while (first_expiring && !(_now < first_expiring->expiry))
 	{
-		Node* newNode = nodeToErase->left;
-		while (newNode->right)
-			newNode = newNode->right;
+		this->deleteNode(unlinkNode(first_expiring));
+		++evicted;
+	}
 
-		sfeb.setNode(newNode);
-		this->swapNodes(nodeToErase, newNode);
-		parent_of_last_erased_node = newNode->parent;
+	return evicted;
+}
 
-		if (newNode->left)
-		{
-			newNode->left->parent = parent_of_last_erased_node;
+template<KEY KeyType, typename ValueType>
+std::vector<KeyType> LRUTree<KeyType, ValueType>::getKeysByRecency() const
+{
+	std::vector<KeyType> keys;
+	keys.reserve(static_cast<std::size_t>(m_size));
+	for (const Entry* current = oldest_node; current; current = current->newer)
+		keys.push_back(current->key);
 
-			if (parent_of_last_erased_node->right == newNode)
-				parent_of_last_erased_node->right = newNode->left;
-			else
-				parent_of_last_erased_node->left = newNode->left;
+	return keys;
+}
 
-			delete newNode;
-			--m_size;
-			eraseBalance(sfeb);
-			return true;
-		}
+template<KEY KeyType, typename ValueType>
+void LRUTree<KeyType, ValueType>::setCapacity(int _capacity)
+{
+	capacity = (_capacity > 0) ? _capacity : 0;
+	evictOverCapacity();
+}
 
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CLASS LRUTREE --------------------------------------------
+//------------------------------------------------ END -------------------------------------------------
 
-		if (parent_of_last_erased_node->right == newNode)
-			parent_of_last_erased_node->right = nullptr;
-		else
-			parent_of_last_erased_node->left = nullptr;
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASSES MULTITREE -----------------------------------------
+//----------------------------------------------- BEGIN ------------------------------------------------
 
-		delete newNode;
-		--m_size;
-		eraseBalance(sfeb);
-		return true;
-	}
+//Деревья, допускающие одинаковые ключи. Каждое значение хранится отдельным узлом,
+//одинаковые ключи идут в порядке добавления. insert всегда добавляет узел,
+//find и erase(key) работают с первым из одинаковых ключей, eraseAll удаляет все
+template<KEY KeyType, typename ValueType>
+class MultiTree : public Tree<KeyType, ValueType>
+{
+public:
+	MultiTree() { this->allow_duplicates = true; };
+	MultiTree(const KeyType& _key, const ValueType& _value) : Tree<KeyType, ValueType>(_key, _value)
+	{
+		this->allow_duplicates = true;
+	};
+	MultiTree(const std::pair<KeyType, ValueType>& _pair) : MultiTree(_pair.first, _pair.second) {};
+	MultiTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : MultiTree()
+	{
+		if (this->buildFromSorted(_vector))
+			return;
 
-	sfeb.setNode(nodeToErase); //nodeToErase будет фактически удален
-	parent_of_last_erased_node = nodeToErase->parent;
+		for (const auto& pair : _vector)
+			this->insert(pair);
+	};
+};
 
-	if (nodeToErase->left)
-	{	
-		//Если удаляемый элемент был корнем, достаточно просто перекрасить новый корень в черный
-		if (nodeToErase == root)
-		{
-			root = root->left;
-			root->parent = nullptr;
-			root->setColor('B');
+template<KEY KeyType, typename ValueType>
+class MultiAVLTree : public AVLTree<KeyType, ValueType>
+{
+public:
+	MultiAVLTree() { this->allow_duplicates = true; };
+	MultiAVLTree(const KeyType& _key, const ValueType& _value) : AVLTree<KeyType, ValueType>(_key, _value)
+	{
+		this->allow_duplicates = true;
+	};
+	MultiAVLTree(const std::pair<KeyType, ValueType>& _pair) : MultiAVLTree(_pair.first, _pair.second) {};
+	MultiAVLTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : MultiAVLTree()
+	{
+		if (this->buildFromSorted(_vector))
+			return;
 
-			delete nodeToErase;
-			--m_size;
-			return true;
-		}
+		for (const auto& pair : _vector)
+			this->insert(pair);
+	};
+};
 
-		if (parent_of_last_erased_node->right == nodeToErase)
-			parent_of_last_erased_node->right = nodeToErase->left;
-		else
-			parent_of_last_erased_node->left = nodeToErase->left;
+template<KEY KeyType, typename ValueType>
+class MultiRBTree : public RBTree<KeyType, ValueType>
+{
+public:
+	MultiRBTree() { this->allow_duplicates = true; };
+	MultiRBTree(const KeyType& _key, const ValueType& _value) : RBTree<KeyType, ValueType>(_key, _value)
+	{
+		this->allow_duplicates = true;
+	};
+	MultiRBTree(const std::pair<KeyType, ValueType>& _pair) : MultiRBTree(_pair.first, _pair.second) {};
+	MultiRBTree(const std::vector<std::pair<KeyType, ValueType>>& _vector) : MultiRBTree()
+	{
+		if (this->buildFromSorted(_vector))
+			return;
+
+		for (const auto& pair : _vector)
+			this->insert(pair);
+	};
+};
 
-		nodeToErase->left->parent = parent_of_last_erased_node;
+//Дерево одного из Multi-видов (в том числе Multi-множество). Во время выполнения то же показывает allowsDuplicates()
+template<typename TreeType, typename KeyType, typename ValueType>
+concept MULTI_TREE = std::derived_from<TreeType, MultiTree<KeyType, ValueType>> ||
+	std::derived_from<TreeType, MultiAVLTree<KeyType, ValueType>> || std::derived_from<TreeType, MultiRBTree<KeyType, ValueType>>;
 
-		delete nodeToErase;
-		--m_size;
-		eraseBalance(sfeb);
-		return true;
-	}
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASSES MULTITREE -----------------------------------------
+//------------------------------------------------ END -------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------- CLASSES SET ---------------------------------------------
+//----------------------------------------------- BEGIN ------------------------------------------------
 
-	if (nodeToErase->right)
+//Множества: деревья, узлы которых хранят только ключ. Значением служит пустой NoValue,
+//который благодаря TREES_NO_UNIQUE_ADDRESS не занимает места в узле.
+//TreeTemplate - любое из деревьев: Tree, AVLTree, RBTree или их Multi-варианты
+template<KEY KeyType, template<KEY, typename> typename TreeTemplate>
+class BasicSet : public TreeTemplate<KeyType, NoValue>
+{
+public:
+	BasicSet() {};
+	BasicSet(const KeyType& _key) { this->insert(_key); };
+	BasicSet(const std::vector<KeyType>& _vector)
 	{
-		//Если удаляемый элемент был корнем, достаточно просто перекрасить новый корень в черный
-		if (nodeToErase == root)
+		std::size_t index = 0;
+		std::pair<KeyType, NoValue> pair;
+		bool built = this->buildFromSorted(static_cast<int>(_vector.size()),
+			[&]() -> const std::pair<KeyType, NoValue>&
 		{
-			root = root->right;
-			root->parent = nullptr;
-			root->setColor('B');
-
-			delete nodeToErase;
-			--m_size;
-			return true;
-		}
-
-		if (parent_of_last_erased_node->right == nodeToErase)
-			parent_of_last_erased_node->right = nodeToErase->right;
-		else
-			parent_of_last_erased_node->left = nodeToErase->right;
+			pair.first = _vector[index++];
+			return pair;
+		});
+		if (built)
+			return;
 
-		nodeToErase->right->parent = parent_of_last_erased_node;
+		for (const auto& key : _vector)
+			this->insert(key);
+	};
 
-		delete nodeToErase;
-		--m_size;
-		eraseBalance(sfeb);
-		return true;
-	}
+	using TreeTemplate<KeyType, NoValue>::insert;
 
-	if (parent_of_last_erased_node)
+	bool insert(const KeyType& _key) { return this->insert(_key, NoValue()); };
+	bool contains(const KeyType& _key)
 	{
-		if (parent_of_last_erased_node->right == nodeToErase)
-			parent_of_last_erased_node->right = nullptr;
-		else
-			parent_of_last_erased_node->left = nullptr;
-	}
-	else
-		root = nullptr;
+		auto* node = this->innerFind(_key);
+		if (!node)
+			return false;
 
-	delete nodeToErase;
-	--m_size;
-	eraseBalance(sfeb);
-	return true;
-}
+		this->accessFixup(node);
+		return true;
+	};
+};
 
+template<KEY KeyType>
+using Set = BasicSet<KeyType, Tree>;
+template<KEY KeyType>
+using AVLSet = BasicSet<KeyType, AVLTree>;
+template<KEY KeyType>
+using RBSet = BasicSet<KeyType, RBTree>;
+template<KEY KeyType>
+using SplaySet = BasicSet<KeyType, SplayTree>;
+template<KEY KeyType>
+using ScapegoatSet = BasicSet<KeyType, ScapegoatTree>;
+
+template<KEY KeyType>
+using MultiSet = BasicSet<KeyType, MultiTree>;
+template<KEY KeyType>
+using MultiAVLSet = BasicSet<KeyType, MultiAVLTree>;
+template<KEY KeyType>
+using MultiRBSet = BasicSet<KeyType, MultiRBTree>;
 
 //------------------------------------------------------------------------------------------------------
-//-------------------------------------------- CLASS RBTREE --------------------------------------------
+//-------------------------------------------- CLASSES SET ---------------------------------------------
 //------------------------------------------------ END -------------------------------------------------
 #endif
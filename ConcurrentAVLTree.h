@@ -0,0 +1,994 @@
+﻿#ifndef CONCURRENTAVLTREE_H
+#define CONCURRENTAVLTREE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "BinaryTrees.h"
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------- CLASS EPOCHRECLAIMER ---------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Отложенное освобождение памяти по эпохам. Читатели не берут блокировок, поэтому узел, отцепленный
+//от дерева, может еще читаться другим потоком. Каждая операция отмечается в слоте своего потока (Guard),
+//отцепленный объект откладывается с текущей эпохой (retire) и освобождается, когда глобальная эпоха
+//уйдет от нее на 2: к этому времени все операции, которые могли его видеть, завершились.
+//Эпоха переходит на следующую, когда не осталось операций, начатых в предыдущей, поэтому одновременно
+//выполняются операции не более чем двух соседних эпох. Слот считает их отдельно по четности эпохи.
+//Поток закрепляет за собой один из SLOTS слотов. Если потоков больше, слот делят несколько потоков:
+//каждая операция учитывается в счетчике своей эпохи, поэтому новые операции не удерживают старую эпоху.
+class EpochReclaimer
+{
+//Public members:
+public:
+	static constexpr int SLOTS = 64;
+
+	static int threadSlot()
+	{
+		static std::atomic<int> nextSlot(0);
+		thread_local int slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+		return slot;
+	};
+
+//Private structs:
+private:
+	struct Retired
+	{
+		void* pointer;
+		void (*destroy)(void*);
+		std::uint64_t epoch;
+	};
+
+	//active[p] - количество выполняющихся в слоте операций, начатых в эпохе четности p
+	struct alignas(64) Slot
+	{
+		std::atomic<std::uint64_t> active[2] = { 0, 0 };
+		std::mutex mutex;
+		std::vector<Retired> retired;
+		std::size_t collect_at = COLLECT_BATCH;
+	};
+
+	static constexpr std::size_t COLLECT_BATCH = 64;
+
+//Private members:
+private:
+	std::atomic<std::uint64_t> global_epoch{ 1 };
+	Slot slots[SLOTS];
+
+	void tryAdvance();
+	void collect(Slot& _slot);
+
+//Public members:
+public:
+	EpochReclaimer() = default;
+	~EpochReclaimer();
+
+	EpochReclaimer(const EpochReclaimer&) = delete;
+	EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+	int enter(int _slot);
+	void leave(int _slot, int _parity) { slots[_slot].active[_parity].fetch_sub(1); };
+
+	template<typename T>
+	void retire(int _slot, T* _pointer);
+
+	class Guard
+	{
+	private:
+		EpochReclaimer& reclaimer;
+		int slot;
+		int parity;
+	public:
+		Guard(EpochReclaimer& _reclaimer) : reclaimer(_reclaimer), slot(threadSlot()), parity(reclaimer.enter(slot)) {};
+		~Guard() { reclaimer.leave(slot, parity); };
+
+		Guard(const Guard&) = delete;
+		Guard& operator=(const Guard&) = delete;
+
+		int getSlot() const { return slot; };
+	};
+};
+
+inline EpochReclaimer::~EpochReclaimer()
+{
+	for (Slot& slot : slots)
+	{
+		for (const Retired& retired : slot.retired)
+			retired.destroy(retired.pointer);
+	}
+}
+
+inline int EpochReclaimer::enter(int _slot)
+{
+	//Операция учитывается в счетчике четности прочитанной эпохи. Если эпоха успела смениться до увеличения
+	//счетчика, отметка могла опоздать к проверке в tryAdvance, поэтому она снимается и ставится заново
+	while (true)
+	{
+		std::uint64_t epoch = global_epoch.load();
+		int parity = static_cast<int>(epoch & 1);
+		slots[_slot].active[parity].fetch_add(1);
+		if (global_epoch.load() == epoch)
+			return parity;
+
+		slots[_slot].active[parity].fetch_sub(1);
+	}
+}
+
+inline void EpochReclaimer::tryAdvance()
+{
+	//Эпоха переходит на следующую, только если все выполняющиеся операции начались в текущей,
+	//то есть не осталось операций предыдущей эпохи (она той же четности, что и следующая)
+	std::uint64_t epoch = global_epoch.load();
+	for (const Slot& slot : slots)
+	{
+		if (slot.active[(epoch + 1) & 1].load())
+			return;
+	}
+
+	global_epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+inline void EpochReclaimer::collect(Slot& _slot)
+{
+	tryAdvance();
+	std::uint64_t epoch = global_epoch.load();
+
+	auto alive = std::partition(_slot.retired.begin(), _slot.retired.end(),
+		[epoch](const Retired& _retired) { return _retired.epoch + 2 > epoch; });
+	for (auto it = alive; it != _slot.retired.end(); ++it)
+		it->destroy(it->pointer);
+	_slot.retired.erase(alive, _slot.retired.end());
+
+	//Если освободить почти ничего не удалось, следующая попытка - через COLLECT_BATCH объектов
+	_slot.collect_at = _slot.retired.size() + COLLECT_BATCH;
+}
+
+template<typename T>
+void EpochReclaimer::retire(int _slot, T* _pointer)
+{
+	Slot& slot = slots[_slot];
+	std::lock_guard<std::mutex> lock(slot.mutex);
+	slot.retired.push_back({ _pointer, [](void* _object) { delete static_cast<T*>(_object); }, global_epoch.load() });
+	if (slot.retired.size() >= slot.collect_at)
+		collect(slot);
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------- CLASS EPOCHRECLAIMER ---------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------
+//--------------------------------------- CLASS CONCURRENTAVLTREE --------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Потокобезопасное АВЛ дерево с оптимистичными чтениями (Bronson, Casper, Chafi, Olukotun,
+//"A Practical Concurrent Binary Search Tree"). Поиск не берет блокировок: он спускается, проверяя версию
+//каждого узла после чтения его ребенка (hand-over-hand validation). Поворот, который уменьшает диапазон
+//ключей узла, отмечает его версию как сжимающуюся, и поиск, проходивший через узел, повторяется с уровня выше.
+//Изменения блокируют только затронутые узлы (вставка - отца нового листа, удаление - узел и его отца,
+//поворот - до четырех узлов сверху вниз), поэтому изменения в разных частях дерева идут параллельно.
+//Удаленный узел с двумя детьми становится маршрутным (без значения) и отцепляется, когда детей станет меньше.
+//Баланс восстанавливается после каждого изменения, но с ослабленными условиями, пока параллельные изменения
+//не закончатся. Отцепленные узлы и замененные значения освобождаются через EpochReclaimer.
+template<KEY KeyType, typename ValueType>
+class ConcurrentAVLTree
+{
+//Private structs:
+private:
+	struct Node
+	{
+		const KeyType key;
+
+		//nullptr - маршрутный или отцепленный узел. Значение неизменяемо, setValue заменяет его целиком
+		std::atomic<ValueType*> value;
+
+		std::atomic<Node*> parent;
+		std::atomic<Node*> left;
+		std::atomic<Node*> right;
+		std::atomic<int> height;
+
+		//Версия: UNLINKED - узел отцеплен, SHRINKING - идет поворот, уменьшающий диапазон ключей узла,
+		//старшие биты - количество завершенных таких поворотов
+		std::atomic<std::uint64_t> version;
+		std::atomic<bool> locked;
+
+		Node(const KeyType& _key, ValueType* _value, Node* _parent) : key(_key), value(_value), parent(_parent),
+			left(nullptr), right(nullptr), height(1), version(0), locked(false) {};
+
+		std::atomic<Node*>& child(bool _right) { return _right ? right : left; }
+
+		//Спин-блокировка: удерживается на время нескольких присваиваний
+		void lock()
+		{
+			while (locked.exchange(true, std::memory_order_acquire))
+			{
+				while (locked.load(std::memory_order_relaxed))
+					std::this_thread::yield();
+			}
+		};
+		void unlock() { locked.store(false, std::memory_order_release); };
+	};
+
+	enum class RESULTS
+	{
+		SUCCESS,
+		FAILURE,
+		RETRY
+	};
+
+	enum class OPERATIONS
+	{
+		INSERT,
+		ERASE,
+		SET_VALUE
+	};
+
+	static constexpr std::uint64_t UNLINKED = 1;
+	static constexpr std::uint64_t SHRINKING = 2;
+	static constexpr std::uint64_t SHRINK_STEP = 4;
+
+	//Результаты nodeCondition, неотрицательное значение - новая высота узла
+	static constexpr int NOTHING_REQUIRED = -1;
+	static constexpr int REBALANCE_REQUIRED = -2;
+	static constexpr int UNLINK_REQUIRED = -3;
+
+	struct alignas(64) Counter
+	{
+		std::atomic<int> value{ 0 };
+	};
+
+//Private members:
+private:
+	//Фиктивный узел над корнем: корень - его правый ребенок. Версия и связь с отцом не меняются
+	Node* holder;
+	EpochReclaimer reclaimer;
+
+	//Размер считается по слотам потоков, чтобы изменения не делили одну строку кэша
+	Counter size_counters[EpochReclaimer::SLOTS];
+
+	static int heightOf(Node* _node) { return _node ? _node->height.load() : 0; };
+	static bool isUnlinked(Node* _node) { return _node->version.load() & UNLINKED; };
+	static void waitUntilNotShrinking(Node* _node);
+
+	RESULTS attemptFind(const KeyType& _key, Node* _node, bool _right, std::uint64_t _nodeVersion, ValueType& _value);
+	RESULTS attemptSuccessor(const KeyType* _after, Node* _node, bool _right, std::uint64_t _nodeVersion, Node*& _best);
+	RESULTS attemptUpdate(const KeyType& _key, OPERATIONS _operation, const ValueType* _value,
+		Node* _node, bool _right, std::uint64_t _nodeVersion, int _slot);
+	RESULTS attemptNodeUpdate(OPERATIONS _operation, const ValueType* _value, Node* _parent, Node* _node, int _slot);
+	bool update(const KeyType& _key, OPERATIONS _operation, const ValueType* _value);
+
+	bool attemptUnlink(Node* _parent, Node* _node);
+	int nodeCondition(Node* _node);
+	void fixHeightAndRebalance(Node* _node, int _slot);
+	Node* fixHeight(Node* _node);
+	Node* rebalance(Node* _parent, Node* _node, std::vector<Node*>& _deferred, int _slot);
+	Node* rebalanceTo(Node* _parent, Node* _node, Node* _heavy, int _lightHeight, bool _right, std::vector<Node*>& _deferred);
+	Node* rotate(Node* _parent, Node* _node, Node* _heavy, int _lightHeight, int _outerHeight,
+		Node* _inner, int _innerHeight, bool _right, std::vector<Node*>& _deferred);
+	Node* rotateDouble(Node* _parent, Node* _node, Node* _heavy, int _lightHeight, int _outerHeight,
+		Node* _inner, int _innerOuterHeight, bool _right, std::vector<Node*>& _deferred);
+
+	bool nextEntry(const std::optional<KeyType>& _after, KeyType& _key, ValueType& _value);
+
+	static int validateSubtree(Node* _node, Node* _parent, const KeyType* _low, const KeyType* _high, int& _values);
+
+//Public members:
+public:
+	ConcurrentAVLTree() : holder(new Node(KeyType(), nullptr, nullptr)) {};
+	~ConcurrentAVLTree();
+
+	ConcurrentAVLTree(const ConcurrentAVLTree&) = delete;
+	ConcurrentAVLTree& operator=(const ConcurrentAVLTree&) = delete;
+
+	bool insert(const KeyType& _key, const ValueType& _value) { return update(_key, OPERATIONS::INSERT, &_value); };
+	bool insert(const std::pair<KeyType, ValueType>& _pair) { return insert(_pair.first, _pair.second); };
+	bool erase(const KeyType& _key) { return update(_key, OPERATIONS::ERASE, nullptr); };
+	bool setValue(const KeyType& _key, const ValueType& _value) { return update(_key, OPERATIONS::SET_VALUE, &_value); };
+
+	bool find(const KeyType& _key, ValueType& _value);
+	bool contains(const KeyType& _key);
+
+	int size() const;
+	bool empty() const { return size() == 0; };
+
+	template<typename Function>
+	void forEach(Function&& _function);
+	std::vector<std::pair<KeyType, ValueType>> getVector();
+
+	//Проверяет связи, порядок ключей, высоты и баланс узлов и size(). Вызывается без параллельных операций
+	bool validate() const;
+};
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::~ConcurrentAVLTree()
+{
+	//Параллельных операций уже нет: освобождаем все узлы, достижимые из holder, отложенные освободит reclaimer
+	std::vector<Node*> stack{ holder };
+	while (!stack.empty())
+	{
+		Node* node = stack.back();
+		stack.pop_back();
+
+		if (Node* left = node->left.load())
+			stack.push_back(left);
+		if (Node* right = node->right.load())
+			stack.push_back(right);
+
+		delete node->value.load();
+		delete node;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+void ConcurrentAVLTree<KeyType, ValueType>::waitUntilNotShrinking(Node* _node)
+{
+	//Поворот держит блокировку узла, поэтому после короткого ожидания просто дожидаемся ее
+	for (int i = 0; i < 100; ++i)
+	{
+		if (!(_node->version.load() & SHRINKING))
+			return;
+	}
+
+	_node->lock();
+	_node->unlock();
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::RESULTS ConcurrentAVLTree<KeyType, ValueType>::attemptFind(const KeyType& _key,
+	Node* _node, bool _right, std::uint64_t _nodeVersion, ValueType& _value)
+{
+	//_node проверен версией _nodeVersion: пока она не изменилась, ключ может быть только в его поддереве _right
+	while (true)
+	{
+		Node* child = _node->child(_right).load();
+		if (_node->version.load() != _nodeVersion)
+			return RESULTS::RETRY;
+
+		if (!child)
+			return RESULTS::FAILURE;
+
+		if (_key == child->key)
+		{
+			ValueType* value = child->value.load();
+			if (!value)
+				return RESULTS::FAILURE;
+
+			_value = *value;
+			return RESULTS::SUCCESS;
+		}
+
+		bool nextRight = _key > child->key;
+		std::uint64_t childVersion = child->version.load();
+		if (childVersion & SHRINKING)
+			waitUntilNotShrinking(child);
+		else if (!(childVersion & UNLINKED) && child == _node->child(_right).load())
+		{
+			if (_node->version.load() != _nodeVersion)
+				return RESULTS::RETRY;
+
+			RESULTS result = attemptFind(_key, child, nextRight, childVersion, _value);
+			if (result != RESULTS::RETRY)
+				return result;
+		}
+		//Иначе ребенок сменился или отцеплен - повторяем шаг от _node
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+bool ConcurrentAVLTree<KeyType, ValueType>::find(const KeyType& _key, ValueType& _value)
+{
+	EpochReclaimer::Guard guard(reclaimer);
+	while (true)
+	{
+		RESULTS result = attemptFind(_key, holder, true, holder->version.load(), _value);
+		if (result != RESULTS::RETRY)
+			return result == RESULTS::SUCCESS;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+bool ConcurrentAVLTree<KeyType, ValueType>::contains(const KeyType& _key)
+{
+	ValueType value;
+	return find(_key, value);
+}
+
+template<KEY KeyType, typename ValueType>
+bool ConcurrentAVLTree<KeyType, ValueType>::update(const KeyType& _key, OPERATIONS _operation, const ValueType* _value)
+{
+	EpochReclaimer::Guard guard(reclaimer);
+	while (true)
+	{
+		RESULTS result = attemptUpdate(_key, _operation, _value, holder, true, holder->version.load(), guard.getSlot());
+		if (result == RESULTS::RETRY)
+			continue;
+
+		if (result == RESULTS::SUCCESS && _operation != OPERATIONS::SET_VALUE)
+			size_counters[guard.getSlot()].value.fetch_add((_operation == OPERATIONS::INSERT) ? 1 : -1,
+				std::memory_order_relaxed);
+
+		return result == RESULTS::SUCCESS;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::RESULTS ConcurrentAVLTree<KeyType, ValueType>::attemptUpdate(const KeyType& _key,
+	OPERATIONS _operation, const ValueType* _value, Node* _node, bool _right, std::uint64_t _nodeVersion, int _slot)
+{
+	//Спуск такой же, как в attemptFind
+	while (true)
+	{
+		Node* child = _node->child(_right).load();
+		if (_node->version.load() != _nodeVersion)
+			return RESULTS::RETRY;
+
+		if (!child)
+		{
+			if (_operation != OPERATIONS::INSERT)
+				return RESULTS::FAILURE;
+
+			//Новый лист подвешивается под блокировкой отца, если отец за это время не изменился
+			{
+				std::lock_guard<Node> lock(*_node);
+				if (_node->version.load() != _nodeVersion)
+					return RESULTS::RETRY;
+
+				if (_node->child(_right).load())
+					continue;
+
+				_node->child(_right).store(new Node(_key, new ValueType(*_value), _node));
+			}
+
+			fixHeightAndRebalance(_node, _slot);
+			return RESULTS::SUCCESS;
+		}
+
+		if (_key == child->key)
+			return attemptNodeUpdate(_operation, _value, _node, child, _slot);
+
+		bool nextRight = _key > child->key;
+		std::uint64_t childVersion = child->version.load();
+		if (childVersion & SHRINKING)
+			waitUntilNotShrinking(child);
+		else if (!(childVersion & UNLINKED) && child == _node->child(_right).load())
+		{
+			if (_node->version.load() != _nodeVersion)
+				return RESULTS::RETRY;
+
+			RESULTS result = attemptUpdate(_key, _operation, _value, child, nextRight, childVersion, _slot);
+			if (result != RESULTS::RETRY)
+				return result;
+		}
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::RESULTS ConcurrentAVLTree<KeyType, ValueType>::attemptNodeUpdate(
+	OPERATIONS _operation, const ValueType* _value, Node* _parent, Node* _node, int _slot)
+{
+	//Узел с нужным ключом найден. Отцепленный узел - повтор от отца
+	switch (_operation)
+	{
+	case OPERATIONS::INSERT:
+	{
+		//Ключ может быть только у маршрутного узла: тогда он снова получает значение
+		if (_node->value.load())
+			return RESULTS::FAILURE;
+
+		std::lock_guard<Node> lock(*_node);
+		if (isUnlinked(_node))
+			return RESULTS::RETRY;
+		if (_node->value.load())
+			return RESULTS::FAILURE;
+
+		_node->value.store(new ValueType(*_value));
+		return RESULTS::SUCCESS;
+	}
+	case OPERATIONS::SET_VALUE:
+	{
+		ValueType* previous;
+		{
+			std::lock_guard<Node> lock(*_node);
+			if (isUnlinked(_node))
+				return RESULTS::RETRY;
+
+			previous = _node->value.load();
+			if (!previous)
+				return RESULTS::FAILURE;
+
+			_node->value.store(new ValueType(*_value));
+		}
+
+		reclaimer.retire(_slot, previous);
+		return RESULTS::SUCCESS;
+	}
+	default:
+		break;
+	}
+
+	if (!_node->value.load())
+		return RESULTS::FAILURE;
+
+	ValueType* previous;
+	if (!_node->left.load() || !_node->right.load())
+	{
+		//Не больше одного ребенка: узел отцепляется под блокировками отца и самого узла
+		{
+			std::lock_guard<Node> parentLock(*_parent);
+			if (isUnlinked(_parent) || _node->parent.load() != _parent)
+				return RESULTS::RETRY;
+
+			std::lock_guard<Node> lock(*_node);
+			previous = _node->value.load();
+			if (!previous)
+				return RESULTS::FAILURE;
+
+			if (!attemptUnlink(_parent, _node))
+				return RESULTS::RETRY;
+		}
+
+		reclaimer.retire(_slot, previous);
+		reclaimer.retire(_slot, _node);
+		fixHeightAndRebalance(_parent, _slot);
+		return RESULTS::SUCCESS;
+	}
+
+	//Два ребенка: узел становится маршрутным
+	{
+		std::lock_guard<Node> lock(*_node);
+		if (isUnlinked(_node))
+			return RESULTS::RETRY;
+
+		previous = _node->value.load();
+		if (!previous)
+			return RESULTS::FAILURE;
+
+		_node->value.store(nullptr);
+	}
+
+	reclaimer.retire(_slot, previous);
+
+	//Пока блокировка не была взята, один ребенок мог исчезнуть - тогда маршрутный узел отцепляется сразу
+	fixHeightAndRebalance(_node, _slot);
+	return RESULTS::SUCCESS;
+}
+
+template<KEY KeyType, typename ValueType>
+bool ConcurrentAVLTree<KeyType, ValueType>::attemptUnlink(Node* _parent, Node* _node)
+{
+	//_parent и _node заблокированы. Узел с не больше чем одним ребенком заменяется этим ребенком
+	Node* parentLeft = _parent->left.load();
+	if (parentLeft != _node && _parent->right.load() != _node)
+		return false;
+
+	Node* left = _node->left.load();
+	Node* right = _node->right.load();
+	if (left && right)
+		return false;
+
+	Node* splice = left ? left : right;
+	_parent->child(parentLeft != _node).store(splice);
+	if (splice)
+		splice->parent.store(_parent);
+
+	_node->version.store(UNLINKED);
+	_node->value.store(nullptr);
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+int ConcurrentAVLTree<KeyType, ValueType>::nodeCondition(Node* _node)
+{
+	Node* left = _node->left.load();
+	Node* right = _node->right.load();
+	if ((!left || !right) && !_node->value.load())
+		return UNLINK_REQUIRED;
+
+	int height = _node->height.load();
+	int leftHeight = heightOf(left);
+	int rightHeight = heightOf(right);
+	int newHeight = 1 + std::max(leftHeight, rightHeight);
+	int balance = leftHeight - rightHeight;
+
+	if (balance < -1 || balance > 1)
+		return REBALANCE_REQUIRED;
+
+	return (height != newHeight) ? newHeight : NOTHING_REQUIRED;
+}
+
+template<KEY KeyType, typename ValueType>
+void ConcurrentAVLTree<KeyType, ValueType>::fixHeightAndRebalance(Node* _node, int _slot)
+{
+	//Поднимаемся от измененного узла, пока высоты и балансы не перестанут меняться.
+	//deferred - узлы выше, повреждение которых поворот оставил на потом, исправив сначала нижний узел
+	std::vector<Node*> deferred;
+	Node* node = _node;
+	while (true)
+	{
+		int condition = (node && node->parent.load() && !isUnlinked(node)) ? nodeCondition(node) : NOTHING_REQUIRED;
+		if (condition == NOTHING_REQUIRED)
+		{
+			if (deferred.empty())
+				return;
+
+			node = deferred.back();
+			deferred.pop_back();
+			continue;
+		}
+
+		if (condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED)
+		{
+			Node* parent;
+			{
+				std::lock_guard<Node> lock(*node);
+				parent = fixHeight(node);
+			}
+
+			//Высоты детей меняются под их собственными блокировками: пока высота узла пересчитывалась, другой поток
+			//мог изменить ребенка и проверить узел до нашей записи. Поэтому перед подъемом узел проверяется еще раз
+			if (parent != node && !isUnlinked(node) && nodeCondition(node) != NOTHING_REQUIRED)
+				continue;
+
+			node = parent;
+			continue;
+		}
+
+		//Блокировки всегда берутся сверху вниз: отец, затем узел
+		Node* parent = node->parent.load();
+		std::lock_guard<Node> parentLock(*parent);
+		if (!isUnlinked(parent) && node->parent.load() == parent)
+		{
+			std::lock_guard<Node> lock(*node);
+			node = rebalance(parent, node, deferred, _slot);
+		}
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::Node* ConcurrentAVLTree<KeyType, ValueType>::fixHeight(Node* _node)
+{
+	//_node заблокирован. Возвращает узел, который нужно проверить следующим, либо nullptr
+	int condition = nodeCondition(_node);
+	switch (condition)
+	{
+	case REBALANCE_REQUIRED:
+	case UNLINK_REQUIRED:
+		return _node;
+	case NOTHING_REQUIRED:
+		return nullptr;
+	default:
+		_node->height.store(condition);
+		return _node->parent.load();
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::Node* ConcurrentAVLTree<KeyType, ValueType>::rebalance(Node* _parent,
+	Node* _node, std::vector<Node*>& _deferred, int _slot)
+{
+	//_parent и _node заблокированы
+	Node* left = _node->left.load();
+	Node* right = _node->right.load();
+	if ((!left || !right) && !_node->value.load())
+	{
+		if (!attemptUnlink(_parent, _node))
+			return _node;
+
+		reclaimer.retire(_slot, _node);
+		return fixHeight(_parent);
+	}
+
+	int height = _node->height.load();
+	int leftHeight = heightOf(left);
+	int rightHeight = heightOf(right);
+	int newHeight = 1 + std::max(leftHeight, rightHeight);
+	int balance = leftHeight - rightHeight;
+
+	if (balance > 1)
+		return rebalanceTo(_parent, _node, left, rightHeight, true, _deferred);
+	if (balance < -1)
+		return rebalanceTo(_parent, _node, right, leftHeight, false, _deferred);
+
+	if (newHeight != height)
+	{
+		_node->height.store(newHeight);
+		return fixHeight(_parent);
+	}
+
+	return nullptr;
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::Node* ConcurrentAVLTree<KeyType, ValueType>::rebalanceTo(Node* _parent,
+	Node* _node, Node* _heavy, int _lightHeight, bool _right, std::vector<Node*>& _deferred)
+{
+	//Поворот в сторону _right (true - правый): тяжелый ребенок _heavy поднимается на место _node.
+	//Внешний внук (_heavy->child(!_right)) остается под _heavy, внутренний (_heavy->child(_right)) переходит к _node.
+	//Симметричные случаи записаны одной веткой, как в RBBalancer
+	std::lock_guard<Node> heavyLock(*_heavy);
+	int heavyHeight = _heavy->height.load();
+	if (heavyHeight - _lightHeight <= 1)
+		return _node;
+
+	Node* inner = _heavy->child(_right).load();
+	int outerHeight = heightOf(_heavy->child(!_right).load());
+	int innerHeight = heightOf(inner);
+	if (outerHeight >= innerHeight)
+		return rotate(_parent, _node, _heavy, _lightHeight, outerHeight, inner, innerHeight, _right, _deferred);
+
+	{
+		std::lock_guard<Node> innerLock(*inner);
+		innerHeight = inner->height.load();
+		if (outerHeight >= innerHeight)
+			return rotate(_parent, _node, _heavy, _lightHeight, outerHeight, inner, innerHeight, _right, _deferred);
+
+		//Если после двойного поворота _heavy остался бы несбалансированным или лишним маршрутным узлом,
+		//сначала отдельно поворачиваем _heavy в обратную сторону. Но если сам _heavy сбалансирован, такой
+		//поворот ничего не исправит, и повреждение _heavy чинится уже после двойного поворота
+		int innerOuterHeight = heightOf(inner->child(!_right).load());
+		int balance = outerHeight - innerOuterHeight;
+		bool heavyDamaged = balance < -1 || balance > 1 ||
+			((outerHeight == 0 || innerOuterHeight == 0) && !_heavy->value.load());
+		if (!heavyDamaged || innerHeight - outerHeight <= 1)
+			return rotateDouble(_parent, _node, _heavy, _lightHeight, outerHeight, inner, innerOuterHeight, _right,
+				_deferred);
+	}
+
+	return rebalanceTo(_node, _heavy, inner, outerHeight, !_right, _deferred);
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::Node* ConcurrentAVLTree<KeyType, ValueType>::rotate(Node* _parent,
+	Node* _node, Node* _heavy, int _lightHeight, int _outerHeight, Node* _inner, int _innerHeight, bool _right,
+	std::vector<Node*>& _deferred)
+{
+	//Одинарный поворот. Диапазон ключей _node сужается, поэтому на время поворота его версия отмечена SHRINKING
+	std::uint64_t nodeVersion = _node->version.load();
+	Node* parentLeft = _parent->left.load();
+
+	_node->version.store(nodeVersion | SHRINKING);
+
+	_node->child(!_right).store(_inner);
+	if (_inner)
+		_inner->parent.store(_node);
+
+	_heavy->child(_right).store(_node);
+	_node->parent.store(_heavy);
+
+	_parent->child(parentLeft != _node).store(_heavy);
+	_heavy->parent.store(_parent);
+
+	int nodeHeight = 1 + std::max(_innerHeight, _lightHeight);
+	_node->height.store(nodeHeight);
+	_heavy->height.store(1 + std::max(_outerHeight, nodeHeight));
+
+	_node->version.store(nodeVersion + SHRINK_STEP);
+
+	//Какой узел проверить следующим: опустившийся _node, поднявшийся _heavy или отец.
+	//Высота поддерева могла измениться, поэтому при исправлении нижнего узла отец откладывается
+	int nodeBalance = _innerHeight - _lightHeight;
+	int heavyBalance = _outerHeight - nodeHeight;
+	Node* damaged = nullptr;
+	if (nodeBalance < -1 || nodeBalance > 1 || ((!_inner || _lightHeight == 0) && !_node->value.load()))
+		damaged = _node;
+	else if (heavyBalance < -1 || heavyBalance > 1 || (_outerHeight == 0 && !_heavy->value.load()))
+		damaged = _heavy;
+
+	if (!damaged)
+		return fixHeight(_parent);
+
+	_deferred.push_back(_parent);
+	return damaged;
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::Node* ConcurrentAVLTree<KeyType, ValueType>::rotateDouble(Node* _parent,
+	Node* _node, Node* _heavy, int _lightHeight, int _outerHeight, Node* _inner, int _innerOuterHeight, bool _right,
+	std::vector<Node*>& _deferred)
+{
+	//Двойной поворот: внутренний внук _inner поднимается на место _node, сужаются диапазоны _node и _heavy
+	std::uint64_t nodeVersion = _node->version.load();
+	std::uint64_t heavyVersion = _heavy->version.load();
+	Node* parentLeft = _parent->left.load();
+	Node* innerOuter = _inner->child(!_right).load();
+	Node* innerInner = _inner->child(_right).load();
+	int innerInnerHeight = heightOf(innerInner);
+
+	_node->version.store(nodeVersion | SHRINKING);
+	_heavy->version.store(heavyVersion | SHRINKING);
+
+	_node->child(!_right).store(innerInner);
+	if (innerInner)
+		innerInner->parent.store(_node);
+
+	_heavy->child(_right).store(innerOuter);
+	if (innerOuter)
+		innerOuter->parent.store(_heavy);
+
+	_inner->child(!_right).store(_heavy);
+	_heavy->parent.store(_inner);
+	_inner->child(_right).store(_node);
+	_node->parent.store(_inner);
+
+	_parent->child(parentLeft != _node).store(_inner);
+	_inner->parent.store(_parent);
+
+	int nodeHeight = 1 + std::max(innerInnerHeight, _lightHeight);
+	int heavyHeight = 1 + std::max(_outerHeight, _innerOuterHeight);
+	_node->height.store(nodeHeight);
+	_heavy->height.store(heavyHeight);
+	_inner->height.store(1 + std::max(heavyHeight, nodeHeight));
+
+	_node->version.store(nodeVersion + SHRINK_STEP);
+	_heavy->version.store(heavyVersion + SHRINK_STEP);
+
+	//Опустившиеся _node и _heavy исправляются раньше поднявшегося _inner и отца
+	int nodeBalance = innerInnerHeight - _lightHeight;
+	int heavyBalance = _outerHeight - _innerOuterHeight;
+	int innerBalance = heavyHeight - nodeHeight;
+	bool nodeDamaged = nodeBalance < -1 || nodeBalance > 1 || ((!innerInner || _lightHeight == 0) && !_node->value.load());
+	bool heavyDamaged = heavyBalance < -1 || heavyBalance > 1 ||
+		((_outerHeight == 0 || _innerOuterHeight == 0) && !_heavy->value.load());
+	bool innerDamaged = innerBalance < -1 || innerBalance > 1;
+	if (!nodeDamaged && !heavyDamaged && !innerDamaged)
+		return fixHeight(_parent);
+
+	_deferred.push_back(_parent);
+	if (innerDamaged && (nodeDamaged || heavyDamaged))
+		_deferred.push_back(_inner);
+	if (nodeDamaged && heavyDamaged)
+		_deferred.push_back(_heavy);
+
+	return nodeDamaged ? _node : (heavyDamaged ? _heavy : _inner);
+}
+
+template<KEY KeyType, typename ValueType>
+ConcurrentAVLTree<KeyType, ValueType>::RESULTS ConcurrentAVLTree<KeyType, ValueType>::attemptSuccessor(
+	const KeyType* _after, Node* _node, bool _right, std::uint64_t _nodeVersion, Node*& _best)
+{
+	//Спуск как в attemptFind к наименьшему ключу больше *_after (nullptr - к наименьшему ключу).
+	//_best - последний узел, в левое поддерево которого ушел спуск
+	while (true)
+	{
+		Node* child = _node->child(_right).load();
+		if (_node->version.load() != _nodeVersion)
+			return RESULTS::RETRY;
+
+		if (!child)
+			return RESULTS::SUCCESS;
+
+		bool nextRight = _after && !(*_after < child->key);
+		std::uint64_t childVersion = child->version.load();
+		if (childVersion & SHRINKING)
+			waitUntilNotShrinking(child);
+		else if (!(childVersion & UNLINKED) && child == _node->child(_right).load())
+		{
+			if (_node->version.load() != _nodeVersion)
+				return RESULTS::RETRY;
+
+			Node* best = nextRight ? _best : child;
+			RESULTS result = attemptSuccessor(_after, child, nextRight, childVersion, best);
+			if (result != RESULTS::RETRY)
+			{
+				_best = best;
+				return result;
+			}
+		}
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+bool ConcurrentAVLTree<KeyType, ValueType>::nextEntry(const std::optional<KeyType>& _after, KeyType& _key,
+	ValueType& _value)
+{
+	EpochReclaimer::Guard guard(reclaimer);
+	const KeyType* after = _after ? &*_after : nullptr;
+	while (true)
+	{
+		Node* best = nullptr;
+		if (attemptSuccessor(after, holder, true, holder->version.load(), best) == RESULTS::RETRY)
+			continue;
+
+		if (!best)
+			return false;
+
+		//Маршрутный или уже удаленный узел пропускаем. Узел не освободится, пока действует guard
+		ValueType* value = best->value.load();
+		if (value)
+		{
+			_key = best->key;
+			_value = *value;
+			return true;
+		}
+
+		after = &best->key;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+template<typename Function>
+void ConcurrentAVLTree<KeyType, ValueType>::forEach(Function&& _function)
+{
+	//Вызывает _function(const KeyType&, const ValueType&) в порядке возрастания ключей. Каждый следующий ключ
+	//ищется отдельным спуском, поэтому обход не мешает изменениям, но и не является мгновенным снимком:
+	//ключи, добавленные или удаленные во время обхода, могут быть как пройдены, так и пропущены
+	std::optional<KeyType> after;
+	KeyType key;
+	ValueType value;
+	while (nextEntry(after, key, value))
+	{
+		_function(static_cast<const KeyType&>(key), static_cast<const ValueType&>(value));
+		after = key;
+	}
+}
+
+template<KEY KeyType, typename ValueType>
+std::vector<std::pair<KeyType, ValueType>> ConcurrentAVLTree<KeyType, ValueType>::getVector()
+{
+	std::vector<std::pair<KeyType, ValueType>> vector;
+	forEach([&](const KeyType& _key, const ValueType& _value) { vector.emplace_back(_key, _value); });
+	return vector;
+}
+
+template<KEY KeyType, typename ValueType>
+int ConcurrentAVLTree<KeyType, ValueType>::size() const
+{
+	int total = 0;
+	for (const Counter& counter : size_counters)
+		total += counter.value.load(std::memory_order_relaxed);
+
+	return total;
+}
+
+template<KEY KeyType, typename ValueType>
+int ConcurrentAVLTree<KeyType, ValueType>::validateSubtree(Node* _node, Node* _parent, const KeyType* _low,
+	const KeyType* _high, int& _values)
+{
+	//Возвращает высоту поддерева или -1, если оно нарушает инварианты
+	if (!_node)
+		return 0;
+
+	if (_node->parent.load() != _parent || _node->version.load() & (UNLINKED | SHRINKING) || _node->locked.load())
+		return -1;
+	if ((_low && !(*_low < _node->key)) || (_high && !(_node->key < *_high)))
+		return -1;
+
+	Node* left = _node->left.load();
+	Node* right = _node->right.load();
+
+	//Маршрутный узел с одним ребенком отцепляется, как только теряет второго
+	if (_node->value.load())
+		++_values;
+	else if (!left || !right)
+		return -1;
+
+	int leftHeight = validateSubtree(left, _node, _low, &_node->key, _values);
+	int rightHeight = validateSubtree(right, _node, &_node->key, _high, _values);
+	if (leftHeight < 0 || rightHeight < 0 || std::abs(leftHeight - rightHeight) > 1)
+		return -1;
+
+	int height = 1 + std::max(leftHeight, rightHeight);
+	return (_node->height.load() == height) ? height : -1;
+}
+
+template<KEY KeyType, typename ValueType>
+bool ConcurrentAVLTree<KeyType, ValueType>::validate() const
+{
+	int values = 0;
+	if (holder->left.load() || validateSubtree(holder->right.load(), holder, nullptr, nullptr, values) < 0)
+		return false;
+
+	return values == size();
+}
+
+//------------------------------------------------------------------------------------------------------
+//--------------------------------------- CLASS CONCURRENTAVLTREE --------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
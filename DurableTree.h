@@ -0,0 +1,365 @@
+﻿#ifndef DURABLETREE_H
+#define DURABLETREE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+
+#include "BinaryTrees.h"
+#include "FrozenTree.h"
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASS DURABLETREE -----------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Обертка над деревом, которая записывает каждое успешное изменение в журнал (write-ahead log)
+//в каталоге _directory и восстанавливает дерево после сбоя.
+//Файлы каталога:
+//	snapshot.frz - последняя контрольная точка в формате FrozenTree;
+//	wal.log - изменения, сделанные после контрольной точки.
+//TreeType - дерево без одинаковых ключей: снимок FrozenTree хранит ключи строго по возрастанию,
+//а повторное применение журнала поверх снимка безопасно, только если вставка существующего ключа ничего не меняет
+template<KEY KeyType, typename ValueType, typename TreeType = RBTree<KeyType, ValueType>>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+class DurableTree
+{
+	static_assert(std::derived_from<TreeType, Tree<KeyType, ValueType>> && !MULTI_TREE<TreeType, KeyType, ValueType>,
+		"DurableTree requires a tree with unique keys");
+
+//Private structs:
+private:
+	enum class OPERATIONS : std::uint8_t
+	{
+		INSERT = 1,
+		ERASE = 2,
+		SET_VALUE = 3
+	};
+
+	//Запись журнала: [4 байта контрольной суммы][1 байт операции][ключ][значение]
+	static constexpr std::size_t RECORD_SIZE = sizeof(std::uint32_t) + 1 + sizeof(KeyType) + sizeof(ValueType);
+
+//Private members:
+private:
+	TreeType tree;
+
+	std::filesystem::path directory;
+	std::FILE* log;
+
+	int syncBatch;
+	int pendingRecords;
+	std::uint64_t checkpointInterval;
+	std::uint64_t recordsSinceCheckpoint;
+
+	static std::uint32_t checksum(const unsigned char* _data, std::size_t _size);
+
+	bool appendRecord(OPERATIONS _operation, const KeyType& _key, const ValueType* _value);
+	void checkpointIfDue();
+	bool loadSnapshot();
+	bool replayLog();
+
+	std::filesystem::path snapshotPath() const { return directory / "snapshot.frz"; };
+	std::filesystem::path logPath() const { return directory / "wal.log"; };
+
+//Public members:
+public:
+	DurableTree() : log(nullptr), syncBatch(1), pendingRecords(0),
+		checkpointInterval(0), recordsSinceCheckpoint(0) {};
+
+	~DurableTree() { close(); };
+
+	DurableTree(const DurableTree&) = delete;
+	DurableTree& operator=(const DurableTree&) = delete;
+
+	bool open(const std::string& _directory, int _syncBatch = 1, std::uint64_t _checkpointInterval = 0);
+	bool close();
+	bool isOpen() const { return log != nullptr; };
+
+	bool empty() const { return tree.empty(); };
+	int size() const { return tree.size(); };
+
+	bool insert(const KeyType& _key, const ValueType& _value);
+	bool insert(const std::pair<KeyType, ValueType>& _pair) { return insert(_pair.first, _pair.second); };
+	bool erase(const KeyType& _key);
+	bool setValue(const KeyType& _key, const ValueType& _value);
+
+	typename TreeType::Iterator find(const KeyType& _key) { return tree.find(_key); };
+	const TreeType& getTree() const { return tree; };
+
+	bool sync();
+	bool checkpoint();
+};
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+std::uint32_t DurableTree<KeyType, ValueType, TreeType>::checksum(const unsigned char* _data, std::size_t _size)
+{
+	//FNV-1a
+	std::uint32_t hash = 2166136261u;
+	for (std::size_t i = 0; i < _size; ++i)
+	{
+		hash ^= _data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::open(const std::string& _directory, int _syncBatch,
+	std::uint64_t _checkpointInterval)
+{
+	if (log)
+		return false;
+
+	directory = _directory;
+	syncBatch = (_syncBatch > 0) ? _syncBatch : 1;
+	checkpointInterval = _checkpointInterval;
+	pendingRecords = 0;
+	recordsSinceCheckpoint = 0;
+
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	if (error)
+		return false;
+
+	tree.clear();
+	if (!loadSnapshot() || !replayLog())
+	{
+		tree.clear();
+		return false;
+	}
+
+	log = std::fopen(logPath().string().c_str(), "ab");
+	return log != nullptr;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::close()
+{
+	if (!log)
+		return false;
+
+	bool result = syncFile(log);
+	if (std::fclose(log) != 0)
+		result = false;
+
+	log = nullptr;
+	pendingRecords = 0;
+	return result;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::loadSnapshot()
+{
+	if (!std::filesystem::exists(snapshotPath()))
+		return true;
+
+	FrozenTree<KeyType, ValueType> snapshot;
+	if (!snapshot.open(snapshotPath().string()))
+		return false;
+
+	//Снимок отсортирован, поэтому дерево строится за линейное время
+	auto it = snapshot.begin();
+	std::pair<KeyType, ValueType> pair;
+	return tree.buildFromSorted(static_cast<int>(snapshot.size()), [&]() -> const std::pair<KeyType, ValueType>&
+	{
+		auto entry = *it;
+		pair.first = entry.first;
+		pair.second = entry.second;
+		++it;
+		return pair;
+	});
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::replayLog()
+{
+	std::FILE* file = std::fopen(logPath().string().c_str(), "rb");
+	if (!file)
+		return true;
+
+	//Журнал может содержать операции, уже вошедшие в контрольную точку (сбой между записью
+	//снимка и очисткой журнала). В журнал попадают только успешные операции, поэтому
+	//их повторное применение к снимку дает то же состояние.
+	unsigned char record[RECORD_SIZE];
+	std::uint64_t validBytes = 0;
+	while (std::fread(record, RECORD_SIZE, 1, file) == 1)
+	{
+		std::uint32_t storedChecksum;
+		std::memcpy(&storedChecksum, record, sizeof(std::uint32_t));
+		if (storedChecksum != checksum(record + sizeof(std::uint32_t), RECORD_SIZE - sizeof(std::uint32_t)))
+			break;
+
+		OPERATIONS operation = static_cast<OPERATIONS>(record[sizeof(std::uint32_t)]);
+		KeyType key;
+		ValueType value;
+		std::memcpy(&key, record + sizeof(std::uint32_t) + 1, sizeof(KeyType));
+		std::memcpy(&value, record + sizeof(std::uint32_t) + 1 + sizeof(KeyType), sizeof(ValueType));
+
+		switch (operation)
+		{
+		case OPERATIONS::INSERT:
+			tree.insert(key, value);
+			break;
+		case OPERATIONS::ERASE:
+			tree.erase(key);
+			break;
+		case OPERATIONS::SET_VALUE:
+			tree.setValue(key, value);
+			break;
+		default:
+			break;
+		}
+
+		validBytes += RECORD_SIZE;
+		++recordsSinceCheckpoint;
+	}
+	std::fclose(file);
+
+	//Отрезаем недописанную при сбое запись, чтобы новые записи шли сразу за последней целой
+	std::error_code error;
+	if (std::filesystem::file_size(logPath(), error) != validBytes)
+		std::filesystem::resize_file(logPath(), validBytes, error);
+
+	return !error;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::appendRecord(OPERATIONS _operation, const KeyType& _key,
+	const ValueType* _value)
+{
+	unsigned char record[RECORD_SIZE];
+	record[sizeof(std::uint32_t)] = static_cast<unsigned char>(_operation);
+	std::memcpy(record + sizeof(std::uint32_t) + 1, &_key, sizeof(KeyType));
+	if (_value)
+		std::memcpy(record + sizeof(std::uint32_t) + 1 + sizeof(KeyType), _value, sizeof(ValueType));
+	else
+		std::memset(record + sizeof(std::uint32_t) + 1 + sizeof(KeyType), 0, sizeof(ValueType));
+
+	std::uint32_t recordChecksum = checksum(record + sizeof(std::uint32_t), RECORD_SIZE - sizeof(std::uint32_t));
+	std::memcpy(record, &recordChecksum, sizeof(std::uint32_t));
+
+	//Групповая фиксация: fsync выполняется один раз на syncBatch записей.
+	//После ошибки записи неизвестно, какая часть журнала дошла до диска, поэтому журнал закрывается:
+	//изменения больше не принимаются, а повторный open() восстановит дерево по тому, что записано
+	if (std::fwrite(record, RECORD_SIZE, 1, log) != 1 || (++pendingRecords >= syncBatch && !sync()))
+	{
+		std::fclose(log);
+		log = nullptr;
+		pendingRecords = 0;
+		return false;
+	}
+
+	++recordsSinceCheckpoint;
+	return true;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+void DurableTree<KeyType, ValueType, TreeType>::checkpointIfDue()
+{
+	//Операция к этому моменту уже записана в журнал и применена, поэтому неудачная контрольная точка
+	//не отменяет ее: журнал остается целым, и следующая операция попробует снова
+	if (checkpointInterval && recordsSinceCheckpoint >= checkpointInterval)
+		checkpoint();
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::insert(const KeyType& _key, const ValueType& _value)
+{
+	//Сначала запись в журнал, потом изменение дерева: если запись не удалась, дерево не меняется
+	if (!log || tree.count(_key))
+		return false;
+
+	if (!appendRecord(OPERATIONS::INSERT, _key, &_value))
+		return false;
+
+	tree.insert(_key, _value);
+	checkpointIfDue();
+	return true;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::erase(const KeyType& _key)
+{
+	if (!log || !tree.count(_key) || !appendRecord(OPERATIONS::ERASE, _key, nullptr))
+		return false;
+
+	tree.erase(_key);
+	checkpointIfDue();
+	return true;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::setValue(const KeyType& _key, const ValueType& _value)
+{
+	if (!log || !tree.count(_key) || !appendRecord(OPERATIONS::SET_VALUE, _key, &_value))
+		return false;
+
+	tree.setValue(_key, _value);
+	checkpointIfDue();
+	return true;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::sync()
+{
+	if (!log)
+		return false;
+
+	pendingRecords = 0;
+	return syncFile(log);
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool DurableTree<KeyType, ValueType, TreeType>::checkpoint()
+{
+	if (!log)
+		return false;
+
+	//Снимок сначала пишется во временный файл и только после fsync заменяет старый,
+	//поэтому при сбое на диске всегда остается целая контрольная точка
+	//write проверяет каждую запись: если хоть одна не попала в снимок, журнал не очищается
+	std::filesystem::path temporaryPath = directory / "snapshot.tmp";
+	if (!FrozenTree<KeyType, ValueType>::write(tree, temporaryPath.string(), true))
+		return false;
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, snapshotPath(), error);
+	if (error)
+		return false;
+
+	//Журнал можно очищать только после того, как на диск попала и запись каталога с новым снимком:
+	//иначе после сбоя в каталоге может остаться старый снимок рядом с пустым журналом
+	if (!syncDirectory(directory.string()))
+		return false;
+
+	//Все записи журнала вошли в снимок - начинаем журнал заново. Журнал открыт на дозапись,
+	//поэтому после усечения новые записи пойдут с начала файла, а при ошибке он остается открытым и целым
+	if (!sync())
+		return false;
+
+	std::filesystem::resize_file(logPath(), 0, error);
+	if (error || !syncFile(log))
+		return false;
+
+	recordsSinceCheckpoint = 0;
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASS DURABLETREE -----------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
@@ -0,0 +1,351 @@
+﻿#ifndef EXTERNALBUILDER_H
+#define EXTERNALBUILDER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <limits>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BinaryTrees.h"
+#include "FrozenTree.h"
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------- CLASS EXTERNALTREEBUILDER -------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Строит дерево из неотсортированного потока пар, который не помещается в память.
+//Пары накапливаются в буфере размером не больше _memoryBudget байт, отсортированный буфер
+//сбрасывается во временный файл (серию), а затем серии сливаются в файл формата FrozenTree.
+//Одновременно открыто не больше _maxOpenRuns серий: если серий больше, они сливаются в несколько проходов.
+//Для одинаковых ключей, как и в Tree::insert, сохраняется пара, добавленная первой.
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+class ExternalTreeBuilder
+{
+	using Entry = typename FrozenTree<KeyType, ValueType>::Entry;
+
+//Private members:
+private:
+	std::vector<Entry> buffer;
+	std::size_t bufferCapacity;
+	std::size_t maxOpenRuns;
+
+	std::filesystem::path workDirectory;
+	std::vector<std::filesystem::path> runs;
+	std::size_t mergePasses;
+	bool failed;
+
+	bool flushRun();
+	void removeRuns();
+
+	template<typename Output>
+	bool mergeRuns(std::size_t _first, std::size_t _last, Output&& _output);
+	bool mergePass();
+
+//Public members:
+public:
+	ExternalTreeBuilder(std::size_t _memoryBudget,
+		const std::string& _temporaryDirectory = std::filesystem::temp_directory_path().string(),
+		std::size_t _maxOpenRuns = 64);
+
+	~ExternalTreeBuilder() { removeRuns(); };
+
+	ExternalTreeBuilder(const ExternalTreeBuilder&) = delete;
+	ExternalTreeBuilder& operator=(const ExternalTreeBuilder&) = delete;
+
+	bool add(const KeyType& _key, const ValueType& _value);
+	bool add(const std::pair<KeyType, ValueType>& _pair) { return add(_pair.first, _pair.second); };
+	bool addFile(const std::string& _path);
+
+	bool writeFrozen(const std::string& _path);
+	template<typename TreeType>
+		requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+	bool build(TreeType& _tree);
+
+	std::size_t runCount() const { return runs.size(); };
+	std::size_t mergePassCount() const { return mergePasses; };
+};
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+ExternalTreeBuilder<KeyType, ValueType>::ExternalTreeBuilder(std::size_t _memoryBudget,
+	const std::string& _temporaryDirectory, std::size_t _maxOpenRuns) : mergePasses(0), failed(false)
+{
+	bufferCapacity = std::max<std::size_t>(_memoryBudget / sizeof(Entry), 1);
+	maxOpenRuns = std::max<std::size_t>(_maxOpenRuns, 2);
+
+	//Серии складываются в отдельный каталог, чтобы несколько построителей не мешали друг другу
+	std::random_device device;
+	std::uint64_t id = (static_cast<std::uint64_t>(device()) << 32) | device();
+	workDirectory = std::filesystem::path(_temporaryDirectory) / ("trees_runs_" + std::to_string(id));
+
+	std::error_code error;
+	std::filesystem::create_directories(workDirectory, error);
+	if (error)
+		failed = true;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+void ExternalTreeBuilder<KeyType, ValueType>::removeRuns()
+{
+	std::error_code error;
+	std::filesystem::remove_all(workDirectory, error);
+	runs.clear();
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool ExternalTreeBuilder<KeyType, ValueType>::flushRun()
+{
+	if (buffer.empty())
+		return true;
+
+	//stable_sort сохраняет порядок поступления одинаковых ключей, оставляем только первый из них
+	std::stable_sort(buffer.begin(), buffer.end(),
+		[](const Entry& _entry1, const Entry& _entry2) { return _entry1.key < _entry2.key; });
+	auto last = std::unique(buffer.begin(), buffer.end(),
+		[](const Entry& _entry1, const Entry& _entry2) { return _entry1.key == _entry2.key; });
+
+	std::filesystem::path path = workDirectory / ("run_0_" + std::to_string(runs.size()) + ".tmp");
+	std::FILE* file = std::fopen(path.string().c_str(), "wb");
+	if (!file)
+		return false;
+
+	std::size_t count = static_cast<std::size_t>(last - buffer.begin());
+	bool result = std::fwrite(buffer.data(), sizeof(Entry), count, file) == count;
+	if (std::fclose(file) != 0)
+		result = false;
+
+	runs.push_back(path);
+	buffer.clear();
+	return result;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool ExternalTreeBuilder<KeyType, ValueType>::add(const KeyType& _key, const ValueType& _value)
+{
+	if (failed)
+		return false;
+
+	if (buffer.capacity() < bufferCapacity)
+		buffer.reserve(bufferCapacity);
+
+	//Байты выравнивания обнуляются, как в FrozenTree::Writer::append: серии и итоговый файл детерминированы
+	Entry entry{};
+	entry.key = _key;
+	entry.value = _value;
+	buffer.push_back(entry);
+
+	if (buffer.size() >= bufferCapacity && !flushRun())
+		failed = true;
+
+	return !failed;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool ExternalTreeBuilder<KeyType, ValueType>::addFile(const std::string& _path)
+{
+	//Файл содержит записи Entry подряд, без заголовка
+	std::FILE* file = std::fopen(_path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	Entry entry{};
+	while (std::fread(&entry, sizeof(Entry), 1, file) == 1)
+	{
+		if (!add(entry.key, entry.value))
+			break;
+	}
+
+	std::fclose(file);
+	return !failed;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+template<typename Output>
+bool ExternalTreeBuilder<KeyType, ValueType>::mergeRuns(std::size_t _first, std::size_t _last, Output&& _output)
+{
+	//Многопутевое слияние серий [_first, _last): в куче лежит текущая запись каждой серии,
+	//при равных ключах первой выходит запись более ранней серии, и только она передается в _output
+	struct Cursor
+	{
+		std::FILE* file;
+		Entry entry{};
+		std::size_t run;
+	};
+
+	auto greater = [](const Cursor* _cursor1, const Cursor* _cursor2)
+	{
+		if (_cursor1->entry.key == _cursor2->entry.key)
+			return _cursor1->run > _cursor2->run;
+		return _cursor2->entry.key < _cursor1->entry.key;
+	};
+
+	std::vector<Cursor> cursors(_last - _first);
+	std::priority_queue<Cursor*, std::vector<Cursor*>, decltype(greater)> heap(greater);
+
+	bool result = true;
+	for (std::size_t i = 0; i < cursors.size(); ++i)
+	{
+		cursors[i].run = i;
+		cursors[i].file = std::fopen(runs[_first + i].string().c_str(), "rb");
+		if (!cursors[i].file)
+		{
+			result = false;
+			continue;
+		}
+
+		if (std::fread(&cursors[i].entry, sizeof(Entry), 1, cursors[i].file) == 1)
+			heap.push(&cursors[i]);
+	}
+
+	bool hasLast = false;
+	KeyType lastKey{};
+	while (result && !heap.empty())
+	{
+		Cursor* cursor = heap.top();
+		heap.pop();
+
+		if (!hasLast || !(lastKey == cursor->entry.key))
+		{
+			result = _output(cursor->entry);
+			lastKey = cursor->entry.key;
+			hasLast = true;
+		}
+
+		if (std::fread(&cursor->entry, sizeof(Entry), 1, cursor->file) == 1)
+			heap.push(cursor);
+	}
+
+	for (Cursor& cursor : cursors)
+	{
+		if (cursor.file)
+			std::fclose(cursor.file);
+	}
+
+	return result;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool ExternalTreeBuilder<KeyType, ValueType>::mergePass()
+{
+	//Соседние группы по maxOpenRuns серий сливаются в новые серии. Группы идут в порядке серий,
+	//поэтому более ранняя пара с одинаковым ключом остается в более ранней серии
+	++mergePasses;
+	std::vector<std::filesystem::path> merged;
+	for (std::size_t first = 0; first < runs.size(); first += maxOpenRuns)
+	{
+		std::size_t last = std::min(first + maxOpenRuns, runs.size());
+		std::filesystem::path path = workDirectory /
+			("run_" + std::to_string(mergePasses) + "_" + std::to_string(merged.size()) + ".tmp");
+		merged.push_back(path);
+
+		std::FILE* file = std::fopen(path.string().c_str(), "wb");
+		if (!file)
+			return false;
+
+		bool result = mergeRuns(first, last, [file](const Entry& _entry)
+		{
+			return std::fwrite(&_entry, sizeof(Entry), 1, file) == 1;
+		});
+		if (std::fclose(file) != 0 || !result)
+			return false;
+
+		//Слитые серии больше не нужны - диск занимают только два поколения серий
+		std::error_code error;
+		for (std::size_t i = first; i < last; ++i)
+			std::filesystem::remove(runs[i], error);
+	}
+
+	runs = std::move(merged);
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool ExternalTreeBuilder<KeyType, ValueType>::writeFrozen(const std::string& _path)
+{
+	if (failed || !flushRun())
+	{
+		removeRuns();
+		return false;
+	}
+
+	bool result = true;
+	while (result && runs.size() > maxOpenRuns)
+		result = mergePass();
+
+	typename FrozenTree<KeyType, ValueType>::Writer writer;
+	if (result && writer.open(_path))
+	{
+		result = mergeRuns(0, runs.size(), [&writer](const Entry& _entry)
+		{
+			return writer.append(_entry.key, _entry.value);
+		});
+
+		if (!writer.close())
+			result = false;
+	}
+	else
+		result = false;
+
+	removeRuns();
+	return result;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+template<typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool ExternalTreeBuilder<KeyType, ValueType>::build(TreeType& _tree)
+{
+	//Сливаем серии во временный файл FrozenTree и строим по нему дерево за линейное время,
+	//читая отображенный файл последовательно
+	std::filesystem::path path = workDirectory.string() + ".frz";
+	if (!writeFrozen(path.string()))
+		return false;
+
+	bool result;
+	{
+		FrozenTree<KeyType, ValueType> frozen;
+		result = frozen.open(path.string());
+
+		//Размер Tree хранится в int, поэтому больше INT_MAX пар в одно дерево не помещается
+		std::uint64_t count = result ? frozen.size() : 0;
+		if (count > static_cast<std::uint64_t>(std::numeric_limits<int>::max()))
+			result = false;
+
+		if (result)
+		{
+			auto it = frozen.begin();
+			std::pair<KeyType, ValueType> pair;
+			result = _tree.buildFromSorted(static_cast<int>(count), [&]() -> const std::pair<KeyType, ValueType>&
+			{
+				auto entry = *it;
+				pair.first = entry.first;
+				pair.second = entry.second;
+				++it;
+				return pair;
+			});
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::remove(path, error);
+	return result;
+}
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------- CLASS EXTERNALTREEBUILDER -------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
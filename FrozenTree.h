@@ -0,0 +1,443 @@
+﻿#ifndef FROZENTREE_H
+#define FROZENTREE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <type_traits>
+
+#include "BinaryTrees.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Типы, которые можно хранить в файле побайтово
+template<typename T>
+concept FROZEN = std::is_trivially_copyable_v<T>;
+
+//Сбрасывает буферы файла и дожидается их записи на диск
+inline bool syncFile(std::FILE* _file)
+{
+	if (std::fflush(_file) != 0)
+		return false;
+
+#ifdef _WIN32
+	return _commit(_fileno(_file)) == 0;
+#else
+	return fsync(fileno(_file)) == 0;
+#endif
+}
+
+//Сбрасывает на диск запись каталога, чтобы переименование файла в нем пережило сбой питания.
+//В Windows метаданные NTFS журналируются самой файловой системой, и каталог открыть для fsync нельзя
+inline bool syncDirectory(const std::string& _path)
+{
+#ifdef _WIN32
+	(void)_path;
+	return true;
+#else
+	int descriptor = ::open(_path.c_str(), O_RDONLY);
+	if (descriptor < 0)
+		return false;
+
+	bool result = fsync(descriptor) == 0;
+	if (::close(descriptor) != 0)
+		result = false;
+	return result;
+#endif
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASS FROZENTREE ------------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Неизменяемое отображение, хранящееся в файле в виде отсортированного массива записей.
+//Файл не содержит указателей: неявное сбалансированное дерево задается индексами массива,
+//поэтому файл можно отобразить в память (mmap) по любому адресу и искать в нем без загрузки.
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+class FrozenTree
+{
+//Public structs:
+public:
+	struct Entry
+	{
+		KeyType key;
+		ValueType value;
+	};
+
+	struct Header
+	{
+		std::uint64_t magic;
+		std::uint32_t version;
+		std::uint32_t keySize;
+		std::uint32_t valueSize;
+		std::uint32_t entrySize;
+		std::uint32_t entryAlign;
+		std::uint32_t reserved;
+		std::uint64_t count;
+		std::uint8_t padding[24];
+	};
+
+	static constexpr std::uint64_t MAGIC = 0x45455254594E5246ull; //"FRNYTREE"
+	static constexpr std::uint32_t VERSION = 1;
+
+	static_assert(sizeof(Header) == 64, "Header must occupy 64 bytes");
+	static_assert(alignof(Entry) <= sizeof(Header), "Entry alignment exceeds header size");
+
+	struct Iterator
+	{
+	private:
+		std::int64_t index;
+		const FrozenTree<KeyType, ValueType>* pointerToOwner;
+	public:
+		Iterator(std::int64_t _index, const FrozenTree<KeyType, ValueType>* _owner) :
+			index(_index), pointerToOwner(_owner) {};
+
+		std::pair<KeyType, const ValueType&> operator*() const
+		{
+			const Entry& entry = pointerToOwner->entries[index];
+			return { entry.key, entry.value };
+		}
+
+		friend bool operator==(const Iterator& _it1, const Iterator& _it2)
+		{
+			return _it1.index == _it2.index && _it1.pointerToOwner == _it2.pointerToOwner;
+		}
+
+		void operator++()
+		{
+			if (index < static_cast<std::int64_t>(pointerToOwner->count))
+				++index;
+		}
+
+		void operator--()
+		{
+			if (index >= 0)
+				--index;
+		}
+	};
+
+	//Последовательно записывает отсортированные пары в файл формата FrozenTree.
+	//Количество записей заранее знать не нужно - заголовок дописывается в close().
+	class Writer
+	{
+	private:
+		std::FILE* file;
+		std::uint64_t count;
+		KeyType lastKey;
+		bool failed;
+
+	public:
+		Writer() : file(nullptr), count(0), lastKey(), failed(false) {};
+		~Writer() { if (file) std::fclose(file); };
+
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+
+		bool open(const std::string& _path);
+		bool append(const KeyType& _key, const ValueType& _value);
+		bool close(bool _sync = false);
+
+		std::uint64_t size() const { return count; };
+	};
+
+//Private members:
+private:
+	const Entry* entries;
+	std::uint64_t count;
+
+	void* mapping;
+	std::size_t mappingSize;
+#ifdef _WIN32
+	HANDLE fileHandle;
+	HANDLE mappingHandle;
+#endif
+
+	std::int64_t lowerBoundIndex(const KeyType& _key) const;
+
+//Public members:
+public:
+	FrozenTree() : entries(nullptr), count(0), mapping(nullptr), mappingSize(0)
+	{
+#ifdef _WIN32
+		fileHandle = INVALID_HANDLE_VALUE;
+		mappingHandle = nullptr;
+#endif
+	};
+	FrozenTree(const std::string& _path) : FrozenTree() { open(_path); };
+
+	~FrozenTree() { close(); };
+
+	FrozenTree(const FrozenTree&) = delete;
+	FrozenTree& operator=(const FrozenTree&) = delete;
+
+	//_sync - дождаться записи файла на диск (fsync) перед возвратом
+	static bool write(const Tree<KeyType, ValueType>& _tree, const std::string& _path, bool _sync = false);
+
+	bool open(const std::string& _path);
+	void close();
+	bool isOpen() const { return mapping != nullptr; };
+
+	bool empty() const { return count == 0; };
+	std::uint64_t size() const { return count; };
+
+	Iterator find(const KeyType& _key) const;
+	Iterator lower_bound(const KeyType& _key) const;
+
+	Iterator begin() const { return { 0, this }; };
+	Iterator end() const { return { static_cast<std::int64_t>(count) - 1, this }; };
+	Iterator beforeBegin() const { return { -1, this }; };
+	Iterator afterEnd() const { return { static_cast<std::int64_t>(count), this }; };
+};
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool FrozenTree<KeyType, ValueType>::Writer::open(const std::string& _path)
+{
+	if (file)
+		return false;
+
+	file = std::fopen(_path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	count = 0;
+	failed = false;
+
+	//Резервируем место под заголовок, он будет записан при закрытии
+	Header header = {};
+	if (std::fwrite(&header, sizeof(Header), 1, file) != 1)
+		failed = true;
+
+	return !failed;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool FrozenTree<KeyType, ValueType>::Writer::append(const KeyType& _key, const ValueType& _value)
+{
+	if (!file || failed)
+		return false;
+
+	//Ключи должны поступать строго по возрастанию, иначе бинарный поиск по файлу невозможен
+	if (count && !(lastKey < _key))
+		return false;
+
+	//Байты выравнивания между ключом и значением обнуляются: иначе в файл попадает содержимое стека,
+	//и одинаковые деревья дают разные файлы
+	Entry entry{};
+	entry.key = _key;
+	entry.value = _value;
+	if (std::fwrite(&entry, sizeof(Entry), 1, file) != 1)
+	{
+		failed = true;
+		return false;
+	}
+
+	lastKey = _key;
+	++count;
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool FrozenTree<KeyType, ValueType>::Writer::close(bool _sync)
+{
+	if (!file)
+		return false;
+
+	Header header = {};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.keySize = sizeof(KeyType);
+	header.valueSize = sizeof(ValueType);
+	header.entrySize = sizeof(Entry);
+	header.entryAlign = alignof(Entry);
+	header.count = count;
+
+	if (!failed)
+	{
+		if (std::fseek(file, 0, SEEK_SET) != 0 || std::fwrite(&header, sizeof(Header), 1, file) != 1)
+			failed = true;
+	}
+
+	if (_sync && !failed && !syncFile(file))
+		failed = true;
+
+	if (std::fclose(file) != 0)
+		failed = true;
+
+	file = nullptr;
+	return !failed;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool FrozenTree<KeyType, ValueType>::write(const Tree<KeyType, ValueType>& _tree, const std::string& _path, bool _sync)
+{
+	Writer writer;
+	if (!writer.open(_path))
+		return false;
+
+	if (!_tree.empty())
+	{
+		for (const auto& pair : _tree.getVector())
+		{
+			if (!writer.append(pair.first, pair.second))
+			{
+				writer.close();
+				return false;
+			}
+		}
+	}
+
+	return writer.close(_sync);
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+bool FrozenTree<KeyType, ValueType>::open(const std::string& _path)
+{
+	close();
+
+#ifdef _WIN32
+	fileHandle = CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(Header)))
+	{
+		close();
+		return false;
+	}
+	mappingSize = static_cast<std::size_t>(fileSize.QuadPart);
+
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappingHandle)
+	{
+		close();
+		return false;
+	}
+
+	mapping = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (!mapping)
+	{
+		close();
+		return false;
+	}
+#else
+	int fd = ::open(_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(sizeof(Header)))
+	{
+		::close(fd);
+		return false;
+	}
+	mappingSize = static_cast<std::size_t>(fileStat.st_size);
+
+	//MAP_SHARED: страницы файла делятся между всеми процессами, открывшими его
+	void* address = mmap(nullptr, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (address == MAP_FAILED)
+	{
+		mappingSize = 0;
+		return false;
+	}
+	mapping = address;
+#endif
+
+	//Проверяем, что файл записан для тех же типов и в том же формате
+	const Header* header = static_cast<const Header*>(mapping);
+	if (header->magic != MAGIC || header->version != VERSION ||
+		header->keySize != sizeof(KeyType) || header->valueSize != sizeof(ValueType) ||
+		header->entrySize != sizeof(Entry) || header->entryAlign != alignof(Entry) ||
+		header->count > (mappingSize - sizeof(Header)) / sizeof(Entry))
+	{
+		close();
+		return false;
+	}
+
+	count = header->count;
+	entries = reinterpret_cast<const Entry*>(static_cast<const char*>(mapping) + sizeof(Header));
+	return true;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+void FrozenTree<KeyType, ValueType>::close()
+{
+#ifdef _WIN32
+	if (mapping)
+		UnmapViewOfFile(mapping);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+
+	mappingHandle = nullptr;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (mapping)
+		munmap(mapping, mappingSize);
+#endif
+
+	mapping = nullptr;
+	mappingSize = 0;
+	entries = nullptr;
+	count = 0;
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+std::int64_t FrozenTree<KeyType, ValueType>::lowerBoundIndex(const KeyType& _key) const
+{
+	//Бинарный поиск по массиву - спуск по неявному сбалансированному дереву,
+	//корнем которого является средний элемент
+	std::uint64_t left = 0, right = count;
+	while (left < right)
+	{
+		std::uint64_t middle = left + (right - left) / 2;
+		if (entries[middle].key < _key)
+			left = middle + 1;
+		else
+			right = middle;
+	}
+
+	return static_cast<std::int64_t>(left);
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+FrozenTree<KeyType, ValueType>::Iterator FrozenTree<KeyType, ValueType>::find(const KeyType& _key) const
+{
+	std::int64_t index = lowerBoundIndex(_key);
+	if (index == static_cast<std::int64_t>(count) || !(entries[index].key == _key))
+		return afterEnd();
+
+	return { index, this };
+}
+
+template<KEY KeyType, typename ValueType>
+	requires FROZEN<KeyType> && FROZEN<ValueType>
+FrozenTree<KeyType, ValueType>::Iterator FrozenTree<KeyType, ValueType>::lower_bound(const KeyType& _key) const
+{
+	return { lowerBoundIndex(_key), this };
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASS FROZENTREE ------------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
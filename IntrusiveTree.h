@@ -0,0 +1,620 @@
+﻿#ifndef INTRUSIVETREE_H
+#define INTRUSIVETREE_H
+
+#include <algorithm>
+#include <concepts>
+#include <utility>
+
+#include "BinaryTrees.h"
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- STRUCTS AVLHOOK, RBHOOK ----------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Крючки интрузивных деревьев: пользователь наследует от крючка свою структуру, и объект сам становится
+//узлом дерева. Tag позволяет включить один объект в несколько деревьев:
+//	struct Session : AVLHook<ById>, RBHook<ByDeadline> { ... };
+//Копирование объекта не копирует связи: копия получает свободный крючок.
+//linked отличает объект в дереве от свободного (у единственного объекта дерева все связи пустые)
+//и занимает байт, который иначе ушел бы на выравнивание
+template<typename Tag = void>
+struct AVLHook
+{
+	AVLHook* parent = nullptr;
+	AVLHook* left = nullptr;
+	AVLHook* right = nullptr;
+	signed char balance = 0;
+	bool linked = false;
+
+	AVLHook() = default;
+	AVLHook(const AVLHook&) {};
+	AVLHook& operator=(const AVLHook&) { return *this; };
+
+	AVLHook*& child(bool _right) { return _right ? right : left; }
+	bool isLinked() const { return linked; }
+};
+
+template<typename Tag = void>
+struct RBHook
+{
+	RBHook* parent = nullptr;
+	RBHook* left = nullptr;
+	RBHook* right = nullptr;
+	NODE_COLORS color = NODE_COLORS::RED;
+	bool linked = false;
+
+	RBHook() = default;
+	RBHook(const RBHook&) {};
+	RBHook& operator=(const RBHook&) { return *this; };
+
+	RBHook*& child(bool _right) { return _right ? right : left; }
+	bool isLinked() const { return linked; }
+};
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- STRUCTS AVLHOOK, RBHOOK ----------------------------------
+//------------------------------------------------- END ------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------- CLASS INTRUSIVETREE ----------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Общая часть интрузивных деревьев: поиск, обход и перестановка связей, не зависящие от балансировки.
+//Дерево не выделяет память и не копирует ни ключи, ни объекты - оно только связывает крючки,
+//объектами по-прежнему владеет пользователь (пул, массив и т.д.).
+//KeyOf - функциональный объект без состояния: const KeyType& operator()(const T&) возвращает ключ объекта.
+//Ключ объекта нельзя менять, пока объект в дереве.
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+class IntrusiveTree
+{
+//Protected members:
+protected:
+	Hook* root;
+	int m_size;
+
+#ifdef TREES_ENABLE_STATS
+	mutable TreeStats m_stats;
+
+	TreeStats* statsSink() const { return &m_stats; };
+#else
+	TreeStats* statsSink() const { return nullptr; };
+#endif
+
+	static T* object(Hook* _hook) { return static_cast<T*>(_hook); };
+	static const KeyType& keyOf(Hook* _hook) { return KeyOf()(*object(_hook)); };
+
+	static Hook* nextHook(Hook* _hook);
+	static Hook* previousHook(Hook* _hook);
+
+	Hook* boundHook(const KeyType& _key, bool _upper) const;
+	bool findInsertPosition(const KeyType& _key, Hook*& _parent, bool& _right) const;
+	bool contains(Hook* _hook) const;
+
+	void link(Hook* _hook, Hook* _parent, bool _right);
+	void swapWithPredecessor(Hook* _hook);
+	Hook* detach(Hook* _hook, Hook*& _parent, bool& _right);
+
+	//Проверка связей, порядка ключей и размера; _check(крючок, высота левого, высота правого) проверяет
+	//балансировку и возвращает высоту поддерева в своей мере или -1 при нарушении
+	template<typename Check>
+	int validateSubtree(Hook* _hook, const Hook* _parent, const KeyType* _low, const KeyType* _high, int& _count,
+		Check& _check) const;
+	template<typename Check>
+	bool validateHooks(Check&& _check) const;
+
+//Public members:
+public:
+	IntrusiveTree() : root(nullptr), m_size(0) {};
+
+	//Связи хранятся в объектах, поэтому копировать дерево нельзя
+	IntrusiveTree(const IntrusiveTree&) = delete;
+	IntrusiveTree& operator=(const IntrusiveTree&) = delete;
+
+	~IntrusiveTree() { clear(); };
+
+	bool empty() const { return !root; };
+	int size() const { return m_size; };
+
+	T* find(const KeyType& _key) const;
+	T* lower_bound(const KeyType& _key) const { Hook* hook = boundHook(_key, false); return hook ? object(hook) : nullptr; };
+	T* upper_bound(const KeyType& _key) const { Hook* hook = boundHook(_key, true); return hook ? object(hook) : nullptr; };
+
+	T* first() const;
+	T* last() const;
+	static T* next(T& _object) { Hook* hook = nextHook(&_object); return hook ? object(hook) : nullptr; };
+	static T* previous(T& _object) { Hook* hook = previousHook(&_object); return hook ? object(hook) : nullptr; };
+
+	void clear();
+
+	//Снимок счетчиков балансировки, при выключенном TREES_ENABLE_STATS все счетчики нулевые
+	TreeStats stats() const
+	{
+#ifdef TREES_ENABLE_STATS
+		return m_stats;
+#else
+		return TreeStats();
+#endif
+	};
+	void resetStats() { TREE_STATS(m_stats = TreeStats()); };
+};
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+Hook* IntrusiveTree<T, KeyType, KeyOf, Hook>::nextHook(Hook* _hook)
+{
+	if (_hook->right)
+	{
+		Hook* searchPtr = _hook->right;
+		while (searchPtr->left)
+			searchPtr = searchPtr->left;
+
+		return searchPtr;
+	}
+
+	Hook* searchPtr = _hook;
+	while (searchPtr->parent && searchPtr->parent->right == searchPtr)
+		searchPtr = searchPtr->parent;
+
+	return searchPtr->parent;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+Hook* IntrusiveTree<T, KeyType, KeyOf, Hook>::previousHook(Hook* _hook)
+{
+	if (_hook->left)
+	{
+		Hook* searchPtr = _hook->left;
+		while (searchPtr->right)
+			searchPtr = searchPtr->right;
+
+		return searchPtr;
+	}
+
+	Hook* searchPtr = _hook;
+	while (searchPtr->parent && searchPtr->parent->left == searchPtr)
+		searchPtr = searchPtr->parent;
+
+	return searchPtr->parent;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+Hook* IntrusiveTree<T, KeyType, KeyOf, Hook>::boundHook(const KeyType& _key, bool _upper) const
+{
+	//Первый крючок с ключом не меньше (_upper = false) или больше (_upper = true) _key
+	Hook* result = nullptr;
+	Hook* searchPtr = root;
+	while (searchPtr)
+	{
+		bool toLeft = _upper ? (_key < keyOf(searchPtr)) : !(keyOf(searchPtr) < _key);
+		if (toLeft)
+		{
+			result = searchPtr;
+			searchPtr = searchPtr->left;
+		}
+		else
+			searchPtr = searchPtr->right;
+	}
+
+	return result;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+bool IntrusiveTree<T, KeyType, KeyOf, Hook>::findInsertPosition(const KeyType& _key, Hook*& _parent, bool& _right) const
+{
+	//Возвращает false, если ключ уже есть в дереве, иначе - будущего отца и сторону, как Tree::findInsertPosition
+	_parent = nullptr;
+	_right = false;
+
+	Hook* searchPtr = root;
+	while (searchPtr)
+	{
+		const KeyType& key = keyOf(searchPtr);
+		if (_key == key)
+			return false;
+
+		_parent = searchPtr;
+		_right = _key > key;
+		searchPtr = searchPtr->child(_right);
+	}
+
+	return true;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+bool IntrusiveTree<T, KeyType, KeyOf, Hook>::contains(Hook* _hook) const
+{
+	//Поднимаемся до корня: объект из другого дерева или свободный объект не должен испортить это дерево
+	Hook* searchPtr = _hook;
+	while (searchPtr->parent)
+		searchPtr = searchPtr->parent;
+
+	return searchPtr == root;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+template<typename Check>
+int IntrusiveTree<T, KeyType, KeyOf, Hook>::validateSubtree(Hook* _hook, const Hook* _parent, const KeyType* _low,
+	const KeyType* _high, int& _count, Check& _check) const
+{
+	if (!_hook)
+		return 0;
+
+	const KeyType& key = keyOf(_hook);
+	if (_hook->parent != _parent || !_hook->linked || (_low && !(*_low < key)) || (_high && !(key < *_high)))
+		return -1;
+
+	++_count;
+	int left = validateSubtree(_hook->left, _hook, _low, &key, _count, _check);
+	int right = validateSubtree(_hook->right, _hook, &key, _high, _count, _check);
+	if (left < 0 || right < 0)
+		return -1;
+
+	return _check(_hook, left, right);
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+template<typename Check>
+bool IntrusiveTree<T, KeyType, KeyOf, Hook>::validateHooks(Check&& _check) const
+{
+	int count = 0;
+	return validateSubtree(root, nullptr, nullptr, nullptr, count, _check) >= 0 && count == m_size;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+void IntrusiveTree<T, KeyType, KeyOf, Hook>::link(Hook* _hook, Hook* _parent, bool _right)
+{
+	_hook->parent = _parent;
+	_hook->left = _hook->right = nullptr;
+	_hook->linked = true;
+
+	if (!_parent)
+		root = _hook;
+	else
+		_parent->child(_right) = _hook;
+
+	++m_size;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+void IntrusiveTree<T, KeyType, KeyOf, Hook>::swapWithPredecessor(Hook* _hook)
+{
+	//У крючка два ребенка. В отличие от Tree::swapNodes ключи и значения обменять нельзя - они принадлежат
+	//объектам, поэтому крючок и его предшественник (самый правый узел левого поддерева) меняются местами
+	//в дереве. Служебные поля (баланс, цвет) относятся к месту, их меняет вызывающий
+	Hook* predecessor = _hook->left;
+	while (predecessor->right)
+		predecessor = predecessor->right;
+
+	Hook* parent = _hook->parent;
+	Hook* right = _hook->right;
+	Hook* predecessorParent = predecessor->parent;
+	Hook* predecessorLeft = predecessor->left;
+
+	predecessor->parent = parent;
+	if (!parent)
+		root = predecessor;
+	else
+		parent->child(parent->right == _hook) = predecessor;
+
+	predecessor->right = right;
+	right->parent = predecessor;
+
+	//Предшественник может быть левым ребенком крючка
+	if (predecessorParent == _hook)
+	{
+		predecessor->left = _hook;
+		_hook->parent = predecessor;
+	}
+	else
+	{
+		predecessor->left = _hook->left;
+		predecessor->left->parent = predecessor;
+		predecessorParent->right = _hook;
+		_hook->parent = predecessorParent;
+	}
+
+	_hook->left = predecessorLeft;
+	if (predecessorLeft)
+		predecessorLeft->parent = _hook;
+	_hook->right = nullptr;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+Hook* IntrusiveTree<T, KeyType, KeyOf, Hook>::detach(Hook* _hook, Hook*& _parent, bool& _right)
+{
+	//У крючка не больше одного ребенка, ребенок занимает его место. Возвращает ребенка,
+	//в _parent и _right - отца и сторону, с которой поддерево стало ниже
+	Hook* child = _hook->left ? _hook->left : _hook->right;
+	_parent = _hook->parent;
+	_right = _parent && _parent->right == _hook;
+
+	if (child)
+		child->parent = _parent;
+
+	if (!_parent)
+		root = child;
+	else
+		_parent->child(_right) = child;
+
+	_hook->parent = _hook->left = _hook->right = nullptr;
+	_hook->linked = false;
+	--m_size;
+	return child;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+T* IntrusiveTree<T, KeyType, KeyOf, Hook>::find(const KeyType& _key) const
+{
+	Hook* searchPtr = root;
+	while (searchPtr)
+	{
+		const KeyType& key = keyOf(searchPtr);
+		if (_key == key)
+			return object(searchPtr);
+
+		searchPtr = searchPtr->child(_key > key);
+	}
+
+	return nullptr;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+T* IntrusiveTree<T, KeyType, KeyOf, Hook>::first() const
+{
+	if (!root)
+		return nullptr;
+
+	Hook* searchPtr = root;
+	while (searchPtr->left)
+		searchPtr = searchPtr->left;
+
+	return object(searchPtr);
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+T* IntrusiveTree<T, KeyType, KeyOf, Hook>::last() const
+{
+	if (!root)
+		return nullptr;
+
+	Hook* searchPtr = root;
+	while (searchPtr->right)
+		searchPtr = searchPtr->right;
+
+	return object(searchPtr);
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Hook>
+void IntrusiveTree<T, KeyType, KeyOf, Hook>::clear()
+{
+	//Отцепляем объекты снизу вверх без стека: спускаемся к листу, отрезаем его и возвращаемся к отцу.
+	//Объекты не освобождаются, их крючки снова свободны
+	Hook* node = root;
+	while (node)
+	{
+		if (node->left)
+			node = node->left;
+		else if (node->right)
+			node = node->right;
+		else
+		{
+			Hook* parent = node->parent;
+			if (parent)
+				parent->child(parent->right == node) = nullptr;
+
+			node->parent = nullptr;
+			node->linked = false;
+			node = parent;
+		}
+	}
+
+	root = nullptr;
+	m_size = 0;
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------- CLASS INTRUSIVETREE ----------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+
+//------------------------------------------------------------------------------------------------------
+//---------------------------------- CLASSES INTRUSIVEAVLTREE, INTRUSIVERBTREE -------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Интрузивные AVL и RB деревья: вставка и удаление не выделяют память, балансировка - та же,
+//что у AVLTree и RBTree (AVLBalancer, RBBalancer). Пример:
+//	struct Order : AVLHook<> { int id; ... };
+//	struct OrderId { const int& operator()(const Order& _order) const { return _order.id; } };
+//	IntrusiveAVLTree<Order, int, OrderId> index;
+//	index.insert(pool[i]);
+//Объект должен оставаться на месте, пока он в дереве. Дерево при разрушении отцепляет все объекты.
+template<typename T, KEY KeyType, typename KeyOf, typename Tag = void>
+	requires std::derived_from<T, AVLHook<Tag>>
+class IntrusiveAVLTree : public IntrusiveTree<T, KeyType, KeyOf, AVLHook<Tag>>
+{
+//Protected members:
+protected:
+	using Hook = AVLHook<Tag>;
+	using IntrusiveTree<T, KeyType, KeyOf, Hook>::root;
+
+	struct NodeTraits
+	{
+		static signed char& balance(Hook* _hook) { return _hook->balance; };
+	};
+
+	AVLBalancer<Hook, NodeTraits> balancer() { return AVLBalancer<Hook, NodeTraits>(root, this->statsSink()); };
+
+//Public members:
+public:
+	bool insert(T& _object);
+	bool erase(T& _object);
+	bool erase(const KeyType& _key);
+
+	//Проверка для отладки и тестов за O(n): связи, порядок ключей, размер и баланс каждого узла
+	bool validate() const
+	{
+		return this->validateHooks([](Hook* _hook, int _left, int _right)
+		{
+			int balance = _right - _left;
+			return (balance == _hook->balance && balance >= -1 && balance <= 1) ? std::max(_left, _right) + 1 : -1;
+		});
+	};
+};
+
+template<typename T, KEY KeyType, typename KeyOf, typename Tag>
+	requires std::derived_from<T, AVLHook<Tag>>
+bool IntrusiveAVLTree<T, KeyType, KeyOf, Tag>::insert(T& _object)
+{
+	//Возвращает false, если объект с таким ключом уже есть или объект уже связан в другом дереве
+	//с тем же Tag: тогда объект не связывается, а перезапись его связей испортила бы оба дерева
+	Hook* hook = &_object;
+	Hook* parent;
+	bool right;
+	if (hook->linked || !this->findInsertPosition(KeyOf()(_object), parent, right))
+		return false;
+
+	this->link(hook, parent, right);
+	hook->balance = 0;
+	balancer().insertRetrace(hook);
+	return true;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Tag>
+	requires std::derived_from<T, AVLHook<Tag>>
+bool IntrusiveAVLTree<T, KeyType, KeyOf, Tag>::erase(T& _object)
+{
+	//Отцепляет объект от дерева. Возвращает false, если объект не в этом дереве
+	Hook* hook = &_object;
+	if (!hook->linked || !this->contains(hook))
+		return false;
+
+	if (hook->left && hook->right)
+	{
+		Hook* predecessor = hook->left;
+		while (predecessor->right)
+			predecessor = predecessor->right;
+
+		this->swapWithPredecessor(hook);
+		std::swap(hook->balance, predecessor->balance);
+	}
+
+	Hook* parent;
+	bool right;
+	this->detach(hook, parent, right);
+	if (parent)
+		balancer().eraseRetrace(parent, !right);
+
+	hook->balance = 0;
+	return true;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Tag>
+	requires std::derived_from<T, AVLHook<Tag>>
+bool IntrusiveAVLTree<T, KeyType, KeyOf, Tag>::erase(const KeyType& _key)
+{
+	T* object = this->find(_key);
+	return object ? erase(*object) : false;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Tag = void>
+	requires std::derived_from<T, RBHook<Tag>>
+class IntrusiveRBTree : public IntrusiveTree<T, KeyType, KeyOf, RBHook<Tag>>
+{
+//Protected members:
+protected:
+	using Hook = RBHook<Tag>;
+	using IntrusiveTree<T, KeyType, KeyOf, Hook>::root;
+
+	struct NodeTraits
+	{
+		static NODE_COLORS& color(Hook* _hook) { return _hook->color; };
+	};
+
+	using Balancer = RBBalancer<Hook, NodeTraits>;
+	Balancer balancer() { return Balancer(root, this->statsSink()); };
+
+//Public members:
+public:
+	bool insert(T& _object);
+	bool erase(T& _object);
+	bool erase(const KeyType& _key);
+
+	//Проверка для отладки и тестов за O(n): связи, порядок ключей, размер, черный корень,
+	//отсутствие двух красных подряд и одинаковая черная высота
+	bool validate() const
+	{
+		if (Balancer::colorOf(root) == NODE_COLORS::RED)
+			return false;
+
+		return this->validateHooks([](Hook* _hook, int _left, int _right)
+		{
+			bool red = _hook->color == NODE_COLORS::RED;
+			if (_left != _right || (red && (Balancer::colorOf(_hook->left) == NODE_COLORS::RED ||
+				Balancer::colorOf(_hook->right) == NODE_COLORS::RED)))
+				return -1;
+			return _left + (red ? 0 : 1);
+		});
+	};
+};
+
+template<typename T, KEY KeyType, typename KeyOf, typename Tag>
+	requires std::derived_from<T, RBHook<Tag>>
+bool IntrusiveRBTree<T, KeyType, KeyOf, Tag>::insert(T& _object)
+{
+	//Как у IntrusiveAVLTree: связанный объект или повторяющийся ключ не вставляются
+	Hook* hook = &_object;
+	Hook* parent;
+	bool right;
+	if (hook->linked || !this->findInsertPosition(KeyOf()(_object), parent, right))
+		return false;
+
+	this->link(hook, parent, right);
+	hook->color = NODE_COLORS::RED;
+	balancer().insertBalance(hook);
+	return true;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Tag>
+	requires std::derived_from<T, RBHook<Tag>>
+bool IntrusiveRBTree<T, KeyType, KeyOf, Tag>::erase(T& _object)
+{
+	Hook* hook = &_object;
+	if (!hook->linked || !this->contains(hook))
+		return false;
+
+	if (hook->left && hook->right)
+	{
+		Hook* predecessor = hook->left;
+		while (predecessor->right)
+			predecessor = predecessor->right;
+
+		this->swapWithPredecessor(hook);
+		std::swap(hook->color, predecessor->color);
+	}
+
+	//Удаление красного узла не меняет черную высоту, красного ребенка достаточно перекрасить в черный
+	Hook* parent;
+	bool right;
+	Hook* child = this->detach(hook, parent, right);
+	if (hook->color == NODE_COLORS::BLACK)
+	{
+		if (Balancer::colorOf(child) == NODE_COLORS::RED)
+			balancer().paint(child, NODE_COLORS::BLACK);
+		else if (parent)
+			balancer().eraseBalance(parent, right);
+	}
+
+	hook->color = NODE_COLORS::RED;
+	return true;
+}
+
+template<typename T, KEY KeyType, typename KeyOf, typename Tag>
+	requires std::derived_from<T, RBHook<Tag>>
+bool IntrusiveRBTree<T, KeyType, KeyOf, Tag>::erase(const KeyType& _key)
+{
+	T* object = this->find(_key);
+	return object ? erase(*object) : false;
+}
+
+//------------------------------------------------------------------------------------------------------
+//---------------------------------- CLASSES INTRUSIVEAVLTREE, INTRUSIVERBTREE -------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
@@ -0,0 +1,245 @@
+﻿#ifndef LATENCYRECORDER_H
+#define LATENCYRECORDER_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Операции, время которых замеряют деревья (см. Tree::setLatencyRecorder)
+enum class TREE_OPERATIONS
+{
+	INSERT,
+	ERASE,
+	FIND,
+	ITERATION
+};
+
+//Одна замеренная операция. Глубина (сумма глубин спусков операции), повороты, перекрашивания и узлы,
+//пройденные при восстановлении баланса AVL дерева, известны, только если собраны счетчики TREES_ENABLE_STATS
+struct LatencySample
+{
+	TREE_OPERATIONS operation = TREE_OPERATIONS::INSERT;
+	long long nanoseconds = 0;
+	long long depth = 0;
+	long long rotations = 0;
+	long long recolorings = 0;
+	long long balanceUpdates = 0;
+};
+
+//------------------------------------------------------------------------------------------------------
+//---------------------------------------- CLASS LATENCYRECORDER ---------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Гистограмма времени операций в духе HdrHistogram: до 2^SUB_BITS нс корзины шириной 1 нс, дальше каждая
+//степень двойки делится на 2^SUB_BITS корзин, поэтому относительная ошибка не больше 1 / 2^SUB_BITS (~3%).
+//Запись не берет блокировок: поток пишет в счетчики своего сегмента (shard) атомарным сложением.
+//Кроме гистограммы сегмент хранит SLOWEST самых медленных операций каждого вида с глубиной и поворотами.
+//Мьютекс сегмента берется, только если операция медленнее самой быстрой из уже сохраненных
+class LatencyRecorder
+{
+//Public members:
+public:
+	static constexpr int OPERATION_COUNT = 4;
+	static constexpr int SUB_BITS = 5;
+	static constexpr int MAX_MAGNITUDE = 40;	//Время от 2^41 нс (~37 минут) попадает в последнюю корзину
+	static constexpr int BUCKETS = (MAX_MAGNITUDE - SUB_BITS + 2) << SUB_BITS;
+	static constexpr int SLOWEST = 16;
+
+//Private members:
+private:
+	struct alignas(64) Shard
+	{
+		std::array<std::array<std::atomic<std::uint64_t>, BUCKETS>, OPERATION_COUNT> counts;
+		std::array<std::atomic<long long>, OPERATION_COUNT> slowThreshold;
+
+		std::mutex mutex;
+		std::array<std::vector<LatencySample>, OPERATION_COUNT> slowest;
+	};
+
+	std::unique_ptr<Shard[]> shards;
+	int shard_count;
+
+	static int threadSlot()
+	{
+		static std::atomic<int> nextSlot(0);
+		thread_local int slot = nextSlot.fetch_add(1, std::memory_order_relaxed);
+		return slot;
+	};
+
+	static int bucketOf(long long _nanoseconds);
+	static long long bucketUpperBound(int _bucket);
+	void recordSlow(Shard& _shard, const LatencySample& _sample);
+
+//Public members:
+public:
+	explicit LatencyRecorder(int _shards = static_cast<int>(std::thread::hardware_concurrency()));
+
+	LatencyRecorder(const LatencyRecorder&) = delete;
+	LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+	void record(const LatencySample& _sample);
+
+	long long count(TREE_OPERATIONS _operation) const;
+	//Время, не превышенное _percent процентами операций (50, 99, 99.9), - верхняя граница корзины
+	long long percentile(TREE_OPERATIONS _operation, double _percent) const;
+	//Самые медленные операции по убыванию времени
+	std::vector<LatencySample> slowest(TREE_OPERATIONS _operation) const;
+
+	//Сброс во время записи из других потоков может потерять отдельные замеры
+	void reset();
+};
+
+inline LatencyRecorder::LatencyRecorder(int _shards)
+{
+	shard_count = std::clamp(_shards, 1, 64);
+	shards = std::make_unique<Shard[]>(static_cast<std::size_t>(shard_count));
+}
+
+inline int LatencyRecorder::bucketOf(long long _nanoseconds)
+{
+	std::uint64_t value = static_cast<std::uint64_t>(std::max(_nanoseconds, 0LL));
+	if (value < (1ull << SUB_BITS))
+		return static_cast<int>(value);
+
+	int magnitude = static_cast<int>(std::bit_width(value)) - 1;
+	if (magnitude > MAX_MAGNITUDE)
+		return BUCKETS - 1;
+
+	int shift = magnitude - SUB_BITS;
+	return ((shift + 1) << SUB_BITS) + static_cast<int>((value >> shift) - (1ull << SUB_BITS));
+}
+
+inline long long LatencyRecorder::bucketUpperBound(int _bucket)
+{
+	if (_bucket < (1 << SUB_BITS))
+		return _bucket;
+
+	int shift = (_bucket >> SUB_BITS) - 1;
+	long long lower = static_cast<long long>((1ull << SUB_BITS) + (_bucket & ((1 << SUB_BITS) - 1))) << shift;
+	return lower + (1LL << shift) - 1;
+}
+
+inline void LatencyRecorder::record(const LatencySample& _sample)
+{
+	Shard& shard = shards[threadSlot() % shard_count];
+	int operation = static_cast<int>(_sample.operation);
+
+	shard.counts[operation][bucketOf(_sample.nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+	if (_sample.nanoseconds > shard.slowThreshold[operation].load(std::memory_order_relaxed))
+		recordSlow(shard, _sample);
+}
+
+inline void LatencyRecorder::recordSlow(Shard& _shard, const LatencySample& _sample)
+{
+	int operation = static_cast<int>(_sample.operation);
+	auto faster = [](const LatencySample& _first, const LatencySample& _second)
+	{
+		return _first.nanoseconds < _second.nanoseconds;
+	};
+
+	std::lock_guard<std::mutex> lock(_shard.mutex);
+	std::vector<LatencySample>& slowest = _shard.slowest[operation];
+	if (static_cast<int>(slowest.size()) < SLOWEST)
+		slowest.push_back(_sample);
+	else
+	{
+		auto fastest = std::min_element(slowest.begin(), slowest.end(), faster);
+		if (fastest->nanoseconds >= _sample.nanoseconds)
+			return;
+		*fastest = _sample;
+	}
+
+	//Пока список не заполнен, порог остается нулевым
+	if (static_cast<int>(slowest.size()) == SLOWEST)
+		_shard.slowThreshold[operation].store(std::min_element(slowest.begin(), slowest.end(), faster)->nanoseconds,
+			std::memory_order_relaxed);
+}
+
+inline long long LatencyRecorder::count(TREE_OPERATIONS _operation) const
+{
+	int operation = static_cast<int>(_operation);
+	long long total = 0;
+	for (int i = 0; i < shard_count; ++i)
+	{
+		for (const auto& counter : shards[i].counts[operation])
+			total += static_cast<long long>(counter.load(std::memory_order_relaxed));
+	}
+	return total;
+}
+
+inline long long LatencyRecorder::percentile(TREE_OPERATIONS _operation, double _percent) const
+{
+	int operation = static_cast<int>(_operation);
+	std::vector<std::uint64_t> merged(BUCKETS, 0);
+	std::uint64_t total = 0;
+	for (int i = 0; i < shard_count; ++i)
+	{
+		for (int bucket = 0; bucket < BUCKETS; ++bucket)
+		{
+			std::uint64_t value = shards[i].counts[operation][bucket].load(std::memory_order_relaxed);
+			merged[bucket] += value;
+			total += value;
+		}
+	}
+	if (!total)
+		return 0;
+
+	//Номер операции с искомым временем среди упорядоченных по времени, начиная с 1
+	double fraction = std::clamp(_percent, 0.0, 100.0) / 100.0;
+	std::uint64_t rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(fraction * static_cast<double>(total) + 0.5));
+
+	std::uint64_t seen = 0;
+	for (int bucket = 0; bucket < BUCKETS; ++bucket)
+	{
+		seen += merged[bucket];
+		if (seen >= rank)
+			return bucketUpperBound(bucket);
+	}
+	return bucketUpperBound(BUCKETS - 1);
+}
+
+inline std::vector<LatencySample> LatencyRecorder::slowest(TREE_OPERATIONS _operation) const
+{
+	int operation = static_cast<int>(_operation);
+	std::vector<LatencySample> result;
+	for (int i = 0; i < shard_count; ++i)
+	{
+		std::lock_guard<std::mutex> lock(shards[i].mutex);
+		result.insert(result.end(), shards[i].slowest[operation].begin(), shards[i].slowest[operation].end());
+	}
+
+	std::sort(result.begin(), result.end(), [](const LatencySample& _first, const LatencySample& _second)
+	{
+		return _first.nanoseconds > _second.nanoseconds;
+	});
+	if (static_cast<int>(result.size()) > SLOWEST)
+		result.resize(SLOWEST);
+	return result;
+}
+
+inline void LatencyRecorder::reset()
+{
+	for (int i = 0; i < shard_count; ++i)
+	{
+		Shard& shard = shards[i];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		for (int operation = 0; operation < OPERATION_COUNT; ++operation)
+		{
+			for (auto& counter : shard.counts[operation])
+				counter.store(0, std::memory_order_relaxed);
+			shard.slowThreshold[operation].store(0, std::memory_order_relaxed);
+			shard.slowest[operation].clear();
+		}
+	}
+}
+
+//------------------------------------------------------------------------------------------------------
+//---------------------------------------- CLASS LATENCYRECORDER ---------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
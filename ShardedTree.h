@@ -0,0 +1,476 @@
+﻿#ifndef SHARDEDTREE_H
+#define SHARDEDTREE_H
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "BinaryTrees.h"
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASS SHARDEDTREE -----------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+enum class SHARDING_MODES
+{
+	RANGE,
+	HASH
+};
+
+//Потокобезопасное отображение из нескольких деревьев (шардов), у каждого своя блокировка, поэтому
+//изменения в разных шардах выполняются параллельно.
+//	SHARDING_MODES::RANGE - шард отвечает за непрерывный диапазон ключей. Обход идет по шардам подряд.
+//		Шард, выросший больше чем вдвое против среднего, делится пополам, соседние маленькие шарды сливаются.
+//	SHARDING_MODES::HASH - шард выбирается по хэшу ключа, количество шардов постоянно. Равномерно распределяет
+//		и последовательные ключи, но упорядоченный обход сливает все шарды. Для ключей без std::hash - RANGE.
+//Методы не возвращают итераторы и ссылки: после снятия блокировки узел может быть изменен другим потоком.
+template<KEY KeyType, typename ValueType, typename TreeType = RBTree<KeyType, ValueType>>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+class ShardedTree
+{
+//Private structs:
+private:
+	//Шарды выровнены по строке кэша, чтобы блокировки соседних шардов не делили одну строку
+	struct alignas(64) Shard
+	{
+		std::shared_mutex mutex;
+		TreeType tree;
+
+		//Размеры, при выходе за которые RANGE-шард вызывает перераспределение (назначаются в rebalance)
+		int splitSize = std::numeric_limits<int>::max();
+		int mergeSize = -1;
+
+		bool outOfBounds() const { return tree.size() > splitSize || tree.size() < mergeSize; };
+	};
+
+	static constexpr bool HASHABLE_KEY = requires(const KeyType& _key) { std::hash<KeyType>{}(_key); };
+
+	//SplayTree и LRUTree перестраиваются при поиске, поэтому поиск в них требует исключительной блокировки
+	static constexpr bool LRU_SHARDS = std::derived_from<TreeType, LRUTree<KeyType, ValueType>>;
+	static constexpr bool MUTATING_FIND = std::derived_from<TreeType, SplayTree<KeyType, ValueType>> || LRU_SHARDS;
+
+//Private members:
+private:
+	SHARDING_MODES mode;
+	int target_shards;
+	int min_split_size;
+
+	//Каталог шардов. В режиме RANGE boundaries[i] - наименьший ключ шарда i + 1.
+	//Операции держат directory_mutex разделяемо, rebalance - исключительно
+	std::vector<std::unique_ptr<Shard>> shards;
+	std::vector<KeyType> boundaries;
+	mutable std::shared_mutex directory_mutex;
+
+	int shardIndex(const KeyType& _key) const;
+
+	template<typename Operation>
+	auto access(const KeyType& _key, bool _write, Operation&& _operation);
+
+	void rebalance();
+	bool splitShard(int _index);
+	void mergeShards(int _index);
+
+	using Vector = std::vector<std::pair<KeyType, ValueType&>>;
+	static Vector contents(const Shard& _shard) { return _shard.tree.empty() ? Vector() : _shard.tree.getVector(); };
+	static void buildShard(Shard& _shard, const Vector& _vector, std::size_t _first, std::size_t _last);
+
+//Public members:
+public:
+	ShardedTree(int _shardCount = static_cast<int>(std::thread::hardware_concurrency()),
+		SHARDING_MODES _mode = SHARDING_MODES::RANGE, int _minSplitSize = 4096);
+
+	ShardedTree(const ShardedTree&) = delete;
+	ShardedTree& operator=(const ShardedTree&) = delete;
+
+	bool insert(const KeyType& _key, const ValueType& _value);
+	bool insert(const std::pair<KeyType, ValueType>& _pair) { return insert(_pair.first, _pair.second); };
+	bool erase(const KeyType& _key);
+	bool setValue(const KeyType& _key, const ValueType& _value);
+
+	bool find(const KeyType& _key, ValueType& _value);
+	bool contains(const KeyType& _key);
+
+	int size() const;
+	bool empty() const { return size() == 0; };
+	int shardCount() const;
+	SHARDING_MODES getMode() const { return mode; };
+
+	template<typename Function>
+	void forEach(Function&& _function);
+	std::vector<std::pair<KeyType, ValueType>> getVector();
+
+	void clear();
+};
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+ShardedTree<KeyType, ValueType, TreeType>::ShardedTree(int _shardCount, SHARDING_MODES _mode, int _minSplitSize) :
+	mode(HASHABLE_KEY ? _mode : SHARDING_MODES::RANGE), target_shards(std::max(_shardCount, 1)),
+	min_split_size(std::max(_minSplitSize, 2))
+{
+	//RANGE начинает с одного шарда и делится по мере роста, HASH сразу создает все шарды
+	int count = (mode == SHARDING_MODES::HASH) ? target_shards : 1;
+	for (int i = 0; i < count; ++i)
+		shards.push_back(std::make_unique<Shard>());
+
+	if (mode == SHARDING_MODES::RANGE)
+		shards.front()->splitSize = min_split_size;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+int ShardedTree<KeyType, ValueType, TreeType>::shardIndex(const KeyType& _key) const
+{
+	if (mode == SHARDING_MODES::RANGE)
+		return static_cast<int>(std::upper_bound(boundaries.begin(), boundaries.end(), _key) - boundaries.begin());
+
+	if constexpr (HASHABLE_KEY)
+	{
+		//Фибоначчиево перемешивание, затем старшие 32 бита отображаются на [0, количество шардов)
+		std::uint64_t hash = static_cast<std::uint64_t>(std::hash<KeyType>{}(_key)) * 0x9E3779B97F4A7C15ull;
+		return static_cast<int>(((hash >> 32) * shards.size()) >> 32);
+	}
+	else
+		return 0;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+template<typename Operation>
+auto ShardedTree<KeyType, ValueType, TreeType>::access(const KeyType& _key, bool _write, Operation&& _operation)
+{
+	//Каталог HASH-шардов не меняется, поэтому его блокировка нужна только в режиме RANGE
+	bool rebalanceNeeded = false;
+	auto result = [&]()
+	{
+		std::shared_lock<std::shared_mutex> directoryLock(directory_mutex, std::defer_lock);
+		if (mode == SHARDING_MODES::RANGE)
+			directoryLock.lock();
+
+		Shard& shard = *shards[shardIndex(_key)];
+		if (!_write && !MUTATING_FIND)
+		{
+			std::shared_lock<std::shared_mutex> shardLock(shard.mutex);
+			return _operation(shard.tree);
+		}
+
+		std::unique_lock<std::shared_mutex> shardLock(shard.mutex);
+		auto value = _operation(shard.tree);
+		rebalanceNeeded = _write && shard.outOfBounds();
+		return value;
+	}();
+
+	//Перераспределение берет каталог исключительно, поэтому выполняется после снятия блокировок
+	if (rebalanceNeeded)
+		rebalance();
+
+	return result;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void ShardedTree<KeyType, ValueType, TreeType>::buildShard(Shard& _shard, const Vector& _vector,
+	std::size_t _first, std::size_t _last)
+{
+	std::size_t index = _first;
+	_shard.tree.buildFromSorted(static_cast<int>(_last - _first),
+		[&]() -> const std::pair<KeyType, ValueType&>& { return _vector[index++]; });
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool ShardedTree<KeyType, ValueType, TreeType>::splitShard(int _index)
+{
+	//Обе половины строятся заново за линейное время и сразу идеально сбалансированы
+	Shard& shard = *shards[_index];
+	Vector vector = contents(shard);
+	auto keyLess = [](const std::pair<KeyType, ValueType&>& _pair, const KeyType& _key) { return _pair.first < _key; };
+	auto lessKey = [](const KeyType& _key, const std::pair<KeyType, ValueType&>& _pair) { return _key < _pair.first; };
+
+	//shardIndex отправляет ключ, равный границе, в верхний шард, поэтому все одинаковые ключи Multi-дерева
+	//должны оказаться по одну сторону границы: деление идет по первому из них, а если он первый в шарде -
+	//сразу за последним. Шард из одного ключа не делится
+	std::size_t middle = std::lower_bound(vector.begin(), vector.end(), vector[vector.size() / 2].first, keyLess) - vector.begin();
+	if (middle == 0)
+		middle = std::upper_bound(vector.begin(), vector.end(), vector.front().first, lessKey) - vector.begin();
+	if (middle == vector.size())
+		return false;
+
+	KeyType boundary = vector[middle].first;
+
+	auto lower = std::make_unique<Shard>();
+	auto upper = std::make_unique<Shard>();
+	if constexpr (LRU_SHARDS)
+	{
+		//Перестройка назначила бы всем записям одну давность и новое время истечения, поэтому узлы LRUTree
+		//переносятся через NodeHandle от давних к свежим: узел сохраняет время истечения, а вставка делает
+		//его самым свежим, так что порядок давности в каждой половине остается прежним. Это O(n log n)
+		for (const KeyType& key : shard.tree.getKeysByRecency())
+			(key < boundary ? lower : upper)->tree.insert(shard.tree.extract(key));
+	}
+	else
+	{
+		buildShard(*lower, vector, 0, middle);
+		buildShard(*upper, vector, middle, vector.size());
+	}
+
+	boundaries.insert(boundaries.begin() + _index, boundary);
+	shards[_index] = std::move(lower);
+	shards.insert(shards.begin() + _index + 1, std::move(upper));
+	return true;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void ShardedTree<KeyType, ValueType, TreeType>::mergeShards(int _index)
+{
+	auto merged = std::make_unique<Shard>();
+	if constexpr (LRU_SHARDS)
+	{
+		//Узлы LRUTree переносятся с сохранением времени истечения, как в splitShard. Давность записей
+		//разных шардов не сравнима, поэтому списки чередуются пропорционально месту записи в своем списке
+		TreeType& lowerTree = shards[_index]->tree;
+		TreeType& upperTree = shards[_index + 1]->tree;
+		std::vector<KeyType> lowerKeys = lowerTree.getKeysByRecency();
+		std::vector<KeyType> upperKeys = upperTree.getKeysByRecency();
+
+		std::size_t i = 0, j = 0;
+		while (i < lowerKeys.size() || j < upperKeys.size())
+		{
+			if (j == upperKeys.size() || (i < lowerKeys.size() &&
+				(2 * i + 1) * upperKeys.size() <= (2 * j + 1) * lowerKeys.size()))
+				merged->tree.insert(lowerTree.extract(lowerKeys[i++]));
+			else
+				merged->tree.insert(upperTree.extract(upperKeys[j++]));
+		}
+	}
+	else
+	{
+		//Диапазоны соседних шардов идут подряд, поэтому их пары уже отсортированы
+		Vector vector = contents(*shards[_index]);
+		Vector upper = contents(*shards[_index + 1]);
+		vector.insert(vector.end(), upper.begin(), upper.end());
+		buildShard(*merged, vector, 0, vector.size());
+	}
+
+	shards[_index] = std::move(merged);
+	shards.erase(shards.begin() + _index + 1);
+	boundaries.erase(boundaries.begin() + _index);
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void ShardedTree<KeyType, ValueType, TreeType>::rebalance()
+{
+	std::unique_lock<std::shared_mutex> directoryLock(directory_mutex);
+
+	//Под исключительной блокировкой каталога других операций нет, шарды читаются без своих блокировок
+	int total = 0;
+	for (const auto& shard : shards)
+		total += shard->tree.size();
+
+	//Средний размер шарда при target_shards шардах. Шард больше max(min_split_size, 2 * ideal) делится,
+	//соседние шарды, вместе меньше половины max(min_split_size, ideal), сливаются. Слитый шард не превышает
+	//порог деления, поэтому шарды не делятся и не сливаются попеременно
+	int ideal = std::max(total / target_shards, 1);
+	int splitSize = std::max(min_split_size, 2 * ideal);
+	int mergeSize = std::max(min_split_size, ideal) / 2;
+
+	for (int i = 0; i < static_cast<int>(shards.size()); )
+	{
+		if (shards[i]->tree.size() <= splitSize || !splitShard(i))
+			++i;
+	}
+
+	for (int i = 0; i + 1 < static_cast<int>(shards.size()); )
+	{
+		if (shards[i]->tree.size() + shards[i + 1]->tree.size() < mergeSize)
+			mergeShards(i);
+		else
+			++i;
+	}
+
+	//Маленький шард, которому не с кем слиться, снова проверяется, только когда уменьшится вдвое,
+	//иначе каждое удаление из него брало бы каталог исключительно. Так же шард из одного ключа,
+	//который нельзя разделить, проверяется снова, только когда вырастет вдвое
+	for (auto& shard : shards)
+	{
+		int size = shard->tree.size();
+		shard->splitSize = (size > splitSize) ? 2 * size : splitSize;
+		shard->mergeSize = (shards.size() > 1) ? std::min(mergeSize / 2, size / 2) : -1;
+	}
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool ShardedTree<KeyType, ValueType, TreeType>::insert(const KeyType& _key, const ValueType& _value)
+{
+	return access(_key, true, [&](TreeType& _tree) { return _tree.insert(_key, _value); });
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool ShardedTree<KeyType, ValueType, TreeType>::erase(const KeyType& _key)
+{
+	return access(_key, true, [&](TreeType& _tree) { return _tree.erase(_key); });
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool ShardedTree<KeyType, ValueType, TreeType>::setValue(const KeyType& _key, const ValueType& _value)
+{
+	return access(_key, true, [&](TreeType& _tree) { return _tree.setValue(_key, _value); });
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool ShardedTree<KeyType, ValueType, TreeType>::find(const KeyType& _key, ValueType& _value)
+{
+	//Значение копируется под блокировкой шарда
+	return access(_key, false, [&](TreeType& _tree)
+	{
+		auto it = _tree.find(_key);
+		if (it == _tree.afterEnd())
+			return false;
+
+		_value = (*it).second;
+		return true;
+	});
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+bool ShardedTree<KeyType, ValueType, TreeType>::contains(const KeyType& _key)
+{
+	return access(_key, false, [&](TreeType& _tree) { return !(_tree.find(_key) == _tree.afterEnd()); });
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+int ShardedTree<KeyType, ValueType, TreeType>::size() const
+{
+	//Сумма размеров шардов, каждый читается под своей блокировкой: при параллельных изменениях
+	//результат соответствует какому-то промежуточному состоянию
+	std::shared_lock<std::shared_mutex> directoryLock(directory_mutex);
+
+	int total = 0;
+	for (const auto& shard : shards)
+	{
+		std::shared_lock<std::shared_mutex> shardLock(shard->mutex);
+		total += shard->tree.size();
+	}
+
+	return total;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+int ShardedTree<KeyType, ValueType, TreeType>::shardCount() const
+{
+	std::shared_lock<std::shared_mutex> directoryLock(directory_mutex);
+	return static_cast<int>(shards.size());
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+template<typename Function>
+void ShardedTree<KeyType, ValueType, TreeType>::forEach(Function&& _function)
+{
+	//Вызывает _function(const KeyType&, const ValueType&) в порядке возрастания ключей.
+	//Изменять дерево из _function нельзя. Обход не является мгновенным снимком: шарды, которые уже
+	//пройдены или еще не начаты, могут меняться параллельно
+	std::shared_lock<std::shared_mutex> directoryLock(directory_mutex);
+
+	if (mode == SHARDING_MODES::RANGE)
+	{
+		for (const auto& shard : shards)
+		{
+			std::shared_lock<std::shared_mutex> shardLock(shard->mutex);
+			for (auto it = shard->tree.begin(); !(it == shard->tree.afterEnd()); ++it)
+			{
+				auto pair = *it;
+				_function(static_cast<const KeyType&>(pair.first), static_cast<const ValueType&>(pair.second));
+			}
+		}
+		return;
+	}
+
+	//HASH: блокируем все шарды по порядку номеров и сливаем их отсортированные векторы кучей
+	std::vector<std::shared_lock<std::shared_mutex>> shardLocks;
+	std::vector<Vector> vectors;
+	for (const auto& shard : shards)
+	{
+		shardLocks.emplace_back(shard->mutex);
+		vectors.push_back(contents(*shard));
+	}
+
+	std::vector<std::size_t> positions(vectors.size(), 0);
+	std::vector<int> heap;
+	auto greater = [&](int _shard1, int _shard2)
+	{
+		return vectors[_shard2][positions[_shard2]].first < vectors[_shard1][positions[_shard1]].first;
+	};
+
+	for (int i = 0; i < static_cast<int>(vectors.size()); ++i)
+	{
+		if (!vectors[i].empty())
+			heap.push_back(i);
+	}
+	std::make_heap(heap.begin(), heap.end(), greater);
+
+	while (!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), greater);
+		int shard = heap.back();
+		const auto& pair = vectors[shard][positions[shard]];
+		_function(static_cast<const KeyType&>(pair.first), static_cast<const ValueType&>(pair.second));
+
+		if (++positions[shard] < vectors[shard].size())
+			std::push_heap(heap.begin(), heap.end(), greater);
+		else
+			heap.pop_back();
+	}
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+std::vector<std::pair<KeyType, ValueType>> ShardedTree<KeyType, ValueType, TreeType>::getVector()
+{
+	std::vector<std::pair<KeyType, ValueType>> vector;
+	forEach([&](const KeyType& _key, const ValueType& _value) { vector.emplace_back(_key, _value); });
+	return vector;
+}
+
+template<KEY KeyType, typename ValueType, typename TreeType>
+	requires std::derived_from<TreeType, Tree<KeyType, ValueType>>
+void ShardedTree<KeyType, ValueType, TreeType>::clear()
+{
+	if (mode == SHARDING_MODES::RANGE)
+	{
+		std::unique_lock<std::shared_mutex> directoryLock(directory_mutex);
+		shards.clear();
+		boundaries.clear();
+		shards.push_back(std::make_unique<Shard>());
+		shards.front()->splitSize = min_split_size;
+		return;
+	}
+
+	//Операции с HASH-шардами не берут каталог, поэтому каждый шард очищается под своей блокировкой
+	for (auto& shard : shards)
+	{
+		std::unique_lock<std::shared_mutex> shardLock(shard->mutex);
+		shard->tree.clear();
+	}
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASS SHARDEDTREE -----------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
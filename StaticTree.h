@@ -0,0 +1,206 @@
+﻿#ifndef STATICTREE_H
+#define STATICTREE_H
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "BinaryTrees.h"
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASS STATICTREE ------------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Неизменяемое отображение, которое строится на этапе компиляции из списка пар:
+//	static constexpr auto routes = makeStaticTree<int, int>({ { 80, 1 }, { 443, 2 }, { 22, 3 } });
+//Записи лежат отсортированным массивом внутри объекта (неявное сбалансированное дерево, как в FrozenTree),
+//поэтому constexpr таблица не строится при запуске и лежит в памяти только для чтения.
+//Capacity - количество переданных пар. Из одинаковых ключей остается первый, как при вставке в RBTree
+template<KEY KeyType, typename ValueType, std::size_t Capacity>
+	requires std::default_initializable<KeyType> && std::default_initializable<ValueType>
+class StaticTree
+{
+//Public structs:
+public:
+	struct Entry
+	{
+		KeyType key;
+		ValueType value;
+	};
+
+	struct Iterator
+	{
+	private:
+		std::int64_t index;
+		const StaticTree<KeyType, ValueType, Capacity>* pointerToOwner;
+	public:
+		constexpr Iterator(std::int64_t _index, const StaticTree<KeyType, ValueType, Capacity>* _owner) :
+			index(_index), pointerToOwner(_owner) {};
+
+		constexpr std::pair<KeyType, const ValueType&> operator*() const
+		{
+			const Entry& entry = pointerToOwner->entries[static_cast<std::size_t>(index)];
+			return { entry.key, entry.value };
+		}
+
+		friend constexpr bool operator==(const Iterator& _it1, const Iterator& _it2)
+		{
+			return _it1.index == _it2.index && _it1.pointerToOwner == _it2.pointerToOwner;
+		}
+
+		constexpr void operator++()
+		{
+			if (index < static_cast<std::int64_t>(pointerToOwner->count))
+				++index;
+		}
+
+		constexpr void operator--()
+		{
+			if (index >= 0)
+				--index;
+		}
+	};
+
+//Private members:
+private:
+	std::array<Entry, Capacity> entries;
+	std::size_t count;
+
+	constexpr void build(const std::pair<KeyType, ValueType>* _pairs);
+	constexpr std::size_t lowerBoundIndex(const KeyType& _key) const;
+
+//Public members:
+public:
+	constexpr StaticTree(const std::pair<KeyType, ValueType> (&_pairs)[Capacity]) : entries(), count(0) { build(_pairs); };
+	constexpr StaticTree(const std::array<std::pair<KeyType, ValueType>, Capacity>& _pairs) : entries(), count(0)
+	{
+		build(_pairs.data());
+	};
+
+	constexpr bool empty() const { return count == 0; };
+	constexpr int size() const { return static_cast<int>(count); };
+
+	constexpr Iterator find(const KeyType& _key) const;
+	constexpr Iterator lower_bound(const KeyType& _key) const;
+	constexpr Iterator upper_bound(const KeyType& _key) const;
+	constexpr bool contains(const KeyType& _key) const { return find(_key) != afterEnd(); };
+
+	constexpr Iterator begin() const { return { 0, this }; };
+	constexpr Iterator end() const { return { static_cast<std::int64_t>(count) - 1, this }; };
+	constexpr Iterator beforeBegin() const { return { -1, this }; };
+	constexpr Iterator afterEnd() const { return { static_cast<std::int64_t>(count), this }; };
+};
+
+template<KEY KeyType, typename ValueType, std::size_t Capacity>
+	requires std::default_initializable<KeyType> && std::default_initializable<ValueType>
+constexpr void StaticTree<KeyType, ValueType, Capacity>::build(const std::pair<KeyType, ValueType>* _pairs)
+{
+	//std::stable_sort не constexpr в C++20, поэтому сортируются номера пар, а равные ключи
+	//упорядочиваются по номеру - так из одинаковых ключей первым остается переданный раньше
+	std::array<std::size_t, Capacity> order{};
+	for (std::size_t i = 0; i < Capacity; ++i)
+		order[i] = i;
+
+	std::sort(order.begin(), order.end(), [_pairs](std::size_t _first, std::size_t _second)
+	{
+		if (_pairs[_first].first < _pairs[_second].first)
+			return true;
+		if (_pairs[_second].first < _pairs[_first].first)
+			return false;
+		return _first < _second;
+	});
+
+	for (std::size_t i = 0; i < Capacity; ++i)
+	{
+		const std::pair<KeyType, ValueType>& pair = _pairs[order[i]];
+		if (count && entries[count - 1].key == pair.first)
+			continue;
+
+		entries[count].key = pair.first;
+		entries[count].value = pair.second;
+		++count;
+	}
+}
+
+template<KEY KeyType, typename ValueType, std::size_t Capacity>
+	requires std::default_initializable<KeyType> && std::default_initializable<ValueType>
+constexpr std::size_t StaticTree<KeyType, ValueType, Capacity>::lowerBoundIndex(const KeyType& _key) const
+{
+	//Спуск по неявному дереву без ветвления: на каждом шаге отбрасывается половина оставшихся записей,
+	//а выбор половины - условная пересылка, поэтому число шагов зависит только от размера таблицы
+	if (!count)
+		return 0;
+
+	std::size_t base = 0;
+	std::size_t length = count;
+	while (length > 1)
+	{
+		std::size_t half = length / 2;
+		base = (entries[base + half].key < _key) ? base + half : base;
+		length -= half;
+	}
+
+	return base + static_cast<std::size_t>(entries[base].key < _key);
+}
+
+template<KEY KeyType, typename ValueType, std::size_t Capacity>
+	requires std::default_initializable<KeyType> && std::default_initializable<ValueType>
+constexpr StaticTree<KeyType, ValueType, Capacity>::Iterator StaticTree<KeyType, ValueType, Capacity>::find(const KeyType& _key) const
+{
+	std::size_t index = lowerBoundIndex(_key);
+	if (index == count || !(entries[index].key == _key))
+		return afterEnd();
+
+	return { static_cast<std::int64_t>(index), this };
+}
+
+template<KEY KeyType, typename ValueType, std::size_t Capacity>
+	requires std::default_initializable<KeyType> && std::default_initializable<ValueType>
+constexpr StaticTree<KeyType, ValueType, Capacity>::Iterator StaticTree<KeyType, ValueType, Capacity>::lower_bound(const KeyType& _key) const
+{
+	return { static_cast<std::int64_t>(lowerBoundIndex(_key)), this };
+}
+
+template<KEY KeyType, typename ValueType, std::size_t Capacity>
+	requires std::default_initializable<KeyType> && std::default_initializable<ValueType>
+constexpr StaticTree<KeyType, ValueType, Capacity>::Iterator StaticTree<KeyType, ValueType, Capacity>::upper_bound(const KeyType& _key) const
+{
+	//Ключи уникальны, поэтому верхняя граница - следующая запись после найденного ключа
+	std::size_t index = lowerBoundIndex(_key);
+	if (index < count && entries[index].key == _key)
+		++index;
+
+	return { static_cast<std::int64_t>(index), this };
+}
+
+//Выводит Capacity из списка пар: makeStaticTree<int, int>({ { 1, 10 }, { 2, 20 } })
+template<KEY KeyType, typename ValueType, std::size_t Capacity>
+	requires std::default_initializable<KeyType> && std::default_initializable<ValueType>
+constexpr StaticTree<KeyType, ValueType, Capacity> makeStaticTree(const std::pair<KeyType, ValueType> (&_pairs)[Capacity])
+{
+	return StaticTree<KeyType, ValueType, Capacity>(_pairs);
+}
+
+//Проверки на этапе компиляции: поиск, границы, первый из одинаковых ключей и пустая таблица
+static_assert([]
+{
+	constexpr auto tree = makeStaticTree<int, int>({ { 3, 1 }, { 1, 2 }, { 3, 9 }, { 7, 4 }, { 5, 5 } });
+	return tree.size() == 4 && tree.find(3) != tree.afterEnd() && (*tree.find(3)).second == 1
+		&& (*tree.find(7)).second == 4 && tree.find(4) == tree.afterEnd() && tree.find(8) == tree.afterEnd()
+		&& (*tree.lower_bound(4)).first == 5 && (*tree.lower_bound(0)).first == 1 && tree.lower_bound(8) == tree.afterEnd()
+		&& (*tree.upper_bound(3)).first == 5 && (*tree.upper_bound(4)).first == 5 && tree.upper_bound(7) == tree.afterEnd();
+}());
+static_assert([]
+{
+	constexpr StaticTree<int, int, 0> tree(std::array<std::pair<int, int>, 0>{});
+	return tree.empty() && tree.find(1) == tree.afterEnd() && tree.lower_bound(1) == tree.afterEnd()
+		&& tree.upper_bound(1) == tree.afterEnd() && tree.begin() == tree.afterEnd();
+}());
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------ CLASS STATICTREE ------------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif
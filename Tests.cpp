@@ -0,0 +1,2218 @@
+﻿//Проверки корректности деревьев. Каждый тест печатает ok или FAIL с причиной,
+//при хотя бы одной ошибке программа завершается с кодом 1.
+//
+//Сборка:
+//	g++ -std=c++20 -O1 -g -fsanitize=address,undefined -pthread Tests.cpp -o Tests
+//	cl /std:c++20 /EHsc Tests.cpp
+//Многопоточные тесты имеет смысл собирать также с -fsanitize=thread.
+//С -DTREES_ENABLE_LATENCY добавляются проверки замеров внутри деревьев (LatencyRecorder/Trees).
+//
+//Параметры:
+//	--filter=LRU           запускать только тесты, в имени которых есть подстрока
+//	--seed=1               начальное значение генератора случайных тестов
+//
+//Имена тестов: <группа>/<проверка>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "AsyncTree.h"
+#include "BinaryTrees.h"
+#include "ConcurrentAVLTree.h"
+#include "DurableTree.h"
+#include "ExternalBuilder.h"
+#include "FrozenTree.h"
+#include "IntrusiveTree.h"
+#include "LatencyRecorder.h"
+#include "ShardedTree.h"
+#include "StaticTree.h"
+#include "ThreadPool.h"
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------------ HARNESS ---------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+struct Options
+{
+	std::string filter;
+	std::uint64_t seed = 1;
+};
+
+static Options options;
+static int failedTests = 0;
+static std::string failure;
+
+//Запоминает первую причину ошибки теста и возвращает false, чтобы тест мог сразу завершиться
+static bool fail(const std::string& _reason)
+{
+	if (failure.empty())
+		failure = _reason;
+	return false;
+}
+
+#define CHECK(condition) do { if (!(condition)) return fail(std::string(#condition) + " (line " + std::to_string(__LINE__) + ")"); } while (false)
+
+template<typename Body>
+void runTest(const std::string& _name, Body&& _body)
+{
+	if (!options.filter.empty() && _name.find(options.filter) == std::string::npos)
+		return;
+
+	failure.clear();
+	bool passed = _body();
+	if (!passed)
+		++failedTests;
+
+	std::printf("%-48s %s%s%s\n", _name.c_str(), passed ? "ok" : "FAIL", passed ? "" : ": ", failure.c_str());
+	std::fflush(stdout);
+}
+
+//------------------------------------------------------------------------------------------------------
+//--------------------------------------------- DIFFERENTIAL -------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Дерево совпадает с эталоном: ключи по порядку, а в деревьях без одинаковых ключей и значения
+//(порядок значений одинаковых ключей Multi-деревьев после удалений не определен)
+template<typename TreeType>
+static bool sameAsReference(TreeType& _tree, const std::multimap<int, int>& _reference)
+{
+	if (_tree.size() != static_cast<int>(_reference.size()))
+		return false;
+	if (_reference.empty())
+		return _tree.empty();
+
+	auto vector = _tree.getVector();
+	std::size_t i = 0;
+	for (const auto& pair : _reference)
+	{
+		if (vector[i].first != pair.first || (!_tree.allowsDuplicates() && vector[i].second != pair.second))
+			return false;
+		++i;
+	}
+
+	return true;
+}
+
+//Случайные операции над деревом и над std::multimap с одинаковыми аргументами: insert, erase, extract
+//с повторной вставкой под другим ключом, insertHint, eraseAll, merge, копирование с перемещением,
+//buildFromSorted и setAlpha у ScapegoatTree. После каждой операции ее ключ ищется через find
+//(у SplayTree поиск меняет форму дерева). Результаты операций сравниваются на каждом шаге,
+//validate() и содержимое - каждые 97 операций и в конце
+template<typename TreeType>
+bool fuzzAgainstMap(int _range, int _operations)
+{
+	std::mt19937_64 generator(options.seed * 7919 + _range);
+	TreeType tree;
+	const bool multi = tree.allowsDuplicates();
+	std::multimap<int, int> reference;
+
+	auto fuzzFail = [&](int _operation, const char* _what)
+	{
+		return fail(std::string(_what) + " at operation " + std::to_string(_operation) + ", range " + std::to_string(_range));
+	};
+
+	for (int operation = 0; operation < _operations; ++operation)
+	{
+		int key = static_cast<int>(generator() % _range);
+		int choice = static_cast<int>(generator() % 100);
+
+		if (choice < 45)
+		{
+			bool expected = multi || !reference.count(key);
+			if (tree.insert(key, operation) != expected)
+				return fuzzFail(operation, "insert");
+			if (expected)
+				reference.insert({ key, operation });
+		}
+		else if (choice < 80)
+		{
+			auto it = reference.find(key);
+			if (tree.erase(key) != (it != reference.end()))
+				return fuzzFail(operation, "erase");
+			if (it != reference.end())
+				reference.erase(it);
+		}
+		else if (choice < 85)
+		{
+			auto handle = tree.extract(key);
+			auto it = reference.find(key);
+			if (static_cast<bool>(handle) != (it != reference.end()))
+				return fuzzFail(operation, "extract");
+
+			if (handle)
+			{
+				reference.erase(it);
+				int newKey = static_cast<int>(generator() % _range);
+				int value = handle.value();
+				handle.key() = newKey;
+				bool expected = multi || !reference.count(newKey);
+				if (tree.insert(std::move(handle)) != expected)
+					return fuzzFail(operation, "insert(NodeHandle&&)");
+				if (expected)
+					reference.insert({ newKey, value });
+			}
+		}
+		else if (choice < 90)
+		{
+			auto hint = tree.lower_bound(key);
+			bool expected = multi || !reference.count(key);
+			if (tree.insertHint(hint, key, operation) != expected)
+				return fuzzFail(operation, "insertHint");
+			if (expected)
+				reference.insert({ key, operation });
+		}
+		else if (choice < 93)
+		{
+			if (tree.eraseAll(key) != static_cast<int>(reference.erase(key)))
+				return fuzzFail(operation, "eraseAll");
+		}
+		else if (choice < 95)
+		{
+			TreeType other;
+			std::multimap<int, int> added;
+			for (int i = 0; i < 20; ++i)
+			{
+				int otherKey = static_cast<int>(generator() % _range);
+				if (other.insert(otherKey, -i))
+					added.insert({ otherKey, -i });
+			}
+
+			tree.merge(other);
+			for (const auto& pair : added)
+			{
+				if (multi || !reference.count(pair.first))
+					reference.insert(pair);
+			}
+		}
+		else if (choice < 96)
+		{
+			TreeType copy(tree);
+			tree = std::move(copy);
+		}
+		else if (choice == 96)
+		{
+			std::vector<std::pair<int, int>> sorted;
+			int sortedKey = 0;
+			int count = static_cast<int>(generator() % 300);
+			for (int i = 0; i < count; ++i)
+			{
+				sortedKey += 1 + static_cast<int>(generator() % 5);
+				sorted.push_back({ sortedKey, i });
+			}
+
+			if (!tree.buildFromSorted(sorted))
+				return fuzzFail(operation, "buildFromSorted");
+			reference = std::multimap<int, int>(sorted.begin(), sorted.end());
+		}
+		else if constexpr (requires { tree.setAlpha(0.6); })
+			tree.setAlpha(0.55 + static_cast<double>(generator() % 40) / 100.0);
+
+		auto found = tree.find(key);
+		auto expected = reference.find(key);
+		if ((found != tree.afterEnd()) != (expected != reference.end())
+			|| (!multi && found != tree.afterEnd() && (*found).second != expected->second))
+			return fuzzFail(operation, "find");
+
+		if (operation % 97 == 0 && (!tree.validate() || !sameAsReference(tree, reference)))
+			return fuzzFail(operation, "validate or contents");
+	}
+
+	CHECK(tree.validate());
+	CHECK(sameAsReference(tree, reference));
+	return true;
+}
+
+//SplayTree в режиме полурасширения и с подъемом узла только при каждом третьем поиске
+struct SemiSplayTree : SplayTree<int, int>
+{
+	SemiSplayTree() { setSplayMode(SPLAY_MODES::SEMI); };
+};
+
+struct PeriodicSplayTree : SplayTree<int, int>
+{
+	PeriodicSplayTree() { setSplayMode(SPLAY_MODES::FULL, 3); };
+};
+
+template<typename TreeType>
+bool fuzzRanges()
+{
+	for (int range : { 50, 1000, 100000 })
+	{
+		if (!fuzzAgainstMap<TreeType>(range, 20000))
+			return false;
+	}
+
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------------ PARALLEL --------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//parallelForEach, parallelReduce, parallelGetVector и параллельный clear дают тот же результат, что и обход
+//по порядку, для пулов из 0, 1 и 3 потоков и деревьев от пустого до размера, при котором обход делится на задачи
+template<typename TreeType>
+bool testParallel()
+{
+	for (int threads : { 0, 1, 3 })
+	{
+		ThreadPool pool(threads);
+		for (int size : { 0, 1, 100, 20000 })
+		{
+			TreeType tree;
+			std::map<int, std::string> reference;
+			std::mt19937_64 generator(options.seed + size);
+			for (int i = 0; i < size; ++i)
+			{
+				int key = static_cast<int>(generator() % (4 * size + 1));
+				tree.insert(key, std::to_string(key));
+				reference.emplace(key, std::to_string(key));
+			}
+			CHECK(tree.size() == static_cast<int>(reference.size()));
+
+			std::atomic<long long> sum(0);
+			std::atomic<int> wrongValues(0);
+			tree.parallelForEach([&](const int& _key, std::string& _value)
+			{
+				sum += _key;
+				if (_value != std::to_string(_key))
+					++wrongValues;
+			}, pool);
+			long long expectedSum = 0;
+			for (const auto& pair : reference)
+				expectedSum += pair.first;
+			CHECK(sum == expectedSum && wrongValues == 0);
+
+			//Свертка строк не коммутативна, поэтому проверяет и порядок объединения частей
+			std::string concatenation = tree.parallelReduce(std::string(),
+				[](const int& _key, std::string&) { return std::to_string(_key) + ","; },
+				[](std::string _left, std::string _right) { return _left + _right; }, pool);
+			std::string expectedConcatenation;
+			for (const auto& pair : reference)
+				expectedConcatenation += std::to_string(pair.first) + ",";
+			CHECK(concatenation == expectedConcatenation);
+
+			auto vector = tree.parallelGetVector(pool);
+			CHECK(vector.size() == reference.size());
+			auto it = reference.begin();
+			for (const auto& pair : vector)
+			{
+				CHECK(pair.first == it->first && pair.second == it->second);
+				++it;
+			}
+
+			tree.setParallelPool(&pool);
+			tree.clear();
+			CHECK(tree.empty() && tree.size() == 0 && tree.validate());
+			tree.insert(1, "1");
+			CHECK(tree.size() == 1 && tree.validate());
+		}
+	}
+
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------------- COPY/MOVE --------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+template<typename TreeType>
+static std::vector<std::pair<int, long long>> itemsOf(const TreeType& _tree)
+{
+	std::vector<std::pair<int, long long>> items;
+	if (!_tree.empty())
+	{
+		for (const auto& pair : _tree.getVector())
+			items.push_back({ pair.first, pair.second });
+	}
+	return items;
+}
+
+//Копия совпадает с исходным деревом и проходит validate() (баланс и цвета перенесены), изменения копии
+//не видны в исходном дереве, перемещенное дерево пусто и пригодно к использованию, самоприсваивание ничего не меняет
+template<typename TreeType>
+bool testCopyMove()
+{
+	static_assert(std::is_nothrow_move_constructible_v<TreeType>);
+
+	std::mt19937_64 generator(options.seed);
+	for (int size : { 0, 1, 2, 7, 100, 5000 })
+	{
+		TreeType source;
+		for (int i = 0; i < size; ++i)
+			source.insert(static_cast<int>(generator() % 20000), i);
+		auto sourceItems = itemsOf(source);
+
+		TreeType copy(source);
+		CHECK(copy.validate() && itemsOf(copy) == sourceItems);
+
+		copy.insert(-5, 1);
+		for (int i = 0; i < size; ++i)
+			copy.erase(static_cast<int>(generator() % 20000));
+		CHECK(copy.validate() && source.validate() && itemsOf(source) == sourceItems);
+
+		auto copyItems = itemsOf(copy);
+		TreeType moved(std::move(copy));
+		CHECK(moved.validate() && itemsOf(moved) == copyItems);
+		CHECK(copy.empty() && copy.size() == 0 && copy.validate());
+		copy.insert(3, 3);
+		CHECK(copy.size() == 1 && copy.validate());
+
+		TreeType assigned;
+		assigned.insert(1, 1);
+		assigned = source;
+		CHECK(assigned.validate() && itemsOf(assigned) == sourceItems);
+		assigned = static_cast<const TreeType&>(assigned);
+		CHECK(assigned.validate() && itemsOf(assigned) == sourceItems);
+
+		TreeType moveAssigned;
+		moveAssigned.insert(9, 9);
+		moveAssigned = std::move(moved);
+		CHECK(moveAssigned.validate() && itemsOf(moveAssigned) == copyItems && moved.empty());
+
+		for (int i = 0; i < size; ++i)
+		{
+			moveAssigned.insert(static_cast<int>(generator() % 20000), 1);
+			assigned.erase(static_cast<int>(generator() % 20000));
+		}
+		CHECK(moveAssigned.validate() && assigned.validate() && itemsOf(source) == sourceItems);
+	}
+
+	return true;
+}
+
+//Копия LRUTree сохраняет порядок давности и сроки жизни: вытеснение в копии и в исходном дереве
+//затрагивает одни и те же ключи, а срок жизни переносится и при перемещении
+bool testCopyLRU()
+{
+	LRUTree<int, long long> source(50);
+	for (int i = 0; i < 100; ++i)
+		source.insert(i * 7 % 101, i);
+	source.find(3);
+	source.find(10);
+
+	LRUTree<int, long long> copy(source);
+	LRUTree<int, long long> assigned;
+	assigned = source;
+	CHECK(copy.validate() && assigned.validate());
+	auto recency = source.getKeysByRecency();
+	CHECK(copy.getKeysByRecency() == recency && assigned.getKeysByRecency() == recency);
+
+	for (int i = 0; i < 30; ++i)
+	{
+		source.insert(1000 + i, 0);
+		copy.insert(1000 + i, 0);
+		assigned.insert(1000 + i, 0);
+	}
+	CHECK(itemsOf(copy) == itemsOf(source) && itemsOf(assigned) == itemsOf(source));
+
+	auto deadline = LRUTree<int, long long>::Clock::now() + std::chrono::hours(1);
+	CHECK(source.setExpiry(3, deadline));
+	LRUTree<int, long long> moved(std::move(source));
+	CHECK(source.empty() && source.validate());
+	source.insert(5, 5);
+	CHECK(source.size() == 1 && source.validate());
+	CHECK(moved.evictExpired(deadline + std::chrono::hours(1)) == 1 && moved.count(3) == 0 && moved.validate());
+	return true;
+}
+
+//Присваивание через ссылку на Tree дерева другого вида перестраивает узлы под вид получателя,
+//а из Multi-дерева в дерево без одинаковых ключей переходит только первый из одинаковых ключей
+bool testCopyAcrossKinds()
+{
+	AVLTree<int, long long> avl;
+	for (int i = 0; i < 100; ++i)
+		avl.insert(i, i);
+
+	RBTree<int, long long> rb;
+	rb.insert(500, 1);
+	Tree<int, long long>& base = rb;
+	base = avl;
+	CHECK(rb.validate() && itemsOf(rb) == itemsOf(avl));
+
+	//Перемещение из дерева другого вида копирует узлы, источник не меняется
+	base = std::move(avl);
+	CHECK(rb.validate() && avl.size() == 100);
+
+	MultiRBTree<int, long long> multi;
+	multi.insert(1, 1);
+	multi.insert(1, 2);
+	base = multi;
+	CHECK(rb.validate() && rb.size() == 1);
+
+	RBSet<int> set({ 1, 2, 3 });
+	RBSet<int> setCopy(set);
+	RBSet<int> setMoved(std::move(set));
+	CHECK(setCopy.contains(2) && setMoved.contains(3) && !set.contains(1));
+
+	//Кэш горячих ключей копируется пустым и не указывает на узлы источника
+	RBTree<int, long long> cached;
+	cached.enableCache(64);
+	for (int i = 0; i < 1000; ++i)
+		cached.insert(i, i);
+	for (int i = 0; i < 1000; ++i)
+		cached.find(i);
+	RBTree<int, long long> cacheCopy(cached);
+	RBTree<int, long long> cacheMoved(std::move(cached));
+	for (int i = 0; i < 1000; ++i)
+		CHECK((*cacheCopy.find(i)).second == i && (*cacheMoved.find(i)).second == i);
+	cached.insert(1, 1);
+	CHECK((*cached.find(1)).second == 1);
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------------- SETS ----------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Множество против std::multiset: insert, contains, erase и обход итераторами в обе стороны,
+//построение из отсортированного вектора и validate(). Из одинаковых ключей Multi-множество хранит все
+template<typename SetType>
+bool testSetAgainstReference()
+{
+	std::mt19937_64 generator(options.seed);
+	SetType set;
+	const bool multi = set.allowsDuplicates();
+	std::multiset<int> reference;
+
+	for (int operation = 0; operation < 20000; ++operation)
+	{
+		int key = static_cast<int>(generator() % 2000);
+		if (generator() % 3)
+		{
+			bool expected = multi || !reference.count(key);
+			CHECK(set.insert(key) == expected);
+			if (expected)
+				reference.insert(key);
+		}
+		else
+		{
+			auto it = reference.find(key);
+			CHECK(set.erase(key) == (it != reference.end()));
+			if (it != reference.end())
+				reference.erase(it);
+		}
+		CHECK(set.contains(key) == (reference.count(key) != 0));
+	}
+	CHECK(set.validate() && set.size() == static_cast<int>(reference.size()));
+
+	auto it = set.begin();
+	for (int key : reference)
+	{
+		CHECK((*it).first == key);
+		++it;
+	}
+	CHECK(it == set.afterEnd());
+	it = set.end();
+	for (auto key = reference.rbegin(); key != reference.rend(); ++key)
+	{
+		CHECK((*it).first == *key);
+		--it;
+	}
+	CHECK(it == set.beforeBegin());
+
+	std::vector<int> sorted(reference.begin(), reference.end());
+	SetType built(sorted);
+	CHECK(built.validate() && built.size() == static_cast<int>(sorted.size()));
+	std::size_t index = 0;
+	for (const auto& pair : built.getVector())
+		CHECK(pair.first == sorted[index++]);
+
+	return true;
+}
+
+//NoValue с [[no_unique_address]] не занимает места: узел множества равен узлу без поля значения
+//и меньше узла с однобайтным значением там, где это значение не помещается в выравнивание
+template<typename KeyType>
+struct KeyOnlyNode
+{
+	void* left;
+	void* right;
+	void* parent;
+	KeyType key;
+};
+
+bool testSetNodeSize()
+{
+	CHECK(sizeof(BasicNode<int, NoValue>) == sizeof(KeyOnlyNode<int>));
+	CHECK(sizeof(BasicNode<long long, NoValue>) == sizeof(KeyOnlyNode<long long>));
+	CHECK(sizeof(BasicNode<long long, NoValue>) < sizeof(BasicNode<long long, char>));
+#if !defined(_MSC_VER)
+	//MSVC не размещает поля наследника в выравнивающем хвосте базового класса
+	CHECK(sizeof(AVLNode<int, NoValue>) == sizeof(KeyOnlyNode<int>));
+	CHECK(sizeof(RBNode<int, NoValue>) == sizeof(KeyOnlyNode<int>));
+#endif
+
+	Set<long long> set;
+	AVLSet<int> avlSet;
+	MultiRBSet<int> multiRBSet;
+	for (int i = 0; i < 10; ++i)
+	{
+		set.insert(i);
+		avlSet.insert(i);
+		multiRBSet.insert(i % 3);
+	}
+	CHECK(set.memoryUsage().nodeSize == static_cast<long long>(sizeof(BasicNode<long long, NoValue>)));
+	CHECK(avlSet.memoryUsage().nodeSize == static_cast<long long>(sizeof(AVLNode<int, NoValue>)));
+	CHECK(multiRBSet.memoryUsage().nodeSize == static_cast<long long>(sizeof(RBNode<int, NoValue>)));
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------------- FRONTCACHE -------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Кэш горячих ключей не возвращает освобожденных узлов: ключ сначала попадает в кэш через find,
+//затем его узел удаляется erase, extract, clear, buildFromSorted или присваиванием, и find того же ключа
+//должен промахнуться или найти новый узел (устаревший слот под ASan - чтение освобожденной памяти)
+template<typename TreeType>
+bool testFrontCacheInvalidation()
+{
+	TreeType tree;
+	CHECK(tree.enableCache(4));
+	auto fill = [](TreeType& _tree, int _count, long long _base)
+	{
+		for (int i = 0; i < _count; ++i)
+			_tree.insert(i, _base + i);
+		for (int i = 0; i < _count; ++i)
+			_tree.find(i);
+	};
+	auto valueOf = [](TreeType& _tree, int _key) { return (*_tree.find(_key)).second; };
+
+	fill(tree, 100, 0);
+	CHECK(tree.erase(7) && tree.find(7) == tree.afterEnd());
+	tree.find(50);
+	CHECK(tree.erase(50) && tree.find(50) == tree.afterEnd() && valueOf(tree, 51) == 51);
+
+	tree.find(8);
+	auto handle = tree.extract(8);
+	CHECK(handle && tree.find(8) == tree.afterEnd());
+	handle.key() = 1000;
+	CHECK(tree.insert(std::move(handle)) && valueOf(tree, 1000) == 8 && tree.find(8) == tree.afterEnd());
+	tree.insert(8, -8);
+	CHECK(valueOf(tree, 8) == -8 && tree.validate());
+
+	tree.clear();
+	for (int i = 0; i < 100; ++i)
+		CHECK(tree.find(i) == tree.afterEnd());
+
+	fill(tree, 100, 0);
+	std::vector<std::pair<int, long long>> sorted;
+	for (int i = 0; i < 100; i += 2)
+		sorted.push_back({ i, 2000 + i });
+	CHECK(tree.buildFromSorted(sorted));
+	for (int i = 0; i < 100; ++i)
+		CHECK(i % 2 ? tree.find(i) == tree.afterEnd() : valueOf(tree, i) == 2000 + i);
+
+	//Копирующее и перемещающее присваивание освобождают узлы дерева-приемника, в кэше которого они лежат;
+	//перемещенное дерево получает пустой кэш и остается пригодным к использованию
+	fill(tree, 100, 0);
+	TreeType other;
+	CHECK(other.enableCache(4));
+	fill(other, 50, 3000);
+	tree = other;
+	for (int i = 0; i < 100; ++i)
+		CHECK(i < 50 ? valueOf(tree, i) == 3000 + i : tree.find(i) == tree.afterEnd());
+
+	fill(tree, 100, 0);
+	fill(other, 60, 4000);
+	tree = std::move(other);
+	for (int i = 0; i < 100; ++i)
+		CHECK(i < 60 ? valueOf(tree, i) == (i < 50 ? 3000 : 4000) + i : tree.find(i) == tree.afterEnd());
+	for (int i = 0; i < 100; ++i)
+		CHECK(other.find(i) == other.afterEnd());
+	fill(other, 10, 5000);
+	CHECK(valueOf(other, 3) == 5003 && other.validate());
+
+	//Присваивание дерева другого вида через ссылку на Tree
+	fill(tree, 100, 0);
+	RBTree<int, long long> source;
+	source.insert(5, 6000);
+	static_cast<Tree<int, long long>&>(tree) = source;
+	CHECK(valueOf(tree, 5) == 6000 && tree.find(6) == tree.afterEnd());
+
+	//Случайные операции против std::map: в 4 слотах ключи постоянно вытесняют друг друга
+	std::mt19937_64 generator(options.seed);
+	std::map<int, long long> reference;
+	tree.clear();
+	for (int operation = 0; operation < 20000; ++operation)
+	{
+		int key = static_cast<int>(generator() % 300);
+		int choice = static_cast<int>(generator() % 100);
+		if (choice < 40)
+			CHECK(tree.insert(key, operation) == reference.insert({ key, operation }).second);
+		else if (choice < 70)
+			CHECK(tree.erase(key) == (reference.erase(key) != 0));
+		else if (choice < 85)
+		{
+			auto extracted = tree.extract(key);
+			CHECK(static_cast<bool>(extracted) == (reference.erase(key) != 0));
+		}
+		else if (choice < 99)
+		{
+			auto it = reference.find(key);
+			CHECK(tree.setValue(key, -operation) == (it != reference.end()));
+			if (it != reference.end())
+				it->second = -operation;
+		}
+		else
+		{
+			TreeType copy(tree);
+			tree = copy;
+		}
+
+		auto found = tree.find(key);
+		auto expected = reference.find(key);
+		CHECK((found != tree.afterEnd()) == (expected != reference.end()));
+		CHECK(expected == reference.end() || (*found).second == expected->second);
+	}
+	CHECK(tree.validate() && tree.size() == static_cast<int>(reference.size()));
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//---------------------------------------------- MEMORYUSAGE -------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//memoryUsage: пустое дерево ничего не занимает, число узлов и байты узлов следуют за size() при вставке,
+//удалении и clear, кэш горячих ключей попадает в auxiliaryBytes, память длинных строк - в ownedBytes
+template<template<typename, typename> class TreeKind, template<typename, typename> class NodeKind>
+bool testMemoryUsage()
+{
+	using Usage = TreeMemoryUsage;
+	constexpr long long nodeSize = static_cast<long long>(sizeof(NodeKind<int, long long>));
+
+	TreeKind<int, long long> tree;
+	Usage empty = tree.memoryUsage();
+	CHECK(empty.nodes == 0 && empty.ownedBytes == 0 && empty.auxiliaryBytes == 0);
+	CHECK(empty.totalBytes() == 0 && empty.bytesPerEntry() == 0.0);
+	CHECK(empty.nodeSize == nodeSize && empty.nodeAllocation == static_cast<long long>(mallocBlockSize(sizeof(NodeKind<int, long long>))));
+	CHECK(empty.nodeAllocation >= nodeSize && empty.nodeAllocation % static_cast<long long>(2 * sizeof(std::size_t)) == 0);
+
+	for (int i = 0; i < 1000; ++i)
+		tree.insert(i, i);
+	Usage thousand = tree.memoryUsage();
+	CHECK(thousand.nodes == tree.size() && thousand.nodeSize == nodeSize && thousand.ownedBytes == 0);
+	CHECK(thousand.totalBytes() == thousand.nodes * thousand.nodeAllocation + thousand.auxiliaryBytes);
+
+	for (int i = 1000; i < 2000; ++i)
+		tree.insert(i, i);
+	Usage twoThousand = tree.memoryUsage();
+	CHECK(twoThousand.nodes == 2000 && twoThousand.nodes * twoThousand.nodeAllocation == 2 * thousand.nodes * thousand.nodeAllocation);
+
+	for (int i = 0; i < 2000; i += 4)
+		tree.erase(i);
+	CHECK(tree.memoryUsage().nodes == 1500 && tree.size() == 1500);
+
+	//Кэш из 64 слотов - массив указателей в одном блоке malloc
+	long long uncachedBytes = tree.memoryUsage().auxiliaryBytes;
+	CHECK(tree.enableCache(64));
+	Usage cached = tree.memoryUsage();
+	CHECK(cached.auxiliaryBytes - uncachedBytes == static_cast<long long>(mallocBlockSize(64 * sizeof(void*))));
+	CHECK(cached.totalBytes() == 1500 * cached.nodeAllocation + cached.auxiliaryBytes);
+	CHECK(tree.enableCache(0));
+
+	//Функция владения считает байты на каждую пару
+	Usage custom = tree.memoryUsage([](const int&, const long long&) { return std::size_t(10); });
+	CHECK(custom.ownedBytes == 10 * 1500 && custom.totalBytes() == tree.memoryUsage().totalBytes() + 15000);
+
+	tree.clear();
+	Usage cleared = tree.memoryUsage();
+	CHECK(cleared.nodes == 0 && cleared.totalBytes() == cleared.auxiliaryBytes);
+
+	//Короткие строки лежат во внутреннем буфере и кучи не занимают, длинные занимают блок на строку
+	TreeKind<int, std::string> strings;
+	CHECK(strings.memoryUsage().ownedBytes == 0);
+	for (int i = 0; i < 100; ++i)
+		strings.insert(i, "s");
+	CHECK(strings.memoryUsage().nodes == 100 && strings.memoryUsage().ownedBytes == 0);
+	std::string longValue(200, 'v');
+	for (int i = 100; i < 200; ++i)
+		strings.insert(i, longValue);
+	Usage owned = strings.memoryUsage();
+	CHECK(owned.nodes == 200 && owned.ownedBytes == 100 * static_cast<long long>(mallocBlockSize(longValue.capacity() + 1)));
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//--------------------------------------------- INTRUSIVETREE ------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Объект в двух интрузивных деревьях сразу: AVLHook и RBHook не мешают друг другу
+struct IntrusiveItem : AVLHook<>, RBHook<>
+{
+	int key = 0;
+};
+
+struct IntrusiveItemKey
+{
+	const int& operator()(const IntrusiveItem& _item) const { return _item.key; }
+};
+
+using IntrusiveAVL = IntrusiveAVLTree<IntrusiveItem, int, IntrusiveItemKey>;
+using IntrusiveRB = IntrusiveRBTree<IntrusiveItem, int, IntrusiveItemKey>;
+
+//Вставка и удаление по объекту и по ключу, поиск и обход сверяются со std::map, который помнит, какой
+//из двух объектов с одним ключом связан; validate() и обход в обе стороны - каждые 97 операций
+template<typename TreeType, typename Hook>
+bool intrusiveAgainstMap(int _range)
+{
+	std::mt19937_64 generator(options.seed * 17 + _range);
+	std::vector<IntrusiveItem> items(_range);
+	std::vector<IntrusiveItem> twins(_range);
+	for (int i = 0; i < _range; ++i)
+		items[i].key = twins[i].key = i;
+
+	TreeType tree;
+	std::map<int, IntrusiveItem*> reference;
+
+	auto sameContents = [&]
+	{
+		if (tree.size() != static_cast<int>(reference.size()) || tree.empty() != reference.empty())
+			return false;
+
+		IntrusiveItem* item = tree.first();
+		for (const auto& pair : reference)
+		{
+			if (item != pair.second)
+				return false;
+			item = TreeType::next(*item);
+		}
+		if (item)
+			return false;
+
+		item = tree.last();
+		for (auto it = reference.rbegin(); it != reference.rend(); ++it)
+		{
+			if (item != it->second)
+				return false;
+			item = TreeType::previous(*item);
+		}
+		return item == nullptr;
+	};
+
+	for (int operation = 0; operation < 40000; ++operation)
+	{
+		int key = static_cast<int>(generator() % _range);
+		IntrusiveItem& item = (generator() % 2) ? items[key] : twins[key];
+		int choice = static_cast<int>(generator() % 100);
+		auto it = reference.find(key);
+
+		if (choice < 45)
+		{
+			//Объект с занятым ключом или уже связанный не вставляется
+			bool expected = it == reference.end();
+			CHECK(tree.insert(item) == expected);
+			if (expected)
+				reference[key] = &item;
+		}
+		else if (choice < 65)
+		{
+			bool expected = it != reference.end() && it->second == &item;
+			CHECK(tree.erase(item) == expected);
+			if (expected)
+				reference.erase(it);
+		}
+		else if (choice < 80)
+		{
+			CHECK(tree.erase(key) == (it != reference.end()));
+			if (it != reference.end())
+				reference.erase(it);
+		}
+		else
+		{
+			auto lower = reference.lower_bound(key);
+			auto upper = reference.upper_bound(key);
+			CHECK(tree.find(key) == (it == reference.end() ? nullptr : it->second));
+			CHECK(tree.lower_bound(key) == (lower == reference.end() ? nullptr : lower->second));
+			CHECK(tree.upper_bound(key) == (upper == reference.end() ? nullptr : upper->second));
+		}
+
+		if (operation % 97 == 0)
+			CHECK(tree.validate() && sameContents());
+	}
+	CHECK(tree.validate() && sameContents());
+
+	//Связаны ровно объекты эталона, после clear все крючки свободны
+	for (int i = 0; i < _range; ++i)
+	{
+		bool linked = reference.count(i) && reference[i] == &items[i];
+		bool twinLinked = reference.count(i) && reference[i] == &twins[i];
+		CHECK(static_cast<Hook&>(items[i]).isLinked() == linked && static_cast<Hook&>(twins[i]).isLinked() == twinLinked);
+	}
+	tree.clear();
+	CHECK(tree.empty() && tree.validate() && tree.first() == nullptr);
+	for (int i = 0; i < _range; ++i)
+		CHECK(!static_cast<Hook&>(items[i]).isLinked() && !static_cast<Hook&>(twins[i]).isLinked());
+	return true;
+}
+
+template<typename TreeType, typename Hook>
+bool testIntrusive()
+{
+	for (int range : { 1, 50, 2000 })
+	{
+		if (!intrusiveAgainstMap<TreeType, Hook>(range))
+			return false;
+	}
+
+	return true;
+}
+
+//Объект, связанный в одном дереве, не вставляется в другое дерево с тем же крючком: раньше вставка
+//перезаписывала его связи и портила оба дерева. Крючки разных видов независимы
+bool testIntrusiveLinkedHook()
+{
+	std::vector<IntrusiveItem> items(100);
+	IntrusiveAVL first;
+	IntrusiveAVL second;
+	IntrusiveRB byColor;
+	for (int i = 0; i < 100; ++i)
+	{
+		items[i].key = i;
+		CHECK(first.insert(items[i]));
+		CHECK(!second.insert(items[i]) && !second.erase(items[i]));
+		CHECK(byColor.insert(items[i]));
+	}
+	CHECK(first.validate() && second.validate() && byColor.validate());
+	CHECK(first.size() == 100 && second.empty() && byColor.size() == 100);
+
+	//Единственный объект дерева тоже считается связанным, хотя все его связи пустые
+	IntrusiveItem lonely;
+	IntrusiveAVL single;
+	CHECK(single.insert(lonely) && !second.insert(lonely) && second.empty());
+
+	//Копия объекта получает свободный крючок
+	IntrusiveItem copy = items[5];
+	CHECK(!copy.AVLHook<>::isLinked() && second.insert(copy) && first.find(5) == &items[5]);
+
+	CHECK(first.erase(items[7]) && second.insert(items[7]) && second.size() == 2);
+	CHECK(first.validate() && second.validate());
+	second.clear();
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------------ LRUTREE ---------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Ключи дерева по возрастанию
+static std::vector<int> keysOf(LRUTree<int, int>& _tree)
+{
+	std::vector<int> keys;
+	for (auto it = _tree.begin(); it != _tree.afterEnd(); ++it)
+		keys.push_back((*it).first);
+	return keys;
+}
+
+//clear, присваивание и buildFromSorted через ссылку на Tree должны обновлять списки LRUTree:
+//раньше они вызывали невиртуальные методы базового класса, и следующая вставка писала в освобожденные узлы
+bool testLRUThroughBase()
+{
+	LRUTree<int, int> lru(8);
+	Tree<int, int>& base = lru;
+
+	for (int i = 0; i < 6; ++i)
+		lru.insert(i, i);
+	base.clear();
+	CHECK(lru.validate());
+	lru.insert(100, 1);
+	lru.insert(101, 2);
+	CHECK(lru.validate() && lru.size() == 2);
+
+	base = AVLTree<int, int>({ { 1, 1 }, { 2, 2 }, { 3, 3 } });
+	CHECK(lru.validate() && lru.size() == 3);
+	lru.insert(4, 4);
+	CHECK(lru.validate());
+
+	std::vector<std::pair<int, int>> sorted;
+	for (int i = 0; i < 20; ++i)
+		sorted.push_back({ i, i });
+	CHECK(base.buildFromSorted(sorted));
+	CHECK(lru.validate() && lru.size() == 8);	//емкость 8: лишние записи вытеснены
+	lru.insert(50, 50);
+	CHECK(lru.validate() && lru.size() == 8);
+
+	//Присваивание LRUTree через ссылку на Tree копирует и списки
+	LRUTree<int, int> other(8);
+	for (int i = 0; i < 5; ++i)
+		other.insert(i * 10, i);
+	other.find(0);
+	base = static_cast<const Tree<int, int>&>(other);
+	CHECK(lru.validate() && lru.size() == 5);
+	base = std::move(static_cast<Tree<int, int>&>(other));
+	CHECK(lru.validate() && other.validate() && other.empty());
+	lru.insert(7, 7);
+	CHECK(lru.validate() && lru.size() == 6);
+
+	//insertHint и merge через ссылку на Tree соблюдают емкость
+	LRUTree<int, int> small(3);
+	Tree<int, int>& smallBase = small;
+	auto hint = smallBase.afterEnd();
+	for (int i = 0; i < 5; ++i)
+		smallBase.insertHint(hint, i, i);
+	CHECK(small.validate() && small.size() == 3);
+
+	RBTree<int, int> donor({ { 10, 1 }, { 11, 2 }, { 12, 3 } });
+	smallBase.merge(donor);
+	CHECK(small.validate() && small.size() == 3);
+	CHECK(keysOf(small) == std::vector<int>({ 10, 11, 12 }));
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//--------------------------------------------- SCAPEGOATTREE ------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//После clear, buildFromSorted и присваивания граница глубины считается от нового размера:
+//раньше max_size оставался от прежнего дерева, и вставки по возрастанию вытягивали дерево в цепочку
+bool testScapegoatSizeBound()
+{
+	ScapegoatTree<int, int> tree;
+	Tree<int, int>& base = tree;
+
+	for (int i = 0; i < 1000; ++i)
+		tree.insert(i, i);
+	base.clear();
+	for (int i = 0; i < 16; ++i)
+		tree.insert(i, i);
+	CHECK(tree.validate());
+
+	std::vector<std::pair<int, int>> sorted;
+	for (int i = 0; i < 5; ++i)
+		sorted.push_back({ i, i });
+	CHECK(base.buildFromSorted(sorted));
+	CHECK(tree.validate());
+	for (int i = 5; i < 40; ++i)
+		tree.insert(i, i);
+	CHECK(tree.validate());
+
+	ScapegoatTree<int, int> other;
+	other.setAlpha(0.6);
+	for (int i = 0; i < 100; ++i)
+		other.insert(i, i);
+	base = static_cast<const Tree<int, int>&>(other);
+	CHECK(tree.validate() && tree.size() == 100);
+	base = std::move(static_cast<Tree<int, int>&>(other));
+	CHECK(tree.validate() && other.validate() && other.empty());
+
+	//После удалений увеличение alpha не должно оставлять размер ниже alpha * max_size
+	for (int i = 0; i < 35; ++i)
+		tree.erase(i);
+	CHECK(tree.setAlpha(0.9));
+	CHECK(tree.validate());
+
+	//Дерево, из которого забрали узлы, строится заново с нулевого max_size
+	ScapegoatTree<int, int> moved(std::move(tree));
+	CHECK(moved.validate() && tree.empty());
+	for (int i = 0; i < 16; ++i)
+		tree.insert(i, i);
+	CHECK(tree.validate());
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//---------------------------------------------- SHARDEDTREE -------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Случайные insert, erase, setValue, find и contains сверяются со std::map. Сначала ключи в основном добавляются,
+//потом в основном удаляются, и в конце удаляются почти все, поэтому RANGE-шарды делятся и сливаются.
+//Содержимое и размер сверяются каждые 499 операций
+bool testShardedAgainstMap(SHARDING_MODES _mode)
+{
+	std::mt19937_64 generator(options.seed * 131 + static_cast<int>(_mode));
+	ShardedTree<int, int> sharded(8, _mode, 16);
+	std::map<int, int> reference;
+	int maxShards = 1;
+
+	auto sameContents = [&]
+	{
+		auto vector = sharded.getVector();
+		return sharded.size() == static_cast<int>(reference.size()) &&
+			vector == std::vector<std::pair<int, int>>(reference.begin(), reference.end());
+	};
+
+	for (int operation = 0; operation < 60000; ++operation)
+	{
+		int key = static_cast<int>(generator() % 3000);
+		int choice = static_cast<int>(generator() % 100);
+		int insertShare = (operation < 30000) ? 60 : 15;
+
+		if (choice < insertShare)
+			CHECK(sharded.insert(key, operation) == reference.insert({ key, operation }).second);
+		else if (choice < 70)
+			CHECK(sharded.erase(key) == (reference.erase(key) == 1));
+		else if (choice < 80)
+		{
+			bool expected = reference.count(key);
+			CHECK(sharded.setValue(key, -operation) == expected);
+			if (expected)
+				reference[key] = -operation;
+		}
+		else
+		{
+			int value = 0;
+			bool found = sharded.find(key, value);
+			CHECK(found == (reference.count(key) == 1) && sharded.contains(key) == found);
+			CHECK(!found || value == reference[key]);
+		}
+
+		maxShards = std::max(maxShards, sharded.shardCount());
+		if (operation % 499 == 0)
+			CHECK(sameContents());
+	}
+	CHECK(sameContents());
+
+	for (int key = 0; key < 3000; ++key)
+	{
+		if (key % 500)
+			CHECK(sharded.erase(key) == (reference.erase(key) == 1));
+	}
+	CHECK(sameContents());
+
+	//RANGE-шарды успели разделиться и слиться обратно, у HASH количество шардов постоянно
+	if (_mode == SHARDING_MODES::RANGE)
+		CHECK(maxShards > 2 && sharded.shardCount() < maxShards);
+	else
+		CHECK(maxShards == 8 && sharded.shardCount() == 8);
+
+	sharded.clear();
+	CHECK(sharded.empty() && sharded.getVector().empty() && !sharded.contains(0));
+	CHECK(sharded.insert(1, 1) && sharded.size() == 1);
+	return true;
+}
+
+//Одинаковые ключи Multi-дерева не разделяются границей RANGE-шардов: раньше часть их оставалась в нижнем шарде,
+//а поиск и удаление шли в верхний. Шард из одного ключа не делится (и не зацикливает перераспределение)
+bool testShardedDuplicateKeys()
+{
+	ShardedTree<int, int, MultiRBTree<int, int>> sharded(4, SHARDING_MODES::RANGE, 16);
+	for (int i = 0; i < 2000; ++i)
+	{
+		CHECK(sharded.insert(5, i));
+		CHECK(sharded.insert(i < 1000 ? i - 1000 : i, i));
+	}
+	CHECK(sharded.shardCount() > 1 && sharded.size() == 4000);
+
+	int erased = 0;
+	while (sharded.erase(5))
+		++erased;
+	CHECK(erased == 2000 && sharded.size() == 2000);
+	for (const auto& pair : sharded.getVector())
+		CHECK(pair.first != 5);
+
+	ShardedTree<int, int, MultiRBTree<int, int>> single(4, SHARDING_MODES::RANGE, 16);
+	for (int i = 0; i < 500; ++i)
+		CHECK(single.insert(7, i));
+	CHECK(single.shardCount() == 1 && single.size() == 500);
+	return true;
+}
+
+//LRUTree, который запоминает все живые экземпляры, чтобы тест мог заглянуть в шарды ShardedTree
+struct TrackedLRUTree : public LRUTree<int, int>
+{
+	static std::set<TrackedLRUTree*> live;
+
+	TrackedLRUTree() { live.insert(this); };
+	~TrackedLRUTree() { live.erase(this); };
+};
+
+std::set<TrackedLRUTree*> TrackedLRUTree::live;
+
+//Порядок давности каждого шарда - подпоследовательность ожидаемого порядка, и все ключи на месте
+static bool recencyPreserved(const std::vector<int>& _expected)
+{
+	std::size_t total = 0;
+	for (TrackedLRUTree* tree : TrackedLRUTree::live)
+	{
+		CHECK(tree->validate());
+		std::size_t position = 0;
+		for (int key : tree->getKeysByRecency())
+		{
+			while (position < _expected.size() && _expected[position] != key)
+				++position;
+			CHECK(position < _expected.size());
+			++total;
+		}
+	}
+
+	CHECK(total == _expected.size());
+	return true;
+}
+
+//Деление и слияние LRU-шардов сохраняют давность записей и время истечения:
+//раньше шарды перестраивались через buildFromSorted, и давность шла по ключам, а время истечения сбрасывалось
+bool testShardedLRUSplitMerge()
+{
+	using Clock = LRUTree<int, int>::Clock;
+	Clock::time_point start = Clock::now() + std::chrono::hours(1);
+
+	ShardedTree<int, int, TrackedLRUTree> sharded(4, SHARDING_MODES::RANGE, 8);
+	CHECK(TrackedLRUTree::live.size() == 1);
+	TrackedLRUTree& first = **TrackedLRUTree::live.begin();
+
+	std::vector<int> order;
+	for (int i = 0; i < 8; ++i)
+		sharded.insert(i, i);
+	for (int i = 7; i >= 0; --i)
+	{
+		CHECK(sharded.contains(i));
+		first.setExpiry(i, start + std::chrono::seconds(i));
+		order.push_back(i);
+	}
+
+	//Девятый ключ делит шард на {0..3} и {4..8}
+	sharded.insert(8, 8);
+	order.push_back(8);
+	CHECK(sharded.shardCount() == 2);
+	if (!recencyPreserved(order))
+		return false;
+
+	//Удаления сливают шарды обратно
+	for (int key : { 4, 5, 6, 0, 1, 2 })
+	{
+		sharded.erase(key);
+		order.erase(std::find(order.begin(), order.end(), key));
+	}
+	CHECK(sharded.shardCount() == 1);
+	if (!recencyPreserved(order))
+		return false;
+
+	//Ключ 3 истекает через 3 секунды после start, 7 - через 7, у 8 время истечения не задано
+	TrackedLRUTree& merged = **TrackedLRUTree::live.begin();
+	CHECK(merged.evictExpired(start + std::chrono::seconds(5)) == 1);
+	CHECK(merged.evictExpired(start + std::chrono::seconds(7)) == 1);
+	CHECK(merged.size() == 1 && merged.getKeysByRecency() == std::vector<int>({ 8 }));
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CONCURRENTAVLTREE ----------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Случайные операции нескольких потоков сверяются со std::map: каждый писатель владеет ключами со своим остатком
+//от деления, поэтому результат каждой его операции предсказуем, хотя повороты затрагивают и чужие ключи.
+//Читатели параллельно ищут ключи и обходят дерево. После завершения потоков проверяется структура дерева
+bool testConcurrentAgainstMap()
+{
+	constexpr int WRITERS = 4;
+	constexpr int READERS = 2;
+	constexpr int KEYS = 4096;
+	constexpr int OPERATIONS = 100000;
+
+	ConcurrentAVLTree<int, int> tree;
+	std::vector<std::map<int, int>> models(WRITERS);
+	std::vector<std::string> errors(WRITERS + READERS);
+	std::atomic<int> runningWriters(WRITERS);
+
+	std::vector<std::thread> threads;
+	for (int writer = 0; writer < WRITERS; ++writer)
+	{
+		threads.emplace_back([&, writer]()
+		{
+			std::mt19937_64 generator(options.seed * 1000 + writer);
+			std::map<int, int>& model = models[writer];
+			for (int i = 0; i < OPERATIONS && errors[writer].empty(); ++i)
+			{
+				int key = static_cast<int>(generator() % (KEYS / WRITERS)) * WRITERS + writer;
+				int value = static_cast<int>(generator() % 1000);
+				bool present = model.count(key) != 0;
+				int found = 0;
+				switch (generator() % 4)
+				{
+				case 0:
+					if (tree.insert(key, value) != !present)
+						errors[writer] = "insert " + std::to_string(key);
+					model.insert({ key, value });
+					break;
+				case 1:
+					if (tree.erase(key) != present)
+						errors[writer] = "erase " + std::to_string(key);
+					model.erase(key);
+					break;
+				case 2:
+					if (tree.setValue(key, value) != present)
+						errors[writer] = "setValue " + std::to_string(key);
+					if (present)
+						model[key] = value;
+					break;
+				default:
+					if (tree.find(key, found) != present || (present && found != model[key]))
+						errors[writer] = "find " + std::to_string(key);
+					break;
+				}
+			}
+			--runningWriters;
+		});
+	}
+
+	for (int reader = 0; reader < READERS; ++reader)
+	{
+		threads.emplace_back([&, reader]()
+		{
+			std::string& error = errors[WRITERS + reader];
+			std::mt19937_64 generator(options.seed * 1000 + WRITERS + reader);
+			while (runningWriters.load() && error.empty())
+			{
+				int value;
+				tree.find(static_cast<int>(generator() % KEYS), value);
+
+				//Обход не мгновенный снимок, но ключи в нем всегда строго возрастают
+				int previous = -1;
+				tree.forEach([&](const int& _key, const int&)
+				{
+					if (_key <= previous)
+						error = "forEach order";
+					previous = _key;
+				});
+			}
+		});
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+	for (const std::string& error : errors)
+	{
+		if (!error.empty())
+			return fail("thread: " + error);
+	}
+
+	std::map<int, int> expected;
+	for (const auto& model : models)
+		expected.insert(model.begin(), model.end());
+
+	CHECK(tree.validate());
+	CHECK(tree.size() == static_cast<int>(expected.size()));
+	std::vector<std::pair<int, int>> contents(expected.begin(), expected.end());
+	CHECK(tree.getVector() == contents);
+	return true;
+}
+
+//Объект, который считает живые экземпляры
+struct Counted
+{
+	static int alive;
+
+	Counted() { ++alive; };
+	~Counted() { --alive; };
+};
+
+int Counted::alive = 0;
+
+//Операции потоков, делящих слот, непрерывно перекрываются: раньше слот хранил эпоху самой первой из них,
+//глобальная эпоха не продвигалась и отложенные объекты не освобождались до разрушения EpochReclaimer
+bool testEpochSharedSlot()
+{
+	constexpr int RETIRED = 10000;
+	{
+		EpochReclaimer reclaimer;
+		int parity = reclaimer.enter(0);
+		for (int i = 0; i < RETIRED; ++i)
+		{
+			//Следующая операция того же слота начинается раньше, чем заканчивается предыдущая
+			int next = reclaimer.enter(0);
+			reclaimer.leave(0, parity);
+			parity = next;
+			reclaimer.retire(1, new Counted());
+		}
+
+		CHECK(Counted::alive < RETIRED / 10);
+		reclaimer.leave(0, parity);
+	}
+
+	CHECK(Counted::alive == 0);
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------------- ASYNCTREE --------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Несколько производителей с непересекающимися ключами ставят операции через future и callback, не дожидаясь
+//результатов. Операции одного ключа применяются в порядке поступления, после flush() готовы все результаты,
+//добавленные до него, а содержимое совпадает со std::map
+bool testAsyncProducers()
+{
+	const int producers = 4;
+	const int keysPerProducer = 2000;
+	AsyncTree<int, int> tree(std::chrono::milliseconds(1), 64);
+	std::atomic<int> mismatches(0);
+	std::atomic<int> callbacks(0);
+	std::vector<std::map<int, int>> expected(producers);
+
+	std::vector<std::thread> threads;
+	for (int producer = 0; producer < producers; ++producer)
+	{
+		threads.emplace_back([&, producer]
+		{
+			std::vector<std::pair<std::future<bool>, bool>> futures;
+			auto expect = [&](bool _expected) { return [&, _expected](bool _result)
+			{
+				if (_result != _expected)
+					++mismatches;
+				++callbacks;
+			}; };
+
+			for (int i = 0; i < keysPerProducer; ++i)
+			{
+				int key = i * producers + producer;
+				futures.push_back({ tree.insert(key, i), true });
+				expected[producer][key] = i;
+
+				if (i % 3 == 0)
+				{
+					futures.push_back({ tree.setValue(key, -i), true });
+					futures.push_back({ tree.erase(key), true });
+					futures.push_back({ tree.erase(key), false });
+					futures.push_back({ tree.setValue(key, 0), false });
+					futures.push_back({ tree.insert(key, i + 1), true });
+					expected[producer][key] = i + 1;
+				}
+				else if (i % 3 == 1)
+				{
+					tree.insert(key, 0, expect(false));
+					tree.setValue(key, -i, expect(true));
+					expected[producer][key] = -i;
+				}
+				else
+					tree.erase(key, nullptr);
+				if (i % 3 == 2)
+					expected[producer].erase(key);
+			}
+
+			tree.flush();
+			for (auto& future : futures)
+			{
+				if (future.first.wait_for(std::chrono::seconds(0)) != std::future_status::ready ||
+					future.first.get() != future.second)
+					++mismatches;
+			}
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+
+	tree.flush();
+	CHECK(mismatches == 0);
+	CHECK(callbacks == producers * 2 * ((keysPerProducer + 1) / 3));
+
+	std::map<int, int> reference;
+	for (const auto& part : expected)
+		reference.insert(part.begin(), part.end());
+
+	std::vector<std::pair<int, int>> contents;
+	std::vector<std::pair<int, int>> referenceContents(reference.begin(), reference.end());
+	tree.forEach([&](const int& _key, const int& _value) { contents.push_back({ _key, _value }); });
+	CHECK(tree.size() == static_cast<int>(reference.size()) && contents == referenceContents);
+
+	//Ключ 1 прошел всю цепочку insert, setValue, erase и снова insert, ключ 2 * producers + 2 удален
+	int value = 0;
+	CHECK(tree.find(1, value) && value == 1 && !tree.contains(2 * producers + 2));
+	return true;
+}
+
+//Деструктор применяет все поставленные операции, не дожидаясь flushLatency, а flush() будит применитель сразу
+bool testAsyncDrainOnDestroy()
+{
+	auto start = std::chrono::steady_clock::now();
+	std::atomic<int> applied(0);
+	std::future<bool> duplicate;
+	{
+		AsyncTree<int, int> tree(std::chrono::hours(1), 1 << 20);
+		tree.insert(-1, -1, nullptr);
+		tree.flush();
+		CHECK(tree.contains(-1));
+
+		for (int i = 0; i < 1000; ++i)
+			tree.insert(i, i, [&applied](bool _result) { applied += _result ? 1 : 0; });
+		duplicate = tree.insert(5, 0);
+		CHECK(applied == 0 && tree.size() == 1);
+	}
+
+	CHECK(applied == 1000 && duplicate.get() == false);
+	CHECK(std::chrono::steady_clock::now() - start < std::chrono::minutes(1));
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------------- FROZENTREE -------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Временный каталог теста, пустой к началу проверки
+static std::string durableDirectory(const std::string& _name)
+{
+	std::filesystem::path path = std::filesystem::temp_directory_path() / ("trees_tests_" + _name);
+	std::filesystem::remove_all(path);
+	return path.string();
+}
+
+static std::vector<char> fileBytes(const std::filesystem::path& _path)
+{
+	std::ifstream file(_path, std::ios::binary);
+	return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static bool writeBytes(const std::filesystem::path& _path, const std::vector<char>& _bytes)
+{
+	std::ofstream file(_path, std::ios::binary | std::ios::trunc);
+	file.write(_bytes.data(), static_cast<std::streamsize>(_bytes.size()));
+	return static_cast<bool>(file);
+}
+
+//Заполняет стек мусором, чтобы неинициализированные байты записи не оказались нулевыми случайно
+static void dirtyStack()
+{
+	volatile unsigned char garbage[4096];
+	for (std::size_t i = 0; i < sizeof(garbage); ++i)
+		garbage[i] = 0xA5;
+}
+
+//Между ключом std::int16_t и значением std::int64_t 6 байт выравнивания: в файле они нулевые
+using PaddedFrozen = FrozenTree<std::int16_t, std::int64_t>;
+static_assert(sizeof(PaddedFrozen::Entry) == 16);
+
+static bool zeroPadding(const std::vector<char>& _bytes)
+{
+	for (std::size_t offset = sizeof(PaddedFrozen::Header); offset + sizeof(PaddedFrozen::Entry) <= _bytes.size();
+		offset += sizeof(PaddedFrozen::Entry))
+	{
+		for (std::size_t i = sizeof(std::int16_t); i < offsetof(PaddedFrozen::Entry, value); ++i)
+		{
+			if (_bytes[offset + i] != 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+//write и open, find, lower_bound и обход в обе стороны против std::map, пустое дерево,
+//одинаковые файлы для одинаковых деревьев и нулевые байты выравнивания
+bool testFrozenTree()
+{
+	std::filesystem::path directory = durableDirectory("frozen");
+	std::filesystem::create_directories(directory);
+
+	std::mt19937_64 generator(options.seed);
+	RBTree<std::int16_t, std::int64_t> tree;
+	std::map<std::int16_t, std::int64_t> reference;
+	for (int i = 0; i < 3000; ++i)
+	{
+		std::int16_t key = static_cast<std::int16_t>(generator() % 20000 - 10000);
+		std::int64_t value = static_cast<std::int64_t>(generator());
+		if (tree.insert(key, value))
+			reference[key] = value;
+	}
+
+	dirtyStack();
+	CHECK(PaddedFrozen::write(tree, (directory / "first.frz").string()));
+	dirtyStack();
+	CHECK(PaddedFrozen::write(tree, (directory / "second.frz").string(), true));
+	std::vector<char> bytes = fileBytes(directory / "first.frz");
+	CHECK(bytes == fileBytes(directory / "second.frz") && zeroPadding(bytes));
+	CHECK(bytes.size() == sizeof(PaddedFrozen::Header) + reference.size() * sizeof(PaddedFrozen::Entry));
+
+	PaddedFrozen frozen;
+	CHECK(frozen.open((directory / "first.frz").string()) && frozen.isOpen());
+	CHECK(frozen.size() == reference.size() && !frozen.empty());
+
+	auto it = frozen.begin();
+	for (const auto& pair : reference)
+	{
+		CHECK((*it).first == pair.first && (*it).second == pair.second);
+		++it;
+	}
+	CHECK(it == frozen.afterEnd());
+	it = frozen.end();
+	for (auto pair = reference.rbegin(); pair != reference.rend(); ++pair)
+	{
+		CHECK((*it).first == pair->first);
+		--it;
+	}
+	CHECK(it == frozen.beforeBegin());
+
+	for (int key = -10050; key <= 10050; key += 7)
+	{
+		std::int16_t searchKey = static_cast<std::int16_t>(key);
+		auto found = reference.find(searchKey);
+		auto lower = reference.lower_bound(searchKey);
+		auto frozenFound = frozen.find(searchKey);
+		auto frozenLower = frozen.lower_bound(searchKey);
+		CHECK((frozenFound == frozen.afterEnd()) == (found == reference.end()));
+		CHECK(found == reference.end() || (*frozenFound).second == found->second);
+		CHECK((frozenLower == frozen.afterEnd()) == (lower == reference.end()));
+		CHECK(lower == reference.end() || (*frozenLower).first == lower->first);
+	}
+	frozen.close();
+	CHECK(!frozen.isOpen() && frozen.empty());
+
+	//Пустое дерево дает файл из одного заголовка
+	RBTree<std::int16_t, std::int64_t> empty;
+	CHECK(PaddedFrozen::write(empty, (directory / "empty.frz").string()));
+	CHECK(frozen.open((directory / "empty.frz").string()) && frozen.empty() && frozen.begin() == frozen.afterEnd());
+	CHECK(frozen.find(0) == frozen.afterEnd() && frozen.lower_bound(0) == frozen.afterEnd());
+	frozen.close();
+
+	//Ключи Writer принимает только строго по возрастанию, поэтому дерево с одинаковыми ключами не записывается
+	PaddedFrozen::Writer writer;
+	CHECK(writer.open((directory / "writer.frz").string()));
+	CHECK(writer.append(1, 1) && writer.append(3, 3) && !writer.append(3, 4) && !writer.append(2, 2));
+	CHECK(writer.size() == 2 && writer.close());
+	MultiRBTree<std::int16_t, std::int64_t> multi;
+	multi.insert(1, 10);
+	multi.insert(1, 11);
+	CHECK(!PaddedFrozen::write(multi, (directory / "multi.frz").string()));
+
+	std::filesystem::remove_all(directory);
+	return true;
+}
+
+//open отклоняет отсутствующий файл, файл короче заголовка, файл с чужими магией, версией или типами
+//и заголовок, число записей в котором не помещается в файл
+bool testFrozenRejectsCorrupt()
+{
+	std::filesystem::path directory = durableDirectory("frozen_corrupt");
+	std::filesystem::create_directories(directory);
+	std::filesystem::path path = directory / "tree.frz";
+
+	RBTree<std::int16_t, std::int64_t> tree;
+	for (int i = 0; i < 100; ++i)
+		tree.insert(static_cast<std::int16_t>(i), i);
+	CHECK(PaddedFrozen::write(tree, (directory / "good.frz").string()));
+	std::vector<char> good = fileBytes(directory / "good.frz");
+
+	PaddedFrozen frozen;
+	CHECK(!frozen.open((directory / "missing.frz").string()));
+
+	auto opens = [&](const std::vector<char>& _bytes)
+	{
+		return writeBytes(path, _bytes) && frozen.open(path.string()) && (frozen.close(), true);
+	};
+	CHECK(opens(good));
+
+	//Усеченный файл: последняя запись неполная, заголовок обещает больше записей, чем есть
+	CHECK(!opens(std::vector<char>(good.begin(), good.end() - 1)));
+	CHECK(!opens(std::vector<char>(good.begin(), good.begin() + sizeof(PaddedFrozen::Header) - 1)));
+	CHECK(!opens(std::vector<char>()));
+
+	for (std::size_t offset : { offsetof(PaddedFrozen::Header, magic), offsetof(PaddedFrozen::Header, version),
+		offsetof(PaddedFrozen::Header, keySize), offsetof(PaddedFrozen::Header, entrySize),
+		offsetof(PaddedFrozen::Header, count) + 7 })
+	{
+		std::vector<char> corrupt = good;
+		corrupt[offset] ^= 0x40;
+		CHECK(!opens(corrupt));
+	}
+
+	//Файл записан для других типов
+	FrozenTree<std::int16_t, std::int32_t> otherTypes;
+	CHECK(!otherTypes.open((directory / "good.frz").string()) && !otherTypes.isOpen());
+
+	std::filesystem::remove_all(directory);
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//----------------------------------------------- STATICTREE -------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Таблица, построенная во время выполнения из случайных пар с повторами, против std::map,
+//в который пары вставляются через try_emplace (остается первая): find, границы и обход
+bool testStaticTreeAgainstMap()
+{
+	constexpr std::size_t count = 2000;
+	std::mt19937_64 generator(options.seed);
+	std::array<std::pair<int, int>, count> pairs;
+	std::map<int, int> reference;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		pairs[i] = { static_cast<int>(generator() % 1500), static_cast<int>(i) };
+		reference.try_emplace(pairs[i].first, pairs[i].second);
+	}
+
+	StaticTree<int, int, count> tree(pairs);
+	CHECK(tree.size() == static_cast<int>(reference.size()));
+
+	auto it = tree.begin();
+	for (const auto& pair : reference)
+	{
+		CHECK((*it).first == pair.first && (*it).second == pair.second);
+		++it;
+	}
+	CHECK(it == tree.afterEnd());
+	it = tree.end();
+	for (auto pair = reference.rbegin(); pair != reference.rend(); ++pair)
+	{
+		CHECK((*it).first == pair->first);
+		--it;
+	}
+	CHECK(it == tree.beforeBegin());
+
+	for (int key = -2; key <= 1502; ++key)
+	{
+		auto found = reference.find(key);
+		auto lower = reference.lower_bound(key);
+		auto upper = reference.upper_bound(key);
+		CHECK(tree.contains(key) == (found != reference.end()));
+		CHECK(found == reference.end() || (*tree.find(key)).second == found->second);
+		CHECK((tree.lower_bound(key) == tree.afterEnd()) == (lower == reference.end()));
+		CHECK(lower == reference.end() || (*tree.lower_bound(key)).first == lower->first);
+		CHECK((tree.upper_bound(key) == tree.afterEnd()) == (upper == reference.end()));
+		CHECK(upper == reference.end() || (*tree.upper_bound(key)).first == upper->first);
+	}
+
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//---------------------------------------------- DURABLETREE -------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Multi-деревья DurableTree не принимает: снимок хранит ключи строго по возрастанию
+static_assert(MULTI_TREE<MultiRBTree<int, int>, int, int> && MULTI_TREE<MultiAVLSet<int>, int, NoValue>);
+static_assert(!MULTI_TREE<RBTree<int, int>, int, int> && !MULTI_TREE<LRUTree<int, int>, int, int>);
+
+//Изменения, записанные в журнал и в контрольные точки, переживают повторное открытие
+bool testDurableRecovery()
+{
+	std::string directory = durableDirectory("durable");
+	std::map<int, int> expected;
+	{
+		DurableTree<int, int> tree;
+		CHECK(tree.open(directory, 4, 50));
+		for (int i = 0; i < 300; ++i)
+		{
+			CHECK(tree.insert(i, i));
+			expected[i] = i;
+		}
+		CHECK(!tree.insert(5, 0));
+		for (int i = 0; i < 300; i += 3)
+		{
+			CHECK(tree.erase(i));
+			expected.erase(i);
+		}
+		CHECK(!tree.erase(3));
+		CHECK(tree.setValue(1, -1));
+		CHECK(!tree.setValue(0, 0));
+		expected[1] = -1;
+		CHECK(tree.close());
+	}
+
+	DurableTree<int, int> reopened;
+	CHECK(reopened.open(directory));
+	CHECK(reopened.size() == static_cast<int>(expected.size()));
+	for (const auto& pair : reopened.getTree().getVector())
+		CHECK(expected.count(pair.first) && expected[pair.first] == pair.second);
+
+	//Явная контрольная точка переносит в снимок все записи и очищает журнал
+	CHECK(reopened.checkpoint());
+	CHECK(std::filesystem::file_size(std::filesystem::path(directory) / "wal.log") == 0);
+	reopened.close();
+
+	DurableTree<int, int, AVLTree<int, int>> fromSnapshot;
+	CHECK(fromSnapshot.open(directory));
+	CHECK(fromSnapshot.size() == static_cast<int>(expected.size()) && fromSnapshot.getTree().validate());
+	for (const auto& pair : fromSnapshot.getTree().getVector())
+		CHECK(expected.count(pair.first) && expected[pair.first] == pair.second);
+	fromSnapshot.close();
+	std::filesystem::remove_all(directory);
+	return true;
+}
+
+//Неудачная автоматическая контрольная точка не отменяет уже записанную в журнал операцию:
+//раньше insert в этом случае возвращал false, хотя ключ оставался в дереве и в журнале
+bool testDurableCheckpointFailure()
+{
+	std::string directory = durableDirectory("durable_checkpoint");
+	{
+		DurableTree<int, int> tree;
+		CHECK(tree.open(directory, 1, 10));
+
+		//Каталог на месте временного снимка не дает записать контрольную точку
+		std::filesystem::create_directory(std::filesystem::path(directory) / "snapshot.tmp");
+		for (int i = 0; i < 25; ++i)
+			CHECK(tree.insert(i, i));
+		CHECK(!tree.checkpoint());
+		CHECK(tree.isOpen() && tree.size() == 25);
+
+		std::filesystem::remove(std::filesystem::path(directory) / "snapshot.tmp");
+		CHECK(tree.checkpoint());
+		CHECK(tree.erase(0));
+		CHECK(tree.close());
+	}
+
+	DurableTree<int, int> reopened;
+	CHECK(reopened.open(directory));
+	CHECK(reopened.size() == 24);
+	CHECK(reopened.getTree().getVector().front().first == 1);
+	reopened.close();
+	std::filesystem::remove_all(directory);
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------- EXTERNALBUILDER -----------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Серий больше, чем можно открыть одновременно: слияние идет в несколько проходов
+//и для одинаковых ключей по-прежнему оставляет пару, добавленную первой
+bool testExternalMergePasses()
+{
+	std::string directory = durableDirectory("external");
+	std::filesystem::create_directories(directory);
+
+	std::mt19937_64 generator(options.seed);
+	std::map<int, int> expected;
+	std::vector<std::pair<int, int>> pairs;
+	for (int i = 0; i < 5000; ++i)
+	{
+		int key = static_cast<int>(generator() % 3000);
+		pairs.push_back({ key, i });
+		expected.insert({ key, i });
+	}
+
+	for (int maxOpenRuns : { 2, 3, 64 })
+	{
+		ExternalTreeBuilder<int, int> builder(64 * sizeof(FrozenTree<int, int>::Entry), directory, maxOpenRuns);
+		for (const auto& pair : pairs)
+			CHECK(builder.add(pair));
+		CHECK(builder.runCount() > 64);
+
+		//Неполный буфер (5000 не делится на 64) уходит в последнюю серию уже в build
+		std::size_t passes = 0;
+		for (std::size_t runs = builder.runCount() + 1; runs > static_cast<std::size_t>(maxOpenRuns); ++passes)
+			runs = (runs + maxOpenRuns - 1) / maxOpenRuns;
+
+		RBTree<int, int> tree;
+		CHECK(builder.build(tree));
+		CHECK(tree.validate() && tree.size() == static_cast<int>(expected.size()));
+		CHECK(builder.mergePassCount() == passes);
+
+		auto it = expected.begin();
+		for (const auto& pair : tree.getVector())
+		{
+			CHECK(pair.first == it->first && pair.second == it->second);
+			++it;
+		}
+	}
+
+	//build получает производный тип: LRUTree строит свои списки и соблюдает емкость
+	ExternalTreeBuilder<int, int> builder(64 * sizeof(FrozenTree<int, int>::Entry), directory, 4);
+	for (const auto& pair : pairs)
+		builder.add(pair);
+	LRUTree<int, int> lru(100);
+	CHECK(builder.build(lru));
+	CHECK(lru.validate() && lru.size() == 100);
+
+	CHECK(std::filesystem::is_empty(directory));
+	std::filesystem::remove_all(directory);
+	return true;
+}
+
+//writeFrozen детерминирован: одинаковый вход через серии с выравниванием внутри записи дает
+//один и тот же файл, совпадающий с FrozenTree::write дерева, в котором оставлены первые пары
+bool testExternalDeterministic()
+{
+	std::filesystem::path directory = durableDirectory("external_frozen");
+	std::filesystem::create_directories(directory);
+
+	std::mt19937_64 generator(options.seed);
+	std::vector<std::pair<std::int16_t, std::int64_t>> pairs;
+	RBTree<std::int16_t, std::int64_t> expected;
+	for (int i = 0; i < 4000; ++i)
+	{
+		std::int16_t key = static_cast<std::int16_t>(generator() % 2500);
+		pairs.push_back({ key, static_cast<std::int64_t>(generator()) });
+		expected.insert(key, pairs.back().second);
+	}
+	CHECK(PaddedFrozen::write(expected, (directory / "expected.frz").string()));
+
+	for (const char* name : { "first.frz", "second.frz" })
+	{
+		dirtyStack();
+		ExternalTreeBuilder<std::int16_t, std::int64_t> builder(
+			64 * sizeof(PaddedFrozen::Entry), (directory / "runs").string(), 4);
+		for (const auto& pair : pairs)
+			CHECK(builder.add(pair));
+		CHECK(builder.writeFrozen((directory / name).string()));
+		CHECK(builder.mergePassCount() > 1);
+	}
+
+	std::vector<char> bytes = fileBytes(directory / "first.frz");
+	CHECK(zeroPadding(bytes));
+	CHECK(bytes == fileBytes(directory / "second.frz") && bytes == fileBytes(directory / "expected.frz"));
+
+	std::filesystem::remove_all(directory);
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------- LATENCYRECORDER -----------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+static LatencySample latencySample(long long _nanoseconds, TREE_OPERATIONS _operation = TREE_OPERATIONS::INSERT)
+{
+	LatencySample sample;
+	sample.operation = _operation;
+	sample.nanoseconds = _nanoseconds;
+	sample.depth = _nanoseconds % 97;
+	return sample;
+}
+
+//Единственный замер попадает в корзину, верхняя граница которой не меньше замера
+//и отличается от него не больше чем на 1 / 2^SUB_BITS
+bool testLatencyBuckets()
+{
+	LatencyRecorder recorder(1);
+	for (long long nanoseconds = 0; nanoseconds < (1LL << 41); nanoseconds = nanoseconds + nanoseconds / 50 + 1)
+	{
+		recorder.reset();
+		recorder.record(latencySample(nanoseconds));
+		long long bound = recorder.percentile(TREE_OPERATIONS::INSERT, 50);
+		CHECK(bound >= nanoseconds && bound <= nanoseconds + (nanoseconds >> LatencyRecorder::SUB_BITS));
+	}
+
+	//Отрицательное время считается нулем, время больше 2^(MAX_MAGNITUDE + 1) нс - последней корзиной
+	recorder.reset();
+	recorder.record(latencySample(-5));
+	CHECK(recorder.percentile(TREE_OPERATIONS::INSERT, 100) == 0);
+	recorder.record(latencySample(1LL << 50));
+	CHECK(recorder.percentile(TREE_OPERATIONS::INSERT, 100) == (1LL << (LatencyRecorder::MAX_MAGNITUDE + 1)) - 1);
+	return true;
+}
+
+//Процентили, счетчики и самые медленные операции из нескольких потоков с разными сегментами,
+//виды операций не смешиваются, reset очищает все
+bool testLatencyPercentiles()
+{
+	const int threads = 4;
+	const long long perThread = 1000;
+	LatencyRecorder recorder(threads);
+
+	std::vector<std::thread> workers;
+	for (int thread = 0; thread < threads; ++thread)
+	{
+		workers.emplace_back([&recorder, thread]
+		{
+			for (long long i = thread + 1; i <= threads * perThread; i += threads)
+				recorder.record(latencySample(i * 1000));
+			recorder.record(latencySample(7, TREE_OPERATIONS::FIND));
+		});
+	}
+	for (auto& worker : workers)
+		worker.join();
+
+	CHECK(recorder.count(TREE_OPERATIONS::INSERT) == threads * perThread);
+	CHECK(recorder.count(TREE_OPERATIONS::FIND) == threads && recorder.count(TREE_OPERATIONS::ERASE) == 0);
+	CHECK(recorder.percentile(TREE_OPERATIONS::FIND, 99.9) == 7 && recorder.percentile(TREE_OPERATIONS::ERASE, 50) == 0);
+
+	//Время i-й по скорости вставки - i мкс, граница корзины больше не более чем на 1 / 2^SUB_BITS
+	const double percents[] = { 50, 99, 99.9, 100 };
+	for (double percent : percents)
+	{
+		long long expected = static_cast<long long>(percent / 100.0 * threads * perThread + 0.5) * 1000;
+		long long bound = recorder.percentile(TREE_OPERATIONS::INSERT, percent);
+		CHECK(bound >= expected && bound <= expected + (expected >> LatencyRecorder::SUB_BITS));
+	}
+
+	std::vector<LatencySample> slowest = recorder.slowest(TREE_OPERATIONS::INSERT);
+	CHECK(static_cast<int>(slowest.size()) == LatencyRecorder::SLOWEST);
+	for (int i = 0; i < LatencyRecorder::SLOWEST; ++i)
+	{
+		long long expected = (threads * perThread - i) * 1000;
+		CHECK(slowest[i].nanoseconds == expected && slowest[i].depth == expected % 97);
+	}
+
+	recorder.reset();
+	CHECK(recorder.count(TREE_OPERATIONS::INSERT) == 0 && recorder.percentile(TREE_OPERATIONS::INSERT, 99) == 0);
+	CHECK(recorder.slowest(TREE_OPERATIONS::INSERT).empty() && recorder.slowest(TREE_OPERATIONS::FIND).empty());
+	return true;
+}
+
+#ifdef TREES_ENABLE_LATENCY
+//Каждый вызов insert, erase, find и getVector замеряется один раз, регистратор переходит в копию дерева
+bool testLatencyTrees()
+{
+	LatencyRecorder recorder(1);
+	RBTree<int, int> tree;
+	LRUTree<int, int> lru;
+	tree.setLatencyRecorder(&recorder);
+	lru.setLatencyRecorder(&recorder);
+
+	for (int i = 0; i < 1000; ++i)
+	{
+		tree.insert(i % 700, i);
+		lru.insert(i % 300, i);
+	}
+	for (int i = 0; i < 500; ++i)
+	{
+		tree.find(i);
+		tree.erase(i * 2);
+	}
+	tree.getVector();
+
+	RBTree<int, int> copy(tree);
+	copy.find(1);
+
+	CHECK(recorder.count(TREE_OPERATIONS::INSERT) == 2000);
+	CHECK(recorder.count(TREE_OPERATIONS::FIND) == 501);
+	CHECK(recorder.count(TREE_OPERATIONS::ERASE) == 500);
+	CHECK(recorder.count(TREE_OPERATIONS::ITERATION) == 1);
+	CHECK(!recorder.slowest(TREE_OPERATIONS::INSERT).empty());
+	return true;
+}
+#endif
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------------ SMALLKEY --------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+//Ключ из двух чисел (16 байт): тривиально копируемый и не больше двух указателей, поэтому идет по быстрому пути.
+//Порядок совпадает с порядком числа, из которого ключ построен
+struct WideKey
+{
+	std::uint64_t high = 0;
+	std::uint64_t low = 0;
+
+	WideKey() = default;
+	WideKey(std::uint64_t _number) : high(_number >> 3), low(_number & 7) {};
+
+	bool operator==(const WideKey& _other) const { return high == _other.high && low == _other.low; };
+	bool operator<(const WideKey& _other) const { return high < _other.high || (high == _other.high && low < _other.low); };
+	bool operator>(const WideKey& _other) const { return _other < *this; };
+};
+
+//Тот же uint64_t, но не тривиально копируемый: дерево с таким ключом идет по общему пути
+struct OpaqueKey
+{
+	std::uint64_t value = 0;
+
+	OpaqueKey() = default;
+	OpaqueKey(std::uint64_t _value) : value(_value) {};
+	OpaqueKey(const OpaqueKey& _other) : value(_other.value) {};
+	OpaqueKey& operator=(const OpaqueKey& _other) { value = _other.value; return *this; };
+
+	bool operator==(const OpaqueKey& _other) const { return value == _other.value; };
+	bool operator<(const OpaqueKey& _other) const { return value < _other.value; };
+	bool operator>(const OpaqueKey& _other) const { return value > _other.value; };
+};
+
+static_assert(std::is_trivially_copyable_v<WideKey> && sizeof(WideKey) == 2 * sizeof(void*));
+static_assert(!std::is_trivially_copyable_v<OpaqueKey>);
+
+//Кэш горячих ключей (enableCache) требует std::hash ключа
+template<>
+struct std::hash<WideKey>
+{
+	std::size_t operator()(const WideKey& _key) const { return std::hash<std::uint64_t>{}(_key.high ^ (_key.low << 61)); }
+};
+
+template<>
+struct std::hash<OpaqueKey>
+{
+	std::size_t operator()(const OpaqueKey& _key) const { return std::hash<std::uint64_t>{}(_key.value); }
+};
+
+static std::uint64_t keyNumber(std::uint64_t _key) { return _key; }
+static std::uint64_t keyNumber(const WideKey& _key) { return (_key.high << 3) | _key.low; }
+static std::uint64_t keyNumber(const OpaqueKey& _key) { return _key.value; }
+
+//Вставка, поиск попаданий и промахов, удаление и clear сверяются со std::map. Значения - длинные строки,
+//поэтому обмен узлов при удалении переносит нетривиальные значения, а clear идет по пути с деструкторами;
+//с тривиальным значением тот же ключ проверяет Differential. С _cache поиск идет и через кэш горячих ключей
+template<typename TreeType>
+bool smallKeyAgainstMap(bool _cache)
+{
+	using KeyType = std::remove_cvref_t<decltype(std::declval<TreeType&>().getVector()[0].first)>;
+	std::mt19937_64 generator(options.seed * 31 + (_cache ? 1 : 0));
+	TreeType tree;
+	if (_cache)
+		CHECK(tree.enableCache(16));
+	std::map<std::uint64_t, std::string> reference;
+
+	auto valueOf = [](int _operation) { return std::string(24, 'v') + std::to_string(_operation); };
+	auto sameContents = [&]
+	{
+		if (tree.size() != static_cast<int>(reference.size()))
+			return false;
+		if (reference.empty())
+			return tree.empty();
+
+		auto vector = tree.getVector();
+		std::size_t i = 0;
+		for (const auto& pair : reference)
+		{
+			if (keyNumber(vector[i].first) != pair.first || vector[i].second != pair.second)
+				return false;
+			++i;
+		}
+		return true;
+	};
+
+	for (int operation = 0; operation < 30000; ++operation)
+	{
+		//Старшие биты ключа заняты, чтобы сравнения WideKey решались и по high, и по low
+		std::uint64_t number = ((generator() % 3000) << 40) | (generator() % 4);
+		KeyType key(number);
+		int choice = static_cast<int>(generator() % 100);
+
+		if (choice < 40)
+		{
+			bool inserted = tree.insert(key, valueOf(operation));
+			CHECK(inserted == reference.insert({ number, valueOf(operation) }).second);
+		}
+		else if (choice < 65)
+		{
+			bool erased = tree.erase(key);
+			CHECK(erased == (reference.erase(number) == 1));
+		}
+		else if (choice < 99)
+		{
+			auto it = tree.find(key);
+			auto expected = reference.find(number);
+			CHECK((it == tree.afterEnd()) == (expected == reference.end()));
+			if (expected != reference.end())
+				CHECK(keyNumber((*it).first) == number && (*it).second == expected->second);
+		}
+		else if (generator() % 4 == 0)
+		{
+			tree.clear();
+			reference.clear();
+			CHECK(tree.empty() && tree.find(key) == tree.afterEnd());
+		}
+
+		if (operation % 997 == 0)
+			CHECK(tree.validate() && sameContents());
+	}
+
+	CHECK(tree.validate() && sameContents());
+	tree.clear();
+	CHECK(tree.empty() && tree.validate());
+	return true;
+}
+
+template<template<typename, typename> class TreeKind>
+bool testSmallKeys()
+{
+	for (bool cache : { false, true })
+	{
+		if (!smallKeyAgainstMap<TreeKind<std::uint64_t, std::string>>(cache) ||
+			!smallKeyAgainstMap<TreeKind<WideKey, std::string>>(cache) ||
+			!smallKeyAgainstMap<TreeKind<OpaqueKey, std::string>>(cache))
+			return false;
+	}
+
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------------
+//-------------------------------------------------- MAIN ----------------------------------------------
+//------------------------------------------------------------------------------------------------------
+
+static void parseArguments(int _argc, char** _argv)
+{
+	for (int i = 1; i < _argc; ++i)
+	{
+		std::string argument = _argv[i];
+		if (argument.rfind("--filter=", 0) == 0)
+			options.filter = argument.substr(9);
+		else if (argument.rfind("--seed=", 0) == 0)
+			options.seed = std::stoull(argument.substr(7));
+		else
+			std::printf("Unknown argument: %s\n", argument.c_str());
+	}
+}
+
+int main(int argc, char** argv)
+{
+	parseArguments(argc, argv);
+
+	runTest("Differential/Tree", fuzzRanges<Tree<int, int>>);
+	runTest("Differential/AVLTree", fuzzRanges<AVLTree<int, int>>);
+	runTest("Differential/RBTree", fuzzRanges<RBTree<int, int>>);
+	runTest("Differential/SplayTree", fuzzRanges<SplayTree<int, int>>);
+	runTest("Differential/SplayTree/Semi", fuzzRanges<SemiSplayTree>);
+	runTest("Differential/SplayTree/Periodic", fuzzRanges<PeriodicSplayTree>);
+	runTest("Differential/ScapegoatTree", fuzzRanges<ScapegoatTree<int, int>>);
+	runTest("Differential/LRUTree", fuzzRanges<LRUTree<int, int>>);
+	runTest("Differential/MultiTree", fuzzRanges<MultiTree<int, int>>);
+	runTest("Differential/MultiAVLTree", fuzzRanges<MultiAVLTree<int, int>>);
+	runTest("Differential/MultiRBTree", fuzzRanges<MultiRBTree<int, int>>);
+	runTest("Parallel/Tree", testParallel<Tree<int, std::string>>);
+	runTest("Parallel/AVLTree", testParallel<AVLTree<int, std::string>>);
+	runTest("Parallel/RBTree", testParallel<RBTree<int, std::string>>);
+	runTest("Parallel/SplayTree", testParallel<SplayTree<int, std::string>>);
+	runTest("Parallel/ScapegoatTree", testParallel<ScapegoatTree<int, std::string>>);
+	runTest("Parallel/LRUTree", testParallel<LRUTree<int, std::string>>);
+	runTest("CopyMove/Tree", testCopyMove<Tree<int, long long>>);
+	runTest("CopyMove/AVLTree", testCopyMove<AVLTree<int, long long>>);
+	runTest("CopyMove/RBTree", testCopyMove<RBTree<int, long long>>);
+	runTest("CopyMove/SplayTree", testCopyMove<SplayTree<int, long long>>);
+	runTest("CopyMove/ScapegoatTree", testCopyMove<ScapegoatTree<int, long long>>);
+	runTest("CopyMove/LRUTree", testCopyMove<LRUTree<int, long long>>);
+	runTest("CopyMove/MultiTree", testCopyMove<MultiTree<int, long long>>);
+	runTest("CopyMove/MultiAVLTree", testCopyMove<MultiAVLTree<int, long long>>);
+	runTest("CopyMove/MultiRBTree", testCopyMove<MultiRBTree<int, long long>>);
+	runTest("CopyMove/LRULists", testCopyLRU);
+	runTest("CopyMove/AcrossKinds", testCopyAcrossKinds);
+	runTest("Set/Set", testSetAgainstReference<Set<int>>);
+	runTest("Set/AVLSet", testSetAgainstReference<AVLSet<int>>);
+	runTest("Set/MultiRBSet", testSetAgainstReference<MultiRBSet<int>>);
+	runTest("Set/NodeSize", testSetNodeSize);
+	runTest("FrontCache/RBTree", testFrontCacheInvalidation<RBTree<int, long long>>);
+	runTest("FrontCache/AVLTree", testFrontCacheInvalidation<AVLTree<int, long long>>);
+	runTest("FrontCache/SplayTree", testFrontCacheInvalidation<SplayTree<int, long long>>);
+	runTest("FrontCache/ScapegoatTree", testFrontCacheInvalidation<ScapegoatTree<int, long long>>);
+	runTest("MemoryUsage/Tree", testMemoryUsage<Tree, BasicNode>);
+	runTest("MemoryUsage/AVLTree", testMemoryUsage<AVLTree, AVLNode>);
+	runTest("MemoryUsage/RBTree", testMemoryUsage<RBTree, RBNode>);
+	runTest("MemoryUsage/SplayTree", testMemoryUsage<SplayTree, BasicNode>);
+	runTest("MemoryUsage/ScapegoatTree", testMemoryUsage<ScapegoatTree, BasicNode>);
+	runTest("MemoryUsage/LRUTree", testMemoryUsage<LRUTree, LRUNode>);
+	runTest("IntrusiveTree/AVLAgainstMap", testIntrusive<IntrusiveAVL, AVLHook<>>);
+	runTest("IntrusiveTree/RBAgainstMap", testIntrusive<IntrusiveRB, RBHook<>>);
+	runTest("IntrusiveTree/LinkedHook", testIntrusiveLinkedHook);
+	runTest("LRUTree/ThroughBase", testLRUThroughBase);
+	runTest("ScapegoatTree/SizeBound", testScapegoatSizeBound);
+	runTest("ShardedTree/RangeAgainstMap", [] { return testShardedAgainstMap(SHARDING_MODES::RANGE); });
+	runTest("ShardedTree/HashAgainstMap", [] { return testShardedAgainstMap(SHARDING_MODES::HASH); });
+	runTest("ShardedTree/DuplicateKeys", testShardedDuplicateKeys);
+	runTest("ShardedTree/LRUSplitMerge", testShardedLRUSplitMerge);
+	runTest("ConcurrentAVLTree/AgainstMap", testConcurrentAgainstMap);
+	runTest("EpochReclaimer/SharedSlot", testEpochSharedSlot);
+	runTest("AsyncTree/Producers", testAsyncProducers);
+	runTest("AsyncTree/DrainOnDestroy", testAsyncDrainOnDestroy);
+	runTest("FrozenTree/OpenFind", testFrozenTree);
+	runTest("FrozenTree/RejectsCorrupt", testFrozenRejectsCorrupt);
+	runTest("StaticTree/AgainstMap", testStaticTreeAgainstMap);
+	runTest("DurableTree/Recovery", testDurableRecovery);
+	runTest("DurableTree/CheckpointFailure", testDurableCheckpointFailure);
+	runTest("ExternalTreeBuilder/MergePasses", testExternalMergePasses);
+	runTest("ExternalTreeBuilder/Deterministic", testExternalDeterministic);
+	runTest("SmallKey/Tree", testSmallKeys<Tree>);
+	runTest("SmallKey/AVLTree", testSmallKeys<AVLTree>);
+	runTest("SmallKey/RBTree", testSmallKeys<RBTree>);
+	runTest("SmallKey/SplayTree", testSmallKeys<SplayTree>);
+	runTest("SmallKey/ScapegoatTree", testSmallKeys<ScapegoatTree>);
+	runTest("LatencyRecorder/Buckets", testLatencyBuckets);
+	runTest("LatencyRecorder/Percentiles", testLatencyPercentiles);
+#ifdef TREES_ENABLE_LATENCY
+	runTest("LatencyRecorder/Trees", testLatencyTrees);
+#endif
+
+	if (failedTests)
+		std::printf("%d test(s) failed\n", failedTests);
+	return failedTests ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+﻿#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CLASS THREADPOOL -----------------------------------------
+//------------------------------------------------ BEGIN -----------------------------------------------
+
+//Пул потоков для параллельных обходов деревьев (Tree::parallelForEach, parallelReduce, parallelGetVector,
+//параллельный clear). Единственная операция - parallelFor: вызывающий поток тоже выполняет задачи,
+//поэтому пул из 0 потоков выполняет все последовательно, а вложенный parallelFor не может зависнуть,
+//ожидая занятые потоки пула
+class ThreadPool
+{
+//Private members:
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping;
+
+	void workerLoop();
+	void submit(std::function<void()> _task);
+
+//Public members:
+public:
+	explicit ThreadPool(int _threads = static_cast<int>(std::thread::hardware_concurrency()) - 1);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	//Количество потоков пула, не считая вызывающего
+	int threadCount() const { return static_cast<int>(workers.size()); };
+
+	template<typename Function>
+	void parallelFor(int _count, Function&& _function);
+};
+
+inline ThreadPool::ThreadPool(int _threads) : stopping(false)
+{
+	for (int i = 0; i < _threads; ++i)
+		workers.emplace_back([this]() { workerLoop(); });
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	condition.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+inline void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (tasks.empty())
+				return;
+
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+
+		task();
+	}
+}
+
+inline void ThreadPool::submit(std::function<void()> _task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(_task));
+	}
+	condition.notify_one();
+}
+
+template<typename Function>
+void ThreadPool::parallelFor(int _count, Function&& _function)
+{
+	//Вызывает _function(i) для каждого i из [0, _count) и возвращается, когда все вызовы завершены.
+	//Индексы раздаются по одному, поэтому задачи разного размера распределяются сами
+	struct State
+	{
+		std::atomic<int> next{ 0 };
+		int count = 0;
+		std::mutex mutex;
+		std::condition_variable finished;
+		int active = 0;
+		bool closed = false;
+	};
+
+	auto state = std::make_shared<State>();
+	state->count = _count;
+
+	//Помощник, начавший работу после того, как вызывающий поток закончил, сразу выходит и не обращается
+	//к _function: вызывающий поток ждет только уже начавших
+	auto help = [state, &_function]()
+	{
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (state->closed)
+				return;
+			++state->active;
+		}
+
+		for (int i = state->next.fetch_add(1); i < state->count; i = state->next.fetch_add(1))
+			_function(i);
+
+		std::lock_guard<std::mutex> lock(state->mutex);
+		if (--state->active == 0)
+			state->finished.notify_all();
+	};
+
+	int helpers = std::min(_count - 1, threadCount());
+	for (int i = 0; i < helpers; ++i)
+		submit(help);
+
+	for (int i = state->next.fetch_add(1); i < state->count; i = state->next.fetch_add(1))
+		_function(i);
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->closed = true;
+	state->finished.wait(lock, [&]() { return state->active == 0; });
+}
+
+//------------------------------------------------------------------------------------------------------
+//------------------------------------------- CLASS THREADPOOL -----------------------------------------
+//------------------------------------------------- END ------------------------------------------------
+#endif